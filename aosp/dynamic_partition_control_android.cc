@@ -19,8 +19,11 @@
 #include <algorithm>
 #include <chrono>  // NOLINT(build/c++11) - using libsnapshot / liblp API
 #include <cstdint>
+#include <functional>
+#include <list>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
 #include <string_view>
@@ -33,6 +36,7 @@
 #include <base/logging.h>
 #include <base/strings/string_util.h>
 #include <base/strings/stringprintf.h>
+#include <base/threading/simple_thread.h>
 #include <bootloader_message/bootloader_message.h>
 #include <fs_mgr.h>
 #include <fs_mgr_dm_linear.h>
@@ -96,6 +100,51 @@ constexpr std::chrono::milliseconds kMapTimeout{1000};
 // Map timeout for dynamic partitions with snapshots. Since several devices
 // needs to be mapped, this timeout is longer than |kMapTimeout|.
 constexpr std::chrono::milliseconds kMapSnapshotTimeout{10000};
+// Maximum number of partitions mapped or unmapped at once.
+constexpr size_t kMaxConcurrentMaps = 8;
+
+// Maps or unmaps one partition for RunConcurrently(), which runs them in a
+// thread pool.
+class PartitionMapTask : public base::DelegateSimpleThread::Delegate {
+ public:
+  explicit PartitionMapTask(std::function<bool()> task)
+      : task_(std::move(task)) {}
+  ~PartitionMapTask() override = default;
+
+  // Overrides DelegateSimpleThread::Delegate.
+  void Run() override { success_ = task_(); }
+
+  bool success() const { return success_; }
+
+ private:
+  std::function<bool()> task_;
+  bool success_{false};
+
+  DISALLOW_COPY_AND_ASSIGN(PartitionMapTask);
+};
+
+// Calls |task| with each index below |count|, from up to |kMaxConcurrentMaps|
+// threads. Returns true if all the calls returned true.
+static bool RunConcurrently(size_t count,
+                            const std::function<bool(size_t)>& task) {
+  if (count == 0) {
+    return true;
+  }
+  std::list<PartitionMapTask> tasks;
+  for (size_t i = 0; i < count; i++) {
+    tasks.emplace_back([&task, i]() { return task(i); });
+  }
+  base::DelegateSimpleThreadPool thread_pool(
+      "partition-map", std::min(count, kMaxConcurrentMaps));
+  thread_pool.Start();
+  for (auto& map_task : tasks) {
+    thread_pool.AddWork(&map_task);
+  }
+  thread_pool.JoinAll();
+  return std::all_of(tasks.begin(),
+                     tasks.end(),
+                     [](const PartitionMapTask& t) { return t.success(); });
+}
 
 DynamicPartitionControlAndroid::~DynamicPartitionControlAndroid() {
   UnmapAllPartitions();
@@ -167,13 +216,21 @@ bool DynamicPartitionControlAndroid::OptimizeOperation(
     const InstallOperation& operation,
     InstallOperation* optimized) {
   switch (operation.type()) {
-    case InstallOperation::SOURCE_COPY:
-      return target_supports_snapshot_ &&
-             GetVirtualAbFeatureFlag().IsEnabled() &&
-             mapped_devices_.count(partition_name +
-                                   SlotSuffixForSlotNumber(target_slot_)) > 0 &&
-             OptimizeSourceCopyOperation(operation, optimized);
-      break;
+    case InstallOperation::SOURCE_COPY: {
+      if (!target_supports_snapshot_ ||
+          !GetVirtualAbFeatureFlag().IsEnabled()) {
+        return false;
+      }
+      const std::string target_partition_name =
+          partition_name + SlotSuffixForSlotNumber(target_slot_);
+      {
+        std::lock_guard<std::mutex> lock(mapped_devices_lock_);
+        if (mapped_devices_.count(target_partition_name) == 0) {
+          return false;
+        }
+      }
+      return OptimizeSourceCopyOperation(operation, optimized);
+    }
     default:
       break;
   }
@@ -201,6 +258,7 @@ bool DynamicPartitionControlAndroid::MapPartitionInternal(
     // One exception is when /metadata is not mounted. Fallback to
     // CreateLogicalPartition as snapshots are not created in the first place.
     params.timeout_ms = kMapSnapshotTimeout;
+    std::lock_guard<std::mutex> lock(snapshot_lock_);
     success = snapshot_->MapUpdateSnapshot(params, path);
   } else {
     params.timeout_ms = kMapTimeout;
@@ -215,6 +273,7 @@ bool DynamicPartitionControlAndroid::MapPartitionInternal(
   LOG(INFO) << "Succesfully mapped " << target_partition_name
             << " to device mapper (force_writable = " << force_writable
             << "); device path at " << *path;
+  std::lock_guard<std::mutex> lock(mapped_devices_lock_);
   mapped_devices_.insert(target_partition_name);
   return true;
 }
@@ -227,7 +286,12 @@ bool DynamicPartitionControlAndroid::MapPartitionOnDeviceMapper(
     std::string* path) {
   DmDeviceState state = GetState(target_partition_name);
   if (state == DmDeviceState::ACTIVE) {
-    if (mapped_devices_.find(target_partition_name) != mapped_devices_.end()) {
+    bool mapped = false;
+    {
+      std::lock_guard<std::mutex> lock(mapped_devices_lock_);
+      mapped = mapped_devices_.count(target_partition_name) > 0;
+    }
+    if (mapped) {
       if (GetDmDevicePathByName(target_partition_name, path)) {
         LOG(INFO) << target_partition_name
                   << " is mapped on device mapper: " << *path;
@@ -266,8 +330,7 @@ bool DynamicPartitionControlAndroid::MapPartitionOnDeviceMapper(
 
 bool DynamicPartitionControlAndroid::UnmapPartitionOnDeviceMapper(
     const std::string& target_partition_name) {
-  if (DeviceMapper::Instance().GetState(target_partition_name) !=
-      DmDeviceState::INVALID) {
+  if (GetState(target_partition_name) != DmDeviceState::INVALID) {
     // Partitions at target slot on non-Virtual A/B devices are mapped as
     // dm-linear. Also, on Virtual A/B devices, system_other may be mapped for
     // preopt apps as dm-linear.
@@ -277,6 +340,7 @@ bool DynamicPartitionControlAndroid::UnmapPartitionOnDeviceMapper(
     // On a Virtual A/B device, |target_partition_name| may be a leftover from
     // a paused update. Clean up any underlying devices.
     if (ExpectMetadataMounted()) {
+      std::lock_guard<std::mutex> lock(snapshot_lock_);
       success &= snapshot_->UnmapUpdateSnapshot(target_partition_name);
     } else {
       LOG(INFO) << "Skip UnmapUpdateSnapshot(" << target_partition_name
@@ -291,22 +355,48 @@ bool DynamicPartitionControlAndroid::UnmapPartitionOnDeviceMapper(
     LOG(INFO) << "Successfully unmapped " << target_partition_name
               << " from device mapper.";
   }
+  std::lock_guard<std::mutex> lock(mapped_devices_lock_);
   mapped_devices_.erase(target_partition_name);
   return true;
 }
 
+bool DynamicPartitionControlAndroid::MapPartitionsOnDeviceMapper(
+    const std::string& super_device,
+    const std::vector<std::string>& partition_names,
+    uint32_t slot,
+    bool force_writable,
+    std::vector<std::string>* paths) {
+  paths->assign(partition_names.size(), "");
+  // Each call waits for the node of its own device, so mapping the partitions
+  // from several threads overlaps these waits. Only the dm-linear mappings
+  // run in parallel, the snapshots are mapped one at a time.
+  return RunConcurrently(partition_names.size(), [&](size_t i) {
+    return MapPartitionOnDeviceMapper(
+        super_device, partition_names[i], slot, force_writable, &(*paths)[i]);
+  });
+}
+
+bool DynamicPartitionControlAndroid::UnmapPartitionsOnDeviceMapper(
+    const std::vector<std::string>& partition_names) {
+  return RunConcurrently(partition_names.size(), [&](size_t i) {
+    return UnmapPartitionOnDeviceMapper(partition_names[i]);
+  });
+}
+
 bool DynamicPartitionControlAndroid::UnmapAllPartitions() {
   snapshot_->UnmapAllSnapshots();
-  if (mapped_devices_.empty()) {
-    return false;
-  }
   // UnmapPartitionOnDeviceMapper removes objects from mapped_devices_, hence
   // a copy is needed for the loop.
-  std::set<std::string> mapped = mapped_devices_;
-  LOG(INFO) << "Destroying [" << Join(mapped, ", ") << "] from device mapper";
-  for (const auto& partition_name : mapped) {
-    ignore_result(UnmapPartitionOnDeviceMapper(partition_name));
+  std::vector<std::string> mapped;
+  {
+    std::lock_guard<std::mutex> lock(mapped_devices_lock_);
+    mapped.assign(mapped_devices_.begin(), mapped_devices_.end());
+  }
+  if (mapped.empty()) {
+    return false;
   }
+  LOG(INFO) << "Destroying [" << Join(mapped, ", ") << "] from device mapper";
+  ignore_result(UnmapPartitionsOnDeviceMapper(mapped));
   return true;
 }
 
@@ -552,6 +642,49 @@ bool DynamicPartitionControlAndroid::PreparePartitionsForUpdate(
   return true;
 }
 
+void DynamicPartitionControlAndroid::MapTargetPartitions(
+    uint32_t target_slot, const DeltaArchiveManifest& manifest) {
+  // With snapshot compression the target partitions are written through the
+  // COW and are not mapped.
+  if (!GetDynamicPartitionsFeatureFlag().IsEnabled() || !is_target_dynamic_ ||
+      UpdateUsesSnapshotCompression()) {
+    return;
+  }
+  std::set<std::string> dynamic_partitions;
+  for (const auto& group : manifest.dynamic_partition_metadata().groups()) {
+    dynamic_partitions.insert(group.partition_names().begin(),
+                              group.partition_names().end());
+  }
+  // Only the partitions with a target size are mapped by
+  // InstallPlan::LoadPartitionsFromSlots().
+  const std::string target_suffix = SlotSuffixForSlotNumber(target_slot);
+  std::vector<std::string> partition_names;
+  for (const auto& partition : manifest.partitions()) {
+    if (partition.new_partition_info().size() > 0 &&
+        dynamic_partitions.count(partition.partition_name()) > 0) {
+      partition_names.push_back(partition.partition_name() + target_suffix);
+    }
+  }
+  if (partition_names.empty()) {
+    return;
+  }
+
+  std::string device_dir_str;
+  if (!GetDeviceDir(&device_dir_str)) {
+    LOG(WARNING) << "Failed to GetDeviceDir(), not mapping target partitions";
+    return;
+  }
+  const base::FilePath device_dir(device_dir_str);
+  const std::string super_device =
+      device_dir.Append(GetSuperPartitionName(target_slot)).value();
+  std::vector<std::string> paths;
+  if (!MapPartitionsOnDeviceMapper(
+          super_device, partition_names, target_slot, true, &paths)) {
+    LOG(WARNING) << "Failed to map all of [" << Join(partition_names, ", ")
+                 << "] at once; they will be mapped when needed.";
+  }
+}
+
 bool DynamicPartitionControlAndroid::SetTargetBuildVars(
     const DeltaArchiveManifest& manifest) {
   // Precondition: current build supports dynamic partition.
@@ -817,13 +950,13 @@ bool DynamicPartitionControlAndroid::PrepareDynamicPartitionsForUpdate(
 
   // Unmap all the target dynamic partitions because they would become
   // inconsistent with the new metadata.
+  std::vector<std::string> target_partitions;
   for (const auto& group : manifest.dynamic_partition_metadata().groups()) {
     for (const auto& partition_name : group.partition_names()) {
-      if (!UnmapPartitionOnDeviceMapper(partition_name + target_suffix)) {
-        return false;
-      }
+      target_partitions.push_back(partition_name + target_suffix);
     }
   }
+  TEST_AND_RETURN_FALSE(UnmapPartitionsOnDeviceMapper(target_partitions));
 
   std::string device_dir_str;
   TEST_AND_RETURN_FALSE(GetDeviceDir(&device_dir_str));
@@ -1244,6 +1377,7 @@ DynamicPartitionControlAndroid::GetDynamicPartitionDevice(
 
 void DynamicPartitionControlAndroid::set_fake_mapped_devices(
     const std::set<std::string>& fake) {
+  std::lock_guard<std::mutex> lock(mapped_devices_lock_);
   mapped_devices_ = fake;
 }
 
@@ -18,10 +18,12 @@
 #define UPDATE_ENGINE_AOSP_DYNAMIC_PARTITION_CONTROL_ANDROID_H_
 
 #include <memory>
+#include <mutex>
 #include <set>
 #include <string>
 #include <string_view>
 #include <array>
+#include <vector>
 
 #include <base/files/file_util.h>
 #include <libsnapshot/auto_device.h>
@@ -55,6 +57,8 @@ class DynamicPartitionControlAndroid : public DynamicPartitionControlInterface {
                                   const DeltaArchiveManifest& manifest,
                                   bool update,
                                   uint64_t* required_size) override;
+  void MapTargetPartitions(uint32_t target_slot,
+                           const DeltaArchiveManifest& manifest) override;
   bool FinishUpdate(bool powerwash_required) override;
   std::unique_ptr<AbstractAction> GetCleanupPreviousUpdateAction(
       BootControlInterface* boot_control,
@@ -128,6 +132,24 @@ class DynamicPartitionControlAndroid : public DynamicPartitionControlInterface {
   virtual bool UnmapPartitionOnDeviceMapper(
       const std::string& target_partition_name);
 
+  // Maps the logical partitions |partition_names| of |super_device| at |slot|
+  // concurrently with MapPartitionOnDeviceMapper, so that their device nodes
+  // are waited for together rather than one after the other. Sets |paths| to
+  // the device path of each partition, in order.
+  // Returns true if all of them are mapped.
+  bool MapPartitionsOnDeviceMapper(
+      const std::string& super_device,
+      const std::vector<std::string>& partition_names,
+      uint32_t slot,
+      bool force_writable,
+      std::vector<std::string>* paths);
+
+  // Unmaps the logical partitions |partition_names| concurrently with
+  // UnmapPartitionOnDeviceMapper.
+  // Returns true if all of them are unmapped.
+  bool UnmapPartitionsOnDeviceMapper(
+      const std::vector<std::string>& partition_names);
+
   // Retrieves metadata from |super_device| at slot |slot|.
   virtual std::unique_ptr<android::fs_mgr::MetadataBuilder> LoadMetadataBuilder(
       const std::string& super_device, uint32_t slot);
@@ -336,6 +358,11 @@ class DynamicPartitionControlAndroid : public DynamicPartitionControlInterface {
   // target_supports_snapshot_ and is_target_dynamic_.
   bool SetTargetBuildVars(const DeltaArchiveManifest& manifest);
 
+  // Partitions are mapped and unmapped from several threads at once.
+  std::mutex mapped_devices_lock_;
+  // SnapshotManager isn't thread-safe, so the snapshots of the partitions are
+  // mapped and unmapped one at a time.
+  std::mutex snapshot_lock_;
   std::set<std::string> mapped_devices_;
   const FeatureFlag dynamic_partitions_;
   const FeatureFlag virtual_ab_;
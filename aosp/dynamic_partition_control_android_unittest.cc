@@ -17,6 +17,7 @@
 #include "update_engine/aosp/dynamic_partition_control_android.h"
 
 #include <algorithm>
+#include <mutex>
 #include <set>
 #include <vector>
 
@@ -747,6 +748,86 @@ TEST_F(DynamicPartitionControlAndroidTest, SimulatedSecondUpdate) {
                                           {"deleted", 64_MiB}}));
 }
 
+// Test that the target partitions are not mapped while they are prepared, and
+// are mapped at once when the update is about to be installed.
+TEST_F(DynamicPartitionControlAndroidTest, MapsTargetPartitionsAfterPrepare) {
+  SetSlots({0, 1});
+
+  SetMetadata(source(), update_sizes_0());
+  SetMetadata(target(), update_sizes_0());
+  ExpectStoreMetadata(update_sizes_1());
+  ExpectUnmap({"grown_b", "shrunk_b", "same_b", "added_b"});
+
+  bool prepared = false;
+  std::mutex lock;
+  std::set<std::string> mapped;
+  EXPECT_CALL(dynamicControl(),
+              MapPartitionOnDeviceMapper(
+                  GetSuperDevice(target()), _, target(), true, _))
+      .Times(4)
+      .WillRepeatedly(
+          Invoke([&](const auto&, const auto& name, auto, auto, auto* path) {
+            std::lock_guard<std::mutex> guard(lock);
+            EXPECT_TRUE(prepared);
+            mapped.insert(name);
+            *path = GetDmDevice(name);
+            return true;
+          }));
+
+  const DeltaArchiveManifest manifest =
+      PartitionSizesToManifest({{"grown", 3_GiB},
+                                {"shrunk", 150_MiB},
+                                {"same", 100_MiB},
+                                {"added", 150_MiB}});
+  EXPECT_TRUE(dynamicControl().PreparePartitionsForUpdate(
+      source(), target(), manifest, true, nullptr));
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    prepared = true;
+  }
+  dynamicControl().MapTargetPartitions(target(), manifest);
+  EXPECT_EQ(
+      (std::set<std::string>{"grown_b", "shrunk_b", "same_b", "added_b"}),
+      mapped);
+}
+
+TEST_F(DynamicPartitionControlAndroidTest, MapPartitionsOnDeviceMapperTest) {
+  const std::vector<std::string> names = {
+      "system_b", "vendor_b", "product_b", "odm_b"};
+  EXPECT_CALL(dynamicControl(),
+              MapPartitionOnDeviceMapper(kFakeSuper, _, 1, true, _))
+      .Times(4)
+      .WillRepeatedly(
+          Invoke([](const auto&, const auto& name, auto, auto, auto* path) {
+            *path = GetDmDevice(name);
+            return name != "product_b";
+          }));
+
+  std::vector<std::string> paths;
+  EXPECT_FALSE(dynamicControl().MapPartitionsOnDeviceMapper(
+      kFakeSuper, names, 1, true, &paths));
+  ASSERT_EQ(names.size(), paths.size());
+  for (size_t i = 0; i < names.size(); i++) {
+    EXPECT_EQ(GetDmDevice(names[i]), paths[i]);
+  }
+}
+
+TEST_F(DynamicPartitionControlAndroidTest, UnmapAllPartitionsTest) {
+  const std::set<std::string> names = {
+      "system_b", "vendor_b", "product_b", "odm_b", "system_ext_b"};
+  dynamicControl().set_fake_mapped_devices(names);
+  // The devices don't exist, so each call only forgets its partition.
+  for (const auto& name : names) {
+    EXPECT_CALL(dynamicControl(), UnmapPartitionOnDeviceMapper(name))
+        .WillOnce(Invoke([&](const auto& partition) {
+          return dynamicControl().RealUnmapPartitionOnDeviceMapper(partition);
+        }));
+  }
+  EXPECT_TRUE(dynamicControl().RealUnmapAllPartitions());
+  // Nothing is left to unmap.
+  EXPECT_FALSE(dynamicControl().RealUnmapAllPartitions());
+}
+
 TEST_F(DynamicPartitionControlAndroidTest, ApplyingToCurrentSlot) {
   SetSlots({1, 1});
   EXPECT_FALSE(PreparePartitionsForUpdate({}))
@@ -143,6 +143,15 @@ class MockDynamicPartitionControlAndroid
     return DynamicPartitionControlAndroid::PrepareDynamicPartitionsForUpdate(
         source_slot, target_slot, manifest, delete_source);
   }
+  bool RealUnmapPartitionOnDeviceMapper(
+      const std::string& target_partition_name) {
+    return DynamicPartitionControlAndroid::UnmapPartitionOnDeviceMapper(
+        target_partition_name);
+  }
+
+  bool RealUnmapAllPartitions() {
+    return DynamicPartitionControlAndroid::UnmapAllPartitions();
+  }
   using DynamicPartitionControlAndroid::SetSourceSlot;
   using DynamicPartitionControlAndroid::SetTargetSlot;
 };
@@ -16,6 +16,8 @@
 
 #include "update_engine/aosp/update_attempter_android.h"
 
+#include <unistd.h>
+
 #include <algorithm>
 #include <map>
 #include <memory>
@@ -45,12 +47,12 @@
 #include "update_engine/payload_consumer/certificate_parser_interface.h"
 #include "update_engine/payload_consumer/delta_performer.h"
 #include "update_engine/payload_consumer/file_descriptor.h"
-#include "update_engine/payload_consumer/file_descriptor_utils.h"
 #include "update_engine/payload_consumer/filesystem_verifier_action.h"
 #include "update_engine/payload_consumer/payload_constants.h"
 #include "update_engine/payload_consumer/payload_metadata.h"
 #include "update_engine/payload_consumer/payload_verifier.h"
 #include "update_engine/payload_consumer/postinstall_runner_action.h"
+#include "update_engine/payload_consumer/source_hash_verifier.h"
 #include "update_engine/update_boot_flags_action.h"
 #include "update_engine/update_status_utils.h"
 
@@ -290,6 +292,15 @@ bool UpdateAttempterAndroid::ApplyPayload(
   install_plan_.run_post_install =
       GetHeaderAsBool(headers[kPayloadPropertyRunPostInstall], true);
 
+  if (!headers[kPayloadPropertyWriteCacheSize].empty() &&
+      !base::StringToUint64(headers[kPayloadPropertyWriteCacheSize],
+                            &install_plan_.write_cache_size)) {
+    return LogAndSetError(
+        error,
+        FROM_HERE,
+        "Invalid write cache size: " + headers[kPayloadPropertyWriteCacheSize]);
+  }
+
   // Skip writing verity if we're resuming and verity has already been written.
   install_plan_.write_verity = true;
   if (install_plan_.is_resume && prefs_->Exists(kPrefsVerityWritten)) {
@@ -520,10 +531,8 @@ bool UpdateAttempterAndroid::VerifyPayloadApplicable(
   TEST_AND_RETURN_FALSE(
       VerifyPayloadParseManifest(metadata_filename, &manifest, error));
 
-  FileDescriptorPtr fd(new EintrSafeFileDescriptor);
-  ErrorCode errorcode;
-
   BootControlInterface::Slot current_slot = GetCurrentSlot();
+  vector<SourcePartition> partitions;
   for (const PartitionUpdate& partition : manifest.partitions()) {
     if (!partition.has_old_partition_info())
       continue;
@@ -535,27 +544,27 @@ bool UpdateAttempterAndroid::VerifyPayloadApplicable(
           FROM_HERE,
           "Failed to get partition device for " + partition.partition_name());
     }
-    if (!fd->Open(partition_path.c_str(), O_RDONLY)) {
-      return LogAndSetError(
-          error, FROM_HERE, "Failed to open " + partition_path);
-    }
-    for (const InstallOperation& operation : partition.operations()) {
-      if (!operation.has_src_sha256_hash())
-        continue;
-      brillo::Blob source_hash;
-      if (!fd_utils::ReadAndHashExtents(fd,
-                                        operation.src_extents(),
-                                        manifest.block_size(),
-                                        &source_hash)) {
-        return LogAndSetError(
-            error, FROM_HERE, "Failed to hash " + partition_path);
-      }
-      if (!PartitionWriter::ValidateSourceHash(
-              source_hash, operation, fd, &errorcode)) {
-        return false;
-      }
+    partitions.push_back({partition_path, &partition});
+  }
+
+  // The partitions are hashed in parallel, each reading its source blocks
+  // once.
+  const size_t max_threads = std::max(sysconf(_SC_NPROCESSORS_ONLN), 1L);
+  int last_percent = 0;
+  auto progress = [&last_percent](uint64_t verified, uint64_t total) {
+    const int percent = static_cast<int>(verified * 100 / total);
+    if (percent / 10 > last_percent / 10) {
+      LOG(INFO) << "Verified " << percent << "% of the source blocks.";
     }
-    fd->Close();
+    last_percent = percent;
+  };
+  string error_message;
+  if (!VerifySourceHashes(partitions,
+                          manifest.block_size(),
+                          max_threads,
+                          progress,
+                          &error_message)) {
+    return LogAndSetError(error, FROM_HERE, error_message);
   }
   return true;
 }
@@ -789,6 +798,7 @@ void UpdateAttempterAndroid::BuildUpdateActions(HttpFetcher* fetcher) {
   auto postinstall_runner_action =
       std::make_unique<PostinstallRunnerAction>(boot_control_, hardware_);
   filesystem_verifier_action->set_delegate(this);
+  filesystem_verifier_action->set_prefs(prefs_);
   postinstall_runner_action->set_delegate(this);
 
   // Bond them together. We have to use the leaf-types when calling
@@ -1202,6 +1212,7 @@ bool UpdateAttempterAndroid::setShouldSwitchSlotOnReboot(
       std::make_unique<PostinstallRunnerAction>(boot_control_, hardware_);
   SetStatusAndNotify(UpdateStatus::VERIFYING);
   filesystem_verifier_action->set_delegate(this);
+  filesystem_verifier_action->set_prefs(prefs_);
   postinstall_runner_action->set_delegate(this);
 
   // Bond them together. We have to use the leaf-types when calling
@@ -148,6 +148,8 @@ static constexpr const auto& kPrefsUpdateTimestampStart =
     "update-timestamp-start";
 static constexpr const auto& kPrefsUrlSwitchCount = "url-switch-count";
 static constexpr const auto& kPrefsVerityWritten = "verity-written";
+static constexpr const auto& kPrefsVerifiedPartitionPrefix =
+    "verified-partition-";
 static constexpr const auto& kPrefsWallClockScatteringWaitPeriod =
     "wall-clock-wait-period";
 static constexpr const auto& kPrefsWallClockStagingWaitPeriod =
@@ -180,6 +182,11 @@ static constexpr const auto& kPayloadPropertySwitchSlotOnReboot =
 // The default is 1 (always run post install).
 static constexpr const auto& kPayloadPropertyRunPostInstall =
     "RUN_POST_INSTALL";
+// Set "WRITE_CACHE_SIZE=<bytes>" to override the size of the cache for the
+// writes to each target partition. The default is picked from the queue
+// limits of the target block device.
+static constexpr const auto& kPayloadPropertyWriteCacheSize =
+    "WRITE_CACHE_SIZE";
 
 static constexpr const auto& kOmahaUpdaterVersion = "0.1.0.0";
 
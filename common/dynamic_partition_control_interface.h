@@ -105,6 +105,13 @@ class DynamicPartitionControlInterface {
                                           bool update,
                                           uint64_t* required_size) = 0;
 
+  // Maps the dynamic partitions written by |manifest| at |target_slot| on
+  // device mapper at once, before they are installed. Only called when the
+  // update is applied, after PreparePartitionsForUpdate(). Partitions which
+  // fail to map here are mapped again when their device is looked up.
+  virtual void MapTargetPartitions(uint32_t target_slot,
+                                   const DeltaArchiveManifest& manifest) = 0;
+
   // After writing to new partitions, before rebooting into the new slot, call
   // this function to indicate writes to new partitions are done.
   virtual bool FinishUpdate(bool powerwash_required) = 0;
@@ -60,6 +60,9 @@ bool DynamicPartitionControlStub::PreparePartitionsForUpdate(
   return true;
 }
 
+void DynamicPartitionControlStub::MapTargetPartitions(
+    uint32_t target_slot, const DeltaArchiveManifest& manifest) {}
+
 bool DynamicPartitionControlStub::FinishUpdate(bool powerwash_required) {
   return true;
 }
@@ -42,6 +42,8 @@ class DynamicPartitionControlStub final : public DynamicPartitionControlInterfac
                                   const DeltaArchiveManifest& manifest,
                                   bool update,
                                   uint64_t* required_size) override;
+  void MapTargetPartitions(uint32_t target_slot,
+                           const DeltaArchiveManifest& manifest) override;
 
   bool FinishUpdate(bool powerwash_required) override;
   std::unique_ptr<AbstractAction> GetCleanupPreviousUpdateAction(
@@ -64,6 +64,10 @@ class MockDynamicPartitionControl : public DynamicPartitionControlInterface {
       PreparePartitionsForUpdate,
       (uint32_t, uint32_t, const DeltaArchiveManifest&, bool, uint64_t*),
       (override));
+  MOCK_METHOD(void,
+              MapTargetPartitions,
+              (uint32_t, const DeltaArchiveManifest&),
+              (override));
 
   MOCK_METHOD(bool, ResetUpdate, (PrefsInterface*), (override));
   MOCK_METHOD(std::unique_ptr<AbstractAction>,
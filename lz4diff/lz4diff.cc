@@ -30,6 +30,7 @@
 #include "update_engine/common/hash_calculator.h"
 #include "update_engine/payload_generator/deflate_utils.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/memory_patch_writer.h"
 #include "lz4diff/lz4diff.pb.h"
 #include "lz4diff_format.h"
 
@@ -87,12 +88,11 @@ template <typename Blob>
 static bool TryBsdiff(Blob src, Blob dst, Blob* output) noexcept {
   static constexpr auto kLz4diffDefaultBrotliQuality = 9;
   CHECK_NE(output, nullptr);
-  ScopedTempFile patch;
 
   Blob bsdiff_delta;
-  bsdiff::BsdiffPatchWriter patch_writer(patch.path(),
-                                         {bsdiff::CompressorType::kBrotli},
-                                         kLz4diffDefaultBrotliQuality);
+  MemoryPatchWriter patch_writer(&bsdiff_delta,
+                                 {bsdiff::CompressorType::kBrotli},
+                                 kLz4diffDefaultBrotliQuality);
   TEST_AND_RETURN_FALSE(0 == bsdiff::bsdiff(src.data(),
                                             src.size(),
                                             dst.data(),
@@ -100,7 +100,6 @@ static bool TryBsdiff(Blob src, Blob dst, Blob* output) noexcept {
                                             &patch_writer,
                                             nullptr));
 
-  TEST_AND_RETURN_FALSE(utils::ReadFile(patch.path(), &bsdiff_delta));
   TEST_AND_RETURN_FALSE(!bsdiff_delta.empty());
   *output = std::move(bsdiff_delta);
   return true;
@@ -151,7 +150,7 @@ static bool TryPuffdiff(puffin::Buffer src,
   }
 
   Blob puffdiff_delta;
-  ScopedTempFile temp_file("puffdiff-delta.XXXXXX");
+  ScopedMemoryTempFile temp_file("puffdiff-delta.XXXXXX");
   // Perform PuffDiff operation.
   TEST_AND_RETURN_FALSE(puffin::PuffDiff(
       src, dst, src_deflates, dst_deflates, temp_file.path(), &puffdiff_delta));
@@ -19,6 +19,7 @@
 #include <algorithm>
 #include <cstdint>
 
+#include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/update_metadata.pb.h"
 
 namespace chromeos_update_engine {
@@ -29,62 +30,74 @@ bool BlockExtentWriter::Init(
   TEST_NE(extents.size(), 0);
   extents_ = extents;
   cur_extent_idx_ = 0;
+  cur_extent_blocks_written_ = 0;
+  block_size_ = block_size;
+  buffer_blocks_ = std::max<uint64_t>(max_buffer_size_ / block_size_, 1);
   buffer_.clear();
   buffer_.reserve(block_size);
-  block_size_ = block_size;
+  return true;
+}
+
+bool BlockExtentWriter::WriteBlocks(const uint8_t* bytes, uint64_t num_blocks) {
+  const auto& cur_extent = extents_[cur_extent_idx_];
+  const Extent extent = ExtentForRange(
+      cur_extent.start_block() + cur_extent_blocks_written_, num_blocks);
+  if (!WriteExtent(bytes, extent, block_size_)) {
+    LOG(ERROR) << "WriteExtent(" << static_cast<const void*>(bytes) << ", "
+               << extent.start_block() << ", " << extent.num_blocks()
+               << ") failed.";
+    return false;
+  }
+  cur_extent_blocks_written_ += num_blocks;
+  if (cur_extent_blocks_written_ == cur_extent.num_blocks()) {
+    cur_extent_blocks_written_ = 0;
+    NextExtent();
+  }
   return true;
 }
 
 size_t BlockExtentWriter::ConsumeWithBuffer(const uint8_t* data, size_t count) {
-  CHECK_LT(cur_extent_idx_, static_cast<size_t>(extents_.size()));
+  if (cur_extent_idx_ >= static_cast<size_t>(extents_.size())) {
+    LOG(ERROR) << "Exhausted all blocks, but still have " << count
+               << " bytes left";
+    // return value is expected to be greater than 0. Return 0 to signal error
+    // condition
+    return 0;
+  }
   const auto& cur_extent = extents_[cur_extent_idx_];
-  const auto cur_extent_size = cur_extent.num_blocks() * block_size_;
+  const uint64_t blocks_left =
+      cur_extent.num_blocks() - cur_extent_blocks_written_;
 
-  if (buffer_.empty() && count >= cur_extent_size) {
-    if (!WriteExtent(data, cur_extent, block_size_)) {
-      LOG(ERROR) << "WriteExtent(" << cur_extent.start_block() << ", "
-                 << static_cast<const void*>(data) << ", " << cur_extent_size
-                 << ") failed.";
-      // return value is expected to be greater than 0. Return 0 to signal error
-      // condition
+  // Whole blocks are written directly from |data|, without copying them.
+  if (buffer_.empty() && count >= block_size_) {
+    const uint64_t num_blocks = std::min<uint64_t>(count / block_size_,
+                                                   blocks_left);
+    if (!WriteBlocks(data, num_blocks)) {
       return 0;
     }
-    if (!NextExtent()) {
-      if (count != cur_extent_size) {
-        LOG(ERROR) << "Exhausted all blocks, but still have "
-                   << count - cur_extent_size << " bytes left";
-        return 0;
-      }
-    }
-    return cur_extent_size;
+    return num_blocks * block_size_;
   }
-  if (buffer_.size() >= cur_extent_size) {
-    LOG(ERROR)
-        << "Data left in buffer should never be >= cur_extent_size, otherwise "
-           "we should have send that data to CowWriter. Buffer size: "
-        << buffer_.size() << " current extent size: " << cur_extent_size;
+
+  // Otherwise the data is buffered until the buffer holds a run of whole
+  // blocks, or the rest of the extent, and then written.
+  const size_t run_size = std::min(blocks_left, buffer_blocks_) * block_size_;
+  if (buffer_.size() >= run_size) {
+    LOG(ERROR) << "Data left in buffer should never be >= run size, otherwise "
+                  "we should have send that data to CowWriter. Buffer size: "
+               << buffer_.size() << " run size: " << run_size;
   }
   const size_t bytes_to_copy =
-      std::min<size_t>(count, cur_extent_size - buffer_.size());
+      std::min<size_t>(count, run_size - buffer_.size());
   TEST_GT(bytes_to_copy, 0U);
 
   buffer_.insert(buffer_.end(), data, data + bytes_to_copy);
-  TEST_LE(buffer_.size(), cur_extent_size);
+  TEST_LE(buffer_.size(), run_size);
 
-  if (buffer_.size() == cur_extent_size) {
-    if (!WriteExtent(buffer_.data(), cur_extent, block_size_)) {
-      LOG(ERROR) << "WriteExtent(" << buffer_.data() << ", "
-                 << cur_extent.start_block() << ", " << cur_extent.num_blocks()
-                 << ") failed.";
+  if (buffer_.size() == run_size) {
+    if (!WriteBlocks(buffer_.data(), run_size / block_size_)) {
       return 0;
     }
     buffer_.clear();
-    if (!NextExtent()) {
-      if (count != bytes_to_copy) {
-        LOG(ERROR) << "Exhausted all blocks, but still have "
-                   << count - bytes_to_copy << " bytes left";
-      }
-    }
   }
   return bytes_to_copy;
 }
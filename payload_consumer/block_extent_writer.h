@@ -25,10 +25,15 @@
 
 namespace chromeos_update_engine {
 
-// Cache data upto size of one extent before writing.
+// Cache data upto |max_buffer_size| bytes, rounded down to whole blocks,
+// before writing. Runs of whole blocks are written as soon as they are
+// complete, so extents larger than the buffer are written in several parts.
 class BlockExtentWriter : public chromeos_update_engine::ExtentWriter {
  public:
-  BlockExtentWriter() = default;
+  static constexpr size_t kDefaultMaxBufferSize = 1024 * 1024;
+
+  explicit BlockExtentWriter(size_t max_buffer_size = kDefaultMaxBufferSize)
+      : max_buffer_size_(max_buffer_size) {}
   ~BlockExtentWriter() = default;
   // Returns true on success.
   bool Init(const google::protobuf::RepeatedPtrField<Extent>& extents,
@@ -36,8 +41,8 @@ class BlockExtentWriter : public chromeos_update_engine::ExtentWriter {
   // Returns true on success.
   bool Write(const void* bytes, size_t count) final;
   // Write data for 1 extent. |bytes| will be a pointer which points to data of
-  // size |extent.num_blocks()*block_size|. |extent| is the current extent we
-  // are writing to.
+  // size |extent.num_blocks()*block_size|. |extent| is the part of the current
+  // extent we are writing to.
   virtual bool WriteExtent(const void* bytes,
                            const Extent& extent,
                            size_t block_size) = 0;
@@ -46,13 +51,18 @@ class BlockExtentWriter : public chromeos_update_engine::ExtentWriter {
  private:
   bool NextExtent();
   [[nodiscard]] size_t ConsumeWithBuffer(const uint8_t* bytes, size_t count);
-  // It's a non-owning pointer, because PartitionWriter owns the CowWruter. This
-  // allows us to use a single instance of CowWriter for all operations applied
-  // to the same partition.
+  // Writes the next |num_blocks| blocks of the current extent from |bytes|.
+  [[nodiscard]] bool WriteBlocks(const uint8_t* bytes, uint64_t num_blocks);
+
   google::protobuf::RepeatedPtrField<Extent> extents_;
   size_t cur_extent_idx_;
+  // The number of blocks of the current extent already written.
+  uint64_t cur_extent_blocks_written_;
   std::vector<uint8_t> buffer_;
   size_t block_size_;
+  const size_t max_buffer_size_;
+  // The most blocks held in |buffer_|.
+  uint64_t buffer_blocks_;
 };
 
 }  // namespace chromeos_update_engine
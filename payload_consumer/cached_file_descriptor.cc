@@ -19,49 +19,106 @@
 #include <unistd.h>
 
 #include <algorithm>
+#include <iterator>
 
+#include <base/files/file_path.h>
+#include <base/files/file_util.h>
 #include <base/logging.h>
+#include <base/strings/string_number_conversions.h>
+#include <base/strings/string_util.h>
 
 #include "update_engine/common/utils.h"
 
+using std::string;
+
 namespace chromeos_update_engine {
 
+namespace {
+
+constexpr size_t kDefaultWriteCacheSize = 1024 * 1024;  // 1MB
+constexpr size_t kMaxWriteCacheSize = 16 * 1024 * 1024;  // 16MB
+// The number of the largest requests of the device queue the cache holds.
+constexpr size_t kRequestsPerWriteCache = 4;
+
+// Reads the number in the sysfs file |path|, or returns 0.
+uint64_t ReadSysfsNumber(const base::FilePath& path) {
+  string value;
+  uint64_t number = 0;
+  if (!base::ReadFileToString(path, &value)) {
+    return 0;
+  }
+  base::TrimWhitespaceASCII(value, base::TRIM_ALL, &value);
+  if (!base::StringToUint64(value, &number)) {
+    LOG(WARNING) << "Invalid value in " << path.value() << ": " << value;
+    return 0;
+  }
+  return number;
+}
+
+}  // namespace
+
 off64_t CachedFileDescriptorBase::Seek(off64_t offset, int whence) {
   // Only support SEEK_SET and SEEK_CUR. I think these two would be enough. If
   // we want to support SEEK_END then we have to figure out the size of the
   // underlying file descriptor each time and it may not be a very good idea.
   CHECK(whence == SEEK_SET || whence == SEEK_CUR);
-  off64_t next_offset = whence == SEEK_SET ? offset : offset_ + offset;
+  // The cached data is kept, each run is written at its own offset.
+  offset_ = whence == SEEK_SET ? offset : offset_ + offset;
+  return offset_;
+}
 
-  if (next_offset != offset_) {
-    // We sought somewhere other than what we are now. So we have to flush and
-    // move to the new offset.
-    if (!FlushCache()) {
-      return -1;
-    }
-    // Then we have to seek there.
-    if (GetFd()->Seek(next_offset, SEEK_SET) < 0) {
-      return -1;
-    }
-    offset_ = next_offset;
+ssize_t CachedFileDescriptorBase::Read(void* buf, size_t count) {
+  // The data is read from |fd_|, which must have all the data written so far.
+  if (!FlushCache() || GetFd()->Seek(offset_, SEEK_SET) < 0) {
+    return -1;
   }
-  return offset_;
+  auto bytes_read = GetFd()->Read(buf, count);
+  if (bytes_read > 0) {
+    offset_ += bytes_read;
+  }
+  return bytes_read;
 }
 
 ssize_t CachedFileDescriptorBase::Write(const void* buf, size_t count) {
+  // Overwriting cached data isn't supported, the cached data is written first.
+  if (OverlapsCache(offset_, count) && !FlushCache()) {
+    return -1;
+  }
   auto bytes = static_cast<const uint8_t*>(buf);
   size_t total_bytes_wrote = 0;
   while (total_bytes_wrote < count) {
+    const off64_t offset = offset_ + total_bytes_wrote;
+    // Extend the run ending at |offset|, or start a new one.
+    auto run = runs_.lower_bound(offset);
+    if (run != runs_.begin() &&
+        std::prev(run)->first +
+                static_cast<off64_t>(std::prev(run)->second.size()) ==
+            offset) {
+      run = std::prev(run);
+    } else {
+      if (runs_.size() == kMaxDirtyRuns && !FlushCache()) {
+        return -1;
+      }
+      run = runs_.emplace(offset, brillo::Blob()).first;
+    }
     auto bytes_to_cache =
-        std::min(count - total_bytes_wrote, cache_.size() - bytes_cached_);
-    if (bytes_to_cache > 0) {  // Which means |cache_| is still have some space.
-      memcpy(cache_.data() + bytes_cached_,
-             bytes + total_bytes_wrote,
-             bytes_to_cache);
-      total_bytes_wrote += bytes_to_cache;
-      bytes_cached_ += bytes_to_cache;
+        std::min(count - total_bytes_wrote, cache_size_ - bytes_cached_);
+    run->second.insert(run->second.end(),
+                       bytes + total_bytes_wrote,
+                       bytes + total_bytes_wrote + bytes_to_cache);
+    total_bytes_wrote += bytes_to_cache;
+    bytes_cached_ += bytes_to_cache;
+
+    // Merge the run with the next one if they are now adjacent.
+    auto next = std::next(run);
+    if (next != runs_.end() &&
+        run->first + static_cast<off64_t>(run->second.size()) == next->first) {
+      run->second.insert(
+          run->second.end(), next->second.begin(), next->second.end());
+      runs_.erase(next);
     }
-    if (bytes_cached_ == cache_.size()) {
+
+    if (bytes_cached_ == cache_size_) {
       // Cache is full; write it to the |fd_| as long as you can.
       if (!FlushCache()) {
         return -1;
@@ -81,19 +138,75 @@ bool CachedFileDescriptorBase::Close() {
   return FlushCache() && GetFd()->Close();
 }
 
+int CachedFileDescriptorBase::GetRawFd() {
+  // The cached data must be written before the kernel accesses the file.
+  const int fd = GetFd()->GetRawFd();
+  if (fd < 0 || !FlushCache()) {
+    return -1;
+  }
+  return fd;
+}
+
 bool CachedFileDescriptorBase::FlushCache() {
-  size_t begin = 0;
-  while (begin < bytes_cached_) {
-    auto bytes_wrote =
-        GetFd()->Write(cache_.data() + begin, bytes_cached_ - begin);
-    if (bytes_wrote < 0) {
-      PLOG(ERROR) << "Failed to flush cached data!";
+  for (const auto& [offset, data] : runs_) {
+    if (GetFd()->Seek(offset, SEEK_SET) < 0) {
+      PLOG(ERROR) << "Failed to seek to " << offset << " to flush cached data!";
       return false;
     }
-    begin += bytes_wrote;
+    size_t begin = 0;
+    while (begin < data.size()) {
+      auto bytes_wrote =
+          GetFd()->Write(data.data() + begin, data.size() - begin);
+      if (bytes_wrote < 0) {
+        PLOG(ERROR) << "Failed to flush cached data!";
+        return false;
+      }
+      begin += bytes_wrote;
+    }
   }
+  runs_.clear();
   bytes_cached_ = 0;
   return true;
 }
 
+bool CachedFileDescriptorBase::OverlapsCache(off64_t offset,
+                                             size_t count) const {
+  auto run = runs_.lower_bound(offset + static_cast<off64_t>(count));
+  if (run == runs_.begin()) {
+    return false;
+  }
+  run = std::prev(run);
+  return run->first + static_cast<off64_t>(run->second.size()) > offset;
+}
+
+size_t GetWriteCacheSize(const string& path, const string& sysfs_block_dir) {
+  // Resolve the symlinks, e.g. /dev/block/by-name/system_b, to the device.
+  const base::FilePath device =
+      base::MakeAbsoluteFilePath(base::FilePath(path));
+  if (device.empty()) {
+    return kDefaultWriteCacheSize;
+  }
+  // Partitions don't have a queue, but their disk does.
+  base::FilePath sysfs_dir =
+      base::FilePath(sysfs_block_dir).Append(device.BaseName());
+  base::FilePath queue_dir = sysfs_dir.Append("queue");
+  if (!base::DirectoryExists(queue_dir)) {
+    queue_dir = sysfs_dir.Append("..").Append("queue");
+    if (!base::DirectoryExists(queue_dir)) {
+      return kDefaultWriteCacheSize;
+    }
+  }
+  const uint64_t max_request_size =
+      std::max(ReadSysfsNumber(queue_dir.Append("max_sectors_kb")) * 1024,
+               ReadSysfsNumber(queue_dir.Append("optimal_io_size")));
+  const size_t cache_size = std::clamp<uint64_t>(
+      max_request_size * kRequestsPerWriteCache,
+      kDefaultWriteCacheSize,
+      kMaxWriteCacheSize);
+  LOG(INFO) << "Using a write cache of " << cache_size / 1024 << " KiB for "
+            << path << ", largest request: " << max_request_size / 1024
+            << " KiB";
+  return cache_size;
+}
+
 }  // namespace chromeos_update_engine
@@ -20,7 +20,9 @@
 #include <errno.h>
 #include <sys/types.h>
 
+#include <map>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include <brillo/secure_blob.h>
@@ -29,9 +31,17 @@
 
 namespace chromeos_update_engine {
 
+// Caches up to |cache_size| bytes of writes before writing them to the
+// underlying file descriptor. The writes don't need to be contiguous: the
+// cache keeps up to |kMaxDirtyRuns| disjoint runs of data, adjacent writes
+// being merged in a single run, and writes them in offset order when it is
+// full, on Flush(), and before the underlying file descriptor is read or
+// sent an ioctl.
 class CachedFileDescriptorBase : public FileDescriptor {
  public:
-  CachedFileDescriptorBase(size_t cache_size) : cache_(cache_size) {}
+  static constexpr size_t kMaxDirtyRuns = 16;
+
+  CachedFileDescriptorBase(size_t cache_size) : cache_size_(cache_size) {}
   ~CachedFileDescriptorBase() override = default;
 
   bool Open(const char* path, int flags, mode_t mode) override {
@@ -40,9 +50,7 @@ class CachedFileDescriptorBase : public FileDescriptor {
   bool Open(const char* path, int flags) override {
     return GetFd()->Open(path, flags);
   }
-  ssize_t Read(void* buf, size_t count) override {
-    return GetFd()->Read(buf, count);
-  }
+  ssize_t Read(void* buf, size_t count) override;
   ssize_t Write(const void* buf, size_t count) override;
   off64_t Seek(off64_t offset, int whence) override;
   uint64_t BlockDevSize() override { return GetFd()->BlockDevSize(); }
@@ -50,12 +58,13 @@ class CachedFileDescriptorBase : public FileDescriptor {
                 uint64_t start,
                 uint64_t length,
                 int* result) override {
-    return GetFd()->BlkIoctl(request, start, length, result);
+    return FlushCache() && GetFd()->BlkIoctl(request, start, length, result);
   }
   bool Flush() override;
   bool Close() override;
   bool IsSettingErrno() override { return GetFd()->IsSettingErrno(); }
   bool IsOpen() override { return GetFd()->IsOpen(); }
+  int GetRawFd() override;
 
  protected:
   virtual FileDescriptor* GetFd() = 0;
@@ -64,7 +73,13 @@ class CachedFileDescriptorBase : public FileDescriptor {
   // Internal flush without the need to call |fd_->Flush()|.
   bool FlushCache();
 
-  brillo::Blob cache_;
+  // Whether any cached data is in the |count| bytes at |offset|.
+  bool OverlapsCache(off64_t offset, size_t count) const;
+
+  // The cached data, keyed by offset. The runs don't overlap and aren't
+  // adjacent.
+  std::map<off64_t, brillo::Blob> runs_;
+  const size_t cache_size_;
   size_t bytes_cached_{0};
   off64_t offset_{0};
 
@@ -91,6 +106,14 @@ class UnownedCachedFileDescriptor final : public CachedFileDescriptorBase {
   FileDescriptor* fd_;
 };
 
+// Returns the size of the write cache for the block device |path|, large
+// enough for several of the largest requests of its queue, as read from
+// |sysfs_block_dir|. Returns a default size for regular files or if the queue
+// limits can't be read.
+size_t GetWriteCacheSize(
+    const std::string& path,
+    const std::string& sysfs_block_dir = "/sys/class/block");
+
 }  // namespace chromeos_update_engine
 
 #endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_CACHED_FILE_DESCRIPTOR_H_
@@ -22,6 +22,8 @@
 #include <string>
 #include <vector>
 
+#include <base/files/file_util.h>
+#include <base/files/scoped_temp_dir.h>
 #include <gtest/gtest.h>
 
 #include "update_engine/common/test_utils.h"
@@ -193,12 +195,131 @@ TEST_F(CachedFileDescriptorTest, SeekAfterWriteTest) {
   // We are writing less than  one cache size; then it should not be committed.
   Write(&blob_in[seek], less_than_cache_size);
 
-  // Then we seek, it should've written the cache after seek.
+  // Then we seek, the cache is kept and only written on flush.
   EXPECT_EQ(cfd_->Seek(200, SEEK_SET), 200);
 
   brillo::Blob blob_out;
   EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &blob_out));
+  EXPECT_EQ(brillo::Blob(kFileSize, 0), blob_out);
+
+  EXPECT_TRUE(cfd_->Flush());
+  EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &blob_out));
+  EXPECT_EQ(blob_in, blob_out);
+}
+
+TEST_F(CachedFileDescriptorTest, DisjointWritesTest) {
+  brillo::Blob blob_in(kFileSize, 0);
+  std::fill_n(&blob_in[0], 20, value_);
+  std::fill_n(&blob_in[50], 30, value_ + 1);
+  // Out of order writes, the last one joining the first two runs.
+  EXPECT_EQ(cfd_->Seek(0, SEEK_SET), 0);
+  Write(&blob_in[0], 10);
+  EXPECT_EQ(cfd_->Seek(50, SEEK_SET), 50);
+  Write(&blob_in[50], 30);
+  EXPECT_EQ(cfd_->Seek(10, SEEK_SET), 10);
+  Write(&blob_in[10], 10);
+
+  brillo::Blob blob_out;
+  EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &blob_out));
+  EXPECT_EQ(brillo::Blob(kFileSize, 0), blob_out);
+
+  EXPECT_TRUE(cfd_->Flush());
+  EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &blob_out));
+  EXPECT_EQ(blob_in, blob_out);
+}
+
+TEST_F(CachedFileDescriptorTest, OverlappingWriteTest) {
+  brillo::Blob blob_in(kFileSize, 0);
+  std::fill_n(&blob_in[0], 20, value_);
+  EXPECT_EQ(cfd_->Seek(0, SEEK_SET), 0);
+  Write(&blob_in[0], 20);
+
+  // Overwriting cached data writes the cache first.
+  std::fill_n(&blob_in[10], 5, value_ + 1);
+  EXPECT_EQ(cfd_->Seek(10, SEEK_SET), 10);
+  Write(&blob_in[10], 5);
+  brillo::Blob blob_out;
+  EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &blob_out));
+  EXPECT_EQ(brillo::Blob(20, value_),
+            brillo::Blob(blob_out.begin(), blob_out.begin() + 20));
+
+  EXPECT_TRUE(cfd_->Flush());
+  EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &blob_out));
+  EXPECT_EQ(blob_in, blob_out);
+}
+
+TEST_F(CachedFileDescriptorTest, MaxDirtyRunsTest) {
+  brillo::Blob blob_in(kFileSize, 0);
+  const size_t num_runs = CachedFileDescriptorBase::kMaxDirtyRuns;
+  for (size_t i = 0; i < num_runs; i++) {
+    blob_in[i * 2] = value_;
+    EXPECT_EQ(cfd_->Seek(i * 2, SEEK_SET), static_cast<off64_t>(i * 2));
+    Write(&blob_in[i * 2], 1);
+  }
+  brillo::Blob blob_out;
+  EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &blob_out));
+  EXPECT_EQ(brillo::Blob(kFileSize, 0), blob_out);
+
+  // One more run writes the cached ones, and is cached.
+  uint8_t last = value_;
+  EXPECT_EQ(cfd_->Seek(num_runs * 2, SEEK_SET),
+            static_cast<off64_t>(num_runs * 2));
+  Write(&last, 1);
+  EXPECT_TRUE(utils::ReadFile(temp_file_.path(), &blob_out));
   EXPECT_EQ(blob_in, blob_out);
 }
 
+TEST_F(CachedFileDescriptorTest, ReadAfterWriteTest) {
+  brillo::Blob blob_in(10, value_);
+  EXPECT_EQ(cfd_->Seek(100, SEEK_SET), 100);
+  Write(blob_in.data(), blob_in.size());
+
+  EXPECT_EQ(cfd_->Seek(95, SEEK_SET), 95);
+  brillo::Blob blob_out(10);
+  EXPECT_EQ(cfd_->Read(blob_out.data(), blob_out.size()), 10);
+  EXPECT_EQ(cfd_->Seek(0, SEEK_CUR), 105);
+  brillo::Blob expected(5, 0);
+  expected.insert(expected.end(), 5, value_);
+  EXPECT_EQ(expected, blob_out);
+}
+
+TEST(GetWriteCacheSizeTest, QueueLimitsTest) {
+  base::ScopedTempDir sysfs_dir;
+  ASSERT_TRUE(sysfs_dir.CreateUniqueTempDir());
+  ScopedTempFile device("sda5.XXXXXX");
+  const base::FilePath device_path(device.path());
+  const base::FilePath disk_dir = sysfs_dir.GetPath().Append("sda");
+  const base::FilePath queue_dir = disk_dir.Append("queue");
+  ASSERT_TRUE(base::CreateDirectory(queue_dir));
+  // The partition is a child of the disk, like in sysfs.
+  ASSERT_TRUE(base::CreateDirectory(disk_dir.Append(device_path.BaseName())));
+  ASSERT_TRUE(base::CreateSymbolicLink(
+      disk_dir.Append(device_path.BaseName()),
+      sysfs_dir.GetPath().Append(device_path.BaseName())));
+
+  // Without limits, the default size is used.
+  EXPECT_EQ(1024u * 1024,
+            GetWriteCacheSize(device.path(), sysfs_dir.GetPath().value()));
+
+  ASSERT_TRUE(test_utils::WriteFileString(
+      queue_dir.Append("max_sectors_kb").value(), "512\n"));
+  ASSERT_TRUE(test_utils::WriteFileString(
+      queue_dir.Append("optimal_io_size").value(), "0\n"));
+  EXPECT_EQ(2u * 1024 * 1024,
+            GetWriteCacheSize(device.path(), sysfs_dir.GetPath().value()));
+
+  ASSERT_TRUE(test_utils::WriteFileString(
+      queue_dir.Append("optimal_io_size").value(), "1048576\n"));
+  EXPECT_EQ(4u * 1024 * 1024,
+            GetWriteCacheSize(device.path(), sysfs_dir.GetPath().value()));
+
+  ASSERT_TRUE(test_utils::WriteFileString(
+      queue_dir.Append("max_sectors_kb").value(), "65536\n"));
+  EXPECT_EQ(16u * 1024 * 1024,
+            GetWriteCacheSize(device.path(), sysfs_dir.GetPath().value()));
+
+  // Not a block device.
+  EXPECT_EQ(1024u * 1024, GetWriteCacheSize(device.path(), "/non/existent"));
+}
+
 }  // namespace chromeos_update_engine
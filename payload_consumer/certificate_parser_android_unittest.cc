@@ -58,4 +58,31 @@ TEST(CertificateParserAndroidTest, VerifySignature) {
   ASSERT_TRUE(verifier->VerifyRawSignature(sig_blob, hash_blob, nullptr));
 }
 
+TEST(CertificateParserAndroidTest, ReparseChangedZipArchive) {
+  brillo::Blob hash_blob;
+  ASSERT_TRUE(HashCalculator::RawHashOfData({'x'}, &hash_blob));
+  brillo::Blob sig_blob;
+  ASSERT_TRUE(PayloadSigner::SignHash(
+      hash_blob,
+      test_utils::GetBuildArtifactsPath(kUnittestPrivateKeyPath),
+      &sig_blob));
+
+  brillo::Blob zip;
+  ASSERT_TRUE(utils::ReadFile(
+      test_utils::GetBuildArtifactsPath(kUnittestOtacertsPath), &zip));
+  ScopedTempFile ota_cert("otacerts.XXXXXX");
+  ASSERT_TRUE(test_utils::WriteFileVector(ota_cert.path(), zip));
+
+  // The cached keys are used until the zip changes.
+  for (int i = 0; i < 2; i++) {
+    auto verifier = PayloadVerifier::CreateInstanceFromZipPath(ota_cert.path());
+    ASSERT_TRUE(verifier != nullptr);
+    ASSERT_TRUE(verifier->VerifyRawSignature(sig_blob, hash_blob, nullptr));
+  }
+
+  ASSERT_TRUE(test_utils::WriteFileString(ota_cert.path(), "not a zip"));
+  EXPECT_EQ(nullptr,
+            PayloadVerifier::CreateInstanceFromZipPath(ota_cert.path()));
+}
+
 }  // namespace chromeos_update_engine
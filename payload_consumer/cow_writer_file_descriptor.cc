@@ -51,50 +51,49 @@ bool CowWriterFileDescriptor::Open(const char* path, int flags) {
 }
 
 ssize_t CowWriterFileDescriptor::Read(void* buf, size_t count) {
-  if (dirty_) {
+  if (dirty_blocks_.blocks() > 0) {
     // OK, CowReader provides a snapshot view of what the cow contains. Which
     // means any writes happened after opening a CowReader isn't visible to
-    // that CowReader. Therefore, we re-open CowReader whenever we attempt a
-    // read after write. This does incur an overhead everytime you read after
-    // write.
-    // The usage of |dirty_| flag to coordinate re-open is a very coarse grained
-    // checked. This implementation has suboptimal performance. For better
-    // performance, keep track of blocks which are overwritten, and only re-open
-    // if reading a dirty block.
-    // TODO(b/173432386) Implement finer grained dirty checks
+    // that CowReader. Therefore, we re-open CowReader whenever we attempt to
+    // read a block written after opening it. Reads of other blocks, like the
+    // data read between the FEC writes, don't pay for the re-open.
     const auto offset = cow_reader_->Seek(0, SEEK_CUR);
-    cow_reader_.reset();
-    if (!cow_writer_->Finalize()) {
-      LOG(ERROR) << "Failed to Finalize() cow writer";
-      return -1;
-    }
-    cow_reader_ = cow_writer_->OpenReader();
-    if (cow_reader_ == nullptr) {
-      LOG(ERROR) << "Failed to re-open cow reader after writing to COW";
-      return -1;
-    }
-    const auto pos = cow_reader_->Seek(offset, SEEK_SET);
-    if (pos != offset) {
-      LOG(ERROR) << "Failed to seek to previous position after re-opening cow "
-                    "reader, expected "
-                 << offset << " actual: " << pos;
-      return -1;
+    if (dirty_blocks_.OverlapsWithExtent(ExtentForBytes(
+            cow_writer_->options().block_size, offset, count))) {
+      cow_reader_.reset();
+      if (!cow_writer_->Finalize()) {
+        LOG(ERROR) << "Failed to Finalize() cow writer";
+        return -1;
+      }
+      cow_reader_ = cow_writer_->OpenReader();
+      if (cow_reader_ == nullptr) {
+        LOG(ERROR) << "Failed to re-open cow reader after writing to COW";
+        return -1;
+      }
+      const auto pos = cow_reader_->Seek(offset, SEEK_SET);
+      if (pos != offset) {
+        LOG(ERROR) << "Failed to seek to previous position after re-opening "
+                      "cow reader, expected "
+                   << offset << " actual: " << pos;
+        return -1;
+      }
+      dirty_blocks_ = ExtentRanges();
+      reader_reopens_++;
     }
-    dirty_ = false;
   }
   return cow_reader_->Read(buf, count);
 }
 
 ssize_t CowWriterFileDescriptor::Write(const void* buf, size_t count) {
   auto offset = cow_reader_->Seek(0, SEEK_CUR);
-  CHECK_EQ(offset % cow_writer_->options().block_size, 0);
-  auto success = cow_writer_->AddRawBlocks(
-      offset / cow_writer_->options().block_size, buf, count);
+  const auto block_size = cow_writer_->options().block_size;
+  CHECK_EQ(offset % block_size, 0);
+  auto success = cow_writer_->AddRawBlocks(offset / block_size, buf, count);
   if (success) {
     if (cow_reader_->Seek(count, SEEK_CUR) < 0) {
       return -1;
     }
-    dirty_ = true;
+    dirty_blocks_.AddExtent(ExtentForBytes(block_size, offset, count));
     return count;
   }
   return -1;
@@ -132,9 +131,12 @@ bool CowWriterFileDescriptor::Close() {
     // when calling SnapshotWriter::Finalize(), data after resume label are
     // discarded, therefore verity data is gone. To prevent phantom reads, don't
     // call Finalize() unless we actually write something.
-    if (dirty_) {
+    if (dirty_blocks_.blocks() > 0) {
       TEST_AND_RETURN_FALSE(cow_writer_->Finalize());
     }
+    LOG_IF(INFO, reader_reopens_ > 0)
+        << "Re-opened the COW reader " << reader_reopens_
+        << " times to read written blocks.";
     cow_writer_ = nullptr;
   }
   if (cow_reader_) {
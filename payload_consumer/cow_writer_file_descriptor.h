@@ -17,9 +17,11 @@
 #include <cstdint>
 #include <memory>
 
+#include <gtest/gtest_prod.h>  // for FRIEND_TEST
 #include <libsnapshot/snapshot_writer.h>
 
 #include "update_engine/payload_consumer/file_descriptor.h"
+#include "update_engine/payload_generator/extent_ranges.h"
 
 namespace chromeos_update_engine {
 
@@ -64,8 +66,13 @@ class CowWriterFileDescriptor final : public FileDescriptor {
   bool IsOpen() override;
 
  private:
+  FRIEND_TEST(CowWriterFileDescriptorUnittest, ReopenOnlyForDirtyReads);
+
   std::unique_ptr<android::snapshot::ISnapshotWriter> cow_writer_;
   FileDescriptorPtr cow_reader_;
-  bool dirty_ = false;
+  // The blocks written since |cow_reader_| was opened, which it doesn't see.
+  ExtentRanges dirty_blocks_;
+  // The number of times |cow_reader_| was re-opened to see the writes.
+  size_t reader_reopens_ = 0;
 };
 }  // namespace chromeos_update_engine
@@ -16,6 +16,7 @@
 
 #include "update_engine/payload_consumer/cow_writer_file_descriptor.h"
 
+#include <algorithm>
 #include <cstring>
 #include <memory>
 #include <utility>
@@ -117,4 +118,47 @@ TEST_F(CowWriterFileDescriptorUnittest, ReadAfterWrite) {
          "is open, Finalize() should not be called.";
 }
 
+// Interleaves reads of the data and hash tree with writes of FEC blocks, like
+// VerityWriterAndroid::EncodeFEC() does.
+TEST_F(CowWriterFileDescriptorUnittest, ReopenOnlyForDirtyReads) {
+  auto cow_writer = GetCowWriter();
+  ASSERT_TRUE(cow_writer->Initialize());
+  CowWriterFileDescriptor cow_fd(std::move(cow_writer));
+
+  // Blocks 6 and 7 hold the hash tree, blocks 8 and 9 the FEC.
+  std::vector<unsigned char> hash_tree(BLOCK_SIZE * 2, 0xAA);
+  ASSERT_EQ(static_cast<off64_t>(BLOCK_SIZE * 6),
+            cow_fd.Seek(BLOCK_SIZE * 6, SEEK_SET));
+  ASSERT_TRUE(utils::WriteAll(&cow_fd, hash_tree.data(), hash_tree.size()));
+  EXPECT_EQ(0u, cow_fd.reader_reopens_);
+
+  std::vector<unsigned char> read_back(BLOCK_SIZE * 8);
+  for (size_t round = 0; round < 2; round++) {
+    ssize_t bytes_read = 0;
+    ASSERT_TRUE(utils::PReadAll(
+        &cow_fd, read_back.data(), read_back.size(), 0, &bytes_read));
+    ASSERT_EQ(static_cast<ssize_t>(read_back.size()), bytes_read);
+    EXPECT_TRUE(std::equal(hash_tree.begin(),
+                           hash_tree.end(),
+                           read_back.begin() + BLOCK_SIZE * 6));
+
+    const std::vector<unsigned char> fec(BLOCK_SIZE,
+                                         static_cast<unsigned char>(round));
+    ASSERT_EQ(static_cast<off64_t>(BLOCK_SIZE * (8 + round)),
+              cow_fd.Seek(BLOCK_SIZE * (8 + round), SEEK_SET));
+    ASSERT_TRUE(utils::WriteAll(&cow_fd, fec.data(), fec.size()));
+  }
+  // Only reading the hash tree needed the writes, the FEC writes aren't read.
+  EXPECT_EQ(1u, cow_fd.reader_reopens_);
+
+  std::vector<unsigned char> fec(BLOCK_SIZE * 2);
+  ssize_t bytes_read = 0;
+  ASSERT_TRUE(utils::PReadAll(
+      &cow_fd, fec.data(), fec.size(), BLOCK_SIZE * 8, &bytes_read));
+  ASSERT_EQ(static_cast<ssize_t>(fec.size()), bytes_read);
+  EXPECT_EQ(0, fec.front());
+  EXPECT_EQ(1, fec.back());
+  EXPECT_EQ(2u, cow_fd.reader_reopens_);
+}
+
 }  // namespace chromeos_update_engine
@@ -584,10 +584,21 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode* error) {
     }
     if (!HandleOpResult(op_result, op_name.c_str(), error))
       return false;
+    RecordOperationThroughput(op, op_start_time);
 
     next_operation_num_++;
+    if (next_operation_num_ == num_total_operations_) {
+      LogOperationThroughput();
+    }
     UpdateOverallProgress(false, "Completed ");
-    CheckpointUpdateProgress(false);
+    // Later checkpoints could succeed once the failed write is forgotten, and
+    // record operations whose data was lost as applied.
+    ErrorCode checkpoint_error = ErrorCode::kSuccess;
+    if (!CheckpointUpdateProgress(false, &checkpoint_error) &&
+        checkpoint_error != ErrorCode::kSuccess) {
+      *error = checkpoint_error;
+      return false;
+    }
   }
 
   if (partition_writer_) {
@@ -627,6 +638,25 @@ bool DeltaPerformer::Write(const void* bytes, size_t count, ErrorCode* error) {
   return true;
 }
 
+void DeltaPerformer::RecordOperationThroughput(
+    const InstallOperation& operation, base::TimeTicks start_time) {
+  OperationThroughput& throughput = op_throughput_[operation.type()];
+  throughput.bytes +=
+      utils::BlocksInExtents(operation.dst_extents()) * block_size_;
+  throughput.duration += base::TimeTicks::Now() - start_time;
+}
+
+void DeltaPerformer::LogOperationThroughput() const {
+  for (const auto& [type, throughput] : op_throughput_) {
+    const double seconds = throughput.duration.InSecondsF();
+    LOG(INFO) << "Install operation throughput: "
+              << InstallOperationTypeName(type) << " wrote "
+              << throughput.bytes << " bytes in " << seconds << " s ("
+              << (seconds > 0 ? throughput.bytes / seconds / 1e6 : 0)
+              << " MB/s)";
+  }
+}
+
 bool DeltaPerformer::IsManifestValid() {
   return manifest_valid_;
 }
@@ -648,6 +678,10 @@ bool DeltaPerformer::ParseManifestPartitions(ErrorCode* error) {
       }
       return false;
     }
+    // The partitions are about to be installed, so they are mapped at once
+    // before ParsePartitions() looks up their devices one by one.
+    boot_control_->GetDynamicPartitionControl()->MapTargetPartitions(
+        install_plan_->target_slot, manifest_);
   }
 
   // Partitions in manifest are no longer needed after preparing partitions.
@@ -945,13 +979,14 @@ ErrorCode DeltaPerformer::ValidateManifest() {
       return ErrorCode::kUnsupportedMinorPayloadVersion;
     }
   } else {
+    const uint32_t max_minor_version = GetMaxSupportedMinorPayloadVersion();
     if (manifest_.minor_version() < kMinSupportedMinorPayloadVersion ||
-        manifest_.minor_version() > kMaxSupportedMinorPayloadVersion) {
+        manifest_.minor_version() > max_minor_version) {
       LOG(ERROR) << "Manifest contains minor version "
                  << manifest_.minor_version()
                  << " not in the range of supported minor versions ["
                  << kMinSupportedMinorPayloadVersion << ", "
-                 << kMaxSupportedMinorPayloadVersion << "].";
+                 << max_minor_version << "].";
       return ErrorCode::kUnsupportedMinorPayloadVersion;
     }
   }
@@ -1206,6 +1241,13 @@ void DeltaPerformer::DiscardBuffer(bool do_advance_offset,
   brillo::Blob().swap(buffer_);
 }
 
+uint32_t DeltaPerformer::GetMaxSupportedMinorPayloadVersion() {
+  if (!XzExtentWriter::Arm64FilterSupported()) {
+    return kXzArm64MinorPayloadVersion - 1;
+  }
+  return kMaxSupportedMinorPayloadVersion;
+}
+
 bool DeltaPerformer::CanResumeUpdate(PrefsInterface* prefs,
                                      const string& update_check_response_hash) {
   int64_t next_operation = kUpdateStateOperationInvalid;
@@ -1286,7 +1328,7 @@ bool DeltaPerformer::ShouldCheckpoint() {
   return false;
 }
 
-bool DeltaPerformer::CheckpointUpdateProgress(bool force) {
+bool DeltaPerformer::CheckpointUpdateProgress(bool force, ErrorCode* error) {
   if (!force && !ShouldCheckpoint()) {
     return false;
   }
@@ -1334,8 +1376,19 @@ bool DeltaPerformer::CheckpointUpdateProgress(bool force) {
       TEST_AND_RETURN_FALSE(
           prefs_->SetInt64(kPrefsUpdateStateNextDataLength, 0));
     }
+    // The data of the applied operations must be durable before the next
+    // operation is recorded below, or a resumed update would skip operations
+    // whose data was lost.
     if (partition_writer_) {
-      partition_writer_->CheckpointUpdateProgress(GetPartitionOperationNum());
+      if (!partition_writer_->CheckpointUpdateProgress(
+              GetPartitionOperationNum())) {
+        LOG(ERROR) << "Failed to checkpoint the writes of partition "
+                   << partitions_[current_partition_].partition_name();
+        if (error != nullptr) {
+          *error = ErrorCode::kDownloadWriteError;
+        }
+        return false;
+      }
     } else {
       CHECK_EQ(next_operation_num_, num_total_operations_)
           << "Partition writer is null, we are expected to finish all "
@@ -20,6 +20,7 @@
 #include <inttypes.h>
 
 #include <limits>
+#include <map>
 #include <memory>
 #include <string>
 #include <utility>
@@ -137,6 +138,11 @@ class DeltaPerformer : public FileWriter {
       uint64_t full_length,
       std::string* positions_string);
 
+  // Returns the highest delta payload minor version this device can apply,
+  // which is lower than kMaxSupportedMinorPayloadVersion if its xz decoder
+  // lacks the ARM64 filter of kXzArm64MinorPayloadVersion payloads.
+  static uint32_t GetMaxSupportedMinorPayloadVersion();
+
   // Returns true if a previous update attempt can be continued based on the
   // persistent preferences and the new update check response hash.
   static bool CanResumeUpdate(PrefsInterface* prefs,
@@ -171,8 +177,10 @@ class DeltaPerformer : public FileWriter {
   // Checkpoints the update progress into persistent storage to allow this
   // update attempt to be resumed after reboot.
   // If |force| is false, checkpoint may be throttled.
+  // If |error| isn't null, it's set to kDownloadWriteError when the data of
+  // the applied operations couldn't be made durable.
   // Exposed for testing purposes.
-  bool CheckpointUpdateProgress(bool force);
+  bool CheckpointUpdateProgress(bool force, ErrorCode* error = nullptr);
 
   // Initialize partitions and allocate required space for an update with the
   // given |manifest|. |update_check_response_hash| is used to check if the
@@ -268,6 +276,16 @@ class DeltaPerformer : public FileWriter {
   bool PerformDiffOperation(const InstallOperation& operation,
                             ErrorCode* error);
 
+  // Adds the time since |start_time| and the bytes written by |operation| to
+  // the totals of its type in |op_throughput_|.
+  void RecordOperationThroughput(const InstallOperation& operation,
+                                 base::TimeTicks start_time);
+
+  // Logs the throughput of each type of operation applied by this instance,
+  // the data used to calibrate the device profiles of the install time
+  // estimator.
+  void LogOperationThroughput() const;
+
   // Extracts the payload signature message from the current |buffer_| if the
   // offset matches the one specified by the manifest. Returns whether the
   // signature was extracted.
@@ -424,6 +442,14 @@ class DeltaPerformer : public FileWriter {
 
   std::unique_ptr<PartitionWriterInterface> partition_writer_;
 
+  // The bytes written and time spent by the operations of each type, the same
+  // durations as the OP_DURATION_HISTOGRAM ones.
+  struct OperationThroughput {
+    uint64_t bytes{0};
+    base::TimeDelta duration;
+  };
+  std::map<InstallOperation::Type, OperationThroughput> op_throughput_;
+
   DISALLOW_COPY_AND_ASSIGN(DeltaPerformer);
 };
 
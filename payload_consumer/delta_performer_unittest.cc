@@ -53,6 +53,7 @@
 #include "update_engine/payload_consumer/mock_partition_writer.h"
 #include "update_engine/payload_consumer/payload_constants.h"
 #include "update_engine/payload_consumer/payload_metadata.h"
+#include "update_engine/payload_consumer/xz_extent_writer.h"
 #include "update_engine/payload_generator/bzip.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/payload_generator/payload_file.h"
@@ -195,7 +196,7 @@ class DeltaPerformerTest : public ::testing::Test {
                            aops,
                            sign_payload,
                            kMaxSupportedMajorPayloadVersion,
-                           kMaxSupportedMinorPayloadVersion,
+                           DeltaPerformer::GetMaxSupportedMinorPayloadVersion(),
                            old_part);
   }
 
@@ -700,7 +701,8 @@ TEST_F(DeltaPerformerTest, ValidateManifestDeltaMaxGoodTest) {
     part->mutable_old_partition_info();
     part->mutable_new_partition_info();
   }
-  manifest.set_minor_version(kMaxSupportedMinorPayloadVersion);
+  manifest.set_minor_version(
+      DeltaPerformer::GetMaxSupportedMinorPayloadVersion());
 
   RunManifestValidation(manifest,
                         kBrilloMajorPayloadVersion,
@@ -708,6 +710,29 @@ TEST_F(DeltaPerformerTest, ValidateManifestDeltaMaxGoodTest) {
                         ErrorCode::kSuccess);
 }
 
+TEST_F(DeltaPerformerTest, ValidateManifestXzArm64MinorVersionTest) {
+  // The Manifest we are validating.
+  DeltaArchiveManifest manifest;
+  for (const auto& part_name : {"kernel", "rootfs"}) {
+    auto part = manifest.add_partitions();
+    part->set_partition_name(part_name);
+    part->mutable_old_partition_info();
+    part->mutable_new_partition_info();
+  }
+  manifest.set_minor_version(kXzArm64MinorPayloadVersion);
+
+  // The payload may use the ARM64 filter, which only some xz decoders have.
+  RunManifestValidation(manifest,
+                        kBrilloMajorPayloadVersion,
+                        InstallPayloadType::kDelta,
+                        XzExtentWriter::Arm64FilterSupported()
+                            ? ErrorCode::kSuccess
+                            : ErrorCode::kUnsupportedMinorPayloadVersion);
+  EXPECT_EQ(XzExtentWriter::Arm64FilterSupported(),
+            DeltaPerformer::GetMaxSupportedMinorPayloadVersion() >=
+                kXzArm64MinorPayloadVersion);
+}
+
 TEST_F(DeltaPerformerTest, ValidateManifestDeltaMinGoodTest) {
   // The Manifest we are validating.
   DeltaArchiveManifest manifest;
@@ -1177,7 +1202,10 @@ TEST_F(DeltaPerformerTest, SetNextOpIndex) {
   std::vector<size_t> indices;
   EXPECT_CALL(writer1, CheckpointUpdateProgress(_))
       .WillRepeatedly(
-          [&indices](size_t index) mutable { indices.emplace_back(index); });
+          [&indices](size_t index) mutable {
+            indices.emplace_back(index);
+            return true;
+          });
   EXPECT_CALL(writer1, Init(_, true, _)).Times(1).WillOnce(Return(true));
   EXPECT_CALL(writer1, PerformSourceCopyOperation(_, _))
       .Times(2)
@@ -1198,4 +1226,62 @@ TEST_F(DeltaPerformerTest, SetNextOpIndex) {
   ASSERT_EQ(indices[indices.size() - 1], 2UL);
 }
 
+// Test that the update fails when the applied operations can't be made durable
+// at a checkpoint, rather than recording them as applied later.
+TEST_F(DeltaPerformerTest, CheckpointWriteFailureFailsUpdate) {
+  TestDeltaPerformer delta_performer{&prefs_,
+                                     &fake_boot_control_,
+                                     &fake_hardware_,
+                                     &mock_delegate_,
+                                     &install_plan_,
+                                     &payload_,
+                                     false};
+  brillo::Blob expected_data(std::begin(kRandomString),
+                             std::end(kRandomString));
+  expected_data.resize(4096 * 2);  // block size
+
+  ScopedTempFile source("Source-XXXXXX");
+  EXPECT_TRUE(test_utils::WriteFileVector(source.path(), expected_data));
+  ScopedTempFile target("Target-XXXXXX");
+  EXPECT_TRUE(test_utils::WriteFileVector(target.path(), {}));
+
+  PartitionConfig old_part(kPartitionNameRoot);
+  old_part.path = source.path();
+  old_part.size = expected_data.size();
+
+  delta_performer.partition_writers_[kPartitionNameRoot] =
+      std::make_unique<MockPartitionWriter>();
+  auto& writer1 = *delta_performer.partition_writers_[kPartitionNameRoot];
+  EXPECT_CALL(writer1, Init(_, true, _)).WillOnce(Return(true));
+  // The checkpoint made when the partition is opened succeeds, the one after
+  // the first operation fails.
+  EXPECT_CALL(writer1, CheckpointUpdateProgress(_))
+      .WillOnce(Return(true))
+      .WillRepeatedly(Return(false));
+  EXPECT_CALL(writer1, PerformSourceCopyOperation(_, _))
+      .Times(1)
+      .WillOnce(Return(true));
+
+  brillo::Blob payload_data = GeneratePayload(
+      brillo::Blob(),
+      {GetSourceCopyOp(0, 0, expected_data.data(), 4096),
+       GetSourceCopyOp(1, 1, expected_data.data() + 4096, 4096)},
+      false,
+      &old_part);
+  payload_.size = payload_data.size();
+  fake_boot_control_.SetPartitionDevice(
+      kPartitionNameRoot, install_plan_.target_slot, target.path());
+  fake_boot_control_.SetPartitionDevice(
+      kPartitionNameRoot, install_plan_.source_slot, source.path());
+  fake_boot_control_.SetPartitionDevice(
+      kPartitionNameKernel, install_plan_.target_slot, "/dev/null");
+  fake_boot_control_.SetPartitionDevice(
+      kPartitionNameKernel, install_plan_.source_slot, "/dev/null");
+
+  ErrorCode error = ErrorCode::kSuccess;
+  EXPECT_FALSE(delta_performer.Write(
+      payload_data.data(), payload_data.size(), &error));
+  EXPECT_EQ(ErrorCode::kDownloadWriteError, error);
+}
+
 }  // namespace chromeos_update_engine
@@ -19,6 +19,7 @@
 
 #include <functional>
 #include <map>
+#include <optional>
 #include <utility>
 #include <vector>
 
@@ -68,6 +69,24 @@ class ExtentMap {
     return {it->second};
   }
 
+  // Return the entry whose extent contains all of |extent|, which may be a
+  // smaller part of it. Returns an empty optional if no single extent in the
+  // map contains |extent|.
+  std::optional<T> GetContaining(const Extent& extent) const {
+    auto it = map_.upper_bound(
+        ExtentForRange(extent.start_block(), UINT64_MAX));
+    if (it == map_.begin()) {
+      return {};
+    }
+    --it;
+    const Extent& ext = it->first;
+    if (ext.start_block() + ext.num_blocks() <
+        extent.start_block() + extent.num_blocks()) {
+      return {};
+    }
+    return {it->second};
+  }
+
   // Return a set of extents that are contained in this extent map.
   // If |extent| is completely covered by this extent map, a vector of itself
   // will be returned.
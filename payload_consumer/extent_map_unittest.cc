@@ -148,4 +148,15 @@ TEST_F(ExtentMapTest, GetTouchingExtents) {
   ASSERT_EQ(extents[1], ExtentForRange(10, 5));
 }
 
+TEST_F(ExtentMapTest, GetContaining) {
+  ASSERT_TRUE(map_.AddExtent(ExtentForRange(5, 5), 7));
+  ASSERT_TRUE(map_.AddExtent(ExtentForRange(10, 5), 12));
+  ASSERT_EQ(map_.GetContaining(ExtentForRange(5, 5)), 7);
+  ASSERT_EQ(map_.GetContaining(ExtentForRange(6, 2)), 7);
+  ASSERT_EQ(map_.GetContaining(ExtentForRange(14, 1)), 12);
+  ASSERT_EQ(map_.GetContaining(ExtentForRange(0, 6)), std::nullopt);
+  ASSERT_EQ(map_.GetContaining(ExtentForRange(9, 2)), std::nullopt);
+  ASSERT_EQ(map_.GetContaining(ExtentForRange(14, 2)), std::nullopt);
+}
+
 }  // namespace chromeos_update_engine
@@ -103,6 +103,11 @@ class FileDescriptor {
   // Indicates whether the descriptor is currently open.
   virtual bool IsOpen() = 0;
 
+  // Returns the kernel file descriptor backing this descriptor, after writing
+  // any data it buffers, so that the kernel can copy data to or from it
+  // directly. Returns -1 if there's none.
+  virtual int GetRawFd() { return -1; }
+
  private:
   DISALLOW_COPY_AND_ASSIGN(FileDescriptor);
 };
@@ -128,6 +133,7 @@ class EintrSafeFileDescriptor : public FileDescriptor {
   bool Close() override;
   bool IsSettingErrno() override { return true; }
   bool IsOpen() override { return (fd_ >= 0); }
+  int GetRawFd() override { return fd_; }
 
  protected:
   int fd_;
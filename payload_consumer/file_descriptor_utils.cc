@@ -16,14 +16,21 @@
 
 #include "update_engine/payload_consumer/file_descriptor_utils.h"
 
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
 #include <algorithm>
 
 #include <base/logging.h>
+#include <base/posix/eintr_wrapper.h>
 
 #include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_consumer/extent_reader.h"
 #include "update_engine/payload_consumer/extent_writer.h"
+#include "update_engine/payload_consumer/payload_constants.h"
 
 using google::protobuf::RepeatedPtrField;
 using std::min;
@@ -35,6 +42,45 @@ namespace {
 // Size of the buffer used to copy blocks.
 const uint64_t kMaxCopyBufferSize = 1024 * 1024;
 
+bool IsRegularFile(int fd) {
+  struct stat stbuf;
+  return fstat(fd, &stbuf) == 0 && S_ISREG(stbuf.st_mode);
+}
+
+ssize_t CopyFileRange(
+    int fd_in, off64_t* off_in, int fd_out, off64_t* off_out, size_t len) {
+#ifdef __NR_copy_file_range
+  return syscall(__NR_copy_file_range, fd_in, off_in, fd_out, off_out, len, 0);
+#else
+  errno = ENOSYS;
+  return -1;
+#endif
+}
+
+// Copies |length| bytes from |src_offset| in |src_fd| to |tgt_offset| in
+// |tgt_fd| in the kernel.
+bool CopyRangeInKernel(int src_fd,
+                       off64_t src_offset,
+                       int tgt_fd,
+                       off64_t tgt_offset,
+                       uint64_t length) {
+  while (length > 0) {
+    const ssize_t copied = HANDLE_EINTR(CopyFileRange(
+        src_fd, &src_offset, tgt_fd, &tgt_offset, length));
+    if (copied <= 0) {
+      // These errors mean the kernel can't copy between these files, e.g.
+      // because they're block devices or on different filesystems.
+      if (copied < 0 && errno != EINVAL && errno != EXDEV &&
+          errno != ENOSYS && errno != EOPNOTSUPP && errno != EBADF) {
+        PLOG(WARNING) << "copy_file_range() failed";
+      }
+      return false;
+    }
+    length -= copied;
+  }
+  return true;
+}
+
 }  // namespace
 namespace fd_utils {
 
@@ -75,6 +121,59 @@ bool CommonHashExtents(FileDescriptorPtr source,
   return true;
 }
 
+bool CopyExtentsInKernel(FileDescriptorPtr source,
+                         const RepeatedPtrField<Extent>& src_extents,
+                         FileDescriptorPtr target,
+                         const RepeatedPtrField<Extent>& tgt_extents,
+                         uint64_t block_size) {
+  // copy_file_range() only copies between regular files. Check the source
+  // first, as getting the target descriptor may write out its cached data.
+  const int src_fd = source->GetRawFd();
+  if (src_fd < 0 || !IsRegularFile(src_fd)) {
+    return false;
+  }
+  const int tgt_fd = target->GetRawFd();
+  if (tgt_fd < 0 || !IsRegularFile(tgt_fd)) {
+    return false;
+  }
+  // Copy the blocks in runs contained in one source and one target extent.
+  int src_index = 0;
+  int tgt_index = 0;
+  uint64_t src_blocks_done = 0;
+  uint64_t tgt_blocks_done = 0;
+  while (src_index < src_extents.size() && tgt_index < tgt_extents.size()) {
+    const Extent& src_extent = src_extents[src_index];
+    const Extent& tgt_extent = tgt_extents[tgt_index];
+    if (src_extent.start_block() == kSparseHole) {
+      return false;
+    }
+    const uint64_t num_blocks =
+        min(src_extent.num_blocks() - src_blocks_done,
+            tgt_extent.num_blocks() - tgt_blocks_done);
+    // Nothing is written to the holes of the target.
+    if (num_blocks > 0 && tgt_extent.start_block() != kSparseHole &&
+        !CopyRangeInKernel(
+            src_fd,
+            (src_extent.start_block() + src_blocks_done) * block_size,
+            tgt_fd,
+            (tgt_extent.start_block() + tgt_blocks_done) * block_size,
+            num_blocks * block_size)) {
+      return false;
+    }
+    src_blocks_done += num_blocks;
+    tgt_blocks_done += num_blocks;
+    if (src_blocks_done == src_extent.num_blocks()) {
+      src_index++;
+      src_blocks_done = 0;
+    }
+    if (tgt_blocks_done == tgt_extent.num_blocks()) {
+      tgt_index++;
+      tgt_blocks_done = 0;
+    }
+  }
+  return true;
+}
+
 bool CopyAndHashExtents(FileDescriptorPtr source,
                         const RepeatedPtrField<Extent>& src_extents,
                         FileDescriptorPtr target,
@@ -85,6 +184,12 @@ bool CopyAndHashExtents(FileDescriptorPtr source,
   TEST_AND_RETURN_FALSE(writer.Init(tgt_extents, block_size));
   TEST_AND_RETURN_FALSE(utils::BlocksInExtents(src_extents) ==
                         utils::BlocksInExtents(tgt_extents));
+  // The data only needs to go through user space to be hashed.
+  if (hash_out == nullptr &&
+      CopyExtentsInKernel(
+          source, src_extents, target, tgt_extents, block_size)) {
+    return true;
+  }
   TEST_AND_RETURN_FALSE(
       CommonHashExtents(source, src_extents, &writer, block_size, hash_out));
   return true;
@@ -41,7 +41,8 @@ bool CommonHashExtents(
 // is passed as |block_size|. In case of error reading or writing, returns
 // false and the value pointed by |hash_out| is undefined.
 // The |source| and |target| files must be different, or otherwise |src_extents|
-// and |tgt_extents| must not overlap.
+// and |tgt_extents| must not overlap. If the hash isn't needed, the blocks are
+// copied in the kernel when possible.
 bool CopyAndHashExtents(
     FileDescriptorPtr source,
     const google::protobuf::RepeatedPtrField<Extent>& src_extents,
@@ -50,6 +51,17 @@ bool CopyAndHashExtents(
     uint64_t block_size,
     brillo::Blob* hash_out);
 
+// Copies the blocks of |src_extents| in |source| to |tgt_extents| in |target|
+// in the kernel, with copy_file_range(), without copying the data to user
+// space. Returns false if the kernel can't copy between the two files, in
+// which case some of the blocks may have been copied.
+bool CopyExtentsInKernel(
+    FileDescriptorPtr source,
+    const google::protobuf::RepeatedPtrField<Extent>& src_extents,
+    FileDescriptorPtr target,
+    const google::protobuf::RepeatedPtrField<Extent>& tgt_extents,
+    uint64_t block_size);
+
 // Reads blocks from |source| and calculates the hash. The blocks to read are
 // specified by |extents|. Stores the hash in |hash_out| if it is not null. The
 // block sizes are passed as |block_size|. In case of error reading, it returns
@@ -165,6 +165,30 @@ TEST_F(FileDescriptorUtilsTest, CopyAndHashExtentsManyToManyTest) {
   EXPECT_EQ(expected_hash, hash_out);
 }
 
+// Copying between two files without hashing lets the kernel copy the blocks,
+// which must give the same result as the copy through user space.
+TEST_F(FileDescriptorUtilsTest, CopyAndHashExtentsBetweenFilesTest) {
+  ScopedTempFile src_file("fd_src.XXXXXX");
+  ASSERT_TRUE(
+      test_utils::WriteFileString(src_file.path(), "00000001000200030004"));
+  FileDescriptorPtr source(new EintrSafeFileDescriptor());
+  ASSERT_TRUE(source->Open(src_file.path().c_str(), O_RDONLY));
+  auto src_extents = CreateExtentList({{1, 1}, {4, 1}, {2, 2}, {0, 1}});
+  auto tgt_extents = CreateExtentList({{2, 3}, {0, 2}});
+
+  EXPECT_TRUE(fd_utils::CopyAndHashExtents(
+      source, src_extents, target_, tgt_extents, 4, nullptr));
+  ExpectTarget("00030000000100040002");
+}
+
+// Descriptors without a kernel file descriptor can't be copied in the kernel.
+TEST_F(FileDescriptorUtilsTest, CopyExtentsInKernelWithoutRawFdTest) {
+  auto extents = CreateExtentList({{0, 5}});
+  EXPECT_FALSE(
+      fd_utils::CopyExtentsInKernel(source_, extents, target_, extents, 4));
+  EXPECT_TRUE(fake_source_->GetReadOps().empty());
+}
+
 // Failing to read from the source should fail the hash calculation.
 TEST_F(FileDescriptorUtilsTest, ReadAndHashExtentsReadFailureTest) {
   auto extents = CreateExtentList({{0, 5}});
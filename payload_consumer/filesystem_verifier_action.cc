@@ -18,24 +18,34 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <inttypes.h>
 #include <sys/stat.h>
+#include <sys/sysmacros.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include <algorithm>
+#include <cstdint>
 #include <cstdlib>
 #include <memory>
 #include <string>
 #include <utility>
 
 #include <base/bind.h>
+#include <base/files/file_enumerator.h>
+#include <base/files/file_path.h>
+#include <base/files/file_util.h>
+#include <base/strings/string_number_conversions.h>
+#include <base/strings/string_split.h>
 #include <base/strings/string_util.h>
+#include <base/strings/stringprintf.h>
 #include <brillo/data_encoding.h>
 #include <brillo/message_loops/message_loop.h>
 #include <brillo/secure_blob.h>
 #include <brillo/streams/file_stream.h>
 
 #include "common/error_code.h"
+#include "update_engine/common/constants.h"
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_consumer/file_descriptor.h"
 
@@ -78,6 +88,80 @@ namespace chromeos_update_engine {
 namespace {
 const off_t kReadFileBufferSize = 128 * 1024;
 constexpr float kVerityProgressPercent = 0.6;
+
+// Adds the number of sectors written to or discarded from the block device in
+// |sysfs_dir| and the devices it's built on since boot to |sectors|.
+bool AddSectorsWritten(const base::FilePath& sysfs_dir, uint64_t* sectors) {
+  string stat;
+  if (!base::ReadFileToString(sysfs_dir.Append("stat"), &stat)) {
+    return false;
+  }
+  // See Documentation/block/stat.rst in the kernel.
+  const auto fields = base::SplitString(
+      stat, " \n", base::TRIM_WHITESPACE, base::SPLIT_WANT_NONEMPTY);
+  uint64_t value = 0;
+  if (fields.size() < 7 || !base::StringToUint64(fields[6], &value)) {
+    return false;
+  }
+  *sectors += value;
+  if (fields.size() >= 14 && base::StringToUint64(fields[13], &value)) {
+    *sectors += value;
+  }
+  base::FileEnumerator slaves(
+      sysfs_dir.Append("slaves"), false, base::FileEnumerator::DIRECTORIES);
+  for (auto slave = slaves.Next(); !slave.empty(); slave = slaves.Next()) {
+    if (!AddSectorsWritten(slave, sectors)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Returns a description of the partition device |path| which changes whenever
+// the partition is written to, or an empty string if there's none. Regular
+// files are described by their status change time, which unlike their
+// modification time can't be set back by userspace.
+string GetPartitionWriteState(const string& path) {
+  struct stat stbuf;
+  if (path.empty() || stat(path.c_str(), &stbuf) != 0) {
+    return "";
+  }
+  if (S_ISREG(stbuf.st_mode)) {
+    return base::StringPrintf("file %ju %ju %jd %jd.%09ld",
+                              static_cast<uintmax_t>(stbuf.st_dev),
+                              static_cast<uintmax_t>(stbuf.st_ino),
+                              static_cast<intmax_t>(stbuf.st_size),
+                              static_cast<intmax_t>(stbuf.st_ctim.tv_sec),
+                              stbuf.st_ctim.tv_nsec);
+  }
+  if (!S_ISBLK(stbuf.st_mode)) {
+    return "";
+  }
+  // The write counters of the block devices start from 0 on every boot, and
+  // device mapper devices are created again when they're mapped.
+  string boot_id;
+  uint64_t sectors = 0;
+  const base::FilePath sysfs_dir(base::StringPrintf(
+      "/sys/dev/block/%u:%u", major(stbuf.st_rdev), minor(stbuf.st_rdev)));
+  if (!utils::GetBootId(&boot_id) || !AddSectorsWritten(sysfs_dir, &sectors)) {
+    return "";
+  }
+  return base::StringPrintf("block %s %u:%u %" PRIu64,
+                            boot_id.c_str(),
+                            major(stbuf.st_rdev),
+                            minor(stbuf.st_rdev),
+                            sectors);
+}
+
+// Returns the value recording that the partition |state| in |slot| had the
+// hash |hash|.
+string VerifiedPartitionValue(uint32_t slot,
+                              const brillo::Blob& hash,
+                              const string& state) {
+  return base::StringPrintf(
+      "%u %s %s", slot, HexEncode(hash).c_str(), state.c_str());
+}
+
 }  // namespace
 
 void FilesystemVerifierAction::PerformAction() {
@@ -326,8 +410,24 @@ void FilesystemVerifierAction::StartPartitionHashing() {
   const auto& part_path = GetPartitionPath();
   partition_size_ = GetPartitionSize();
 
+  if (IsPartitionVerified()) {
+    LOG(INFO) << "Skip hashing partition " << partition_index_ << " ("
+              << partition.name
+              << ") because it wasn't written to since it was verified.";
+    UpdatePartitionProgress(1.0);
+    partition_index_++;
+    StartPartitionHashing();
+    return;
+  }
+
   LOG(INFO) << "Hashing partition " << partition_index_ << " ("
             << partition.name << ") on device " << part_path;
+  // The state is taken before the first read, so that writes made while the
+  // partition is hashed aren't recorded as verified.
+  write_state_before_hashing_.clear();
+  if (prefs_ != nullptr && verifier_step_ == VerifierStep::kVerifyTargetHash) {
+    write_state_before_hashing_ = GetPartitionWriteState(part_path);
+  }
   auto success = false;
   if (IsVABC(partition)) {
     success = InitializeFdVABC(ShouldWriteVerity());
@@ -424,6 +524,48 @@ bool FilesystemVerifierAction::ShouldWriteVerity() {
          (partition.hash_tree_size > 0 || partition.fec_size > 0);
 }
 
+bool FilesystemVerifierAction::IsPartitionVerified() {
+  const InstallPlan::Partition& partition =
+      install_plan_.partitions[partition_index_];
+  // Writing verity changes the partition, so it's never skipped.
+  if (prefs_ == nullptr || verifier_step_ != VerifierStep::kVerifyTargetHash ||
+      ShouldWriteVerity() || partition.target_hash.empty()) {
+    return false;
+  }
+  string stored;
+  if (!prefs_->GetString(kPrefsVerifiedPartitionPrefix + partition.name,
+                         &stored)) {
+    return false;
+  }
+  const string state = GetPartitionWriteState(GetPartitionPath());
+  if (state.empty()) {
+    return false;
+  }
+  return stored == VerifiedPartitionValue(
+                       install_plan_.target_slot, partition.target_hash, state);
+}
+
+void FilesystemVerifierAction::StoreVerifiedPartition() {
+  if (prefs_ == nullptr) {
+    return;
+  }
+  const InstallPlan::Partition& partition =
+      install_plan_.partitions[partition_index_];
+  const string key = kPrefsVerifiedPartitionPrefix + partition.name;
+  // The partition was written to while it was hashed, e.g. with its verity
+  // data, so the hash doesn't describe its current state.
+  if (write_state_before_hashing_.empty() ||
+      GetPartitionWriteState(GetPartitionPath()) !=
+          write_state_before_hashing_) {
+    prefs_->Delete(key);
+    return;
+  }
+  prefs_->SetString(key,
+                    VerifiedPartitionValue(install_plan_.target_slot,
+                                           hasher_->raw_hash(),
+                                           write_state_before_hashing_));
+}
+
 void FilesystemVerifierAction::FinishPartitionHashing() {
   if (!hasher_->Finalize()) {
     LOG(ERROR) << "Unable to finalize the hash.";
@@ -451,6 +593,7 @@ void FilesystemVerifierAction::FinishPartitionHashing() {
         // source partition does not match either.
         verifier_step_ = VerifierStep::kVerifySourceHash;
       } else {
+        StoreVerifiedPartition();
         partition_index_++;
       }
       break;
@@ -29,6 +29,7 @@
 
 #include "update_engine/common/action.h"
 #include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/prefs_interface.h"
 #include "update_engine/common/scoped_task_id.h"
 #include "update_engine/payload_consumer/file_descriptor.h"
 #include "update_engine/payload_consumer/install_plan.h"
@@ -80,6 +81,12 @@ class FilesystemVerifierAction : public InstallPlanAction {
     return this->delegate_;
   }
 
+  // Stores the hashes of the verified target partitions in |prefs|, with the
+  // state of the partition devices. A later verification of the same data,
+  // e.g. by setShouldSwitchSlotOnReboot(), skips hashing the partitions which
+  // weren't written to since they were verified.
+  void set_prefs(PrefsInterface* prefs) { prefs_ = prefs; }
+
   // Debugging/logging
   static std::string StaticType() { return "FilesystemVerifierAction"; }
   std::string Type() const override { return StaticType(); }
@@ -97,6 +104,13 @@ class FilesystemVerifierAction : public InstallPlanAction {
 
   // Return true if we need to write verity bytes.
   bool ShouldWriteVerity();
+
+  // Returns whether the current target partition was verified before and
+  // wasn't written to since.
+  bool IsPartitionVerified();
+  // Records that the current target partition matches its hash.
+  void StoreVerifiedPartition();
+
   // Starts the hashing of the current partition. If there aren't any partitions
   // remaining to be hashed, it finishes the action.
   void StartPartitionHashing();
@@ -168,6 +182,12 @@ class FilesystemVerifierAction : public InstallPlanAction {
   // An observer that observes progress updates of this action.
   FilesystemVerifyDelegate* delegate_{};
 
+  // Where the verified partitions are recorded, if not null.
+  PrefsInterface* prefs_{nullptr};
+  // The write state of the target partition being hashed, taken before it
+  // was first read. Empty if it isn't recorded.
+  std::string write_state_before_hashing_;
+
   // Callback that should be cancelled on |TerminateProcessing|. Usually this
   // points to pending read callbacks from async stream.
   ScopedTaskId pending_task_id_;
@@ -16,6 +16,10 @@
 
 #include "update_engine/payload_consumer/filesystem_verifier_action.h"
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include <algorithm>
 #include <cstring>
 #include <memory>
@@ -32,7 +36,9 @@
 #include <libsnapshot/snapshot_writer.h>
 #include <sys/stat.h>
 
+#include "update_engine/common/constants.h"
 #include "update_engine/common/dynamic_partition_control_stub.h"
+#include "update_engine/common/fake_prefs.h"
 #include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/mock_dynamic_partition_control.h"
 #include "update_engine/common/test_utils.h"
@@ -198,6 +204,8 @@ class FilesystemVerifierActionTest : public ::testing::Test {
   static ScopedTempFile source_part_;
   static ScopedTempFile target_part_;
   InstallPlan install_plan_;
+  // The prefs of the verifier actions, if not null.
+  PrefsInterface* prefs_{nullptr};
 };
 
 ScopedTempFile FilesystemVerifierActionTest::source_part_{
@@ -349,6 +357,7 @@ void FilesystemVerifierActionTest::BuildActions(
   auto feeder_action = std::make_unique<ObjectFeederAction<InstallPlan>>();
   auto verifier_action =
       std::make_unique<FilesystemVerifierAction>(dynamic_control);
+  verifier_action->set_prefs(prefs_);
   auto collector_action =
       std::make_unique<ObjectCollectorAction<InstallPlan>>();
 
@@ -686,4 +695,101 @@ TEST_F(FilesystemVerifierActionTest, VABC_Verity_Target_Mismatch) {
   DoTestVABC(true, true);
 }
 
+TEST_F(FilesystemVerifierActionTest, ReuseVerifiedPartitionTest) {
+  ScopedTempFile part_file("part_file.XXXXXX");
+  brillo::Blob part_data(256 * BLOCK_SIZE);
+  test_utils::FillWithData(&part_data);
+  ASSERT_TRUE(test_utils::WriteFileVector(part_file.path(), part_data));
+
+  FakePrefs prefs;
+  prefs_ = &prefs;
+  install_plan_.write_verity = false;
+  InstallPlan::Partition part;
+  part.name = "part";
+  part.target_path = part_file.path();
+  part.target_size = part_data.size();
+  part.block_size = BLOCK_SIZE;
+  EXPECT_TRUE(HashCalculator::RawHashOfData(part_data, &part.target_hash));
+  install_plan_.partitions = {part};
+
+  auto run_verifier = [this]() {
+    BuildActions(install_plan_);
+    FilesystemVerifierActionTestDelegate delegate;
+    processor_.set_delegate(&delegate);
+    loop_.PostTask(
+        FROM_HERE,
+        base::Bind(
+            [](ActionProcessor* processor) { processor->StartProcessing(); },
+            base::Unretained(&processor_)));
+    loop_.Run();
+    EXPECT_FALSE(processor_.IsRunning());
+    EXPECT_TRUE(delegate.ran());
+    return delegate.code();
+  };
+  const string key = string(kPrefsVerifiedPartitionPrefix) + "part";
+  ASSERT_EQ(ErrorCode::kSuccess, run_verifier());
+  ASSERT_TRUE(prefs.Exists(key));
+  string verified;
+  ASSERT_TRUE(prefs.GetString(key, &verified));
+
+  // The partition wasn't written to, so the same state is recorded again.
+  ASSERT_EQ(ErrorCode::kSuccess, run_verifier());
+  string reverified;
+  ASSERT_TRUE(prefs.GetString(key, &reverified));
+  EXPECT_EQ(verified, reverified);
+
+  // Change the data and set its modification time back. The status change
+  // time has the resolution of the kernel's coarse clock, so let it move on
+  // first. The change is still noticed and the partition hashed again.
+  usleep(20 * 1000);
+  struct stat stbuf;
+  ASSERT_EQ(0, stat(part_file.path().c_str(), &stbuf));
+  brillo::Blob other_data = part_data;
+  other_data[BLOCK_SIZE + 10] ^= 0xff;
+  ASSERT_TRUE(test_utils::WriteFileVector(part_file.path(), other_data));
+  const struct timespec times[2] = {stbuf.st_atim, stbuf.st_mtim};
+  ASSERT_EQ(0, utimensat(AT_FDCWD, part_file.path().c_str(), times, 0));
+  ASSERT_EQ(ErrorCode::kNewRootfsVerificationError, run_verifier());
+}
+
+// Test that a partition written to while it's hashed isn't recorded as
+// verified, even if its hash matches.
+TEST_F(FilesystemVerifierActionTest, WriteWhileHashingNotRecordedTest) {
+  ScopedTempFile part_file("part_file.XXXXXX");
+  brillo::Blob part_data(256 * BLOCK_SIZE);
+  test_utils::FillWithData(&part_data);
+  ASSERT_TRUE(test_utils::WriteFileVector(part_file.path(), part_data));
+
+  FakePrefs prefs;
+  prefs_ = &prefs;
+  install_plan_.write_verity = false;
+  InstallPlan::Partition part;
+  part.name = "part";
+  part.target_path = part_file.path();
+  part.target_size = part_data.size();
+  part.block_size = BLOCK_SIZE;
+  EXPECT_TRUE(HashCalculator::RawHashOfData(part_data, &part.target_hash));
+  install_plan_.partitions = {part};
+
+  BuildActions(install_plan_);
+  FilesystemVerifierActionTestDelegate delegate;
+  processor_.set_delegate(&delegate);
+  // The first buffer is read when the processing starts, the rest of the
+  // partition is read after the file grows past the hashed size.
+  loop_.PostTask(
+      FROM_HERE,
+      base::Bind(
+          [](ActionProcessor* processor, const string& path, off_t size) {
+            processor->StartProcessing();
+            ASSERT_EQ(0, truncate(path.c_str(), size));
+          },
+          base::Unretained(&processor_),
+          part_file.path(),
+          static_cast<off_t>(part_data.size() + BLOCK_SIZE)));
+  loop_.Run();
+  EXPECT_TRUE(delegate.ran());
+  EXPECT_EQ(ErrorCode::kSuccess, delegate.code());
+  EXPECT_FALSE(prefs.Exists(string(kPrefsVerifiedPartitionPrefix) + "part"));
+}
+
 }  // namespace chromeos_update_engine
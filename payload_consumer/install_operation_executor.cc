@@ -229,6 +229,19 @@ bool InstallOperationExecutor::ExecuteSourceCopyOperation(
       source_fd, operation.src_extents(), writer.get(), block_size_, nullptr);
 }
 
+bool InstallOperationExecutor::ExecuteSourceCopyOperation(
+    const InstallOperation& operation,
+    FileDescriptorPtr target_fd,
+    FileDescriptorPtr source_fd) {
+  TEST_AND_RETURN_FALSE(operation.type() == InstallOperation::SOURCE_COPY);
+  return fd_utils::CopyAndHashExtents(source_fd,
+                                      operation.src_extents(),
+                                      target_fd,
+                                      operation.dst_extents(),
+                                      block_size_,
+                                      nullptr);
+}
+
 bool InstallOperationExecutor::ExecuteDiffOperation(
     const InstallOperation& operation,
     std::unique_ptr<ExtentWriter> writer,
@@ -39,6 +39,11 @@ class InstallOperationExecutor {
   bool ExecuteSourceCopyOperation(const InstallOperation& operation,
                                   std::unique_ptr<ExtentWriter> writer,
                                   FileDescriptorPtr source_fd);
+  // Copies the source blocks straight to |target_fd|, in the kernel when
+  // both descriptors support it.
+  bool ExecuteSourceCopyOperation(const InstallOperation& operation,
+                                  FileDescriptorPtr target_fd,
+                                  FileDescriptorPtr source_fd);
 
   bool ExecuteDiffOperation(const InstallOperation& operation,
                             std::unique_ptr<ExtentWriter> writer,
@@ -104,6 +104,7 @@ string InstallPlan::ToString() const {
           {"rollback_data_save_requested",
            utils::ToString(rollback_data_save_requested)},
           {"write_verity", utils::ToString(write_verity)},
+          {"write_cache_size", base::NumberToString(write_cache_size)},
       },
       "\n"));
 
@@ -187,6 +187,10 @@ struct InstallPlan {
   // False otherwise.
   bool write_verity{true};
 
+  // The size of the cache for the writes to each target partition, in bytes.
+  // If 0, it's picked from the queue limits of the target block device.
+  uint64_t write_cache_size{0};
+
   // If not blank, a base-64 encoded representation of the PEM-encoded
   // public key in the response.
   std::string public_key_rsa;
@@ -18,16 +18,18 @@
 #include <fcntl.h>
 #include <linux/fs.h>
 #include <sys/mman.h>
+#include <unistd.h>
 
 #include <inttypes.h>
 
 #include <algorithm>
-#include <initializer_list>
 #include <memory>
 #include <string>
+#include <thread>
 #include <utility>
 #include <vector>
 
+#include <base/posix/eintr_wrapper.h>
 #include <base/strings/string_number_conversions.h>
 #include <base/strings/string_util.h>
 #include <base/strings/stringprintf.h>
@@ -44,53 +46,112 @@
 #include "update_engine/payload_consumer/mount_history.h"
 #include "update_engine/payload_consumer/payload_constants.h"
 #include "update_engine/payload_consumer/xz_extent_writer.h"
+#include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/payload_generator/extent_utils.h"
 
 namespace chromeos_update_engine {
 
 namespace {
-constexpr uint64_t kCacheSize = 1024 * 1024;  // 1MB
 
-// Discard the tail of the block device referenced by |fd|, from the offset
-// |data_size| until the end of the block device. Returns whether the data was
-// discarded.
+// The largest range discarded by a single ioctl, so that cancelling the
+// discards doesn't have to wait for a whole partition to be discarded.
+constexpr uint64_t kMaxDiscardBytes = 64 * 1024 * 1024;
 
-bool DiscardPartitionTail(const FileDescriptorPtr& fd, uint64_t data_size) {
-  uint64_t part_size = fd->BlockDevSize();
-  if (!part_size || part_size <= data_size)
-    return false;
+struct BlkIoctlRequest {
+  int number;
+  const char* name;
+};
 
-  struct blkioctl_request {
-    int number;
-    const char* name;
-  };
-  const std::initializer_list<blkioctl_request> blkioctl_requests = {
-      {BLKDISCARD, "BLKDISCARD"},
-      {BLKSECDISCARD, "BLKSECDISCARD"},
-#ifdef BLKZEROOUT
-      {BLKZEROOUT, "BLKZEROOUT"},
-#endif
-  };
-  for (const auto& req : blkioctl_requests) {
-    int error = 0;
-    if (fd->BlkIoctl(req.number, data_size, part_size - data_size, &error) &&
-        error == 0) {
-      return true;
+// The ioctls tried to discard data, in order of preference. BLKZEROOUT isn't
+// one of them: writing zeros over every unwritten block would cost as much
+// I/O as the update itself, for blocks that only hold stale data.
+const BlkIoctlRequest kDiscardRequests[] = {
+    {BLKDISCARD, "BLKDISCARD"},
+    {BLKSECDISCARD, "BLKSECDISCARD"},
+};
+
+}  // namespace
+
+namespace partition_writer {
+
+std::vector<Extent> GetUnwrittenExtents(const PartitionUpdate& partition,
+                                        uint64_t num_blocks) {
+  if (num_blocks == 0) {
+    return {};
+  }
+  ExtentRanges unwritten;
+  unwritten.AddExtent(ExtentForRange(0, num_blocks));
+  for (const InstallOperation& op : partition.operations()) {
+    for (const Extent& extent : op.dst_extents()) {
+      if (extent.start_block() != kSparseHole) {
+        unwritten.SubtractExtent(extent);
+      }
     }
-    LOG(WARNING) << "Error discarding the last "
-                 << (part_size - data_size) / 1024 << " KiB using ioctl("
-                 << req.name << ")";
   }
-  return false;
+  // The verity data is written by the FilesystemVerifierAction once all the
+  // operations are done.
+  if (partition.has_hash_tree_extent()) {
+    unwritten.SubtractExtent(partition.hash_tree_extent());
+  }
+  if (partition.has_fec_extent()) {
+    unwritten.SubtractExtent(partition.fec_extent());
+  }
+  return unwritten.GetExtentsForBlockCount(unwritten.blocks());
 }
 
-}  // namespace
+bool DiscardExtents(FileDescriptorPtr fd,
+                    const std::vector<Extent>& extents,
+                    uint64_t block_size,
+                    const std::atomic<bool>& cancel) {
+  // The first range probes the ioctls the device supports, the other ranges
+  // only use the one that worked.
+  const BlkIoctlRequest* request = nullptr;
+  for (const Extent& extent : extents) {
+    const uint64_t end = (extent.start_block() + extent.num_blocks()) *
+                         block_size;
+    for (uint64_t start = extent.start_block() * block_size; start < end;) {
+      if (cancel) {
+        return false;
+      }
+      const uint64_t length = std::min(end - start, kMaxDiscardBytes);
+      int error = 0;
+      if (request) {
+        if (!fd->BlkIoctl(request->number, start, length, &error) ||
+            error != 0) {
+          LOG(WARNING) << "Error discarding " << length / 1024
+                       << " KiB at offset " << start << " using ioctl("
+                       << request->name << ")";
+          return false;
+        }
+      } else {
+        for (const BlkIoctlRequest& candidate : kDiscardRequests) {
+          if (fd->BlkIoctl(candidate.number, start, length, &error) &&
+              error == 0) {
+            request = &candidate;
+            break;
+          }
+          LOG(WARNING) << "Error discarding " << length / 1024
+                       << " KiB at offset " << start << " using ioctl("
+                       << candidate.name << ")";
+        }
+        if (!request) {
+          return false;
+        }
+      }
+      start += length;
+    }
+  }
+  return true;
+}
 
-// Opens path for read/write. On success returns an open FileDescriptor
-// and sets *err to 0. On failure, sets *err to errno and returns nullptr.
+}  // namespace partition_writer
+
+// Opens path for read/write. If |cache_size| isn't 0, up to |cache_size| bytes
+// of writes are cached. On success returns an open FileDescriptor and sets
+// *err to 0. On failure, sets *err to errno and returns nullptr.
 FileDescriptorPtr OpenFile(const char* path,
                            int mode,
-                           bool cache_writes,
+                           size_t cache_size,
                            int* err) {
   // Try to mark the block device read-only based on the mode. Ignore any
   // failure since this won't work when passing regular files.
@@ -98,9 +159,9 @@ FileDescriptorPtr OpenFile(const char* path,
   utils::SetBlockDeviceReadOnly(path, read_only);
 
   FileDescriptorPtr fd(new EintrSafeFileDescriptor());
-  if (cache_writes && !read_only) {
-    fd = FileDescriptorPtr(new CachedFileDescriptor(fd, kCacheSize));
-    LOG(INFO) << "Caching writes.";
+  if (cache_size > 0 && !read_only) {
+    fd = FileDescriptorPtr(new CachedFileDescriptor(fd, cache_size));
+    LOG(INFO) << "Caching up to " << cache_size / 1024 << " KiB of writes.";
   }
   if (!fd->Open(path, mode, 000)) {
     *err = errno;
@@ -162,14 +223,18 @@ bool PartitionWriter::Init(const InstallPlan* install_plan,
   target_path_ = install_part_.target_path;
   int err;
 
-  int flags = O_RDWR;
-  if (!interactive_)
-    flags |= O_DSYNC;
-
-  LOG(INFO) << "Opening " << target_path_ << " partition with"
-            << (interactive_ ? "out" : "") << " O_DSYNC";
-
-  target_fd_ = OpenFile(target_path_.c_str(), flags, true, &err);
+  // The target isn't opened with O_DSYNC, which would block every write until
+  // it reaches the storage. Instead, the writes are made durable in batches by
+  // CheckpointUpdateProgress(), before the progress is recorded.
+  LOG(INFO) << "Opening " << target_path_ << " partition for "
+            << (interactive_ ? "an interactive" : "a background") << " update";
+
+  // The cache should hold several of the largest requests the device takes,
+  // so that scattered writes reach it in large sequential requests.
+  const size_t cache_size = install_plan->write_cache_size > 0
+                                ? install_plan->write_cache_size
+                                : GetWriteCacheSize(target_path_);
+  target_fd_ = OpenFile(target_path_.c_str(), O_RDWR, cache_size, &err);
   if (!target_fd_) {
     LOG(ERROR) << "Unable to open target partition "
                << partition.partition_name() << " on slot "
@@ -182,12 +247,49 @@ bool PartitionWriter::Init(const InstallPlan* install_plan,
             << " operations to partition \"" << partition.partition_name()
             << "\"";
 
-  // Discard the end of the partition, but ignore failures.
-  DiscardPartitionTail(target_fd_, install_part_.target_size);
+  // The blocks written by a previous attempt may be resumed from, so only
+  // discard the blocks nothing writes when starting a partition.
+  if (next_op_index == 0) {
+    StartDiscardingUnwrittenBlocks();
+  }
 
   return true;
 }
 
+void PartitionWriter::StartDiscardingUnwrittenBlocks() {
+  // The discards use their own descriptor, so that they don't flush the cache
+  // of |target_fd_| or wait for its writes. No operation writes the blocks
+  // they discard, and the verity data is only written after Close().
+  FileDescriptorPtr fd(new EintrSafeFileDescriptor());
+  if (!fd->Open(target_path_.c_str(), O_RDWR)) {
+    PLOG(WARNING) << "Unable to open " << target_path_ << " to discard it";
+    return;
+  }
+  const uint64_t num_blocks = fd->BlockDevSize() / block_size_;
+  std::vector<Extent> extents =
+      partition_writer::GetUnwrittenExtents(partition_update_, num_blocks);
+  if (extents.empty()) {
+    fd->Close();
+    return;
+  }
+  LOG(INFO) << "Discarding " << utils::BlocksInExtents(extents)
+            << " blocks not written by the update in " << extents.size()
+            << " ranges";
+  cancel_discard_ = false;
+  // Failures are ignored, the blocks only hold stale data.
+  discard_thread_ = std::thread([this, fd, extents = std::move(extents)]() {
+    partition_writer::DiscardExtents(fd, extents, block_size_, cancel_discard_);
+    fd->Close();
+  });
+}
+
+void PartitionWriter::StopDiscardingUnwrittenBlocks(bool cancel) {
+  if (discard_thread_.joinable()) {
+    cancel_discard_ = cancel;
+    discard_thread_.join();
+  }
+}
+
 bool PartitionWriter::PerformReplaceOperation(const InstallOperation& operation,
                                               const void* data,
                                               size_t count) {
@@ -248,9 +350,10 @@ bool PartitionWriter::PerformSourceCopyOperation(
     return false;
   }
 
-  auto writer = CreateBaseExtentWriter();
+  // Nothing needs to be done with the data on the way, so let the kernel copy
+  // it when it can.
   return install_op_executor_.ExecuteSourceCopyOperation(
-      optimized, std::move(writer), source_fd);
+      optimized, target_fd_, source_fd);
 }
 
 bool PartitionWriter::PerformDiffOperation(const InstallOperation& operation,
@@ -273,6 +376,8 @@ FileDescriptorPtr PartitionWriter::ChooseSourceFD(
 int PartitionWriter::Close() {
   int err = 0;
 
+  StopDiscardingUnwrittenBlocks(true);
+
   source_path_.clear();
 
   if (target_fd_ && !target_fd_->Close()) {
@@ -287,8 +392,44 @@ int PartitionWriter::Close() {
   return -err;
 }
 
-void PartitionWriter::CheckpointUpdateProgress(size_t next_op_index) {
-  target_fd_->Flush();
+bool PartitionWriter::CheckpointUpdateProgress(size_t next_op_index) {
+  // Writes the cached data and waits for everything written so far to reach
+  // the storage, so that the operations before |next_op_index| are durable
+  // when DeltaPerformer records them as applied.
+  TEST_AND_RETURN_FALSE(target_fd_ != nullptr);
+  if (!SyncTarget()) {
+    LOG(ERROR) << "Failed to sync the target partition before operation "
+               << next_op_index;
+    return false;
+  }
+  return true;
+}
+
+bool PartitionWriter::FinishedInstallOps() {
+  StopDiscardingUnwrittenBlocks(false);
+  // Later checkpoints only flush the partition being written, so the last
+  // operations of this partition must be durable before moving on.
+  if (target_fd_ && !SyncTarget()) {
+    LOG(ERROR) << "Failed to sync the target partition";
+    return false;
+  }
+  return true;
+}
+
+bool PartitionWriter::SyncTarget() {
+  // Getting the kernel fd writes the cached data.
+  const int fd = target_fd_->GetRawFd();
+  if (fd < 0) {
+    return target_fd_->Flush();
+  }
+  // Only the data and the metadata needed to read it back are synced, the
+  // target partitions are block devices or preallocated files. Files that
+  // don't support synchronization, like /dev/null, have nothing to sync.
+  if (HANDLE_EINTR(fdatasync(fd)) != 0 && errno != EINVAL && errno != EROFS) {
+    PLOG(ERROR) << "Failed to sync " << target_path_;
+    return false;
+  }
+  return true;
 }
 
 std::unique_ptr<ExtentWriter> PartitionWriter::CreateBaseExtentWriter() {
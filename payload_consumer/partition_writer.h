@@ -17,9 +17,12 @@
 #ifndef UPDATE_ENGINE_PARTITION_WRITER_H_
 #define UPDATE_ENGINE_PARTITION_WRITER_H_
 
+#include <atomic>
 #include <cstdint>
 #include <memory>
 #include <string>
+#include <thread>
+#include <vector>
 
 #include <brillo/secure_blob.h>
 #include <gtest/gtest_prod.h>
@@ -62,7 +65,7 @@ class PartitionWriter : public PartitionWriterInterface {
   // applied.
   //   |next_op_index| is index of next operation that should be applied.
   // |next_op_index-1| is the last operation that is already applied.
-  void CheckpointUpdateProgress(size_t next_op_index) override;
+  [[nodiscard]] bool CheckpointUpdateProgress(size_t next_op_index) override;
 
   // Close partition writer, when calling this function there's no guarantee
   // that all |InstallOperations| are sent to |PartitionWriter|. This function
@@ -88,7 +91,7 @@ class PartitionWriter : public PartitionWriterInterface {
   // |DeltaPerformer| calls this when all Install Ops are sent to partition
   // writer. No |Perform*Operation| methods will be called in the future, and
   // the partition writer is expected to be closed soon.
-  [[nodiscard]] bool FinishedInstallOps() override { return true; }
+  [[nodiscard]] bool FinishedInstallOps() override;
 
  private:
   friend class PartitionWriterTest;
@@ -101,6 +104,17 @@ class PartitionWriter : public PartitionWriterInterface {
 
   [[nodiscard]] std::unique_ptr<ExtentWriter> CreateBaseExtentWriter();
 
+  // Writes the data cached for the target partition and waits for everything
+  // written to it to reach the storage. Returns false if that fails.
+  [[nodiscard]] bool SyncTarget();
+
+  // Discards the blocks of the target partition that no operation writes, in
+  // a background thread.
+  void StartDiscardingUnwrittenBlocks();
+  // Waits for the discards to finish, or stops them at the next range if
+  // |cancel| is true.
+  void StopDiscardingUnwrittenBlocks(bool cancel);
+
   const PartitionUpdate& partition_update_;
   const InstallPlan::Partition& install_part_;
   DynamicPartitionControlInterface* dynamic_control_;
@@ -117,9 +131,27 @@ class PartitionWriter : public PartitionWriterInterface {
   // constructing data which should be written to target partition, actual
   // "writing" is handled by |PartitionWriter|
   InstallOperationExecutor install_op_executor_;
+
+  std::thread discard_thread_;
+  std::atomic<bool> cancel_discard_{false};
 };
 
 namespace partition_writer {
+// Returns the extents of a target partition of |num_blocks| blocks that none
+// of the operations of |partition| write and that don't hold its hash tree or
+// FEC data, in order.
+std::vector<Extent> GetUnwrittenExtents(const PartitionUpdate& partition,
+                                        uint64_t num_blocks);
+
+// Discards the |extents| of the block device |fd|, in ranges of up to 64 MiB,
+// until |cancel| is set. The first range finds the first of BLKDISCARD and
+// BLKSECDISCARD that the device supports, which is then used for the other
+// ranges. Returns whether all the extents were discarded.
+bool DiscardExtents(FileDescriptorPtr fd,
+                    const std::vector<Extent>& extents,
+                    uint64_t block_size,
+                    const std::atomic<bool>& cancel);
+
 // Return a PartitionWriter instance for perform InstallOps on this partition.
 // Uses VABCPartitionWriter for Virtual AB Compression
 std::unique_ptr<PartitionWriterInterface> CreatePartitionWriter(
@@ -45,7 +45,10 @@ class PartitionWriterInterface {
   // applied.
   //   |next_op_index| is index of next operation that should be applied.
   // |next_op_index-1| is the last operation that is already applied.
-  virtual void CheckpointUpdateProgress(size_t next_op_index) = 0;
+  // The data written by the applied operations must be durable when this
+  // returns true.
+  [[nodiscard]] virtual bool CheckpointUpdateProgress(
+      size_t next_op_index) = 0;
 
   // Close partition writer, when calling this function there's no guarantee
   // that all |InstallOperations| are sent to |PartitionWriter|. This function
@@ -14,7 +14,14 @@
 // limitations under the License.
 //
 
+#include <fcntl.h>
+#include <linux/fs.h>
+
+#include <algorithm>
+#include <atomic>
 #include <memory>
+#include <string>
+#include <utility>
 #include <vector>
 
 #include <brillo/secure_blob.h>
@@ -26,6 +33,7 @@
 #include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/test_utils.h"
 #include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/cached_file_descriptor.h"
 #include "update_engine/payload_consumer/delta_performer.h"
 #include "update_engine/payload_consumer/extent_reader.h"
 #include "update_engine/payload_consumer/extent_writer.h"
@@ -35,12 +43,72 @@
 #include "update_engine/payload_generator/annotated_operation.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
 #include "update_engine/payload_generator/extent_ranges.h"
+#include "update_engine/payload_generator/extent_utils.h"
 #include "update_engine/payload_generator/payload_file.h"
 #include "update_engine/payload_generator/payload_generation_config.h"
 #include "update_engine/update_metadata.pb.h"
 
 namespace chromeos_update_engine {
 
+namespace {
+// A writable file descriptor which discards the data and records the writes
+// and flushes it receives, in order.
+class RecordingFileDescriptor : public FileDescriptor {
+ public:
+  RecordingFileDescriptor() = default;
+
+  bool Open(const char* path, int flags, mode_t mode) override { return true; }
+  bool Open(const char* path, int flags) override { return true; }
+  ssize_t Read(void* buf, size_t count) override { return 0; }
+  ssize_t Write(const void* buf, size_t count) override {
+    events_.push_back("write " + std::to_string(offset_) + " " +
+                      std::to_string(count));
+    offset_ += count;
+    return count;
+  }
+  off64_t Seek(off64_t offset, int whence) override {
+    EXPECT_EQ(SEEK_SET, whence);
+    offset_ = offset;
+    return offset_;
+  }
+  uint64_t BlockDevSize() override { return 0; }
+  bool BlkIoctl(int request,
+                uint64_t start,
+                uint64_t length,
+                int* result) override {
+    events_.push_back("ioctl " + std::to_string(request) + " " +
+                      std::to_string(start) + " " + std::to_string(length));
+    *result = 0;
+    return request == supported_ioctl_;
+  }
+  bool Flush() override {
+    events_.push_back("flush");
+    return flush_result_;
+  }
+  bool Close() override { return true; }
+  bool IsSettingErrno() override { return false; }
+  bool IsOpen() override { return true; }
+
+  // Returns and forgets the writes and flushes received so far.
+  std::vector<std::string> TakeEvents() {
+    std::vector<std::string> events;
+    events.swap(events_);
+    return events;
+  }
+
+  void set_flush_result(bool result) { flush_result_ = result; }
+  void set_supported_ioctl(int request) { supported_ioctl_ = request; }
+
+ private:
+  off64_t offset_{0};
+  bool flush_result_{true};
+  int supported_ioctl_{-1};
+  std::vector<std::string> events_;
+
+  DISALLOW_COPY_AND_ASSIGN(RecordingFileDescriptor);
+};
+}  // namespace
+
 class PartitionWriterTest : public testing::Test {
  public:
   // Helper function to pretend that the ECC file descriptor was already opened.
@@ -57,6 +125,12 @@ class PartitionWriterTest : public testing::Test {
     return ret;
   }
 
+  // Makes the writer write the target partition to |fd|, through a cache of
+  // |cache_size| bytes like the real target.
+  void SetTargetFd(FileDescriptorPtr fd, size_t cache_size) {
+    writer_.target_fd_ = std::make_shared<CachedFileDescriptor>(fd, cache_size);
+  }
+
   uint64_t GetSourceEccRecoveredFailures() const {
     return writer_.verified_source_fd_.source_ecc_recovered_failures_;
   }
@@ -108,7 +182,7 @@ class PartitionWriterTest : public testing::Test {
       return {};
     }
     EXPECT_TRUE(writer_.PerformSourceCopyOperation(op, &error));
-    writer_.CheckpointUpdateProgress(1);
+    EXPECT_TRUE(writer_.CheckpointUpdateProgress(1));
 
     brillo::Blob output_data;
     EXPECT_TRUE(utils::ReadFile(target_partition.path(), &output_data));
@@ -211,12 +285,269 @@ TEST_F(PartitionWriterTest, ChooseSourceFDTest) {
   op.set_src_sha256_hash(src_hash.data(), src_hash.size());
 
   ErrorCode error = ErrorCode::kSuccess;
-  ASSERT_EQ(writer_.verified_source_fd_.source_ecc_fd_,
-            writer_.ChooseSourceFD(op, &error));
+  FileDescriptorPtr fd = writer_.ChooseSourceFD(op, &error);
+  ASSERT_NE(nullptr, fd);
   ASSERT_EQ(ErrorCode::kSuccess, error);
   // Verify that the fake_fec was actually used.
   ASSERT_EQ(1U, fake_fec->GetReadOps().size());
   ASSERT_EQ(1U, GetSourceEccRecoveredFailures());
+
+  brillo::Blob data(kSourceSize);
+  ssize_t bytes_read = 0;
+  ASSERT_TRUE(utils::ReadAll(fd, data.data(), data.size(), 0, &bytes_read));
+  ASSERT_EQ(static_cast<ssize_t>(kSourceSize), bytes_read);
+  EXPECT_EQ(expected_data, data);
+}
+
+// Test that only the corrupted blocks of an operation are read through the
+// error-corrected file descriptor.
+TEST_F(PartitionWriterTest, ChooseSourceFDCorrectsCorruptedBlocksTest) {
+  constexpr size_t kSourceSize = 4 * 4096;
+  ScopedTempFile source("Source-XXXXXX");
+  brillo::Blob expected_data = FakeFileDescriptorData(kSourceSize);
+  // Flip a bit in the third block.
+  brillo::Blob corrupted_data = expected_data;
+  corrupted_data[2 * 4096 + 10] ^= 1;
+  ASSERT_TRUE(test_utils::WriteFileVector(source.path(), corrupted_data));
+
+  writer_.verified_source_fd_.source_fd_ =
+      std::make_shared<EintrSafeFileDescriptor>();
+  writer_.verified_source_fd_.source_fd_->Open(source.path().c_str(), O_RDONLY);
+  FakeFileDescriptor* fake_fec = SetFakeECCFile(kSourceSize);
+
+  InstallOperation op;
+  *(op.add_src_extents()) = ExtentForRange(2, 2);
+  *(op.add_src_extents()) = ExtentForRange(0, 2);
+  HashCalculator hasher;
+  ASSERT_TRUE(hasher.Update(expected_data.data() + 2 * 4096, 2 * 4096));
+  ASSERT_TRUE(hasher.Update(expected_data.data(), 2 * 4096));
+  ASSERT_TRUE(hasher.Finalize());
+  op.set_src_sha256_hash(hasher.raw_hash().data(), hasher.raw_hash().size());
+
+  ErrorCode error = ErrorCode::kSuccess;
+  FileDescriptorPtr fd = writer_.ChooseSourceFD(op, &error);
+  ASSERT_NE(nullptr, fd);
+  EXPECT_NE(writer_.verified_source_fd_.source_ecc_fd_, fd);
+  EXPECT_EQ(1U, GetSourceEccRecoveredFailures());
+  const size_t ecc_reads = fake_fec->GetReadOps().size();
+
+  // Reads across the corrected block return the corrected data, without
+  // reading the error-corrected file descriptor again.
+  brillo::Blob data(kSourceSize - 100);
+  ssize_t bytes_read = 0;
+  ASSERT_TRUE(utils::ReadAll(fd, data.data(), data.size(), 50, &bytes_read));
+  ASSERT_EQ(static_cast<ssize_t>(data.size()), bytes_read);
+  EXPECT_EQ(brillo::Blob(expected_data.begin() + 50, expected_data.end() - 50),
+            data);
+  EXPECT_EQ(ecc_reads, fake_fec->GetReadOps().size());
+}
+
+// Test that the corrected blocks which can't be read from the raw device are
+// served from memory, while the other blocks are still read from it.
+TEST_F(PartitionWriterTest, ChooseSourceFDUnreadableBlockTest) {
+  constexpr size_t kSourceSize = 4 * 4096;
+  brillo::Blob expected_data = FakeFileDescriptorData(kSourceSize);
+  auto fake_source = std::make_shared<FakeFileDescriptor>();
+  fake_source->Open("", 0);
+  fake_source->SetFileSize(kSourceSize);
+  // The third block can't be read from the raw device.
+  fake_source->AddFailureRange(2 * 4096, 4096);
+  writer_.verified_source_fd_.source_fd_ = fake_source;
+  FakeFileDescriptor* fake_fec = SetFakeECCFile(kSourceSize);
+
+  InstallOperation op;
+  *(op.add_src_extents()) = ExtentForRange(2, 1);
+  *(op.add_src_extents()) = ExtentForRange(0, 2);
+  *(op.add_src_extents()) = ExtentForRange(3, 1);
+  HashCalculator hasher;
+  ASSERT_TRUE(hasher.Update(expected_data.data() + 2 * 4096, 4096));
+  ASSERT_TRUE(hasher.Update(expected_data.data(), 2 * 4096));
+  ASSERT_TRUE(hasher.Update(expected_data.data() + 3 * 4096, 4096));
+  ASSERT_TRUE(hasher.Finalize());
+  op.set_src_sha256_hash(hasher.raw_hash().data(), hasher.raw_hash().size());
+
+  ErrorCode error = ErrorCode::kSuccess;
+  FileDescriptorPtr fd = writer_.ChooseSourceFD(op, &error);
+  ASSERT_NE(nullptr, fd);
+  EXPECT_NE(writer_.verified_source_fd_.source_ecc_fd_, fd);
+  const size_t ecc_reads = fake_fec->GetReadOps().size();
+  const size_t raw_reads = fake_source->GetReadOps().size();
+
+  brillo::Blob data(kSourceSize);
+  ssize_t bytes_read = 0;
+  ASSERT_TRUE(utils::ReadAll(fd, data.data(), data.size(), 0, &bytes_read));
+  ASSERT_EQ(static_cast<ssize_t>(kSourceSize), bytes_read);
+  EXPECT_EQ(expected_data, data);
+  EXPECT_EQ(ecc_reads, fake_fec->GetReadOps().size());
+  // The raw device was only read around the unreadable block.
+  auto read_ops = fake_source->GetReadOps();
+  read_ops.erase(read_ops.begin(), read_ops.begin() + raw_reads);
+  EXPECT_EQ((std::vector<std::pair<uint64_t, uint64_t>>{{0, 2 * 4096},
+                                                       {3 * 4096, 4096}}),
+            read_ops);
+}
+
+// Test that an operation with too many corrupted blocks to keep in memory is
+// read through the error-corrected file descriptor.
+TEST_F(PartitionWriterTest, ChooseSourceFDTooManyCorruptedBlocksTest) {
+  constexpr size_t kSourceBlocks = 300;
+  constexpr size_t kSourceSize = kSourceBlocks * 4096;
+  brillo::Blob expected_data = FakeFileDescriptorData(kSourceSize);
+  auto fake_source = std::make_shared<FakeFileDescriptor>();
+  fake_source->Open("", 0);
+  fake_source->SetFileSize(kSourceSize);
+  fake_source->AddFailureRange(0, kSourceSize);
+  writer_.verified_source_fd_.source_fd_ = fake_source;
+  SetFakeECCFile(kSourceSize);
+
+  InstallOperation op;
+  *(op.add_src_extents()) = ExtentForRange(0, kSourceBlocks);
+  brillo::Blob src_hash;
+  ASSERT_TRUE(HashCalculator::RawHashOfData(expected_data, &src_hash));
+  op.set_src_sha256_hash(src_hash.data(), src_hash.size());
+
+  ErrorCode error = ErrorCode::kSuccess;
+  EXPECT_EQ(writer_.verified_source_fd_.source_ecc_fd_,
+            writer_.ChooseSourceFD(op, &error));
+  EXPECT_EQ(ErrorCode::kSuccess, error);
+  EXPECT_EQ(1U, GetSourceEccRecoveredFailures());
+}
+
+// Test that the target writes are only made durable at checkpoints, after all
+// the data of the applied operations was written.
+TEST_F(PartitionWriterTest, CheckpointFlushesAfterWritesTest) {
+  auto target_fd = std::make_shared<RecordingFileDescriptor>();
+  SetTargetFd(target_fd, 4 * kBlockSize);
+  const brillo::Blob data(kBlockSize, 'a');
+
+  InstallOperation op;
+  op.set_type(InstallOperation::REPLACE);
+  *op.add_dst_extents() = ExtentForRange(0, 1);
+  ASSERT_TRUE(writer_.PerformReplaceOperation(op, data.data(), data.size()));
+  // Writing elsewhere keeps both blocks in the cache.
+  op.clear_dst_extents();
+  *op.add_dst_extents() = ExtentForRange(2, 1);
+  ASSERT_TRUE(writer_.PerformReplaceOperation(op, data.data(), data.size()));
+  EXPECT_TRUE(target_fd->TakeEvents().empty());
+
+  ASSERT_TRUE(writer_.CheckpointUpdateProgress(2));
+  EXPECT_EQ(
+      std::vector<std::string>({"write 0 4096", "write 8192 4096", "flush"}),
+      target_fd->TakeEvents());
+
+  // Nothing is left to write, but the checkpoint is still a barrier.
+  ASSERT_TRUE(writer_.CheckpointUpdateProgress(2));
+  EXPECT_EQ(std::vector<std::string>({"flush"}), target_fd->TakeEvents());
+}
+
+// Test that a checkpoint writes the cached data to a real target file and
+// syncs it.
+TEST_F(PartitionWriterTest, CheckpointSyncsTargetFileTest) {
+  ScopedTempFile target("Target-XXXXXX");
+  ASSERT_TRUE(
+      test_utils::WriteFileVector(target.path(), brillo::Blob(4 * kBlockSize)));
+  auto target_fd = std::make_shared<EintrSafeFileDescriptor>();
+  ASSERT_TRUE(target_fd->Open(target.path().c_str(), O_RDWR));
+  SetTargetFd(target_fd, 4 * kBlockSize);
+  const brillo::Blob data(kBlockSize, 'a');
+
+  InstallOperation op;
+  op.set_type(InstallOperation::REPLACE);
+  *op.add_dst_extents() = ExtentForRange(2, 1);
+  ASSERT_TRUE(writer_.PerformReplaceOperation(op, data.data(), data.size()));
+  brillo::Blob file_data;
+  ASSERT_TRUE(utils::ReadFile(target.path(), &file_data));
+  EXPECT_EQ(brillo::Blob(4 * kBlockSize), file_data);
+
+  ASSERT_TRUE(writer_.CheckpointUpdateProgress(1));
+  brillo::Blob expected_data(4 * kBlockSize);
+  std::copy(data.begin(), data.end(), expected_data.begin() + 2 * kBlockSize);
+  ASSERT_TRUE(utils::ReadFile(target.path(), &file_data));
+  EXPECT_EQ(expected_data, file_data);
+  EXPECT_TRUE(writer_.FinishedInstallOps());
+}
+
+TEST_F(PartitionWriterTest, GetUnwrittenExtentsTest) {
+  PartitionUpdate partition;
+  InstallOperation* op = partition.add_operations();
+  *op->add_dst_extents() = ExtentForRange(2, 3);
+  *op->add_dst_extents() = ExtentForRange(kSparseHole, 4);
+  op = partition.add_operations();
+  *op->add_dst_extents() = ExtentForRange(8, 2);
+  *op->add_dst_extents() = ExtentForRange(4, 2);
+
+  EXPECT_EQ(std::vector<Extent>({ExtentForRange(0, 2),
+                                 ExtentForRange(6, 2),
+                                 ExtentForRange(10, 2)}),
+            partition_writer::GetUnwrittenExtents(partition, 12));
+  EXPECT_TRUE(partition_writer::GetUnwrittenExtents(partition, 0).empty());
+
+  // The hash tree and FEC data are written after the operations.
+  *partition.mutable_hash_tree_extent() = ExtentForRange(10, 1);
+  *partition.mutable_fec_extent() = ExtentForRange(11, 3);
+  EXPECT_EQ(std::vector<Extent>({ExtentForRange(0, 2), ExtentForRange(6, 2)}),
+            partition_writer::GetUnwrittenExtents(partition, 12));
+}
+
+// The first range finds the ioctl the device supports, which is then used for
+// all the ranges, in pieces of up to 64 MiB.
+TEST_F(PartitionWriterTest, DiscardExtentsProbesOnceTest) {
+  auto fd = std::make_shared<RecordingFileDescriptor>();
+  fd->set_supported_ioctl(BLKSECDISCARD);
+  std::atomic<bool> cancel{false};
+  const std::vector<Extent> extents = {ExtentForRange(0, 1),
+                                       ExtentForRange(100, 20000)};
+  EXPECT_TRUE(
+      partition_writer::DiscardExtents(fd, extents, kBlockSize, cancel));
+
+  const std::string secdiscard = "ioctl " + std::to_string(BLKSECDISCARD);
+  EXPECT_EQ(std::vector<std::string>(
+                {"ioctl " + std::to_string(BLKDISCARD) + " 0 4096",
+                 secdiscard + " 0 4096",
+                 secdiscard + " 409600 67108864",
+                 secdiscard + " 67518464 14811136"}),
+            fd->TakeEvents());
+
+  cancel = true;
+  EXPECT_FALSE(
+      partition_writer::DiscardExtents(fd, extents, kBlockSize, cancel));
+  EXPECT_TRUE(fd->TakeEvents().empty());
+}
+
+TEST_F(PartitionWriterTest, DiscardExtentsUnsupportedTest) {
+  auto fd = std::make_shared<RecordingFileDescriptor>();
+  std::atomic<bool> cancel{false};
+  EXPECT_FALSE(partition_writer::DiscardExtents(
+      fd, {ExtentForRange(0, 1), ExtentForRange(10, 1)}, kBlockSize, cancel));
+  // Only the first range was tried.
+  for (const std::string& event : fd->TakeEvents()) {
+    EXPECT_NE(std::string::npos, event.find(" 0 4096")) << event;
+  }
+}
+
+#ifdef BLKZEROOUT
+// The unwritten blocks are never zeroed out, even when the device can't
+// discard them.
+TEST_F(PartitionWriterTest, DiscardExtentsDoesNotZeroOutTest) {
+  auto fd = std::make_shared<RecordingFileDescriptor>();
+  fd->set_supported_ioctl(BLKZEROOUT);
+  std::atomic<bool> cancel{false};
+  EXPECT_FALSE(partition_writer::DiscardExtents(
+      fd, {ExtentForRange(0, 1)}, kBlockSize, cancel));
+  for (const std::string& event : fd->TakeEvents()) {
+    EXPECT_EQ(std::string::npos,
+              event.find("ioctl " + std::to_string(BLKZEROOUT) + " "))
+        << event;
+  }
+}
+#endif  // BLKZEROOUT
+
+TEST_F(PartitionWriterTest, CheckpointFailsWhenFlushFailsTest) {
+  auto target_fd = std::make_shared<RecordingFileDescriptor>();
+  SetTargetFd(target_fd, 4 * kBlockSize);
+  target_fd->set_flush_result(false);
+  EXPECT_FALSE(writer_.CheckpointUpdateProgress(0));
+  EXPECT_FALSE(writer_.FinishedInstallOps());
 }
 
 }  // namespace chromeos_update_engine
@@ -65,6 +65,9 @@ extern const uint32_t kZucchiniMinorPayloadVersion;
 // THe minor version that allows LZ4DIFF operation
 constexpr uint32_t kLZ4DIFFMinorPayloadVersion = 9;
 
+// The minor version that allows the ARM64 BCJ filter in REPLACE_XZ operations.
+constexpr uint32_t kXzArm64MinorPayloadVersion = 10;
+
 // The minimum and maximum supported minor version.
 extern const uint32_t kMinSupportedMinorPayloadVersion;
 extern const uint32_t kMaxSupportedMinorPayloadVersion;
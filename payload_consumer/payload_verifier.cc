@@ -16,6 +16,10 @@
 
 #include "update_engine/payload_consumer/payload_verifier.h"
 
+#include <sys/stat.h>
+
+#include <map>
+#include <mutex>
 #include <utility>
 #include <vector>
 
@@ -68,13 +72,52 @@ std::unique_ptr<PayloadVerifier> PayloadVerifier::CreateInstance(
     return nullptr;
   }
 
-  std::vector<std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)>> keys;
-  keys.emplace_back(std::move(pub_key));
-  return std::unique_ptr<PayloadVerifier>(new PayloadVerifier(std::move(keys)));
+  auto public_keys = std::make_shared<PublicKeys>();
+  public_keys->keys.emplace_back(std::move(pub_key));
+  return std::unique_ptr<PayloadVerifier>(
+      new PayloadVerifier(std::move(public_keys)));
 }
 
 std::unique_ptr<PayloadVerifier> PayloadVerifier::CreateInstanceFromZipPath(
     const std::string& certificate_zip_path) {
+  auto public_keys = ReadPublicKeysFromZip(certificate_zip_path);
+  if (!public_keys) {
+    return nullptr;
+  }
+  return std::unique_ptr<PayloadVerifier>(
+      new PayloadVerifier(std::move(public_keys)));
+}
+
+std::shared_ptr<const PayloadVerifier::PublicKeys>
+PayloadVerifier::ReadPublicKeysFromZip(
+    const std::string& certificate_zip_path) {
+  // The file the cached keys were read from. The zip is only replaced by an
+  // update, but the keys are checked on every attempt and every pre-check.
+  struct CachedKeys {
+    dev_t device;
+    ino_t inode;
+    struct timespec mtime;
+    off_t size;
+    std::shared_ptr<const PublicKeys> public_keys;
+  };
+  static std::mutex lock;
+  static std::map<string, CachedKeys> cache;
+
+  struct stat stbuf;
+  if (stat(certificate_zip_path.c_str(), &stbuf) != 0) {
+    PLOG(ERROR) << "Failed to stat " << certificate_zip_path;
+    return nullptr;
+  }
+  std::lock_guard<std::mutex> guard(lock);
+  auto it = cache.find(certificate_zip_path);
+  if (it != cache.end() && it->second.device == stbuf.st_dev &&
+      it->second.inode == stbuf.st_ino &&
+      it->second.mtime.tv_sec == stbuf.st_mtim.tv_sec &&
+      it->second.mtime.tv_nsec == stbuf.st_mtim.tv_nsec &&
+      it->second.size == stbuf.st_size) {
+    return it->second.public_keys;
+  }
+
   auto parser = CreateCertificateParser();
   if (!parser) {
     LOG(ERROR) << "Failed to create certificate parser from "
@@ -82,21 +125,27 @@ std::unique_ptr<PayloadVerifier> PayloadVerifier::CreateInstanceFromZipPath(
     return nullptr;
   }
 
-  std::vector<std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)>> public_keys;
+  auto public_keys = std::make_shared<PublicKeys>();
   if (!parser->ReadPublicKeysFromCertificates(certificate_zip_path,
-                                              &public_keys) ||
-      public_keys.empty()) {
+                                              &public_keys->keys) ||
+      public_keys->keys.empty()) {
     LOG(ERROR) << "Failed to parse public keys in: " << certificate_zip_path;
     return nullptr;
   }
-
-  return std::unique_ptr<PayloadVerifier>(
-      new PayloadVerifier(std::move(public_keys)));
+  LOG(INFO) << "Read " << public_keys->keys.size() << " public keys from "
+            << certificate_zip_path;
+
+  cache[certificate_zip_path] = {stbuf.st_dev,
+                                 stbuf.st_ino,
+                                 stbuf.st_mtim,
+                                 stbuf.st_size,
+                                 public_keys};
+  return public_keys;
 }
 
 bool PayloadVerifier::VerifySignature(
     const string& signature_proto, const brillo::Blob& sha256_hash_data) const {
-  TEST_AND_RETURN_FALSE(!public_keys_.empty());
+  TEST_AND_RETURN_FALSE(!public_keys_->keys.empty());
 
   Signatures signatures;
   LOG(INFO) << "signature blob size = " << signature_proto.size();
@@ -148,9 +197,15 @@ bool PayloadVerifier::VerifyRawSignature(
     const brillo::Blob& sig_data,
     const brillo::Blob& sha256_hash_data,
     brillo::Blob* decrypted_sig_data) const {
-  TEST_AND_RETURN_FALSE(!public_keys_.empty());
-
-  for (const auto& public_key : public_keys_) {
+  const auto& keys = public_keys_->keys;
+  TEST_AND_RETURN_FALSE(!keys.empty());
+
+  // Try the key which verified the last signature first, it's most likely to
+  // verify this one too.
+  const size_t first_key = public_keys_->last_verified_key % keys.size();
+  for (size_t i = 0; i < keys.size(); i++) {
+    const size_t key_index = (first_key + i) % keys.size();
+    const auto& public_key = keys[key_index];
     int key_type = EVP_PKEY_id(public_key.get());
     if (key_type == EVP_PKEY_RSA) {
       brillo::Blob sig_hash_data;
@@ -170,6 +225,7 @@ bool PayloadVerifier::VerifyRawSignature(
           PadRSASHA256Hash(&padded_hash_data, sig_hash_data.size()));
 
       if (padded_hash_data == sig_hash_data) {
+        public_keys_->last_verified_key = key_index;
         return true;
       }
     } else if (key_type == EVP_PKEY_EC) {
@@ -181,6 +237,7 @@ bool PayloadVerifier::VerifyRawSignature(
                        sig_data.data(),
                        sig_data.size(),
                        ec_key) == 1) {
+        public_keys_->last_verified_key = key_index;
         return true;
       }
     } else {
@@ -188,7 +245,7 @@ bool PayloadVerifier::VerifyRawSignature(
       return false;
     }
   }
-  LOG(INFO) << "Failed to verify the signature with " << public_keys_.size()
+  LOG(INFO) << "Failed to verify the signature with " << keys.size()
             << " keys.";
   return false;
 }
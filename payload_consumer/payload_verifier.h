@@ -17,6 +17,7 @@
 #ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_PAYLOAD_VERIFIER_H_
 #define UPDATE_ENGINE_PAYLOAD_CONSUMER_PAYLOAD_VERIFIER_H_
 
+#include <atomic>
 #include <memory>
 #include <string>
 #include <utility>
@@ -49,7 +50,9 @@ class PayloadVerifier {
       const std::string& pem_public_key);
 
   // Extracts the public keys from the certificates contained in the input
-  // zip file. And creates a PayloadVerifier with these public keys.
+  // zip file. And creates a PayloadVerifier with these public keys. The keys
+  // are cached, and only parsed again if the zip file was replaced or
+  // modified, so the verifiers created from the same zip file share them.
   static std::unique_ptr<PayloadVerifier> CreateInstanceFromZipPath(
       const std::string& certificate_zip_path);
 
@@ -70,11 +73,22 @@ class PayloadVerifier {
                           brillo::Blob* decrypted_sig_data) const;
 
  private:
-  explicit PayloadVerifier(
-      std::vector<std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)>>&&
-          public_keys)
+  // The public keys of a verifier, shared with the verifiers created from the
+  // same certificates.
+  struct PublicKeys {
+    std::vector<std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)>> keys;
+    // The index of the key which verified the last signature, tried first.
+    mutable std::atomic<size_t> last_verified_key{0};
+  };
+
+  explicit PayloadVerifier(std::shared_ptr<const PublicKeys> public_keys)
       : public_keys_(std::move(public_keys)) {}
 
+  // Returns the public keys of the certificates in |certificate_zip_path|,
+  // from the cache if the file didn't change since they were read.
+  static std::shared_ptr<const PublicKeys> ReadPublicKeysFromZip(
+      const std::string& certificate_zip_path);
+
   // Decrypts |sig_data| with the given |public_key| and populates
   // |out_hash_data| with the decoded raw hash. Returns true if successful,
   // false otherwise.
@@ -82,7 +96,7 @@ class PayloadVerifier {
                                const EVP_PKEY* public_key,
                                brillo::Blob* out_hash_data) const;
 
-  std::vector<std::unique_ptr<EVP_PKEY, decltype(&EVP_PKEY_free)>> public_keys_;
+  std::shared_ptr<const PublicKeys> public_keys_;
 };
 
 }  // namespace chromeos_update_engine
@@ -29,8 +29,10 @@ namespace chromeos_update_engine {
 
 class SnapshotExtentWriter final : public BlockExtentWriter {
  public:
-  explicit SnapshotExtentWriter(android::snapshot::ICowWriter* cow_writer)
-      : cow_writer_(cow_writer) {}
+  explicit SnapshotExtentWriter(
+      android::snapshot::ICowWriter* cow_writer,
+      size_t max_buffer_size = kDefaultMaxBufferSize)
+      : BlockExtentWriter(max_buffer_size), cow_writer_(cow_writer) {}
   bool WriteExtent(const void* bytes,
                    const Extent& extent,
                    size_t block_size) override;
@@ -188,4 +188,38 @@ TEST_F(SnapshotExtentWriterTest, WriteAcrossBlockBoundary) {
                      cow_writer_.operations_[125].data.end());
   ASSERT_EQ(buf, actual_data);
 }
+
+TEST_F(SnapshotExtentWriterTest, WritesLargeExtentInParts) {
+  SnapshotExtentWriter writer{&cow_writer_, 2 * kBlockSize};
+  google::protobuf::RepeatedPtrField<Extent> extents;
+  AddExtent(&extents, 123, 5);
+  writer.Init(extents, kBlockSize);
+
+  std::vector<uint8_t> buf(kBlockSize * 5);
+  std::iota(buf.begin(), buf.end(), 0);
+
+  // Half blocks are buffered until the buffer holds 2 blocks.
+  const size_t half_block = kBlockSize / 2;
+  for (size_t offset = 0; offset < 3 * half_block; offset += half_block) {
+    ASSERT_TRUE(writer.Write(buf.data() + offset, half_block));
+  }
+  ASSERT_TRUE(cow_writer_.operations_.empty());
+  ASSERT_TRUE(writer.Write(buf.data() + 3 * half_block, half_block));
+  ASSERT_EQ(cow_writer_.operations_.size(), 1U);
+  ASSERT_EQ(cow_writer_.operations_[123].data.size(), 2 * kBlockSize);
+  for (size_t offset = 2 * kBlockSize; offset < buf.size();
+       offset += half_block) {
+    ASSERT_TRUE(writer.Write(buf.data() + offset, half_block));
+  }
+  ASSERT_EQ(cow_writer_.operations_.size(), 3U);
+  ASSERT_TRUE(cow_writer_.Contains(125));
+  ASSERT_TRUE(cow_writer_.Contains(127));
+
+  std::vector<uint8_t> actual_data;
+  for (const auto& [block, op] : cow_writer_.operations_) {
+    actual_data.insert(actual_data.end(), op.data.begin(), op.data.end());
+  }
+  ASSERT_EQ(buf, actual_data);
+}
+
 }  // namespace chromeos_update_engine
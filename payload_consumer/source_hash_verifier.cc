@@ -0,0 +1,297 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/source_hash_verifier.h"
+
+#include <fcntl.h>
+
+#include <algorithm>
+#include <atomic>
+#include <list>
+#include <memory>
+
+#include <base/logging.h>
+#include <base/synchronization/lock.h>
+#include <base/threading/simple_thread.h>
+
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/file_descriptor_utils.h"
+#include "update_engine/payload_consumer/partition_writer.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// Size of the buffer used to read the coalesced source blocks.
+constexpr uint64_t kMaxReadBufferSize = 2 * 1024 * 1024;
+
+}  // namespace
+
+OperationSourceHasher::OperationSourceHasher(const PartitionUpdate& partition,
+                                             uint64_t block_size)
+    : partition_(partition), block_size_(block_size) {
+  for (int i = 0; i < partition.operations_size(); i++) {
+    const InstallOperation& op = partition.operations(i);
+    if (!op.has_src_sha256_hash()) {
+      continue;
+    }
+    // The data of an operation is only hashed in read order if its extents
+    // are increasing and don't overlap.
+    bool increasing = true;
+    uint64_t previous_end = 0;
+    for (const Extent& extent : op.src_extents()) {
+      if (extent.start_block() < previous_end) {
+        increasing = false;
+        break;
+      }
+      previous_end = extent.start_block() + extent.num_blocks();
+    }
+    if (!increasing) {
+      separate_operations_.push_back(i);
+      total_blocks_ += utils::BlocksInExtents(op.src_extents());
+      continue;
+    }
+    for (const Extent& extent : op.src_extents()) {
+      if (extent.num_blocks() > 0) {
+        segments_.push_back({extent.start_block(),
+                             extent.start_block() + extent.num_blocks(),
+                             i});
+      }
+    }
+  }
+  // Keeps the extents of each operation in order.
+  std::stable_sort(segments_.begin(),
+                   segments_.end(),
+                   [](const Segment& a, const Segment& b) {
+                     return a.start < b.start;
+                   });
+  for (const Segment& segment : segments_) {
+    if (!ranges_.empty() && segment.start <= ranges_.back().second) {
+      ranges_.back().second = std::max(ranges_.back().second, segment.end);
+    } else {
+      ranges_.emplace_back(segment.start, segment.end);
+    }
+  }
+  for (const auto& [start, end] : ranges_) {
+    total_blocks_ += end - start;
+  }
+}
+
+bool OperationSourceHasher::Run(
+    FileDescriptorPtr source,
+    const std::function<void(uint64_t)>& on_blocks_read,
+    vector<brillo::Blob>* hashes) const {
+  hashes->clear();
+  hashes->resize(partition_.operations_size());
+  // Only the operations with a segment use their hash calculator.
+  vector<HashCalculator> hashers(partition_.operations_size());
+
+  const uint64_t buffer_blocks =
+      std::max<uint64_t>(kMaxReadBufferSize / block_size_, 1);
+  brillo::Blob buffer(buffer_blocks * block_size_);
+  // The segments overlapping the blocks read so far and not yet fully hashed,
+  // in the order of |segments_|.
+  vector<const Segment*> active;
+  size_t next_segment = 0;
+  for (const auto& [range_start, range_end] : ranges_) {
+    for (uint64_t start = range_start; start < range_end;) {
+      const uint64_t end = std::min(range_end, start + buffer_blocks);
+      const size_t size = (end - start) * block_size_;
+      ssize_t bytes_read = 0;
+      TEST_AND_RETURN_FALSE(utils::PReadAll(
+          source, buffer.data(), size, start * block_size_, &bytes_read));
+      TEST_AND_RETURN_FALSE(static_cast<size_t>(bytes_read) == size);
+
+      while (next_segment < segments_.size() &&
+             segments_[next_segment].start < end) {
+        active.push_back(&segments_[next_segment++]);
+      }
+      for (const Segment* segment : active) {
+        const uint64_t from = std::max(segment->start, start);
+        const uint64_t to = std::min(segment->end, end);
+        TEST_AND_RETURN_FALSE(hashers[segment->operation].Update(
+            buffer.data() + (from - start) * block_size_,
+            (to - from) * block_size_));
+      }
+      active.erase(std::remove_if(active.begin(),
+                                  active.end(),
+                                  [end](const Segment* segment) {
+                                    return segment->end <= end;
+                                  }),
+                   active.end());
+      if (on_blocks_read) {
+        on_blocks_read(end - start);
+      }
+      start = end;
+    }
+  }
+
+  vector<bool> separate(partition_.operations_size());
+  for (int i : separate_operations_) {
+    const InstallOperation& op = partition_.operations(i);
+    TEST_AND_RETURN_FALSE(fd_utils::ReadAndHashExtents(
+        source, op.src_extents(), block_size_, &(*hashes)[i]));
+    if (on_blocks_read) {
+      on_blocks_read(utils::BlocksInExtents(op.src_extents()));
+    }
+    separate[i] = true;
+  }
+  for (int i = 0; i < partition_.operations_size(); i++) {
+    if (partition_.operations(i).has_src_sha256_hash() && !separate[i]) {
+      TEST_AND_RETURN_FALSE(hashers[i].Finalize());
+      (*hashes)[i] = hashers[i].raw_hash();
+    }
+  }
+  return true;
+}
+
+namespace {
+
+// The state shared by the SourceHashTask of a VerifySourceHashes() call.
+struct SourceHashProgress {
+  const std::function<void(uint64_t, uint64_t)>& progress;
+  const uint64_t total_blocks;
+
+  base::Lock lock;
+  uint64_t verified_blocks{0};
+  // Set once a partition fails, so that the partitions not started yet are
+  // skipped.
+  std::atomic<bool> failed{false};
+};
+
+// Verifies the source hashes of one partition for VerifySourceHashes(), which
+// runs them in a thread pool.
+class SourceHashTask : public base::DelegateSimpleThread::Delegate {
+ public:
+  SourceHashTask(const SourcePartition& partition,
+                 const OperationSourceHasher& hasher,
+                 SourceHashProgress* progress)
+      : partition_(partition), hasher_(hasher), progress_(progress) {}
+  ~SourceHashTask() override = default;
+
+  // Overrides DelegateSimpleThread::Delegate.
+  void Run() override {
+    if (progress_->failed) {
+      return;
+    }
+    if (!Verify()) {
+      progress_->failed = true;
+    }
+  }
+
+  // The reason the partition failed, empty if it was verified or skipped.
+  const string& error() const { return error_; }
+
+ private:
+  bool Verify();
+  void OnBlocksRead(uint64_t blocks);
+
+  const SourcePartition& partition_;
+  const OperationSourceHasher& hasher_;
+  SourceHashProgress* progress_;
+
+  string error_;
+
+  DISALLOW_COPY_AND_ASSIGN(SourceHashTask);
+};
+
+bool SourceHashTask::Verify() {
+  FileDescriptorPtr fd(new EintrSafeFileDescriptor);
+  if (!fd->Open(partition_.path.c_str(), O_RDONLY)) {
+    error_ = "Failed to open " + partition_.path;
+    return false;
+  }
+  vector<brillo::Blob> hashes;
+  if (!hasher_.Run(
+          fd,
+          [this](uint64_t blocks) { OnBlocksRead(blocks); },
+          &hashes)) {
+    error_ = "Failed to hash " + partition_.path;
+    return false;
+  }
+  for (int op_index = 0; op_index < partition_.update->operations_size();
+       op_index++) {
+    const InstallOperation& op = partition_.update->operations(op_index);
+    ErrorCode error_code;
+    if (op.has_src_sha256_hash() &&
+        !PartitionWriter::ValidateSourceHash(
+            hashes[op_index], op, fd, &error_code)) {
+      error_ = "Source hash mismatch in " +
+               partition_.update->partition_name() + " operation " +
+               std::to_string(op_index);
+      return false;
+    }
+  }
+  fd->Close();
+  return true;
+}
+
+void SourceHashTask::OnBlocksRead(uint64_t blocks) {
+  base::AutoLock auto_lock(progress_->lock);
+  progress_->verified_blocks += blocks;
+  if (progress_->progress) {
+    progress_->progress(progress_->verified_blocks, progress_->total_blocks);
+  }
+}
+
+}  // namespace
+
+bool VerifySourceHashes(
+    const vector<SourcePartition>& partitions,
+    uint64_t block_size,
+    size_t max_threads,
+    const std::function<void(uint64_t, uint64_t)>& progress,
+    string* error_message) {
+  if (partitions.empty()) {
+    return true;
+  }
+  vector<std::unique_ptr<OperationSourceHasher>> hashers;
+  uint64_t total_blocks = 0;
+  for (const SourcePartition& partition : partitions) {
+    hashers.push_back(std::make_unique<OperationSourceHasher>(
+        *partition.update, block_size));
+    total_blocks += hashers.back()->total_blocks();
+  }
+
+  SourceHashProgress shared_progress{progress, total_blocks};
+  std::list<SourceHashTask> tasks;
+  for (size_t i = 0; i < partitions.size(); i++) {
+    tasks.emplace_back(partitions[i], *hashers[i], &shared_progress);
+  }
+  base::DelegateSimpleThreadPool thread_pool(
+      "source-hash-verifier",
+      std::min(std::max<size_t>(max_threads, 1), tasks.size()));
+  thread_pool.Start();
+  for (auto& task : tasks) {
+    thread_pool.AddWork(&task);
+  }
+  thread_pool.JoinAll();
+
+  // Reports the first failed partition in the order of |partitions|.
+  for (const auto& task : tasks) {
+    if (!task.error().empty()) {
+      *error_message = task.error();
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,99 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_CONSUMER_SOURCE_HASH_VERIFIER_H_
+#define UPDATE_ENGINE_PAYLOAD_CONSUMER_SOURCE_HASH_VERIFIER_H_
+
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <brillo/secure_blob.h>
+
+#include "update_engine/payload_consumer/file_descriptor.h"
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// Hashes the source data of the operations of a partition which have a
+// src_sha256_hash. Instead of reading the extents of each operation, which
+// reads the blocks shared by several operations several times, the source
+// extents of all the operations are coalesced and every source block is read
+// once, in large sequential reads, and fed to the hash of each operation
+// reading it. Operations whose extents aren't in increasing order are hashed
+// on their own.
+class OperationSourceHasher {
+ public:
+  OperationSourceHasher(const PartitionUpdate& partition, uint64_t block_size);
+
+  // The number of blocks Run() reads.
+  uint64_t total_blocks() const { return total_blocks_; }
+
+  // Hashes the operations from |source|. Stores the hash of each operation in
+  // |hashes|, indexed like the operations of the partition and empty for the
+  // operations without a src_sha256_hash. Calls |on_blocks_read|, if set,
+  // with the number of blocks read after each read.
+  bool Run(FileDescriptorPtr source,
+           const std::function<void(uint64_t)>& on_blocks_read,
+           std::vector<brillo::Blob>* hashes) const;
+
+ private:
+  // A source extent of an operation, in blocks.
+  struct Segment {
+    uint64_t start;
+    uint64_t end;
+    int operation;
+  };
+
+  const PartitionUpdate& partition_;
+  const uint64_t block_size_;
+
+  // The extents of the operations hashed while reading the coalesced
+  // |ranges_|, sorted by start block.
+  std::vector<Segment> segments_;
+  // The sorted and disjoint [start, end) block ranges covering |segments_|.
+  std::vector<std::pair<uint64_t, uint64_t>> ranges_;
+  // The operations hashed on their own.
+  std::vector<int> separate_operations_;
+
+  uint64_t total_blocks_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(OperationSourceHasher);
+};
+
+// A source partition to check a payload against.
+struct SourcePartition {
+  // The source partition device.
+  std::string path;
+  const PartitionUpdate* update;
+};
+
+// Verifies that the source data of all the operations of |partitions| matches
+// their src_sha256_hash, hashing up to |max_threads| partitions at once.
+// |progress|, if set, is called from the worker threads, one at a time, with
+// the number of source blocks verified so far and the total. Returns false
+// and sets |error_message| to the error of the first partition that failed.
+bool VerifySourceHashes(
+    const std::vector<SourcePartition>& partitions,
+    uint64_t block_size,
+    size_t max_threads,
+    const std::function<void(uint64_t, uint64_t)>& progress,
+    std::string* error_message);
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_CONSUMER_SOURCE_HASH_VERIFIER_H_
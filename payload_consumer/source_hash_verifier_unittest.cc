@@ -0,0 +1,131 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_consumer/source_hash_verifier.h"
+
+#include <fcntl.h>
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/file_descriptor_utils.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+// Large blocks so that the operations span several reads.
+constexpr uint64_t kBlockSize = 128 * 1024;
+constexpr uint64_t kPartitionBlocks = 40;
+}  // namespace
+
+class SourceHashVerifierTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    brillo::Blob data(kPartitionBlocks * kBlockSize);
+    test_utils::FillWithData(&data);
+    ASSERT_TRUE(test_utils::WriteFileVector(source_.path(), data));
+    fd_->Open(source_.path().c_str(), O_RDONLY);
+
+    partition_.set_partition_name("system");
+    // Overlapping operations, crossing the reads of 16 blocks.
+    AddOperation({ExtentForRange(0, 4), ExtentForRange(14, 6)});
+    AddOperation({ExtentForRange(2, 4), ExtentForRange(18, 1)});
+    // Extents out of order.
+    AddOperation({ExtentForRange(30, 2), ExtentForRange(1, 1)});
+    // Without a source hash.
+    partition_.add_operations()->set_type(InstallOperation::REPLACE);
+  }
+
+  void AddOperation(const vector<Extent>& extents) {
+    InstallOperation* op = partition_.add_operations();
+    op->set_type(InstallOperation::SOURCE_COPY);
+    for (const Extent& extent : extents) {
+      *op->add_src_extents() = extent;
+    }
+    brillo::Blob hash;
+    ASSERT_TRUE(fd_utils::ReadAndHashExtents(
+        fd_, op->src_extents(), kBlockSize, &hash));
+    op->set_src_sha256_hash(hash.data(), hash.size());
+  }
+
+  ScopedTempFile source_{"Source-XXXXXX"};
+  FileDescriptorPtr fd_{new EintrSafeFileDescriptor};
+  PartitionUpdate partition_;
+};
+
+TEST_F(SourceHashVerifierTest, HashesMatchSeparateReadsTest) {
+  OperationSourceHasher hasher(partition_, kBlockSize);
+  // Blocks 0 to 5 and 14 to 19 read once, and the 3 blocks of the unordered
+  // operation.
+  EXPECT_EQ(15u, hasher.total_blocks());
+
+  uint64_t blocks_read = 0;
+  vector<brillo::Blob> hashes;
+  ASSERT_TRUE(hasher.Run(
+      fd_, [&](uint64_t blocks) { blocks_read += blocks; }, &hashes));
+  EXPECT_EQ(hasher.total_blocks(), blocks_read);
+  ASSERT_EQ(4u, hashes.size());
+  for (int i = 0; i < 3; i++) {
+    const string& expected = partition_.operations(i).src_sha256_hash();
+    EXPECT_EQ(brillo::Blob(expected.begin(), expected.end()), hashes[i])
+        << "operation " << i;
+  }
+  EXPECT_TRUE(hashes[3].empty());
+}
+
+TEST_F(SourceHashVerifierTest, VerifySourceHashesTest) {
+  PartitionUpdate vendor = partition_;
+  vendor.set_partition_name("vendor");
+  vector<SourcePartition> partitions = {{source_.path(), &partition_},
+                                        {source_.path(), &vendor}};
+
+  uint64_t last_verified = 0;
+  uint64_t last_total = 0;
+  string error;
+  EXPECT_TRUE(VerifySourceHashes(
+      partitions,
+      kBlockSize,
+      2,
+      [&](uint64_t verified, uint64_t total) {
+        EXPECT_GT(verified, last_verified);
+        last_verified = verified;
+        last_total = total;
+      },
+      &error));
+  EXPECT_EQ(30u, last_total);
+  EXPECT_EQ(last_total, last_verified);
+
+  vendor.mutable_operations(1)->set_src_sha256_hash(string(32, 'x'));
+  EXPECT_FALSE(VerifySourceHashes(partitions, kBlockSize, 2, {}, &error));
+  EXPECT_EQ("Source hash mismatch in vendor operation 1", error);
+}
+
+TEST_F(SourceHashVerifierTest, MissingPartitionTest) {
+  vector<SourcePartition> partitions = {{"/non/existent", &partition_}};
+  string error;
+  EXPECT_FALSE(VerifySourceHashes(partitions, kBlockSize, 1, {}, &error));
+  EXPECT_EQ("Failed to open /non/existent", error);
+}
+
+}  // namespace chromeos_update_engine
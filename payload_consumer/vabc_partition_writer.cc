@@ -317,13 +317,13 @@ bool VABCPartitionWriter::PerformDiffOperation(
       operation, std::move(writer), source_fd, data, count);
 }
 
-void VABCPartitionWriter::CheckpointUpdateProgress(size_t next_op_index) {
+bool VABCPartitionWriter::CheckpointUpdateProgress(size_t next_op_index) {
   // No need to call fsync/sync, as CowWriter flushes after a label is added
   // added.
   // if cow_writer_ failed, that means Init() failed. This function shouldn't be
   // called if Init() fails.
-  TEST_AND_RETURN(cow_writer_ != nullptr);
-  cow_writer_->AddLabel(next_op_index);
+  TEST_AND_RETURN_FALSE(cow_writer_ != nullptr);
+  return cow_writer_->AddLabel(next_op_index);
 }
 
 [[nodiscard]] bool VABCPartitionWriter::FinishedInstallOps() {
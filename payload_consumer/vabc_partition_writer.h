@@ -60,7 +60,7 @@ class VABCPartitionWriter final : public PartitionWriterInterface {
                                           const void* data,
                                           size_t count) override;
 
-  void CheckpointUpdateProgress(size_t next_op_index) override;
+  [[nodiscard]] bool CheckpointUpdateProgress(size_t next_op_index) override;
 
   [[nodiscard]] static bool WriteSourceCopyCowOps(
       size_t block_size,
@@ -16,8 +16,11 @@
 #include "update_engine/payload_consumer/verified_source_fd.h"
 
 #include <fcntl.h>
+#include <string.h>
 #include <sys/stat.h>
 
+#include <algorithm>
+#include <map>
 #include <memory>
 #include <utility>
 #include <vector>
@@ -26,6 +29,7 @@
 #include <base/strings/string_util.h>
 #include <base/strings/stringprintf.h>
 
+#include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_consumer/fec_file_descriptor.h"
 #include "update_engine/payload_consumer/file_descriptor_utils.h"
@@ -35,6 +39,120 @@
 namespace chromeos_update_engine {
 using std::string;
 
+namespace {
+
+// Size of the buffer used to compare the raw and the error corrected blocks.
+constexpr uint64_t kMaxCompareBufferSize = 1024 * 1024;
+
+// The most blocks corrected through ECC kept in memory for an operation. If
+// more blocks are corrupted the operation is read through the ECC device.
+constexpr size_t kMaxCorrectedBlocks = 256;
+
+// A read-only file descriptor reading |fd|, except for the blocks in
+// |overlay|, which are read from memory.
+class OverlayFileDescriptor : public FileDescriptor {
+ public:
+  OverlayFileDescriptor(FileDescriptorPtr fd,
+                        size_t block_size,
+                        std::map<uint64_t, brillo::Blob> overlay)
+      : fd_(std::move(fd)),
+        block_size_(block_size),
+        overlay_(std::move(overlay)) {}
+
+  bool Open(const char* path, int flags, mode_t mode) override {
+    return false;
+  }
+  bool Open(const char* path, int flags) override { return false; }
+
+  ssize_t Read(void* buf, size_t count) override {
+    uint8_t* data = static_cast<uint8_t*>(buf);
+    const uint64_t end = offset_ + count;
+    uint64_t pos = offset_;
+    while (pos < end) {
+      const uint64_t block = pos / block_size_;
+      const auto it = overlay_.lower_bound(block);
+      if (it != overlay_.end() && it->first == block) {
+        const uint64_t to = std::min((block + 1) * block_size_, end);
+        memcpy(data + (pos - offset_),
+               it->second.data() + (pos - block * block_size_),
+               to - pos);
+        pos = to;
+        continue;
+      }
+      // The raw device is only read up to the next corrected block, which may
+      // not be readable from it.
+      uint64_t to = end;
+      if (it != overlay_.end()) {
+        to = std::min(to, it->first * block_size_);
+      }
+      ssize_t bytes_read = 0;
+      if (!utils::PReadAll(
+              fd_, data + (pos - offset_), to - pos, pos, &bytes_read)) {
+        if (pos == offset_) {
+          return -1;
+        }
+        break;
+      }
+      pos += bytes_read;
+      if (pos < to) {
+        // End of file.
+        break;
+      }
+    }
+    const ssize_t bytes_read = pos - offset_;
+    offset_ = pos;
+    return bytes_read;
+  }
+
+  ssize_t Write(const void* buf, size_t count) override {
+    errno = EROFS;
+    return -1;
+  }
+
+  off64_t Seek(off64_t offset, int whence) override {
+    switch (whence) {
+      case SEEK_SET:
+        offset_ = offset;
+        return offset_;
+      case SEEK_CUR:
+        offset_ += offset;
+        return offset_;
+      default:
+        errno = EINVAL;
+        return -1;
+    }
+  }
+
+  uint64_t BlockDevSize() override { return fd_->BlockDevSize(); }
+
+  bool BlkIoctl(int request,
+                uint64_t start,
+                uint64_t length,
+                int* result) override {
+    return false;
+  }
+
+  bool Flush() override { return true; }
+
+  // The raw device is shared with VerifiedSourceFd, so it is left open.
+  bool Close() override { return true; }
+
+  bool IsSettingErrno() override { return fd_->IsSettingErrno(); }
+
+  bool IsOpen() override { return fd_->IsOpen(); }
+
+ private:
+  FileDescriptorPtr fd_;
+  const uint64_t block_size_;
+  // The corrected blocks, by block number.
+  const std::map<uint64_t, brillo::Blob> overlay_;
+  uint64_t offset_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(OverlayFileDescriptor);
+};
+
+}  // namespace
+
 bool VerifiedSourceFd::OpenCurrentECCPartition() {
   // No support for ECC for full payloads.
   // Full payload should not have any opeartion that requires ECC partitions.
@@ -103,14 +221,88 @@ FileDescriptorPtr VerifiedSourceFd::ChooseSourceFD(
                << base::HexEncode(expected_source_hash.data(),
                                   expected_source_hash.size());
 
-  if (fd_utils::ReadAndHashExtents(
-          source_ecc_fd_, operation.src_extents(), block_size_, &source_hash) &&
-      PartitionWriter::ValidateSourceHash(
+  std::map<uint64_t, brillo::Blob> corrected_blocks;
+  bool too_many_corrupted = false;
+  if (!FindCorruptedBlocks(operation.src_extents(),
+                           &source_hash,
+                           &corrected_blocks,
+                           &too_many_corrupted) ||
+      !PartitionWriter::ValidateSourceHash(
           source_hash, operation, source_ecc_fd_, error)) {
-    source_ecc_recovered_failures_++;
+    return nullptr;
+  }
+  source_ecc_recovered_failures_++;
+  if (too_many_corrupted) {
+    LOG(INFO) << "More than " << kMaxCorrectedBlocks << " of "
+              << utils::BlocksInExtents(operation.src_extents())
+              << " source blocks are corrupted, reading them through ECC";
     return source_ecc_fd_;
   }
-  return nullptr;
+  LOG(INFO) << "Corrected " << corrected_blocks.size() << " of "
+            << utils::BlocksInExtents(operation.src_extents())
+            << " source blocks through ECC";
+  // Only the corrupted blocks are served from the ECC data, the others are
+  // read from the faster raw device.
+  return std::make_shared<OverlayFileDescriptor>(
+      source_fd_, block_size_, std::move(corrected_blocks));
+}
+
+bool VerifiedSourceFd::FindCorruptedBlocks(
+    const google::protobuf::RepeatedPtrField<Extent>& extents,
+    brillo::Blob* ecc_hash,
+    std::map<uint64_t, brillo::Blob>* corrected_blocks,
+    bool* too_many_corrupted) {
+  *too_many_corrupted = false;
+  const uint64_t buffer_blocks =
+      std::max<uint64_t>(kMaxCompareBufferSize / block_size_, 1);
+  brillo::Blob ecc_buffer(buffer_blocks * block_size_);
+  brillo::Blob raw_buffer(ecc_buffer.size());
+  HashCalculator hasher;
+  for (const Extent& extent : extents) {
+    const uint64_t extent_end = extent.start_block() + extent.num_blocks();
+    for (uint64_t block = extent.start_block(); block < extent_end;) {
+      const uint64_t num_blocks = std::min(extent_end - block, buffer_blocks);
+      const size_t size = num_blocks * block_size_;
+      ssize_t bytes_read = 0;
+      TEST_AND_RETURN_FALSE(utils::ReadAll(source_ecc_fd_,
+                                           ecc_buffer.data(),
+                                           size,
+                                           block * block_size_,
+                                           &bytes_read));
+      TEST_AND_RETURN_FALSE(static_cast<size_t>(bytes_read) == size);
+      TEST_AND_RETURN_FALSE(hasher.Update(ecc_buffer.data(), size));
+      if (*too_many_corrupted) {
+        // Only the hash of the remaining blocks is needed.
+        block += num_blocks;
+        continue;
+      }
+
+      // Blocks which can't be read from the raw device are corrected too.
+      const bool raw_read = utils::PReadAll(source_fd_,
+                                            raw_buffer.data(),
+                                            size,
+                                            block * block_size_,
+                                            &bytes_read) &&
+                            static_cast<size_t>(bytes_read) == size;
+      for (uint64_t i = 0; i < num_blocks; i++) {
+        const uint8_t* ecc_block = ecc_buffer.data() + i * block_size_;
+        if (!raw_read || memcmp(raw_buffer.data() + i * block_size_,
+                                ecc_block,
+                                block_size_) != 0) {
+          (*corrected_blocks)[block + i].assign(ecc_block,
+                                                ecc_block + block_size_);
+        }
+      }
+      if (corrected_blocks->size() > kMaxCorrectedBlocks) {
+        corrected_blocks->clear();
+        *too_many_corrupted = true;
+      }
+      block += num_blocks;
+    }
+  }
+  TEST_AND_RETURN_FALSE(hasher.Finalize());
+  *ecc_hash = hasher.raw_hash();
+  return true;
 }
 
 bool VerifiedSourceFd::Open() {
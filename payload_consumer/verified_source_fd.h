@@ -18,9 +18,11 @@
 
 #include <cstddef>
 
+#include <map>
 #include <string>
 #include <utility>
 
+#include <brillo/secure_blob.h>
 #include <gtest/gtest_prod.h>
 #include <update_engine/update_metadata.pb.h>
 
@@ -40,6 +42,18 @@ class VerifiedSourceFd {
 
  private:
   bool OpenCurrentECCPartition();
+
+  // Reads the blocks of |extents| through |source_ecc_fd_|, stores the hash
+  // of the data in |ecc_hash| and the blocks which differ from, or can't be
+  // read from, |source_fd_| in |corrected_blocks|, by block number. If too
+  // many blocks differ to keep them in memory, the comparison stops,
+  // |corrected_blocks| is left empty and |too_many_corrupted| is set.
+  bool FindCorruptedBlocks(
+      const google::protobuf::RepeatedPtrField<Extent>& extents,
+      brillo::Blob* ecc_hash,
+      std::map<uint64_t, brillo::Blob>* corrected_blocks,
+      bool* too_many_corrupted);
+
   const size_t block_size_;
   const std::string source_path_;
   FileDescriptorPtr source_ecc_fd_;
@@ -145,6 +145,14 @@ bool VerityWriterAndroid::Finalize(FileDescriptor* read_fd,
   return true;
 }
 
+uint64_t VerityWriterAndroid::GetFECRounds(uint64_t data_size,
+                                           uint32_t fec_roots,
+                                           uint32_t block_size) {
+  // This is the N in RS(M, N), which is the number of bytes for each rs block.
+  size_t rs_n = FEC_RSM - fec_roots;
+  return utils::DivRoundUp(data_size / block_size, rs_n);
+}
+
 bool VerityWriterAndroid::EncodeFEC(FileDescriptor* read_fd,
                                     FileDescriptor* write_fd,
                                     uint64_t data_offset,
@@ -156,21 +164,76 @@ bool VerityWriterAndroid::EncodeFEC(FileDescriptor* read_fd,
                                     bool verify_mode) {
   TEST_AND_RETURN_FALSE(data_size % block_size == 0);
   TEST_AND_RETURN_FALSE(fec_roots >= 0 && fec_roots < FEC_RSM);
-  // This is the N in RS(M, N), which is the number of bytes for each rs block.
-  size_t rs_n = FEC_RSM - fec_roots;
-  uint64_t rounds = utils::DivRoundUp(data_size / block_size, rs_n);
+  uint64_t rounds = GetFECRounds(data_size, fec_roots, block_size);
   TEST_AND_RETURN_FALSE(rounds * fec_roots * block_size == fec_size);
 
-  std::unique_ptr<void, decltype(&free_rs_char)> rs_char(
-      init_rs_char(FEC_PARAMS(fec_roots)), &free_rs_char);
-  TEST_AND_RETURN_FALSE(rs_char != nullptr);
   // Cache at most 1MB of fec data, in VABC, we need to re-open fd if we
   // perform a read() operation after write(). So reduce the number of writes
   // can save unnecessary re-opens.
   UnownedCachedFileDescriptor cache_fd(write_fd, 1 * (1 << 20));
-  write_fd = &cache_fd;
+  TEST_AND_RETURN_FALSE(EncodeFECRounds(read_fd,
+                                        &cache_fd,
+                                        data_offset,
+                                        data_size,
+                                        fec_offset,
+                                        fec_roots,
+                                        block_size,
+                                        verify_mode,
+                                        0,
+                                        rounds,
+                                        rounds));
+  cache_fd.Flush();
+  return true;
+}
+
+bool VerityWriterAndroid::VerifyFECRounds(FileDescriptor* read_fd,
+                                          uint64_t data_offset,
+                                          uint64_t data_size,
+                                          uint64_t fec_offset,
+                                          uint64_t fec_size,
+                                          uint32_t fec_roots,
+                                          uint32_t block_size,
+                                          uint64_t first_round,
+                                          uint64_t num_rounds) {
+  TEST_AND_RETURN_FALSE(data_size % block_size == 0);
+  TEST_AND_RETURN_FALSE(fec_roots >= 0 && fec_roots < FEC_RSM);
+  uint64_t rounds = GetFECRounds(data_size, fec_roots, block_size);
+  TEST_AND_RETURN_FALSE(rounds * fec_roots * block_size == fec_size);
+  TEST_AND_RETURN_FALSE(first_round + num_rounds <= rounds);
+  return EncodeFECRounds(read_fd,
+                         nullptr,
+                         data_offset,
+                         data_size,
+                         fec_offset,
+                         fec_roots,
+                         block_size,
+                         true /* verify_mode */,
+                         first_round,
+                         first_round + num_rounds,
+                         rounds);
+}
+
+bool VerityWriterAndroid::EncodeFECRounds(FileDescriptor* read_fd,
+                                          FileDescriptor* write_fd,
+                                          uint64_t data_offset,
+                                          uint64_t data_size,
+                                          uint64_t fec_offset,
+                                          uint32_t fec_roots,
+                                          uint32_t block_size,
+                                          bool verify_mode,
+                                          uint64_t begin_round,
+                                          uint64_t end_round,
+                                          uint64_t rounds) {
+  // This is the N in RS(M, N), which is the number of bytes for each rs block.
+  size_t rs_n = FEC_RSM - fec_roots;
+
+  std::unique_ptr<void, decltype(&free_rs_char)> rs_char(
+      init_rs_char(FEC_PARAMS(fec_roots)), &free_rs_char);
+  TEST_AND_RETURN_FALSE(rs_char != nullptr);
 
-  for (size_t i = 0; i < rounds; i++) {
+  // Each round produces |fec_roots| blocks of parity data.
+  fec_offset += begin_round * fec_roots * block_size;
+  for (uint64_t i = begin_round; i < end_round; i++) {
     // Encodes |block_size| number of rs blocks each round so that we can read
     // one block each time instead of 1 byte to increase random read
     // performance. This uses about 1 MiB memory for 4K block size.
@@ -221,7 +284,6 @@ bool VerityWriterAndroid::EncodeFEC(FileDescriptor* read_fd,
     }
     fec_offset += fec.size();
   }
-  write_fd->Flush();
   return true;
 }
 
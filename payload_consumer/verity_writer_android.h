@@ -60,7 +60,42 @@ class VerityWriterAndroid : public VerityWriterInterface {
                         uint32_t block_size,
                         bool verify_mode);
 
+  // Returns the number of RS rounds needed to encode FEC for |data_size| bytes
+  // of data. Each round reads |block_size| interleaved data blocks and
+  // produces |fec_roots| blocks of FEC data.
+  static uint64_t GetFECRounds(uint64_t data_size,
+                               uint32_t fec_roots,
+                               uint32_t block_size);
+
+  // Same as EncodeFEC() in verify mode, but only checks the RS rounds in
+  // [first_round, first_round + num_rounds). Rounds are independent of each
+  // other, so disjoint ranges can be verified concurrently using one
+  // |read_fd| each.
+  static bool VerifyFECRounds(FileDescriptor* read_fd,
+                              uint64_t data_offset,
+                              uint64_t data_size,
+                              uint64_t fec_offset,
+                              uint64_t fec_size,
+                              uint32_t fec_roots,
+                              uint32_t block_size,
+                              uint64_t first_round,
+                              uint64_t num_rounds);
+
  private:
+  // Encodes the RS rounds in [begin_round, end_round) out of |rounds|, see
+  // EncodeFEC(). |write_fd| is only used when not in |verify_mode|.
+  static bool EncodeFECRounds(FileDescriptor* read_fd,
+                              FileDescriptor* write_fd,
+                              uint64_t data_offset,
+                              uint64_t data_size,
+                              uint64_t fec_offset,
+                              uint32_t fec_roots,
+                              uint32_t block_size,
+                              bool verify_mode,
+                              uint64_t begin_round,
+                              uint64_t end_round,
+                              uint64_t rounds);
+
   const InstallPlan::Partition* partition_ = nullptr;
 
   std::unique_ptr<HashTreeBuilder> hash_tree_builder_;
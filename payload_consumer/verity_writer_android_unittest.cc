@@ -165,6 +165,61 @@ TEST_F(VerityWriterAndroidTest, FECTest) {
   ASSERT_EQ(part_data, actual_part);
 }
 
+TEST_F(VerityWriterAndroidTest, VerifyFECRoundsTest) {
+  // 300 data blocks need two RS rounds with 2 roots.
+  constexpr uint32_t kBlockSize = 4096;
+  constexpr uint64_t kDataSize = 300 * kBlockSize;
+  const uint64_t rounds =
+      VerityWriterAndroid::GetFECRounds(kDataSize, 2, kBlockSize);
+  ASSERT_EQ(2u, rounds);
+  const uint64_t fec_size = rounds * 2 * kBlockSize;
+  brillo::Blob part_data(kDataSize + fec_size);
+  test_utils::FillWithData(&part_data);
+  test_utils::WriteFileVector(partition_.target_path, part_data);
+  ASSERT_TRUE(VerityWriterAndroid::EncodeFEC(partition_.target_path,
+                                             0,
+                                             kDataSize,
+                                             kDataSize,
+                                             fec_size,
+                                             2,
+                                             kBlockSize,
+                                             false /* verify_mode */));
+  ASSERT_TRUE(VerityWriterAndroid::EncodeFEC(partition_.target_path,
+                                             0,
+                                             kDataSize,
+                                             kDataSize,
+                                             fec_size,
+                                             2,
+                                             kBlockSize,
+                                             true /* verify_mode */));
+  auto verify_rounds = [&](uint64_t first_round, uint64_t num_rounds) {
+    return VerityWriterAndroid::VerifyFECRounds(partition_fd_.get(),
+                                                0,
+                                                kDataSize,
+                                                kDataSize,
+                                                fec_size,
+                                                2,
+                                                kBlockSize,
+                                                first_round,
+                                                num_rounds);
+  };
+  EXPECT_TRUE(verify_rounds(0, 1));
+  EXPECT_TRUE(verify_rounds(1, 1));
+  EXPECT_FALSE(verify_rounds(1, 2));
+
+  // Corrupt the FEC data of the second round only.
+  const off_t corrupt_offset = kDataSize + 2 * kBlockSize;
+  brillo::Blob fec_byte(1);
+  ssize_t bytes_read = 0;
+  ASSERT_TRUE(utils::PReadAll(
+      partition_fd_, fec_byte.data(), 1, corrupt_offset, &bytes_read));
+  fec_byte[0] ^= 0xff;
+  ASSERT_TRUE(
+      utils::PWriteAll(partition_fd_, fec_byte.data(), 1, corrupt_offset));
+  EXPECT_TRUE(verify_rounds(0, 1));
+  EXPECT_FALSE(verify_rounds(1, 1));
+}
+
 TEST_F(VerityWriterAndroidTest, HashTreeDisabled) {
   partition_.hash_tree_size = 0;
   partition_.hash_tree_data_size = 0;
@@ -31,7 +31,9 @@ bool XORExtentWriter::WriteExtent(const void* bytes,
   brillo::Blob xor_block_data;
   const auto xor_extents = xor_map_.GetIntersectingExtents(extent);
   for (const auto& xor_ext : xor_extents) {
-    const auto merge_op_opt = xor_map_.Get(xor_ext);
+    // |extent| may be only a part of an install op extent, so |xor_ext| can
+    // be a part of a merge op.
+    const auto merge_op_opt = xor_map_.GetContaining(xor_ext);
     if (!merge_op_opt.has_value()) {
       // If a file in the target build contains duplicate blocks, e.g.
       // [120503-120514], [120503-120503], we can end up here. If that's the
@@ -48,12 +50,6 @@ bool XORExtentWriter::WriteExtent(const void* bytes,
     const auto merge_op = merge_op_opt.value();
     TEST_AND_RETURN_FALSE(merge_op->has_src_extent());
     TEST_AND_RETURN_FALSE(merge_op->has_dst_extent());
-    if (merge_op->dst_extent() != xor_ext) {
-      LOG(ERROR) << "Each xor extent is expected to correspond to a complete "
-                    "MergeOp, extent in value: "
-                 << merge_op->dst_extent() << " extent in key: " << xor_ext;
-      return false;
-    }
     if (xor_ext.start_block() + xor_ext.num_blocks() >
         extent.start_block() + extent.num_blocks()) {
       LOG(ERROR) << "CowXor merge op extent should be completely inside "
@@ -62,7 +58,9 @@ bool XORExtentWriter::WriteExtent(const void* bytes,
       return false;
     }
     const auto src_offset = merge_op->src_offset();
-    const auto src_block = merge_op->src_extent().start_block();
+    const auto src_block = merge_op->src_extent().start_block() +
+                           xor_ext.start_block() -
+                           merge_op->dst_extent().start_block();
     xor_block_data.resize(BlockSize() * xor_ext.num_blocks());
     ssize_t bytes_read = 0;
     TEST_AND_RETURN_FALSE_ERRNO(
@@ -131,4 +131,26 @@ TEST_F(XorExtentWriterTest, StreamTest) {
   ASSERT_TRUE(writer_.Write(zeros->data(), 9 * kBlockSize));
 }
 
+TEST_F(XorExtentWriterTest, SplitMergeOpTest) {
+  constexpr auto COW_XOR = CowMergeOperation::COW_XOR;
+  const auto op1 = CreateCowMergeOperation(
+      ExtentForRange(20, 2), ExtentForRange(5, 2), COW_XOR, 123);
+  ASSERT_TRUE(xor_map_.AddExtent(op1.dst_extent(), &op1));
+  *op_.add_src_extents() = op1.src_extent();
+  *op_.add_dst_extents() = op1.dst_extent();
+  XORExtentWriter writer_{op_, source_fd_, &cow_writer_, xor_map_};
+
+  // Writing one block at a time writes each block on its own, so each block
+  // is XOR-ed with its own source block.
+  EXPECT_CALL(cow_writer_, EmitXorBlocks(5, _, kBlockSize, 20, 123))
+      .WillOnce(Return(true));
+  EXPECT_CALL(cow_writer_, EmitXorBlocks(6, _, kBlockSize, 21, 123))
+      .WillOnce(Return(true));
+
+  auto zeros = utils::GetReadonlyZeroBlock(kBlockSize * 2);
+  ASSERT_TRUE(writer_.Init(op_.dst_extents(), kBlockSize));
+  ASSERT_TRUE(writer_.Write(zeros->data(), kBlockSize));
+  ASSERT_TRUE(writer_.Write(zeros->data() + kBlockSize, kBlockSize));
+}
+
 }  // namespace chromeos_update_engine
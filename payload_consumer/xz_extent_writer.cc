@@ -16,6 +16,8 @@
 
 #include "update_engine/payload_consumer/xz_extent_writer.h"
 
+#include "update_engine/payload_consumer/payload_constants.h"
+
 using google::protobuf::RepeatedPtrField;
 
 namespace chromeos_update_engine {
@@ -50,8 +52,34 @@ const char* XzErrorString(enum xz_ret error) {
   }
 #undef __XZ_ERROR_STRING_CASE
 }
+
+// An AArch64 BL instruction compressed with the ARM64 BCJ filter:
+// printf '\x00\x00\x00\x94' | xz --check=none --arm64 --lzma2=preset=0
+const uint8_t kArm64FilterStream[] = {
+    0xfd, 0x37, 0x7a, 0x58, 0x5a, 0x00, 0x00, 0x00, 0xff, 0x12, 0xd9,
+    0x41, 0x02, 0x01, 0x0a, 0x00, 0x21, 0x01, 0x0c, 0x00, 0xa6, 0x1d,
+    0x12, 0x95, 0x01, 0x00, 0x03, 0x00, 0x00, 0x00, 0x94, 0x00, 0x00,
+    0x01, 0x14, 0x04, 0x67, 0xa6, 0x45, 0x09, 0x06, 0x72, 0x9e, 0x7a,
+    0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x59, 0x5a};
 }  // namespace
 
+bool XzExtentWriter::Arm64FilterSupported() {
+  static const bool supported = []() {
+    std::unique_ptr<xz_dec, xz_deleter> stream(xz_dec_init(XZ_SINGLE, 0));
+    if (!stream) {
+      return false;
+    }
+    uint8_t output[4];
+    xz_buf request{};
+    request.in = kArm64FilterStream;
+    request.in_size = sizeof(kArm64FilterStream);
+    request.out = output;
+    request.out_size = sizeof(output);
+    return xz_dec_run(stream.get(), &request) == XZ_STREAM_END;
+  }();
+  return supported;
+}
+
 XzExtentWriter::~XzExtentWriter() {
   stream_.reset();
   TEST_AND_RETURN(input_buffer_.empty());
@@ -89,6 +117,9 @@ bool XzExtentWriter::Write(const void* bytes, size_t count) {
     xz_ret ret = xz_dec_run(stream_.get(), &request);
     if (ret != XZ_OK && ret != XZ_STREAM_END) {
       LOG(ERROR) << "xz_dec_run returned " << XzErrorString(ret);
+      LOG_IF(ERROR, ret == XZ_OPTIONS_ERROR && !Arm64FilterSupported())
+          << "The xz decoder doesn't support the ARM64 filter of minor version "
+          << kXzArm64MinorPayloadVersion << " payloads.";
       return false;
     }
 
@@ -47,6 +47,10 @@ class XzExtentWriter : public ExtentWriter {
             uint32_t block_size) override;
   bool Write(const void* bytes, size_t count) override;
 
+  // Returns whether xz-embedded was built with the ARM64 BCJ filter, which
+  // REPLACE_XZ operations may use from kXzArm64MinorPayloadVersion on.
+  static bool Arm64FilterSupported();
+
  private:
   // The underlying ExtentWriter.
   std::unique_ptr<ExtentWriter> underlying_writer_;
@@ -81,7 +81,10 @@ bool ABGenerator::GenerateOperations(const PayloadGenerationConfig& config,
 
 void ABGenerator::SortOperationsByDestination(
     vector<AnnotatedOperation>* aops) {
-  sort(aops->begin(), aops->end(), diff_utils::CompareAopsByDestination);
+  // Stable, so the order of the operations never depends on the sort
+  // implementation.
+  std::stable_sort(
+      aops->begin(), aops->end(), diff_utils::CompareAopsByDestination);
 }
 
 bool ABGenerator::FragmentOperations(const PayloadVersion& version,
@@ -38,6 +38,18 @@ off_t BlobFileWriter::StoreBlob(const brillo::Blob& blob) {
   return result;
 }
 
+bool BlobFileWriter::LoadBlob(off_t offset,
+                              size_t size,
+                              brillo::Blob* blob) const {
+  // Stored blobs are never rewritten, so they can be read without the lock.
+  blob->resize(size);
+  ssize_t bytes_read = 0;
+  TEST_AND_RETURN_FALSE(
+      utils::PReadAll(blob_fd_, blob->data(), size, offset, &bytes_read));
+  TEST_AND_RETURN_FALSE(static_cast<size_t>(bytes_read) == size);
+  return true;
+}
+
 void BlobFileWriter::IncTotalBlobs(size_t increment) {
   base::AutoLock auto_lock(blob_mutex_);
   total_blobs_ += increment;
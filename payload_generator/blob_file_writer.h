@@ -35,6 +35,10 @@ class BlobFileWriter {
   // was stored, or -1 in case of failure.
   off_t StoreBlob(const brillo::Blob& blob);
 
+  // Reads back the |size| bytes of a blob previously stored at |offset|.
+  // Thread safe.
+  bool LoadBlob(off_t offset, size_t size, brillo::Blob* blob) const;
+
   // Increase |total_blobs| by |increment|. Thread safe.
   void IncTotalBlobs(size_t increment);
 
@@ -16,12 +16,16 @@
 
 #include "update_engine/payload_generator/boot_img_filesystem.h"
 
+#include <algorithm>
+
 #include <base/logging.h>
 #include <bootimg.h>
 #include <brillo/secure_blob.h>
+#include <lz4.h>
 #include <puffin/utils.h>
 
 #include "update_engine/common/utils.h"
+#include "update_engine/lz4diff/lz4diff_compress.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 
@@ -31,14 +35,147 @@ using std::vector;
 
 namespace chromeos_update_engine {
 
+namespace {
+
+// The magic number starting the LZ4 legacy frames the kernel and the Android
+// build compress kernels and ramdisks with, made of independent blocks of up
+// to 8 MiB each preceded by their little endian compressed size.
+constexpr uint32_t kLz4LegacyMagic = 0x184C2102;
+constexpr int kLz4LegacyBlockSize = 8 * 1024 * 1024;
+
+// lz4diff patches the bytes recompressing the new file doesn't reproduce, as
+// long as less than this fraction of them differ.
+constexpr uint64_t kMaxRecompressionMismatchRatio = 16;
+
+uint32_t ReadLE32(const uint8_t* data) {
+  return data[0] | (data[1] << 8) | (data[2] << 16) |
+         (static_cast<uint32_t>(data[3]) << 24);
+}
+
+bool IsLz4LegacyFrame(const uint8_t* data, uint64_t size) {
+  return size >= sizeof(uint32_t) && ReadLE32(data) == kLz4LegacyMagic;
+}
+
+// Appends to |blocks| |compressed_length| bytes holding |uncompressed_length|
+// bytes once decompressed, merging the bytes stored as is.
+void AppendBlock(uint64_t compressed_length,
+                 uint64_t uncompressed_length,
+                 vector<CompressedBlock>* blocks) {
+  if (compressed_length == 0) {
+    return;
+  }
+  uint64_t uncompressed_offset = 0;
+  if (!blocks->empty()) {
+    CompressedBlock& last = blocks->back();
+    if (compressed_length == uncompressed_length && !last.IsCompressed()) {
+      last.compressed_length += compressed_length;
+      last.uncompressed_length += uncompressed_length;
+      return;
+    }
+    uncompressed_offset = last.uncompressed_offset + last.uncompressed_length;
+  }
+  blocks->emplace_back(
+      uncompressed_offset, compressed_length, uncompressed_length);
+}
+
+// Appends to |blocks| the bytes [begin, end) of |data|, describing the blocks
+// of the LZ4 legacy frames they start with. Anything after the frames, like
+// the uncompressed size the kernel appends, is stored as is. Returns whether
+// any block is compressed.
+bool AppendLz4LegacyFrames(const brillo::Blob& data,
+                           uint64_t begin,
+                           uint64_t end,
+                           vector<CompressedBlock>* blocks) {
+  bool compressed = false;
+  brillo::Blob buffer(kLz4LegacyBlockSize);
+  uint64_t pos = begin;
+  while (IsLz4LegacyFrame(data.data() + pos, end - pos)) {
+    AppendBlock(sizeof(uint32_t), sizeof(uint32_t), blocks);
+    pos += sizeof(uint32_t);
+    while (end - pos >= sizeof(uint32_t)) {
+      // A frame ends with the data or where another one starts.
+      const uint32_t block_size = ReadLE32(data.data() + pos);
+      if (block_size == 0 || block_size == kLz4LegacyMagic ||
+          block_size > end - pos - sizeof(uint32_t)) {
+        break;
+      }
+      const int decompressed_size = LZ4_decompress_safe(
+          reinterpret_cast<const char*>(data.data() + pos + sizeof(uint32_t)),
+          reinterpret_cast<char*>(buffer.data()),
+          block_size,
+          kLz4LegacyBlockSize);
+      if (decompressed_size < 0) {
+        break;
+      }
+      AppendBlock(sizeof(uint32_t), sizeof(uint32_t), blocks);
+      // Incompressible blocks are bigger than their data, keep them as is.
+      if (block_size < static_cast<uint32_t>(decompressed_size)) {
+        AppendBlock(block_size, decompressed_size, blocks);
+        compressed = true;
+      } else {
+        AppendBlock(block_size, block_size, blocks);
+      }
+      pos += sizeof(uint32_t) + block_size;
+    }
+  }
+  AppendBlock(end - pos, end - pos, blocks);
+  return compressed;
+}
+
+// Looks for the compression settings lz4diff reproduces the LZ4 blocks of
+// |info| in |data| with, and sets them in |info|. Returns false if none
+// recompresses the blocks closely enough.
+bool FindLz4RecompressionAlgo(const brillo::Blob& data, CompressedFile* info) {
+  // mkbootimg and the kernel compress with lz4 -l -12, lz4 defaults to -1.
+  vector<CompressionAlgorithm> algos(3);
+  algos[0].set_type(CompressionAlgorithm::LZ4HC);
+  algos[0].set_level(12);
+  algos[1].set_type(CompressionAlgorithm::LZ4HC);
+  algos[1].set_level(9);
+  algos[2].set_type(CompressionAlgorithm::LZ4);
+
+  const brillo::Blob decompressed =
+      TryDecompressBlob(data, info->blocks, info->zero_padding_enabled);
+  TEST_AND_RETURN_FALSE(!decompressed.empty());
+  for (const CompressionAlgorithm& algo : algos) {
+    const brillo::Blob recompressed =
+        TryCompressBlob(ToStringView(decompressed),
+                        info->blocks,
+                        info->zero_padding_enabled,
+                        algo);
+    if (recompressed.size() != data.size()) {
+      continue;
+    }
+    uint64_t mismatches = 0;
+    for (size_t i = 0; i < data.size(); i++) {
+      mismatches += data[i] != recompressed[i];
+    }
+    if (mismatches * kMaxRecompressionMismatchRatio <= data.size()) {
+      info->algo = algo;
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace
+
 unique_ptr<BootImgFilesystem> BootImgFilesystem::CreateFromFile(
     const string& filename) {
   if (filename.empty())
     return nullptr;
 
-  if (brillo::Blob header_magic;
-      !utils::ReadFileChunk(filename, 0, BOOT_MAGIC_SIZE, &header_magic) ||
-      memcmp(header_magic.data(), BOOT_MAGIC, BOOT_MAGIC_SIZE) != 0) {
+  brillo::Blob header_magic;
+  if (!utils::ReadFileChunk(filename, 0, BOOT_MAGIC_SIZE, &header_magic) ||
+      header_magic.size() != BOOT_MAGIC_SIZE) {
+    return nullptr;
+  }
+  static_assert(VENDOR_BOOT_MAGIC_SIZE == BOOT_MAGIC_SIZE);
+  if (memcmp(header_magic.data(), VENDOR_BOOT_MAGIC, VENDOR_BOOT_MAGIC_SIZE) ==
+      0) {
+    return CreateFromVendorBootFile(filename);
+  }
+  if (memcmp(header_magic.data(), BOOT_MAGIC, BOOT_MAGIC_SIZE) != 0) {
     return nullptr;
   }
 
@@ -103,6 +240,85 @@ unique_ptr<BootImgFilesystem> BootImgFilesystem::CreateFromFile(
   return result;
 }
 
+unique_ptr<BootImgFilesystem> BootImgFilesystem::CreateFromVendorBootFile(
+    const string& filename) {
+  // Version 4 only appends fields to the version 3 header, and the header
+  // version follows the magic in both.
+  brillo::Blob header_blob;
+  if (!utils::ReadFileChunk(
+          filename, 0, sizeof(vendor_boot_img_hdr_v4), &header_blob) ||
+      header_blob.size() < sizeof(vendor_boot_img_hdr_v3)) {
+    return nullptr;
+  }
+  auto hdr_v3 = reinterpret_cast<vendor_boot_img_hdr_v3*>(header_blob.data());
+  if (hdr_v3->header_version < 3 || hdr_v3->header_version > 4) {
+    LOG(WARNING) << "Vendor boot image header version "
+                 << hdr_v3->header_version << " isn't supported for parsing";
+    return nullptr;
+  }
+  if (hdr_v3->page_size == 0) {
+    LOG(WARNING) << "Vendor boot image " << filename << " has no page size";
+    return nullptr;
+  }
+
+  unique_ptr<BootImgFilesystem> result(new BootImgFilesystem());
+  result->filename_ = filename;
+  result->vendor_boot_ = true;
+  result->page_size_ = hdr_v3->page_size;
+  result->header_size_ = hdr_v3->header_size;
+  result->ramdisk_size_ = hdr_v3->vendor_ramdisk_size;
+  if (hdr_v3->header_version < 4 ||
+      header_blob.size() < sizeof(vendor_boot_img_hdr_v4)) {
+    return result;
+  }
+
+  // The vendor ramdisk table follows the vendor ramdisks and the DTB. Each
+  // ramdisk is compressed on its own.
+  auto hdr_v4 = reinterpret_cast<vendor_boot_img_hdr_v4*>(header_blob.data());
+  const uint64_t entry_size = hdr_v4->vendor_ramdisk_table_entry_size;
+  const uint64_t entry_num = hdr_v4->vendor_ramdisk_table_entry_num;
+  if (entry_num == 0 || entry_size < sizeof(vendor_ramdisk_table_entry_v4) ||
+      hdr_v4->vendor_ramdisk_table_size < entry_num * entry_size) {
+    return result;
+  }
+  const uint64_t table_offset =
+      utils::RoundUp(hdr_v4->header_size, hdr_v4->page_size) +
+      utils::RoundUp(hdr_v4->vendor_ramdisk_size, hdr_v4->page_size) +
+      utils::RoundUp(hdr_v4->dtb_size, hdr_v4->page_size);
+  brillo::Blob table;
+  if (!utils::ReadFileChunk(
+          filename, table_offset, entry_num * entry_size, &table) ||
+      table.size() != entry_num * entry_size) {
+    LOG(WARNING) << "Failed to read the vendor ramdisk table of " << filename;
+    return result;
+  }
+  vector<Stream> ramdisks;
+  for (uint64_t i = 0; i < entry_num; i++) {
+    auto entry = reinterpret_cast<vendor_ramdisk_table_entry_v4*>(
+        table.data() + i * entry_size);
+    const uint64_t end =
+        static_cast<uint64_t>(entry->ramdisk_offset) + entry->ramdisk_size;
+    if (end > hdr_v4->vendor_ramdisk_size) {
+      LOG(WARNING) << "Vendor ramdisk " << i << " of " << filename
+                   << " is out of the vendor ramdisk section";
+      return result;
+    }
+    ramdisks.push_back({entry->ramdisk_offset, entry->ramdisk_size});
+  }
+  std::sort(
+      ramdisks.begin(), ramdisks.end(), [](const Stream& a, const Stream& b) {
+        return a.offset < b.offset;
+      });
+  for (size_t i = 1; i < ramdisks.size(); i++) {
+    if (ramdisks[i - 1].offset + ramdisks[i - 1].size > ramdisks[i].offset) {
+      LOG(WARNING) << "Overlapping vendor ramdisks in " << filename;
+      return result;
+    }
+  }
+  result->vendor_ramdisks_ = std::move(ramdisks);
+  return result;
+}
+
 size_t BootImgFilesystem::GetBlockSize() const {
   // Page size may not be 4K, but we currently only support 4K block size.
   return kBlockSize;
@@ -112,35 +328,96 @@ size_t BootImgFilesystem::GetBlockCount() const {
   return utils::DivRoundUp(utils::FileSize(filename_), kBlockSize);
 }
 
-FilesystemInterface::File BootImgFilesystem::GetFile(const string& name,
-                                                     uint64_t offset,
-                                                     uint64_t size) const {
+FilesystemInterface::File BootImgFilesystem::GetFile(
+    const string& name,
+    uint64_t offset,
+    uint64_t size,
+    const vector<Stream>& streams) const {
   File file;
   file.name = name;
   file.extents = {ExtentForBytes(kBlockSize, offset, size)};
 
   brillo::Blob data;
-  if (utils::ReadFileChunk(filename_, offset, size, &data)) {
+  if (!utils::ReadFileChunk(filename_, offset, size, &data) ||
+      data.size() != size) {
+    return file;
+  }
+  vector<Stream> file_streams = streams;
+  if (file_streams.empty()) {
+    file_streams.push_back({0, size});
+  }
+
+  bool has_lz4 = false;
+  for (const Stream& stream : file_streams) {
+    const uint8_t* stream_data = data.data() + stream.offset;
     constexpr size_t kGZipHeaderSize = 10;
     // Check GZip header magic.
-    if (data.size() > kGZipHeaderSize && data[0] == 0x1F && data[1] == 0x8B) {
-      if (!puffin::LocateDeflatesInGzip(data, &file.deflates)) {
+    if (stream.size > kGZipHeaderSize && stream_data[0] == 0x1F &&
+        stream_data[1] == 0x8B) {
+      vector<puffin::BitExtent> deflates;
+      if (!puffin::LocateDeflatesInGzip(
+              brillo::Blob(stream_data, stream_data + stream.size),
+              &deflates)) {
         LOG(ERROR) << "Error occurred parsing gzip " << name << " at offset "
-                   << offset << " of " << filename_ << ", found "
-                   << file.deflates.size() << " deflates.";
+                   << offset + stream.offset << " of " << filename_
+                   << ", found " << deflates.size() << " deflates.";
         return file;
       }
-      for (auto& deflate : file.deflates) {
-        deflate.offset += offset * 8;
+      for (auto& deflate : deflates) {
+        deflate.offset += (offset + stream.offset) * 8;
+        file.deflates.push_back(deflate);
       }
     }
+    has_lz4 = has_lz4 || IsLz4LegacyFrame(stream_data, stream.size);
   }
+  if (!has_lz4) {
+    return file;
+  }
+
+  // lz4diff reads and writes the whole blocks of the file, describe them all.
+  const uint64_t start = file.extents[0].start_block() * kBlockSize;
+  const uint64_t end = start + file.extents[0].num_blocks() * kBlockSize;
+  brillo::Blob blocks_data;
+  if (!utils::ReadFileChunk(filename_, start, end - start, &blocks_data) ||
+      blocks_data.size() != end - start) {
+    return file;
+  }
+  CompressedFile info;
+  bool compressed = false;
+  uint64_t pos = 0;
+  for (const Stream& stream : file_streams) {
+    const uint64_t stream_start = offset - start + stream.offset;
+    AppendBlock(stream_start - pos, stream_start - pos, &info.blocks);
+    pos = stream_start + stream.size;
+    compressed = AppendLz4LegacyFrames(
+                     blocks_data, stream_start, pos, &info.blocks) ||
+                 compressed;
+  }
+  AppendBlock(end - start - pos, end - start - pos, &info.blocks);
+  if (!compressed) {
+    return file;
+  }
+  if (!FindLz4RecompressionAlgo(blocks_data, &info)) {
+    LOG(INFO) << "LZ4 blocks of " << name << " in " << filename_
+              << " can't be recompressed the same, diffing them compressed.";
+    return file;
+  }
+  file.compressed_file_info = std::move(info);
   return file;
 }
 
 bool BootImgFilesystem::GetFiles(vector<File>* files) const {
   files->clear();
   const uint64_t file_size = utils::FileSize(filename_);
+  if (vendor_boot_) {
+    // The header pages are followed by the vendor ramdisks.
+    const uint64_t offset = utils::RoundUp(header_size_, page_size_);
+    if (ramdisk_size_ > 0 && offset + ramdisk_size_ <= file_size) {
+      files->emplace_back(GetFile(
+          "<vendor ramdisk>", offset, ramdisk_size_, vendor_ramdisks_));
+    }
+    return true;
+  }
   // The first page is header.
   uint64_t offset = page_size_;
   if (kernel_size_ > 0 && offset + kernel_size_ <= file_size) {
@@ -27,7 +27,8 @@ namespace chromeos_update_engine {
 
 class BootImgFilesystem : public FilesystemInterface {
  public:
-  // Creates an BootImgFilesystem from an Android boot.img file.
+  // Creates an BootImgFilesystem from an Android boot.img or vendor_boot.img
+  // file.
   static std::unique_ptr<BootImgFilesystem> CreateFromFile(
       const std::string& filename);
   ~BootImgFilesystem() override = default;
@@ -37,7 +38,7 @@ class BootImgFilesystem : public FilesystemInterface {
   size_t GetBlockCount() const override;
 
   // GetFiles will return one FilesystemInterface::File for kernel and one for
-  // ramdisk.
+  // ramdisk, or one for all the vendor ramdisks of a vendor_boot image.
   bool GetFiles(std::vector<File>* files) const override;
 
   bool LoadSettings(brillo::KeyValueStore* store) const override;
@@ -45,9 +46,24 @@ class BootImgFilesystem : public FilesystemInterface {
  private:
   friend class BootImgFilesystemTest;
 
+  // A compressed stream in a file of the image, in bytes from the start of
+  // the file.
+  struct Stream {
+    uint64_t offset;
+    uint64_t size;
+  };
+
   BootImgFilesystem() = default;
 
-  File GetFile(const std::string& name, uint64_t offset, uint64_t size) const;
+  static std::unique_ptr<BootImgFilesystem> CreateFromVendorBootFile(
+      const std::string& filename);
+
+  // Returns the file of the |size| bytes at |offset| of the image, made of
+  // the compressed |streams|, or of a single one if empty.
+  File GetFile(const std::string& name,
+               uint64_t offset,
+               uint64_t size,
+               const std::vector<Stream>& streams = {}) const;
 
   // The boot.img file path.
   std::string filename_;
@@ -57,6 +73,13 @@ class BootImgFilesystem : public FilesystemInterface {
   uint32_t signature_size_ = 0; /* size in bytes */
   uint32_t page_size_ = 4096;   /* flash page size we assume */
 
+  // Whether the file is a vendor_boot image, whose header of |header_size_|
+  // bytes is followed by the vendor ramdisks in |ramdisk_size_| bytes.
+  bool vendor_boot_ = false;
+  uint32_t header_size_ = 0; /* size in bytes */
+  // The ramdisks of the vendor ramdisk table, sorted by offset.
+  std::vector<Stream> vendor_ramdisks_;
+
   DISALLOW_COPY_AND_ASSIGN(BootImgFilesystem);
 };
 
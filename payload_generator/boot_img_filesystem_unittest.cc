@@ -16,14 +16,17 @@
 
 #include "update_engine/payload_generator/boot_img_filesystem.h"
 
+#include <string>
 #include <vector>
 
 #include <bootimg.h>
 #include <brillo/secure_blob.h>
 #include <gtest/gtest.h>
+#include <lz4hc.h>
 
 #include "update_engine/common/test_utils.h"
 #include "update_engine/common/utils.h"
+#include "update_engine/lz4diff/lz4diff_compress.h"
 
 namespace chromeos_update_engine {
 
@@ -63,6 +66,33 @@ class BootImgFilesystemTest : public ::testing::Test {
     return boot_img;
   }
 
+  // Compresses |data| in an LZ4 legacy frame of a single block, like
+  // lz4 -l -12 does.
+  brillo::Blob GetLz4LegacyFrame(const brillo::Blob& data) {
+    brillo::Blob frame = {0x02, 0x21, 0x4C, 0x18, 0, 0, 0, 0};
+    frame.resize(frame.size() + LZ4_compressBound(data.size()));
+    const int size =
+        LZ4_compress_HC(reinterpret_cast<const char*>(data.data()),
+                        reinterpret_cast<char*>(frame.data() + 8),
+                        data.size(),
+                        frame.size() - 8,
+                        12);
+    EXPECT_GT(size, 0);
+    memcpy(frame.data() + 4, &size, sizeof(size));
+    frame.resize(8 + size);
+    return frame;
+  }
+
+  // Returns |size| bytes of repeated text.
+  brillo::Blob GetText(size_t size) {
+    const std::string text = "init.rc ueventd.rc /system/bin/init ";
+    brillo::Blob data(size);
+    for (size_t i = 0; i < size; i++) {
+      data[i] = text[i % text.size()];
+    }
+    return data;
+  }
+
   ScopedTempFile boot_file_;
 };
 
@@ -154,4 +184,98 @@ TEST_F(BootImgFilesystemTest, GZipRamdiskTest) {
   EXPECT_EQ(1u, files[1].deflates.size());
 }
 
+TEST_F(BootImgFilesystemTest, Lz4RamdiskTest) {
+  const brillo::Blob ramdisk_data = GetText(20000);
+  const brillo::Blob ramdisk = GetLz4LegacyFrame(ramdisk_data);
+  ASSERT_LT(ramdisk.size(), 4096u);
+  test_utils::WriteFileVector(boot_file_.path(),
+                              GetBootImg(brillo::Blob(1234, 'k'), ramdisk));
+  unique_ptr<BootImgFilesystem> fs =
+      BootImgFilesystem::CreateFromFile(boot_file_.path());
+  ASSERT_NE(nullptr, fs);
+
+  vector<FilesystemInterface::File> files;
+  EXPECT_TRUE(fs->GetFiles(&files));
+  ASSERT_EQ(2u, files.size());
+  EXPECT_TRUE(files[0].compressed_file_info.blocks.empty());
+
+  EXPECT_EQ("<ramdisk>", files[1].name);
+  ASSERT_EQ(1u, files[1].extents.size());
+  EXPECT_EQ(2u, files[1].extents[0].start_block());
+  EXPECT_EQ(1u, files[1].extents[0].num_blocks());
+  EXPECT_TRUE(files[1].deflates.empty());
+
+  // The headers of the frame and of the block, the block, and the rest of the
+  // file block stored as is.
+  const CompressedFile& info = files[1].compressed_file_info;
+  ASSERT_EQ(3u, info.blocks.size());
+  EXPECT_EQ(8u, info.blocks[0].compressed_length);
+  EXPECT_FALSE(info.blocks[0].IsCompressed());
+  EXPECT_EQ(ramdisk.size() - 8, info.blocks[1].compressed_length);
+  EXPECT_EQ(ramdisk_data.size(), info.blocks[1].uncompressed_length);
+  EXPECT_EQ(4096u - ramdisk.size(), info.blocks[2].compressed_length);
+  EXPECT_FALSE(info.blocks[2].IsCompressed());
+  EXPECT_EQ(CompressionAlgorithm::LZ4HC, info.algo.type());
+  EXPECT_EQ(12, info.algo.level());
+
+  brillo::Blob block(4096);
+  memcpy(block.data(), ramdisk.data(), ramdisk.size());
+  const brillo::Blob decompressed =
+      TryDecompressBlob(block, info.blocks, false);
+  ASSERT_EQ(4096u - ramdisk.size() + 8 + ramdisk_data.size(),
+            decompressed.size());
+  EXPECT_EQ(ramdisk_data,
+            brillo::Blob(decompressed.begin() + 8,
+                         decompressed.begin() + 8 + ramdisk_data.size()));
+}
+
+TEST_F(BootImgFilesystemTest, VendorBootRamdiskTableTest) {
+  const brillo::Blob first = GetLz4LegacyFrame(GetText(10000));
+  const brillo::Blob second = GetLz4LegacyFrame(GetText(30000));
+  constexpr uint32_t page_size = 4096;
+
+  brillo::Blob vendor_boot_img(3 * page_size);
+  vendor_boot_img_hdr_v4 hdr{};
+  memcpy(hdr.magic, VENDOR_BOOT_MAGIC, VENDOR_BOOT_MAGIC_SIZE);
+  hdr.header_version = 4;
+  hdr.page_size = page_size;
+  hdr.header_size = sizeof(hdr);
+  hdr.vendor_ramdisk_size = first.size() + second.size();
+  hdr.vendor_ramdisk_table_size = 2 * sizeof(vendor_ramdisk_table_entry_v4);
+  hdr.vendor_ramdisk_table_entry_num = 2;
+  hdr.vendor_ramdisk_table_entry_size = sizeof(vendor_ramdisk_table_entry_v4);
+  memcpy(vendor_boot_img.data(), &hdr, sizeof(hdr));
+  memcpy(vendor_boot_img.data() + page_size, first.data(), first.size());
+  memcpy(vendor_boot_img.data() + page_size + first.size(),
+         second.data(),
+         second.size());
+  // The table lists the ramdisks out of order.
+  vendor_ramdisk_table_entry_v4 entries[2]{};
+  entries[0].ramdisk_offset = first.size();
+  entries[0].ramdisk_size = second.size();
+  entries[1].ramdisk_size = first.size();
+  memcpy(vendor_boot_img.data() + 2 * page_size, entries, sizeof(entries));
+  test_utils::WriteFileVector(boot_file_.path(), vendor_boot_img);
+
+  unique_ptr<BootImgFilesystem> fs =
+      BootImgFilesystem::CreateFromFile(boot_file_.path());
+  ASSERT_NE(nullptr, fs);
+  vector<FilesystemInterface::File> files;
+  EXPECT_TRUE(fs->GetFiles(&files));
+  ASSERT_EQ(1u, files.size());
+  EXPECT_EQ("<vendor ramdisk>", files[0].name);
+  ASSERT_EQ(1u, files[0].extents.size());
+  EXPECT_EQ(1u, files[0].extents[0].start_block());
+  EXPECT_EQ(1u, files[0].extents[0].num_blocks());
+
+  // Each ramdisk has its own frame.
+  const CompressedFile& info = files[0].compressed_file_info;
+  ASSERT_EQ(5u, info.blocks.size());
+  EXPECT_EQ(first.size() - 8, info.blocks[1].compressed_length);
+  EXPECT_EQ(10000u, info.blocks[1].uncompressed_length);
+  EXPECT_EQ(8u, info.blocks[2].compressed_length);
+  EXPECT_EQ(second.size() - 8, info.blocks[3].compressed_length);
+  EXPECT_EQ(30000u, info.blocks[3].uncompressed_length);
+}
+
 }  // namespace chromeos_update_engine
@@ -0,0 +1,111 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/content_sketch.h"
+
+#include <algorithm>
+#include <array>
+#include <utility>
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// Features of the sketches are taken about once every 256 bytes.
+constexpr unsigned int kSketchSpacingBits = 8;
+
+// splitmix64, used both to fill the gear table and to spread the feature
+// hashes over the whole 64-bit range.
+uint64_t Mix(uint64_t x) {
+  x += 0x9e3779b97f4a7c15ULL;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return x ^ (x >> 31);
+}
+
+const std::array<uint64_t, 256>& GearTable() {
+  static const std::array<uint64_t, 256> table = [] {
+    std::array<uint64_t, 256> gear{};
+    for (size_t i = 0; i < gear.size(); i++) {
+      gear[i] = Mix(i);
+    }
+    return gear;
+  }();
+  return table;
+}
+
+}  // namespace
+
+void ForEachContentFeature(
+    const uint8_t* data,
+    size_t size,
+    unsigned int spacing_bits,
+    const std::function<void(size_t offset, uint64_t hash)>& callback) {
+  const auto& gear = GearTable();
+  const uint64_t mask = (1ULL << spacing_bits) - 1;
+  uint64_t hash = 0;
+  for (size_t i = 0; i < size; i++) {
+    // Each byte is shifted out of the hash after 64 steps, so the hash only
+    // depends on the last 64 bytes.
+    hash = (hash << 1) + gear[data[i]];
+    if ((hash & mask) == 0) {
+      callback(i, Mix(hash));
+    }
+  }
+}
+
+ContentSketch ContentSketch::FromData(const uint8_t* data, size_t size) {
+  std::vector<uint64_t> features;
+  ForEachContentFeature(
+      data, size, kSketchSpacingBits, [&features](size_t, uint64_t hash) {
+        features.push_back(hash);
+      });
+  std::sort(features.begin(), features.end());
+  features.erase(std::unique(features.begin(), features.end()),
+                 features.end());
+  if (features.size() > kSketchSize) {
+    features.resize(kSketchSize);
+  }
+
+  ContentSketch sketch;
+  sketch.hashes_ = std::move(features);
+  return sketch;
+}
+
+double ContentSketch::Similarity(const ContentSketch& other) const {
+  // Walk the smallest hashes of the union of both sets and count the ones
+  // present in both, an unbiased estimate of the Jaccard similarity.
+  size_t union_size = 0;
+  size_t common = 0;
+  auto a = hashes_.begin();
+  auto b = other.hashes_.begin();
+  while (union_size < kSketchSize &&
+         (a != hashes_.end() || b != other.hashes_.end())) {
+    if (b == other.hashes_.end() || (a != hashes_.end() && *a < *b)) {
+      a++;
+    } else if (a == hashes_.end() || *b < *a) {
+      b++;
+    } else {
+      common++;
+      a++;
+      b++;
+    }
+    union_size++;
+  }
+  return union_size == 0 ? 0 : static_cast<double>(common) / union_size;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,67 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_CONTENT_SKETCH_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_CONTENT_SKETCH_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace chromeos_update_engine {
+
+// Calls |callback| with the offset and hash of each content defined feature
+// of the |size| bytes at |data|. A feature is the hash of the 64 bytes ending
+// at its offset, and features are taken about once every 2^|spacing_bits|
+// bytes, at positions that only depend on the content around them.
+void ForEachContentFeature(
+    const uint8_t* data,
+    size_t size,
+    unsigned int spacing_bits,
+    const std::function<void(size_t offset, uint64_t hash)>& callback);
+
+// A bottom-k MinHash sketch of the content of a file, used to find which old
+// file a renamed or moved new file came from.
+//
+// The features of the file are taken with ForEachContentFeature(), so
+// insertions and deletions only change the features around them. The sketch
+// keeps the |kSketchSize| smallest distinct features, which is enough to
+// estimate the Jaccard similarity of the feature sets of two files.
+class ContentSketch {
+ public:
+  // The maximum number of feature hashes kept.
+  static constexpr size_t kSketchSize = 64;
+
+  ContentSketch() = default;
+
+  // Returns the sketch of the |size| bytes at |data|.
+  static ContentSketch FromData(const uint8_t* data, size_t size);
+
+  // Returns the estimated Jaccard similarity between the features of this and
+  // |other|, from 0 (nothing in common) to 1 (same features).
+  double Similarity(const ContentSketch& other) const;
+
+  bool empty() const { return hashes_.empty(); }
+
+ private:
+  // The smallest feature hashes, sorted and distinct.
+  std::vector<uint64_t> hashes_;
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_CONTENT_SKETCH_H_
@@ -0,0 +1,71 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/content_sketch.h"
+
+#include <random>
+
+#include <brillo/secure_blob.h>
+#include <gtest/gtest.h>
+
+namespace chromeos_update_engine {
+
+class ContentSketchTest : public ::testing::Test {
+ protected:
+  brillo::Blob RandomData(size_t size) {
+    std::uniform_int_distribution<uint8_t> dis(0, 255);
+    brillo::Blob data(size);
+    for (auto& byte : data) {
+      byte = dis(gen_);
+    }
+    return data;
+  }
+
+  ContentSketch Sketch(const brillo::Blob& data) {
+    return ContentSketch::FromData(data.data(), data.size());
+  }
+
+  std::mt19937 gen_{42};
+};
+
+TEST_F(ContentSketchTest, EmptyDataTest) {
+  EXPECT_TRUE(Sketch({}).empty());
+  EXPECT_EQ(0, Sketch({}).Similarity(Sketch({})));
+}
+
+TEST_F(ContentSketchTest, IdenticalDataTest) {
+  brillo::Blob data = RandomData(256 * 1024);
+  EXPECT_FALSE(Sketch(data).empty());
+  EXPECT_EQ(1, Sketch(data).Similarity(Sketch(data)));
+}
+
+TEST_F(ContentSketchTest, ShiftedDataTest) {
+  brillo::Blob data = RandomData(1024 * 1024);
+  brillo::Blob shifted = data;
+  // Insertions move all the following data, which block based hashes
+  // wouldn't match anymore.
+  shifted.insert(shifted.begin() + 100, 3, 0);
+  shifted.insert(shifted.begin() + 500000, 5000, 'x');
+  EXPECT_GT(Sketch(data).Similarity(Sketch(shifted)), 0.8);
+}
+
+TEST_F(ContentSketchTest, UnrelatedDataTest) {
+  EXPECT_LT(Sketch(RandomData(1024 * 1024))
+                .Similarity(Sketch(RandomData(1024 * 1024))),
+            0.1);
+}
+
+}  // namespace chromeos_update_engine
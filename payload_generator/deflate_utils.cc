@@ -17,15 +17,18 @@
 #include "update_engine/payload_generator/deflate_utils.h"
 
 #include <algorithm>
+#include <list>
 #include <string>
 #include <utility>
 
 #include <base/files/file_util.h>
 #include <base/logging.h>
 #include <base/strings/string_util.h>
+#include <base/threading/simple_thread.h>
 
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/delta_diff_utils.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/payload_generator/extent_utils.h"
 #include "update_engine/payload_generator/squashfs_filesystem.h"
@@ -111,8 +114,113 @@ bool IsBitExtentInExtent(const Extent& extent, const BitExtent& bit_extent) {
              ((extent.start_block() + extent.num_blocks()) * kBlockSize);
 }
 
-// Returns whether the given file |name| has an extension listed in
-// |extensions|.
+// Processes a file of a partition for PreprocessPartitionFiles(), which runs
+// them in a thread pool.
+class FilePreprocessTask : public base::DelegateSimpleThread::Delegate {
+ public:
+  FilePreprocessTask(const PartitionConfig& part,
+                     FilesystemInterface::File file,
+                     bool extract_deflates)
+      : part_(part),
+        file_(std::move(file)),
+        extract_deflates_(extract_deflates) {}
+  ~FilePreprocessTask() override = default;
+
+  // Overrides DelegateSimpleThread::Delegate.
+  void Run() override { success_ = Process(); }
+
+  bool success() const { return success_; }
+  // The files replacing the processed file.
+  const vector<FilesystemInterface::File>& files() const { return files_; }
+
+ private:
+  bool Process();
+
+  const PartitionConfig& part_;
+  FilesystemInterface::File file_;
+  const bool extract_deflates_;
+
+  vector<FilesystemInterface::File> files_;
+  bool success_{false};
+
+  DISALLOW_COPY_AND_ASSIGN(FilePreprocessTask);
+};
+
+bool FilePreprocessTask::Process() {
+  auto& file = file_;
+  auto is_regular_file = IsRegularFile(file);
+
+  if (is_regular_file && IsSquashfsImage(part_.path, file)) {
+    // Read the image into a file.
+    base::FilePath path;
+    TEST_AND_RETURN_FALSE(base::CreateTemporaryFile(&path));
+    ScopedPathUnlinker old_unlinker(path.value());
+    TEST_AND_RETURN_FALSE(
+        CopyExtentsToFile(part_.path, file.extents, path.value(), kBlockSize));
+    // Test if it is actually a Squashfs file.
+    auto sqfs = SquashfsFilesystem::CreateFromFile(path.value(),
+                                                   extract_deflates_,
+                                                   /*load_settings=*/false);
+    if (sqfs) {
+      // It is an squashfs file. Get its files to replace with itself.
+      vector<FilesystemInterface::File> files;
+      sqfs->GetFiles(&files);
+
+      // Replace squashfs file with its files only if |files| has at least two
+      // files or if it has some deflates (since it is better to replace it to
+      // take advantage of the deflates.)
+      if (files.size() > 1 ||
+          (files.size() == 1 && !files[0].deflates.empty())) {
+        TEST_AND_RETURN_FALSE(RealignSplittedFiles(file, &files));
+        files_ = std::move(files);
+        return true;
+      }
+    } else {
+      LOG(WARNING) << "We thought file: " << file.name
+                   << " was a Squashfs file, but it was not.";
+    }
+  }
+
+  if (is_regular_file && extract_deflates_ && !file.is_compressed) {
+    // Search for deflates if the file is in zip or gzip format.
+    // .zvoice files may eventually move out of rootfs. If that happens,
+    // remove ".zvoice" (crbug.com/782918).
+    bool is_zip = IsFileExtensions(
+        file.name, {".apk", ".zip", ".jar", ".zvoice", ".apex", "capex"});
+    bool is_gzip = IsFileExtensions(file.name, {".gz", ".gzip", ".tgz"});
+    if (is_zip || is_gzip) {
+      brillo::Blob data;
+      TEST_AND_RETURN_FALSE(utils::ReadExtents(
+          part_.path,
+          file.extents,
+          &data,
+          kBlockSize * utils::BlocksInExtents(file.extents),
+          kBlockSize));
+      // |data| read from disk always has size multiple of kBlockSize. So it
+      // might contain trailing garbage data and confuse the gzip/zip
+      // processors. Trim them.
+      if (file.file_stat.st_size > 0 &&
+          static_cast<size_t>(file.file_stat.st_size) < data.size()) {
+        data.resize(file.file_stat.st_size);
+      }
+      vector<puffin::BitExtent> deflates;
+      if (!DeflatePreprocessFileData(file.name, data, &deflates)) {
+        LOG(ERROR) << "Failed to preprocess deflate data in partition "
+                   << part_.name;
+        return false;
+      }
+      // Shift the deflate's extent to the offset starting from the beginning
+      // of the current partition; and the delta processor will align the
+      // extents in a continuous buffer later.
+      TEST_AND_RETURN_FALSE(
+          ShiftBitExtentsOverExtents(file.extents, &deflates));
+      file.deflates = std::move(deflates);
+    }
+  }
+
+  files_.push_back(std::move(file));
+  return true;
+}
 
 }  // namespace
 
@@ -192,46 +300,82 @@ bool ShiftBitExtentsOverExtents(const vector<Extent>& base_extents,
   TEST_LE(last_extent.offset + last_extent.length,
           utils::BlocksInExtents(base_extents) * kBlockSize);
 
-  for (auto o_ext = over_extents->begin(); o_ext != over_extents->end();) {
-    size_t gap_blocks = base_extents[0].start_block();
-    size_t last_end_block = base_extents[0].start_block();
-    bool o_ext_processed = false;
-    for (auto b_ext : base_extents) {  // We need to modify |b_ext|, so we copy.
-      gap_blocks += b_ext.start_block() - last_end_block;
-      last_end_block = b_ext.start_block() + b_ext.num_blocks();
-      b_ext.set_start_block(b_ext.start_block() - gap_blocks);
-      auto byte_o_ext = ExpandToByteExtent(*o_ext);
-      if (byte_o_ext.offset >= b_ext.start_block() * kBlockSize &&
-          byte_o_ext.offset <
-              (b_ext.start_block() + b_ext.num_blocks()) * kBlockSize) {
-        if ((byte_o_ext.offset + byte_o_ext.length) <=
-            (b_ext.start_block() + b_ext.num_blocks()) * kBlockSize) {
-          // |o_ext| is inside |b_ext|, increase its start block.
-          o_ext->offset += gap_blocks * kBlockSize * 8;
-          ++o_ext;
-        } else {
-          // |o_ext| spills over this |b_ext|, remove it.
-          o_ext = over_extents->erase(o_ext);
-        }
-        o_ext_processed = true;
-        break;  // We processed o_ext, so break the loop;
-      }
+  // The offset of each extent of |base_extents| once they are put together.
+  vector<uint64_t> base_offsets;
+  base_offsets.reserve(base_extents.size());
+  uint64_t base_bytes = 0;
+  for (const auto& b_ext : base_extents) {
+    base_offsets.push_back(base_bytes);
+    base_bytes += b_ext.num_blocks() * kBlockSize;
+  }
+
+  size_t kept = 0;
+  for (const auto& o_ext : *over_extents) {
+    auto byte_o_ext = ExpandToByteExtent(o_ext);
+    TEST_AND_RETURN_FALSE(byte_o_ext.offset < base_bytes);
+    // The last extent starting at or before |o_ext|, skipping the empty ones.
+    size_t idx = std::upper_bound(base_offsets.begin(),
+                                  base_offsets.end(),
+                                  byte_o_ext.offset) -
+                 base_offsets.begin() - 1;
+    while (base_extents[idx].num_blocks() == 0) {
+      idx--;
+    }
+    const Extent& b_ext = base_extents[idx];
+    if (byte_o_ext.offset + byte_o_ext.length <=
+        base_offsets[idx] + b_ext.num_blocks() * kBlockSize) {
+      // |o_ext| is inside |b_ext|, move it to |b_ext|.
+      (*over_extents)[kept] = o_ext;
+      (*over_extents)[kept].offset +=
+          (b_ext.start_block() * kBlockSize - base_offsets[idx]) * 8;
+      kept++;
     }
-    TEST_AND_RETURN_FALSE(o_ext_processed);
+    // Otherwise |o_ext| spills over |b_ext|, remove it.
   }
+  over_extents->erase(over_extents->begin() + kept, over_extents->end());
   return true;
 }
 
 vector<BitExtent> FindDeflates(const vector<Extent>& extents,
                                const vector<BitExtent>& in_deflates) {
+  // Sort the extents by start block and keep the furthest end of the extents
+  // up to each of them, so that a deflate is inside one of |extents| if it is
+  // inside the furthest reaching extent starting before it.
+  vector<Extent> sorted_extents = extents;
+  std::sort(sorted_extents.begin(),
+            sorted_extents.end(),
+            [](const Extent& a, const Extent& b) {
+              return a.start_block() < b.start_block();
+            });
+  vector<Extent> reaching_extents;
+  reaching_extents.reserve(sorted_extents.size());
+  for (const auto& extent : sorted_extents) {
+    if (reaching_extents.empty() ||
+        extent.start_block() + extent.num_blocks() >
+            reaching_extents.back().start_block() +
+                reaching_extents.back().num_blocks()) {
+      reaching_extents.push_back(extent);
+    } else {
+      reaching_extents.push_back(reaching_extents.back());
+    }
+  }
+
   vector<BitExtent> result;
-  // TODO(ahassani): Replace this with binary_search style search.
   for (const auto& deflate : in_deflates) {
-    for (const auto& extent : extents) {
-      if (IsBitExtentInExtent(extent, deflate)) {
-        result.push_back(deflate);
-        break;
-      }
+    const uint64_t offset = deflate.offset / 8;
+    auto it = std::upper_bound(sorted_extents.begin(),
+                               sorted_extents.end(),
+                               offset,
+                               [](uint64_t value, const Extent& extent) {
+                                 return value <
+                                        extent.start_block() * kBlockSize;
+                               });
+    if (it == sorted_extents.begin()) {
+      continue;
+    }
+    const size_t idx = it - sorted_extents.begin() - 1;
+    if (IsBitExtentInExtent(reaching_extents[idx], deflate)) {
+      result.push_back(deflate);
     }
   }
   return result;
@@ -240,16 +384,52 @@ vector<BitExtent> FindDeflates(const vector<Extent>& extents,
 bool CompactDeflates(const vector<Extent>& extents,
                      const vector<BitExtent>& in_deflates,
                      vector<BitExtent>* out_deflates) {
+  // The indexes of |in_deflates| sorted by offset, to find the deflates
+  // starting in each extent.
+  vector<size_t> by_offset(in_deflates.size());
+  for (size_t i = 0; i < by_offset.size(); i++) {
+    by_offset[i] = i;
+  }
+  std::stable_sort(by_offset.begin(),
+                   by_offset.end(),
+                   [&in_deflates](size_t a, size_t b) {
+                     return in_deflates[a].offset < in_deflates[b].offset;
+                   });
+
   size_t bytes_passed = 0;
   out_deflates->reserve(in_deflates.size());
+  vector<size_t> inside;
   for (const auto& extent : extents) {
     size_t gap_bytes = extent.start_block() * kBlockSize - bytes_passed;
-    for (const auto& deflate : in_deflates) {
-      if (IsBitExtentInExtent(extent, deflate)) {
-        out_deflates->emplace_back(deflate.offset - (gap_bytes * 8),
-                                   deflate.length);
+    // The deflates starting in the bytes of the extent, up to its end for the
+    // empty ones.
+    auto first = std::lower_bound(
+        by_offset.begin(),
+        by_offset.end(),
+        extent.start_block() * kBlockSize * 8,
+        [&in_deflates](size_t index, uint64_t offset) {
+          return in_deflates[index].offset < offset;
+        });
+    auto last = std::upper_bound(
+        first,
+        by_offset.end(),
+        (extent.start_block() + extent.num_blocks()) * kBlockSize * 8 + 7,
+        [&in_deflates](uint64_t offset, size_t index) {
+          return offset < in_deflates[index].offset;
+        });
+    // Keep the deflates of the extent in the order of |in_deflates|.
+    inside.clear();
+    for (auto it = first; it != last; ++it) {
+      if (IsBitExtentInExtent(extent, in_deflates[*it])) {
+        inside.push_back(*it);
       }
     }
+    std::sort(inside.begin(), inside.end());
+    for (size_t index : inside) {
+      const auto& deflate = in_deflates[index];
+      out_deflates->emplace_back(deflate.offset - (gap_bytes * 8),
+                                 deflate.length);
+    }
     bytes_passed += extent.num_blocks() * kBlockSize;
   }
 
@@ -303,80 +483,30 @@ bool PreprocessPartitionFiles(const PartitionConfig& part,
   // Get the file system files.
   vector<FilesystemInterface::File> tmp_files;
   part.fs_interface->GetFiles(&tmp_files);
-  result_files->reserve(tmp_files.size());
+  if (tmp_files.empty()) {
+    return true;
+  }
 
+  // The files are processed concurrently, but their results are gathered in
+  // the order of |tmp_files|.
+  std::list<FilePreprocessTask> tasks;
   for (auto& file : tmp_files) {
-    auto is_regular_file = IsRegularFile(file);
-
-    if (is_regular_file && IsSquashfsImage(part.path, file)) {
-      // Read the image into a file.
-      base::FilePath path;
-      TEST_AND_RETURN_FALSE(base::CreateTemporaryFile(&path));
-      ScopedPathUnlinker old_unlinker(path.value());
-      TEST_AND_RETURN_FALSE(
-          CopyExtentsToFile(part.path, file.extents, path.value(), kBlockSize));
-      // Test if it is actually a Squashfs file.
-      auto sqfs = SquashfsFilesystem::CreateFromFile(path.value(),
-                                                     extract_deflates,
-                                                     /*load_settings=*/false);
-      if (sqfs) {
-        // It is an squashfs file. Get its files to replace with itself.
-        vector<FilesystemInterface::File> files;
-        sqfs->GetFiles(&files);
-
-        // Replace squashfs file with its files only if |files| has at least two
-        // files or if it has some deflates (since it is better to replace it to
-        // take advantage of the deflates.)
-        if (files.size() > 1 ||
-            (files.size() == 1 && !files[0].deflates.empty())) {
-          TEST_AND_RETURN_FALSE(RealignSplittedFiles(file, &files));
-          result_files->insert(result_files->end(), files.begin(), files.end());
-          continue;
-        }
-      } else {
-        LOG(WARNING) << "We thought file: " << file.name
-                     << " was a Squashfs file, but it was not.";
-      }
-    }
-
-    if (is_regular_file && extract_deflates && !file.is_compressed) {
-      // Search for deflates if the file is in zip or gzip format.
-      // .zvoice files may eventually move out of rootfs. If that happens,
-      // remove ".zvoice" (crbug.com/782918).
-      bool is_zip = IsFileExtensions(
-          file.name, {".apk", ".zip", ".jar", ".zvoice", ".apex", "capex"});
-      bool is_gzip = IsFileExtensions(file.name, {".gz", ".gzip", ".tgz"});
-      if (is_zip || is_gzip) {
-        brillo::Blob data;
-        TEST_AND_RETURN_FALSE(utils::ReadExtents(
-            part.path,
-            file.extents,
-            &data,
-            kBlockSize * utils::BlocksInExtents(file.extents),
-            kBlockSize));
-        // |data| read from disk always has size multiple of kBlockSize. So it
-        // might contain trailing garbage data and confuse the gzip/zip
-        // processors. Trim them.
-        if (file.file_stat.st_size > 0 &&
-            static_cast<size_t>(file.file_stat.st_size) < data.size()) {
-          data.resize(file.file_stat.st_size);
-        }
-        vector<puffin::BitExtent> deflates;
-        if (!DeflatePreprocessFileData(file.name, data, &deflates)) {
-          LOG(ERROR) << "Failed to preprocess deflate data in partition "
-                     << part.name;
-          return false;
-        }
-        // Shift the deflate's extent to the offset starting from the beginning
-        // of the current partition; and the delta processor will align the
-        // extents in a continuous buffer later.
-        TEST_AND_RETURN_FALSE(
-            ShiftBitExtentsOverExtents(file.extents, &deflates));
-        file.deflates = std::move(deflates);
-      }
-    }
+    tasks.emplace_back(part, std::move(file), extract_deflates);
+  }
+  base::DelegateSimpleThreadPool thread_pool(
+      "deflate-preprocessor",
+      std::min(diff_utils::GetMaxThreads(), tasks.size()));
+  thread_pool.Start();
+  for (auto& task : tasks) {
+    thread_pool.AddWork(&task);
+  }
+  thread_pool.JoinAll();
 
-    result_files->push_back(file);
+  result_files->reserve(result_files->size() + tasks.size());
+  for (const auto& task : tasks) {
+    TEST_AND_RETURN_FALSE(task.success());
+    result_files->insert(
+        result_files->end(), task.files().begin(), task.files().end());
   }
   return true;
 }
@@ -28,8 +28,8 @@
 namespace chromeos_update_engine {
 namespace deflate_utils {
 
-// Gets the files from the partition and processes all its files. Processing
-// includes:
+// Gets the files from the partition and processes all its files, concurrently,
+// keeping them in order. Processing includes:
 //  - splitting large Squashfs containers into its smaller files.
 //  - extracting deflates in zip and gzip files.
 bool PreprocessPartitionFiles(const PartitionConfig& part,
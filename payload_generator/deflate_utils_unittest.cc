@@ -26,6 +26,7 @@
 
 #include "update_engine/common/test_utils.h"
 #include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/delta_diff_generator.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/payload_generator/extent_utils.h"
 
@@ -186,5 +187,56 @@ TEST(DeflateUtilsTest, CompactBoundaryTest) {
   EXPECT_EQ(out_deflates, expected_out_deflates);
 }
 
+// A file with 100k deflates over 1k scattered extents, the size of a large
+// APK.
+TEST(DeflateUtilsTest, ManyDeflatesOverManyExtentsTest) {
+  constexpr uint64_t kNumExtents = 1000;
+  constexpr uint64_t kExtentBlocks = 25;
+  constexpr uint64_t kNumDeflates = 100000;
+  constexpr uint64_t kDeflateStride = 1000;
+  constexpr uint64_t kDeflateSize = 900;
+  vector<Extent> extents;
+  for (uint64_t i = 0; i < kNumExtents; i++) {
+    extents.push_back(
+        ExtentForRange((i * 7919 % kNumExtents) * 2 * kExtentBlocks,
+                       kExtentBlocks));
+  }
+  vector<BitExtent> deflates;
+  // The deflates which don't cross the boundary of an extent.
+  vector<BitExtent> kept_deflates;
+  for (uint64_t i = 0; i < kNumDeflates; i++) {
+    const uint64_t offset = i * kDeflateStride;
+    deflates.emplace_back(offset * 8, kDeflateSize * 8);
+    if (offset / (kExtentBlocks * kBlockSize) ==
+        (offset + kDeflateSize - 1) / (kExtentBlocks * kBlockSize)) {
+      kept_deflates.push_back(deflates.back());
+    }
+  }
+  ASSERT_LT(kept_deflates.size(), deflates.size());
+
+  vector<BitExtent> part_deflates = deflates;
+  ASSERT_TRUE(ShiftBitExtentsOverExtents(extents, &part_deflates));
+  ASSERT_EQ(kept_deflates.size(), part_deflates.size());
+  std::sort(part_deflates.begin(),
+            part_deflates.end(),
+            [](const BitExtent& a, const BitExtent& b) {
+              return a.offset < b.offset;
+            });
+
+  vector<BitExtent> file_deflates;
+  ASSERT_TRUE(FindAndCompactDeflates(extents, part_deflates, &file_deflates));
+  EXPECT_EQ(kept_deflates, file_deflates);
+
+  // Only the deflates of the first extent are found in it.
+  const auto first_extent_deflates =
+      std::count_if(kept_deflates.begin(),
+                    kept_deflates.end(),
+                    [](const BitExtent& deflate) {
+                      return deflate.offset < kExtentBlocks * kBlockSize * 8;
+                    });
+  EXPECT_EQ(static_cast<size_t>(first_extent_deflates),
+            FindDeflates({extents[0]}, part_deflates).size());
+}
+
 }  // namespace deflate_utils
 }  // namespace chromeos_update_engine
@@ -42,6 +42,7 @@
 #include "update_engine/payload_generator/delta_diff_utils.h"
 #include "update_engine/payload_generator/full_update_generator.h"
 #include "update_engine/payload_generator/merge_sequence_generator.h"
+#include "update_engine/payload_generator/partition_result_cache.h"
 #include "update_engine/payload_generator/payload_file.h"
 #include "update_engine/update_metadata.pb.h"
 
@@ -90,6 +91,37 @@ class PartitionProcessor : public base::DelegateSimpleThread::Delegate {
   void Run() override {
     LOG(INFO) << "Started an async task to process partition "
               << new_part_.name;
+    const auto& result_cache = config_.partition_result_cache;
+    std::string cache_key;
+    if (result_cache) {
+      cache_key = PartitionResultCache::GetKey(config_, old_part_, new_part_);
+      PartitionResult result;
+      if (result_cache->Lookup(cache_key,
+                               new_part_.size,
+                               config_.block_size,
+                               file_writer_,
+                               &result)) {
+        LOG(INFO) << "Reusing the cached operations of partition "
+                  << new_part_.name;
+        *aops_ = std::move(result.aops);
+        *cow_merge_sequence_ = std::move(result.merge_sequence);
+        *cow_size_ = result.cow_size;
+        return;
+      }
+    }
+
+    Generate();
+
+    if (result_cache) {
+      result_cache->Store(
+          cache_key, {*aops_, *cow_merge_sequence_, *cow_size_}, *file_writer_);
+    }
+  }
+
+ private:
+  // Generates the operations of the partition, then its merge sequence and
+  // COW size if needed.
+  void Generate() {
     bool success = strategy_->GenerateOperations(
         config_, old_part_, new_part_, file_writer_, aops_);
     if (!success) {
@@ -147,7 +179,6 @@ class PartitionProcessor : public base::DelegateSimpleThread::Delegate {
               << *cow_size_;
   }
 
- private:
   const PayloadGenerationConfig& config_;
   const PartitionConfig& old_part_;
   const PartitionConfig& new_part_;
@@ -36,6 +36,7 @@
 #include <map>
 #include <memory>
 #include <numeric>
+#include <set>
 #include <utility>
 #include <vector>
 
@@ -44,12 +45,12 @@
 #include <base/strings/string_util.h>
 #include <base/strings/stringprintf.h>
 #include <base/threading/simple_thread.h>
+#include <base/time/time.h>
 #include <brillo/data_encoding.h>
 #include <bsdiff/bsdiff.h>
 #include <bsdiff/constants.h>
 #include <bsdiff/control_entry.h>
 #include <bsdiff/patch_reader.h>
-#include <bsdiff/patch_writer_factory.h>
 #include <puffin/brotli_util.h>
 #include <puffin/utils.h>
 #include <zucchini/buffer_view.h>
@@ -63,12 +64,16 @@
 #include "update_engine/payload_generator/ab_generator.h"
 #include "update_engine/payload_generator/block_mapping.h"
 #include "update_engine/payload_generator/bzip.h"
+#include "update_engine/payload_generator/content_sketch.h"
 #include "update_engine/payload_generator/deflate_utils.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/payload_generator/extent_utils.h"
+#include "update_engine/payload_generator/memory_patch_writer.h"
 #include "update_engine/payload_generator/merge_sequence_generator.h"
+#include "update_engine/payload_generator/puffdiff_cache.h"
 #include "update_engine/payload_generator/squashfs_filesystem.h"
+#include "update_engine/payload_generator/suffix_array_cache.h"
 #include "update_engine/payload_generator/xz.h"
 #include "update_engine/lz4diff/lz4diff.h"
 
@@ -98,6 +103,63 @@ const uint64_t kMaxZucchiniDestinationSize = 150 * 1024 * 1024;  // bytes
 
 const int kBrotliCompressionQuality = 11;
 
+// The maximum estimated memory used to keep suffix arrays of source buffers
+// that are diffed more than once in a partition.
+const uint64_t kMaxSuffixArrayCacheSize = 2ULL * 1024 * 1024 * 1024;  // bytes
+
+// Budget of the content based matching of renamed files: only the first
+// |kMaxSketchBytesPerFile| bytes of a file are sketched, and at most
+// |kMaxSketchBytes| are read from each of the old and new partitions.
+const uint64_t kMaxSketchBytesPerFile = 32 * 1024 * 1024;      // bytes
+const uint64_t kMaxSketchBytes = 1024ULL * 1024 * 1024;        // bytes
+const uint64_t kMaxSketchComparisons = 16 * 1024 * 1024;
+// Files smaller than this don't have enough features to be matched reliably.
+const uint64_t kMinSketchFileBlocks = 4;
+// The minimum estimated similarity to use an old file as the source of a
+// renamed file.
+const double kMinContentSimilarity = 0.25;
+
+// Anchors used to align the chunks of a large file with its old version are
+// taken about once every 4 KiB, and at most |kMaxChunkAlignmentAnchors| of the
+// old file are indexed. Anchors repeated more than |kMaxAnchorRepeats| times,
+// like the ones in runs of zeros, don't tell where the data moved.
+const unsigned int kChunkAlignmentSpacingBits = 12;
+const size_t kMaxChunkAlignmentAnchors = 1 << 20;
+const size_t kMaxAnchorRepeats = 4;
+// Only |kChunkAlignmentSamples| evenly spaced windows of
+// |kChunkAlignmentSampleBlocks| blocks of each new chunk vote for its shift,
+// instead of the whole chunk, which is read again to be diffed.
+const uint64_t kChunkAlignmentSamples = 4;
+const uint64_t kChunkAlignmentSampleBlocks = 64;
+
+// Rough peak memory of puffdiff and zucchini per input byte. Puffdiff bsdiffs
+// the puffed streams, which are a few times larger than the deflated input.
+// Zucchini keeps the disassembled images, their reference tables and the
+// equivalence map of both files alive at the same time.
+const uint64_t kPuffdiffMemoryPerByte = 4;
+const uint64_t kZucchiniMemoryPerByte = 12;
+
+// Returns the estimated peak memory used by |op| to diff |old_size| bytes into
+// |new_size| bytes.
+uint64_t EstimateDiffMemory(InstallOperation::Type op,
+                            uint64_t old_size,
+                            uint64_t new_size) {
+  switch (op) {
+    case InstallOperation::SOURCE_BSDIFF:
+    case InstallOperation::BROTLI_BSDIFF:
+      return old_size + new_size +
+             SuffixArrayCache::EstimatedSuffixArraySize(old_size);
+    case InstallOperation::PUFFDIFF:
+      return kPuffdiffMemoryPerByte *
+             (old_size + new_size +
+              SuffixArrayCache::EstimatedSuffixArraySize(old_size));
+    case InstallOperation::ZUCCHINI:
+      return kZucchiniMemoryPerByte * (old_size + new_size);
+    default:
+      return 0;
+  }
+}
+
 // Storing a diff operation has more overhead over replace operation in the
 // manifest, we need to store an additional src_sha256_hash which is 32 bytes
 // and not compressible, and also src_extents which could use anywhere from a
@@ -147,6 +209,36 @@ int LevenshteinDistance(const string& a, const string& b) {
   return distances.back();
 }
 
+// Returns the source extents that DeltaReadFile() diffs the chunk of
+// |chunk_blocks| blocks starting at |block_offset| against.
+vector<Extent> GetOldChunkExtents(const vector<Extent>& old_extents,
+                                  uint64_t block_offset,
+                                  uint64_t chunk_blocks) {
+  vector<Extent> old_extents_chunk =
+      ExtentsSublist(old_extents, block_offset, chunk_blocks);
+  NormalizeExtents(&old_extents_chunk);
+  return old_extents_chunk;
+}
+
+// Returns whether DeltaReadFile() looks for the best old window of each chunk
+// of a file of |new_blocks| blocks instead of pairing chunks by index.
+bool ShouldAlignOldChunks(const File& old_file,
+                          uint64_t new_blocks,
+                          ssize_t chunk_blocks) {
+  // Compressed files are diffed as a whole by lz4diff, which relies on the
+  // chunks being aligned with the compressed blocks.
+  return chunk_blocks > 0 && static_cast<uint64_t>(chunk_blocks) < new_blocks &&
+         !old_file.extents.empty() &&
+         old_file.compressed_file_info.blocks.empty();
+}
+
+// Returns the key identifying the old data read from |src_extents| in a
+// SuffixArrayCache. A cache is only used for a single partition, so the
+// extents are enough to identify the data.
+string SuffixArrayCacheKey(const vector<Extent>& src_extents) {
+  return ExtentsToString(src_extents);
+}
+
 static bool ShouldCreateNewOp(const std::vector<CowMergeOperation>& ops,
                               size_t src_block,
                               size_t dst_block,
@@ -246,8 +338,8 @@ bool BestDiffGenerator::GenerateBestDiffOperation(
 
     // Disable the specific diff algorithm when the data is too big.
     if (input_bytes > limit) {
-      LOG(INFO) << op_type << " ignored, file " << aop->name
-                << " too big: " << input_bytes << " bytes";
+      LOG(INFO) << InstallOperationTypeName(op_type) << " ignored, file "
+                << aop->name << " too big: " << input_bytes << " bytes";
       continue;
     }
 
@@ -277,31 +369,64 @@ bool BestDiffGenerator::GenerateBestDiffOperation(
   return true;
 }
 
+bool BestDiffGenerator::WithinDiffSizeLimits(InstallOperation::Type op_type,
+                                             const string& name) const {
+  const DiffSizeLimits limits = config_.GetDiffSizeLimits(op_type);
+  if (limits.max_memory_bytes == 0 && limits.max_input_bytes == 0) {
+    return true;
+  }
+  const uint64_t memory =
+      EstimateDiffMemory(op_type, old_data_.size(), new_data_.size());
+  const uint64_t input = old_data_.size() + new_data_.size();
+  LOG(INFO) << InstallOperationTypeName(op_type) << " size limits for " << name
+            << ": estimated " << memory / 1024 / 1024 << " MiB of memory of "
+            << limits.max_memory_bytes / 1024 / 1024 << " MiB, "
+            << input / 1024 / 1024 << " MiB of input of "
+            << limits.max_input_bytes / 1024 / 1024 << " MiB (0 is unlimited)";
+  if (limits.max_memory_bytes != 0 && memory > limits.max_memory_bytes) {
+    LOG(INFO) << InstallOperationTypeName(op_type) << " skipped for " << name
+              << ", over the memory limit";
+    return false;
+  }
+  if (limits.max_input_bytes != 0 && input > limits.max_input_bytes) {
+    LOG(INFO) << InstallOperationTypeName(op_type) << " skipped for " << name
+              << ", over the input size limit";
+    return false;
+  }
+  return true;
+}
+
 bool BestDiffGenerator::TryBsdiffAndUpdateOperation(
     InstallOperation_Type operation_type,
     AnnotatedOperation* aop,
     brillo::Blob* data_blob) {
-  base::FilePath patch;
-  TEST_AND_RETURN_FALSE(base::CreateTemporaryFile(&patch));
-  ScopedPathUnlinker unlinker(patch.value());
-
+  if (!WithinDiffSizeLimits(operation_type, aop->name)) {
+    return true;
+  }
+  brillo::Blob bsdiff_delta;
   std::unique_ptr<bsdiff::PatchWriterInterface> bsdiff_patch_writer;
   if (operation_type == InstallOperation::BROTLI_BSDIFF) {
-    bsdiff_patch_writer = bsdiff::CreateBSDF2PatchWriter(
-        patch.value(), GetUsableCompressorTypes(), kBrotliCompressionQuality);
+    bsdiff_patch_writer = std::make_unique<MemoryPatchWriter>(
+        &bsdiff_delta, GetUsableCompressorTypes(), kBrotliCompressionQuality);
   } else {
-    bsdiff_patch_writer = bsdiff::CreateBsdiffPatchWriter(patch.value());
+    bsdiff_patch_writer = std::make_unique<MemoryPatchWriter>(&bsdiff_delta);
+  }
+
+  if (sarray_cache_) {
+    TEST_AND_RETURN_FALSE(
+        sarray_cache_->Bsdiff(SuffixArrayCacheKey(src_extents_),
+                              old_data_,
+                              new_data_,
+                              bsdiff_patch_writer.get()));
+  } else {
+    TEST_AND_RETURN_FALSE(0 == bsdiff::bsdiff(old_data_.data(),
+                                              old_data_.size(),
+                                              new_data_.data(),
+                                              new_data_.size(),
+                                              bsdiff_patch_writer.get(),
+                                              nullptr));
   }
 
-  brillo::Blob bsdiff_delta;
-  TEST_AND_RETURN_FALSE(0 == bsdiff::bsdiff(old_data_.data(),
-                                            old_data_.size(),
-                                            new_data_.data(),
-                                            new_data_.size(),
-                                            bsdiff_patch_writer.get(),
-                                            nullptr));
-
-  TEST_AND_RETURN_FALSE(utils::ReadFile(patch.value(), &bsdiff_delta));
   TEST_AND_RETURN_FALSE(!bsdiff_delta.empty());
 
   InstallOperation& operation = aop->op;
@@ -325,16 +450,33 @@ bool BestDiffGenerator::TryPuffdiffAndUpdateOperation(AnnotatedOperation* aop,
   // Only Puffdiff if both files have at least one deflate left.
   if (!old_deflates_.empty() && !new_deflates_.empty()) {
     brillo::Blob puffdiff_delta;
-    ScopedTempFile temp_file("puffdiff-delta.XXXXXX");
-    // Perform PuffDiff operation.
-    TEST_AND_RETURN_FALSE(puffin::PuffDiff(old_data_,
-                                           new_data_,
-                                           old_deflates_,
-                                           new_deflates_,
-                                           GetUsableCompressorTypes(),
-                                           temp_file.path(),
-                                           &puffdiff_delta));
-    TEST_AND_RETURN_FALSE(!puffdiff_delta.empty());
+    PuffdiffCache* cache = config_.puffdiff_cache.get();
+    std::string cache_key;
+    if (cache) {
+      cache_key = PuffdiffCache::GetKey(old_data_,
+                                        new_data_,
+                                        old_deflates_,
+                                        new_deflates_,
+                                        GetUsableCompressorTypes());
+    }
+    if (!cache || !cache->Lookup(cache_key, &puffdiff_delta)) {
+      if (!WithinDiffSizeLimits(InstallOperation::PUFFDIFF, aop->name)) {
+        return true;
+      }
+      ScopedMemoryTempFile temp_file("puffdiff-delta.XXXXXX");
+      // Perform PuffDiff operation.
+      TEST_AND_RETURN_FALSE(puffin::PuffDiff(old_data_,
+                                             new_data_,
+                                             old_deflates_,
+                                             new_deflates_,
+                                             GetUsableCompressorTypes(),
+                                             temp_file.path(),
+                                             &puffdiff_delta));
+      TEST_AND_RETURN_FALSE(!puffdiff_delta.empty());
+      if (cache) {
+        cache->Store(cache_key, puffdiff_delta);
+      }
+    }
 
     InstallOperation& operation = aop->op;
     if (IsDiffOperationBetter(operation,
@@ -364,6 +506,9 @@ bool BestDiffGenerator::TryZucchiniAndUpdateOperation(AnnotatedOperation* aop,
            /*, ".capex",".jar", ".apk", ".apex"*/})) {
     return true;
   }
+  if (!WithinDiffSizeLimits(InstallOperation::ZUCCHINI, aop->name)) {
+    return true;
+  }
   zucchini::ConstBufferView src_bytes(old_data_.data(), old_data_.size());
   zucchini::ConstBufferView dst_bytes(new_data_.data(), new_data_.size());
 
@@ -405,7 +550,8 @@ class FileDeltaProcessor : public base::DelegateSimpleThread::Delegate {
                      const File& new_extents,
                      const string& name,
                      ssize_t chunk_blocks,
-                     BlobFileWriter* blob_file)
+                     BlobFileWriter* blob_file,
+                     SuffixArrayCache* sarray_cache)
       : old_part_(old_part),
         new_part_(new_part),
         config_(config),
@@ -414,7 +560,8 @@ class FileDeltaProcessor : public base::DelegateSimpleThread::Delegate {
         new_extents_blocks_(utils::BlocksInExtents(new_extents.extents)),
         name_(name),
         chunk_blocks_(chunk_blocks),
-        blob_file_(blob_file) {}
+        blob_file_(blob_file),
+        sarray_cache_(sarray_cache) {}
 
   bool operator>(const FileDeltaProcessor& other) const {
     return new_extents_blocks_ > other.new_extents_blocks_;
@@ -430,6 +577,10 @@ class FileDeltaProcessor : public base::DelegateSimpleThread::Delegate {
   // Merge each file processor's ops list to aops.
   bool MergeOperation(vector<AnnotatedOperation>* aops);
 
+  // Register in |sarray_cache_| every source chunk this processor is going to
+  // diff against.
+  void AddSuffixArrayReferences() const;
+
  private:
   const string& old_part_;  // NOLINT(runtime/member_string_references)
   const string& new_part_;  // NOLINT(runtime/member_string_references)
@@ -443,6 +594,7 @@ class FileDeltaProcessor : public base::DelegateSimpleThread::Delegate {
   // Block limit of one aop.
   const ssize_t chunk_blocks_;
   BlobFileWriter* blob_file_;
+  SuffixArrayCache* sarray_cache_;
 
   // The list of ops to reach the new file from the old file.
   vector<AnnotatedOperation> file_aops_;
@@ -463,7 +615,8 @@ void FileDeltaProcessor::Run() {
                      new_extents_,
                      chunk_blocks_,
                      config_,
-                     blob_file_)) {
+                     blob_file_,
+                     sarray_cache_)) {
     LOG(ERROR) << "Failed to generate delta for " << name_ << " ("
                << new_extents_blocks_ << " blocks)";
     failed_ = true;
@@ -488,6 +641,150 @@ bool FileDeltaProcessor::MergeOperation(vector<AnnotatedOperation>* aops) {
   return true;
 }
 
+void FileDeltaProcessor::AddSuffixArrayReferences() const {
+  if (!sarray_cache_ || old_extents_.extents.empty() || chunk_blocks_ == 0)
+    return;
+  // The old windows of aligned chunks are only known when running.
+  if (ShouldAlignOldChunks(old_extents_, new_extents_blocks_, chunk_blocks_))
+    return;
+  // Same chunking as DeltaReadFile().
+  const uint64_t chunk_blocks =
+      chunk_blocks_ == -1 ? new_extents_blocks_ : chunk_blocks_;
+  for (uint64_t block_offset = 0; block_offset < new_extents_blocks_;
+       block_offset += chunk_blocks) {
+    vector<Extent> old_extents_chunk =
+        GetOldChunkExtents(old_extents_.extents, block_offset, chunk_blocks);
+    if (!old_extents_chunk.empty()) {
+      sarray_cache_->AddReference(SuffixArrayCacheKey(old_extents_chunk));
+    }
+  }
+}
+
+// Reads the beginning of a file and computes its ContentSketch, on a thread
+// pool.
+class ContentSketcher : public base::DelegateSimpleThread::Delegate {
+ public:
+  ContentSketcher(const string& part_path, const File& file, uint64_t blocks)
+      : part_path_(part_path), file_(file), blocks_(blocks) {}
+  ~ContentSketcher() override = default;
+
+  // Overrides DelegateSimpleThread::Delegate.
+  void Run() override {
+    vector<Extent> extents = ExtentsSublist(file_.extents, 0, blocks_);
+    brillo::Blob data;
+    if (!utils::ReadExtents(
+            part_path_, extents, &data, blocks_ * kBlockSize, kBlockSize)) {
+      LOG(WARNING) << "Failed to read " << file_.name << " to sketch it.";
+      return;
+    }
+    sketch_ = ContentSketch::FromData(data.data(), data.size());
+  }
+
+  const File& file() const { return file_; }
+  uint64_t blocks() const { return blocks_; }
+  const ContentSketch& sketch() const { return sketch_; }
+
+ private:
+  const string& part_path_;  // NOLINT(runtime/member_string_references)
+  const File& file_;
+  const uint64_t blocks_;
+  ContentSketch sketch_;
+
+  DISALLOW_COPY_AND_ASSIGN(ContentSketcher);
+};
+
+map<string, string> MatchOldFilesByContent(
+    const string& old_part,
+    const string& new_part,
+    const map<string, File>& old_files_map,
+    const vector<File>& new_files) {
+  std::set<string> new_file_names;
+  for (const File& file : new_files) {
+    new_file_names.insert(file.name);
+  }
+
+  // Adds a sketcher for |file| to |sketchers| unless it is too small or the
+  // |budget| of blocks to read is exhausted.
+  auto add_sketcher = [](const string& part_path,
+                         const File& file,
+                         uint64_t* budget,
+                         list<ContentSketcher>* sketchers) {
+    const uint64_t blocks = std::min(utils::BlocksInExtents(file.extents),
+                                     kMaxSketchBytesPerFile / kBlockSize);
+    if (blocks < kMinSketchFileBlocks || blocks > *budget) {
+      return;
+    }
+    *budget -= blocks;
+    sketchers->emplace_back(part_path, file, blocks);
+  };
+
+  list<ContentSketcher> new_sketchers;
+  uint64_t new_budget = kMaxSketchBytes / kBlockSize;
+  for (const File& file : new_files) {
+    if (old_files_map.count(file.name) == 0) {
+      add_sketcher(new_part, file, &new_budget, &new_sketchers);
+    }
+  }
+  // Only old files that no new file is going to use by name are candidates.
+  list<ContentSketcher> old_sketchers;
+  uint64_t old_budget = kMaxSketchBytes / kBlockSize;
+  for (const auto& [name, file] : old_files_map) {
+    if (new_file_names.count(name) == 0) {
+      add_sketcher(old_part, file, &old_budget, &old_sketchers);
+    }
+  }
+  if (new_sketchers.empty() || old_sketchers.empty()) {
+    return {};
+  }
+
+  const size_t num_sketchers = new_sketchers.size() + old_sketchers.size();
+  base::DelegateSimpleThreadPool thread_pool(
+      "content-sketcher", std::min(GetMaxThreads(), num_sketchers));
+  thread_pool.Start();
+  for (auto& sketcher : new_sketchers) {
+    thread_pool.AddWork(&sketcher);
+  }
+  for (auto& sketcher : old_sketchers) {
+    thread_pool.AddWork(&sketcher);
+  }
+  thread_pool.JoinAll();
+
+  map<string, string> matches;
+  uint64_t comparisons = 0;
+  for (const auto& new_sketcher : new_sketchers) {
+    if (new_sketcher.sketch().empty()) {
+      continue;
+    }
+    const ContentSketcher* best = nullptr;
+    double best_similarity = kMinContentSimilarity;
+    for (const auto& old_sketcher : old_sketchers) {
+      // Files that changed size a lot are not worth diffing anyway.
+      if (old_sketcher.blocks() * 4 < new_sketcher.blocks() ||
+          new_sketcher.blocks() * 4 < old_sketcher.blocks()) {
+        continue;
+      }
+      if (++comparisons > kMaxSketchComparisons) {
+        LOG(INFO) << "Content matching budget exhausted, using file names "
+                  << "for the remaining files.";
+        return matches;
+      }
+      double similarity =
+          new_sketcher.sketch().Similarity(old_sketcher.sketch());
+      if (similarity >= best_similarity) {
+        best_similarity = similarity;
+        best = &old_sketcher;
+      }
+    }
+    if (best) {
+      LOG(INFO) << "Using " << best->file().name << " as source for "
+                << new_sketcher.file().name << ", content similarity "
+                << best_similarity;
+      matches[new_sketcher.file().name] = best->file().name;
+    }
+  }
+  return matches;
+}
+
 FilesystemInterface::File GetOldFile(
     const map<string, FilesystemInterface::File>& old_files_map,
     const string& new_file_name) {
@@ -595,7 +892,16 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
       old_files_map[file.name] = file;
   }
 
+  // Files renamed between the two builds have no old file with the same
+  // name, look for one with similar content before falling back to names.
+  map<string, string> content_matches;
+  if (!old_files_map.empty()) {
+    content_matches = MatchOldFilesByContent(
+        old_part.path, new_part.path, old_files_map, new_files);
+  }
+
   list<FileDeltaProcessor> file_delta_processors;
+  SuffixArrayCache sarray_cache(kMaxSuffixArrayCacheSize);
 
   // The processing is very straightforward here, we generate operations for
   // every file (and pseudo-file such as the metadata) in the new filesystem
@@ -616,8 +922,11 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
     if (new_file_extents.empty())
       continue;
 
+    auto content_match = content_matches.find(new_file.name);
     FilesystemInterface::File old_file =
-        GetOldFile(old_files_map, new_file.name);
+        content_match != content_matches.end()
+            ? old_files_map.at(content_match->second)
+            : GetOldFile(old_files_map, new_file.name);
     old_visited_blocks.AddExtents(old_file.extents);
 
     // TODO(b/177104308) Filtering |new_file_extents| might confuse puffdiff, as
@@ -644,7 +953,8 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
                                        std::move(filtered_new_file),
                                        new_file.name,  // operation name
                                        hard_chunk_blocks,
-                                       blob_file);
+                                       blob_file,
+                                       &sarray_cache);
   }
   // Process all the blocks not included in any file. We provided all the unused
   // blocks in the old partition as available data.
@@ -675,22 +985,37 @@ bool DeltaReadPartition(vector<AnnotatedOperation>* aops,
                                        new_file,
                                        "<non-file-data>",  // operation name
                                        soft_chunk_blocks,
-                                       blob_file);
+                                       blob_file,
+                                       &sarray_cache);
+  }
+
+  // Several new files may be diffed against the same old file, let them share
+  // the suffix array of the old data.
+  for (const auto& processor : file_delta_processors) {
+    processor.AddSuffixArrayReferences();
   }
 
   size_t max_threads = GetMaxThreads();
 
-  // Sort the files in descending order based on number of new blocks to make
-  // sure we start the largest ones first.
-  if (file_delta_processors.size() > max_threads) {
-    file_delta_processors.sort(std::greater<FileDeltaProcessor>());
+  // Start the largest files first. Only the scheduling is sorted, the
+  // operations are merged in the order of the files below, so they don't
+  // depend on the number of threads.
+  vector<FileDeltaProcessor*> schedule;
+  for (auto& processor : file_delta_processors) {
+    schedule.push_back(&processor);
   }
+  std::stable_sort(
+      schedule.begin(),
+      schedule.end(),
+      [](const FileDeltaProcessor* a, const FileDeltaProcessor* b) {
+        return *a > *b;
+      });
 
   base::DelegateSimpleThreadPool thread_pool("incremental-update-generator",
                                              max_threads);
   thread_pool.Start();
-  for (auto& processor : file_delta_processors) {
-    thread_pool.AddWork(&processor);
+  for (FileDeltaProcessor* processor : schedule) {
+    thread_pool.AddWork(processor);
   }
   thread_pool.JoinAll();
 
@@ -850,6 +1175,111 @@ bool DeltaMovedAndZeroBlocks(vector<AnnotatedOperation>* aops,
   return true;
 }
 
+bool AlignOldChunks(const string& old_part,
+                    const string& new_part,
+                    const vector<Extent>& old_extents,
+                    const vector<Extent>& new_extents,
+                    uint64_t chunk_blocks,
+                    vector<uint64_t>* old_chunk_offsets) {
+  const uint64_t old_blocks = utils::BlocksInExtents(old_extents);
+  const uint64_t new_blocks = utils::BlocksInExtents(new_extents);
+  TEST_AND_RETURN_FALSE(chunk_blocks > 0);
+
+  // Index the anchors of the old file, reading it one chunk at a time so the
+  // memory used stays within the chunk budget.
+  vector<std::pair<uint64_t, uint64_t>> anchors;  // hash, byte offset
+  brillo::Blob data;
+  for (uint64_t block_offset = 0;
+       block_offset < old_blocks && anchors.size() < kMaxChunkAlignmentAnchors;
+       block_offset += chunk_blocks) {
+    vector<Extent> extents =
+        ExtentsSublist(old_extents, block_offset, chunk_blocks);
+    TEST_AND_RETURN_FALSE(utils::ReadExtents(old_part,
+                                             extents,
+                                             &data,
+                                             utils::BlocksInExtents(extents) *
+                                                 kBlockSize,
+                                             kBlockSize));
+    const uint64_t base = block_offset * kBlockSize;
+    ForEachContentFeature(data.data(),
+                          data.size(),
+                          kChunkAlignmentSpacingBits,
+                          [&anchors, base](size_t offset, uint64_t hash) {
+                            anchors.emplace_back(hash, base + offset);
+                          });
+  }
+  if (anchors.size() > kMaxChunkAlignmentAnchors) {
+    anchors.resize(kMaxChunkAlignmentAnchors);
+  }
+  std::sort(anchors.begin(), anchors.end());
+
+  // The window of an old chunk must fit in the old file.
+  const uint64_t max_old_offset =
+      old_blocks > chunk_blocks ? old_blocks - chunk_blocks : 0;
+  old_chunk_offsets->clear();
+  for (uint64_t block_offset = 0; block_offset < new_blocks;
+       block_offset += chunk_blocks) {
+    const uint64_t num_blocks =
+        std::min(chunk_blocks, new_blocks - block_offset);
+    // The windows of the chunk voting for its shift, as offsets from the
+    // start of the chunk.
+    vector<uint64_t> windows = {0};
+    uint64_t window_blocks = num_blocks;
+    if (num_blocks > kChunkAlignmentSamples * kChunkAlignmentSampleBlocks) {
+      window_blocks = kChunkAlignmentSampleBlocks;
+      for (uint64_t i = 1; i < kChunkAlignmentSamples; i++) {
+        windows.push_back(i * num_blocks / kChunkAlignmentSamples);
+      }
+    }
+    // Every anchor of the windows found in the old file votes for how far the
+    // data moved. The most voted shift wins.
+    const int64_t chunk_base = block_offset * kBlockSize;
+    map<int64_t, uint64_t> votes;
+    for (uint64_t window : windows) {
+      vector<Extent> extents =
+          ExtentsSublist(new_extents, block_offset + window, window_blocks);
+      TEST_AND_RETURN_FALSE(utils::ReadExtents(new_part,
+                                               extents,
+                                               &data,
+                                               utils::BlocksInExtents(extents) *
+                                                   kBlockSize,
+                                               kBlockSize));
+      const int64_t base = (block_offset + window) * kBlockSize;
+      ForEachContentFeature(
+          data.data(),
+          data.size(),
+          kChunkAlignmentSpacingBits,
+          [&anchors, &votes, base](size_t offset, uint64_t hash) {
+            auto range = std::equal_range(
+                anchors.begin(),
+                anchors.end(),
+                std::make_pair(hash, uint64_t{0}),
+                [](const auto& a, const auto& b) { return a.first < b.first; });
+            const size_t repeats = std::distance(range.first, range.second);
+            if (repeats == 0 || repeats > kMaxAnchorRepeats) {
+              return;
+            }
+            for (auto it = range.first; it != range.second; ++it) {
+              votes[static_cast<int64_t>(it->second) - base -
+                    static_cast<int64_t>(offset)]++;
+            }
+          });
+    }
+
+    uint64_t old_offset = block_offset;
+    if (!votes.empty()) {
+      auto best = std::max_element(
+          votes.begin(), votes.end(), [](const auto& a, const auto& b) {
+            return a.second < b.second;
+          });
+      const int64_t start = chunk_base + best->first;
+      old_offset = start > 0 ? start / kBlockSize : 0;
+    }
+    old_chunk_offsets->push_back(std::min(old_offset, max_old_offset));
+  }
+  return true;
+}
+
 bool DeltaReadFile(std::vector<AnnotatedOperation>* aops,
                    const std::string& old_part,
                    const std::string& new_part,
@@ -857,7 +1287,8 @@ bool DeltaReadFile(std::vector<AnnotatedOperation>* aops,
                    const File& new_file,
                    ssize_t chunk_blocks,
                    const PayloadGenerationConfig& config,
-                   BlobFileWriter* blob_file) {
+                   BlobFileWriter* blob_file,
+                   SuffixArrayCache* sarray_cache) {
   const auto& old_extents = old_file.extents;
   const auto& new_extents = new_file.extents;
   const auto& name = new_file.name;
@@ -873,17 +1304,36 @@ bool DeltaReadFile(std::vector<AnnotatedOperation>* aops,
   if (chunk_blocks == -1)
     chunk_blocks = total_blocks;
 
+  // When data was inserted or removed in a large file, the old chunk with the
+  // same index as a new chunk doesn't hold the same data anymore. Pick the
+  // old window each new chunk moved from instead. The suffix arrays of these
+  // windows are not shared, see FileDeltaProcessor::AddSuffixArrayReferences.
+  vector<uint64_t> old_chunk_offsets;
+  if (ShouldAlignOldChunks(old_file, total_blocks, chunk_blocks)) {
+    TEST_AND_RETURN_FALSE(AlignOldChunks(old_part,
+                                         new_part,
+                                         old_extents,
+                                         new_extents,
+                                         chunk_blocks,
+                                         &old_chunk_offsets));
+    sarray_cache = nullptr;
+  }
+
   for (uint64_t block_offset = 0; block_offset < total_blocks;
        block_offset += chunk_blocks) {
-    // Split the old/new file in the same chunks. Note that this could drop
-    // some information from the old file used for the new chunk. If the old
-    // file is smaller (or even empty when there's no old file) the chunk will
-    // also be empty.
+    // Split the old/new file in chunks. Unless the chunks were aligned above,
+    // the new chunk is diffed against the old chunk with the same index. Note
+    // that this could drop some information from the old file used for the
+    // new chunk. If the old file is smaller (or even empty when there's no old
+    // file) the chunk will also be empty.
+    const uint64_t old_block_offset =
+        old_chunk_offsets.empty()
+            ? block_offset
+            : old_chunk_offsets[block_offset / chunk_blocks];
     vector<Extent> old_extents_chunk =
-        ExtentsSublist(old_extents, block_offset, chunk_blocks);
+        GetOldChunkExtents(old_extents, old_block_offset, chunk_blocks);
     vector<Extent> new_extents_chunk =
         ExtentsSublist(new_extents, block_offset, chunk_blocks);
-    NormalizeExtents(&old_extents_chunk);
     NormalizeExtents(&new_extents_chunk);
 
     // Now, insert into the list of operations.
@@ -897,7 +1347,8 @@ bool DeltaReadFile(std::vector<AnnotatedOperation>* aops,
                                             new_file,
                                             config,
                                             &data,
-                                            &aop));
+                                            &aop,
+                                            sarray_cache));
 
     // Check if the operation writes nothing.
     if (aop.op.dst_extents_size() == 0) {
@@ -939,7 +1390,8 @@ bool GenerateBestFullOperation(const brillo::Blob& new_data,
   // Try compressing |new_data| with xz first.
   if (version.OperationAllowed(InstallOperation::REPLACE_XZ)) {
     brillo::Blob new_data_xz;
-    if (XzCompress(new_data, &new_data_xz) && !new_data_xz.empty()) {
+    if (XzCompress(new_data, version.XzArm64FilterAllowed(), &new_data_xz) &&
+        !new_data_xz.empty()) {
       *out_type = InstallOperation::REPLACE_XZ;
       *out_blob = std::move(new_data_xz);
       out_blob_set = true;
@@ -1045,7 +1497,8 @@ bool ReadExtentsToDiff(const string& old_part,
                        const File& new_file,
                        const PayloadGenerationConfig& config,
                        brillo::Blob* out_data,
-                       AnnotatedOperation* out_op) {
+                       AnnotatedOperation* out_op,
+                       SuffixArrayCache* sarray_cache) {
   const auto& version = config.version;
   AnnotatedOperation& aop = *out_op;
   InstallOperation& operation = aop.op;
@@ -1100,11 +1553,15 @@ bool ReadExtentsToDiff(const string& old_part,
                                             old_file,
                                             new_file,
                                             config);
+      best_diff_generator.set_suffix_array_cache(sarray_cache);
       if (!best_diff_generator.GenerateBestDiffOperation(&aop, &data_blob)) {
         LOG(INFO) << "Failed to generate diff for " << new_file.name;
         return false;
       }
     }
+    if (sarray_cache) {
+      sarray_cache->Release(SuffixArrayCacheKey(src_extents));
+    }
   }
 
   // WARNING: We always set legacy |src_length| and |dst_length| fields for
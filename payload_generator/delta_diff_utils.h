@@ -29,6 +29,7 @@
 #include "update_engine/payload_generator/annotated_operation.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 #include "update_engine/payload_generator/payload_generation_config.h"
+#include "update_engine/payload_generator/suffix_array_cache.h"
 #include "update_engine/update_metadata.pb.h"
 
 namespace chromeos_update_engine {
@@ -83,7 +84,9 @@ bool DeltaMovedAndZeroBlocks(std::vector<AnnotatedOperation>* aops,
 // exists, the old version exists in |old_part| in the blocks described by
 // |old_extents|. The operations added to |aops| reference the data blob
 // in the |blob_file|. |old_deflates| and |new_deflates| are all deflate
-// locations in |old_part| and |new_part|. Returns true on success.
+// locations in |old_part| and |new_part|. If |sarray_cache| is not null, it is
+// used to share the bsdiff suffix arrays of the old data. Returns true on
+// success.
 bool DeltaReadFile(std::vector<AnnotatedOperation>* aops,
                    const std::string& old_part,
                    const std::string& new_part,
@@ -91,7 +94,22 @@ bool DeltaReadFile(std::vector<AnnotatedOperation>* aops,
                    const File& new_file,
                    ssize_t chunk_blocks,
                    const PayloadGenerationConfig& config,
-                   BlobFileWriter* blob_file);
+                   BlobFileWriter* blob_file,
+                   SuffixArrayCache* sarray_cache = nullptr);
+
+// Finds, for each chunk of |chunk_blocks| blocks of |new_extents| in
+// |new_part|, the offset in blocks of the window of |chunk_blocks| blocks of
+// |old_extents| in |old_part| the chunk's data most likely comes from, using
+// an index of content defined anchors of the old data, looked up from a few
+// sampled windows of each new chunk. The offsets are stored
+// in |old_chunk_offsets|, one per chunk. Chunks without any anchor found in
+// the old data keep the offset of the new chunk. Returns true on success.
+bool AlignOldChunks(const std::string& old_part,
+                    const std::string& new_part,
+                    const std::vector<Extent>& old_extents,
+                    const std::vector<Extent>& new_extents,
+                    uint64_t chunk_blocks,
+                    std::vector<uint64_t>* old_chunk_offsets);
 
 // Reads the blocks |old_extents| from |old_part| (if it exists) and the
 // |new_extents| from |new_part| and determines the smallest way to encode
@@ -101,7 +119,9 @@ bool DeltaReadFile(std::vector<AnnotatedOperation>* aops,
 // operations allowed in the given |version| (REPLACE, REPLACE_BZ, BSDIFF,
 // SOURCE_BSDIFF, PUFFDIFF or ZUCCHINI) wins.
 // |new_extents| must not be empty. |old_deflates| and |new_deflates| are all
-// the deflate locations in |old_part| and |new_part|. Returns true on success.
+// the deflate locations in |old_part| and |new_part|. |sarray_cache|, if not
+// null, is used to share the bsdiff suffix array of the old data and is
+// released once for |old_extents|. Returns true on success.
 // TODO(197361113) Move logic to calculate deflates inside puffin.
 bool ReadExtentsToDiff(const std::string& old_part,
                        const std::string& new_part,
@@ -111,7 +131,8 @@ bool ReadExtentsToDiff(const std::string& old_part,
                        const File& new_file,
                        const PayloadGenerationConfig& config,
                        brillo::Blob* out_data,
-                       AnnotatedOperation* out_op);
+                       AnnotatedOperation* out_op,
+                       SuffixArrayCache* sarray_cache = nullptr);
 
 // Generates the best allowed full operation to produce |new_data|. The allowed
 // operations are based on |payload_version|. The operation blob will be stored
@@ -150,6 +171,18 @@ FilesystemInterface::File GetOldFile(
     const std::map<std::string, FilesystemInterface::File>& old_files_map,
     const std::string& new_file_name);
 
+// Returns a map from the name of each of the |new_files| without an old file of
+// the same name to the name of the old file with the most similar content,
+// for the files where one is similar enough. Only the old files from
+// |old_files_map| without a new file of the same name are considered. The
+// contents are read from |old_part| and |new_part| and sketched in parallel,
+// within a fixed budget of bytes read and comparisons.
+std::map<std::string, std::string> MatchOldFilesByContent(
+    const std::string& old_part,
+    const std::string& new_part,
+    const std::map<std::string, FilesystemInterface::File>& old_files_map,
+    const std::vector<FilesystemInterface::File>& new_files);
+
 // Read BSDIFF patch data in |data|, compute list of blocks that can be COW_XOR,
 // store these blocks in |aop|.
 bool PopulateXorOps(AnnotatedOperation* aop, const uint8_t* data, size_t size);
@@ -217,6 +250,11 @@ class BestDiffGenerator {
       AnnotatedOperation* aop,
       brillo::Blob* data_blob);
 
+  // Share the bsdiff suffix array of the old data through |sarray_cache|.
+  void set_suffix_array_cache(SuffixArrayCache* sarray_cache) {
+    sarray_cache_ = sarray_cache;
+  }
+
  private:
   std::vector<bsdiff::CompressorType> GetUsableCompressorTypes() const;
   bool TryBsdiffAndUpdateOperation(InstallOperation_Type operation_type,
@@ -227,6 +265,11 @@ class BestDiffGenerator {
   bool TryZucchiniAndUpdateOperation(AnnotatedOperation* aop,
                                      brillo::Blob* data_blob);
 
+  // Returns whether the file |name| is within the size limits of |op_type|
+  // set in the config, logging the limits and the estimates.
+  bool WithinDiffSizeLimits(InstallOperation::Type op_type,
+                            const std::string& name) const;
+
   const brillo::Blob& old_data_;
   const brillo::Blob& new_data_;
   const std::vector<Extent>& src_extents_;
@@ -236,6 +279,7 @@ class BestDiffGenerator {
   const CompressedFile& old_block_info_;
   const CompressedFile& new_block_info_;
   const PayloadGenerationConfig& config_;
+  SuffixArrayCache* sarray_cache_{nullptr};
 };
 
 }  // namespace diff_utils
@@ -389,6 +389,75 @@ TEST_F(DeltaDiffUtilsTest, GenerateBestDiffOperation_Zucchini) {
   ASSERT_EQ(InstallOperation::ZUCCHINI, op.type());
 }
 
+TEST_F(DeltaDiffUtilsTest, GenerateBestDiffOperation_ZucchiniOverMemoryLimit) {
+  brillo::Blob dst_data_blob(kBlockSize);
+  test_utils::FillWithData(&dst_data_blob);
+  brillo::Blob src_data_blob = dst_data_blob;
+  src_data_blob[0]++;
+  vector<Extent> old_extents = {ExtentForRange(1, 1)};
+  vector<Extent> new_extents = {ExtentForRange(2, 1)};
+
+  brillo::Blob data = dst_data_blob;  // Fake the full operation
+  AnnotatedOperation aop;
+  aop.name = "data.so";
+  aop.op.set_type(InstallOperation::REPLACE);
+
+  const FilesystemInterface::File empty;
+  PayloadGenerationConfig config{
+      .version = PayloadVersion(kBrilloMajorPayloadVersion,
+                                kZucchiniMinorPayloadVersion)};
+  // Far less memory than zucchini needs for two blocks.
+  config.diff_size_limits[InstallOperation::ZUCCHINI].max_memory_bytes = 1024;
+  diff_utils::BestDiffGenerator best_diff_generator(src_data_blob,
+                                                    dst_data_blob,
+                                                    old_extents,
+                                                    new_extents,
+                                                    empty,
+                                                    empty,
+                                                    config);
+  ASSERT_TRUE(best_diff_generator.GenerateBestDiffOperation(
+      {{InstallOperation::ZUCCHINI, 1024 * 1024}}, &aop, &data));
+
+  // Zucchini was skipped, so the full operation is kept.
+  EXPECT_EQ(InstallOperation::REPLACE, aop.op.type());
+  EXPECT_EQ(dst_data_blob, data);
+}
+
+TEST_F(DeltaDiffUtilsTest, GenerateBestDiffOperation_BsdiffOverInputLimit) {
+  // 4 MiB of input, over the 1 MiB limit.
+  brillo::Blob dst_data_blob(2 * 1024 * 1024);
+  test_utils::FillWithData(&dst_data_blob);
+  brillo::Blob src_data_blob = dst_data_blob;
+  src_data_blob[0]++;
+  vector<Extent> old_extents = {ExtentForRange(1, 512)};
+  vector<Extent> new_extents = {ExtentForRange(1000, 512)};
+
+  brillo::Blob data = dst_data_blob;  // Fake the full operation
+  AnnotatedOperation aop;
+  aop.name = "data.bin";
+  aop.op.set_type(InstallOperation::REPLACE);
+
+  const FilesystemInterface::File empty;
+  PayloadGenerationConfig config{
+      .version = PayloadVersion(kBrilloMajorPayloadVersion,
+                                kSourceMinorPayloadVersion)};
+  config.diff_size_limits[InstallOperation::SOURCE_BSDIFF].max_input_bytes =
+      1024 * 1024;
+  diff_utils::BestDiffGenerator best_diff_generator(src_data_blob,
+                                                    dst_data_blob,
+                                                    old_extents,
+                                                    new_extents,
+                                                    empty,
+                                                    empty,
+                                                    config);
+  ASSERT_TRUE(best_diff_generator.GenerateBestDiffOperation(
+      {{InstallOperation::SOURCE_BSDIFF, 1024 * 1024 * 1024}}, &aop, &data));
+
+  // bsdiff was skipped, so the full operation is kept.
+  EXPECT_EQ(InstallOperation::REPLACE, aop.op.type());
+  EXPECT_EQ(dst_data_blob, data);
+}
+
 TEST_F(DeltaDiffUtilsTest, GenerateBestDiffOperation_FullOperationBetter) {
   // Makes sure SOURCE_BSDIFF operations are emitted whenever src_ops_allowed
   // is true. It is the same setup as BsdiffSmallTest, which checks
@@ -682,6 +751,108 @@ TEST_F(DeltaDiffUtilsTest, IsExtFilesystemTest) {
       test_utils::GetBuildArtifactsPath("gen/disk_ext2_4k.img")));
 }
 
+TEST_F(DeltaDiffUtilsTest, MatchOldFilesByContentTest) {
+  std::mt19937 gen(12345);
+  std::uniform_int_distribution<uint8_t> dis(0, 255);
+  auto random_data = [&gen, &dis](size_t size) {
+    brillo::Blob data(size);
+    for (auto& byte : data) {
+      byte = dis(gen);
+    }
+    return data;
+  };
+
+  // Two unrelated old files, renamed in the new image. The renamed copy of
+  // "a" got a few bytes inserted.
+  brillo::Blob a_data = random_data(16 * kBlockSize);
+  brillo::Blob b_data = random_data(16 * kBlockSize);
+  brillo::Blob renamed_a_data = a_data;
+  renamed_a_data.insert(renamed_a_data.begin() + 1000, 100, 'x');
+  renamed_a_data.resize(a_data.size());
+  brillo::Blob unrelated_data = random_data(16 * kBlockSize);
+
+  std::map<string, FilesystemInterface::File> old_files_map;
+  old_files_map["lib/a-v1.so"].name = "lib/a-v1.so";
+  old_files_map["lib/a-v1.so"].extents = {ExtentForRange(0, 16)};
+  old_files_map["lib/b-v1.so"].name = "lib/b-v1.so";
+  old_files_map["lib/b-v1.so"].extents = {ExtentForRange(16, 16)};
+  ASSERT_TRUE(WriteExtents(
+      old_part_.path, {ExtentForRange(0, 16)}, kBlockSize, a_data));
+  ASSERT_TRUE(WriteExtents(
+      old_part_.path, {ExtentForRange(16, 16)}, kBlockSize, b_data));
+
+  vector<FilesystemInterface::File> new_files(2);
+  new_files[0].name = "1f3a/liba.so";
+  new_files[0].extents = {ExtentForRange(32, 16)};
+  new_files[1].name = "9c0e/unrelated.so";
+  new_files[1].extents = {ExtentForRange(48, 16)};
+  ASSERT_TRUE(WriteExtents(
+      new_part_.path, {ExtentForRange(32, 16)}, kBlockSize, renamed_a_data));
+  ASSERT_TRUE(WriteExtents(
+      new_part_.path, {ExtentForRange(48, 16)}, kBlockSize, unrelated_data));
+
+  auto matches = diff_utils::MatchOldFilesByContent(
+      old_part_.path, new_part_.path, old_files_map, new_files);
+  ASSERT_EQ(1u, matches.size());
+  EXPECT_EQ("lib/a-v1.so", matches["1f3a/liba.so"]);
+}
+
+TEST_F(DeltaDiffUtilsTest, AlignOldChunksTest) {
+  std::mt19937 gen(4321);
+  std::uniform_int_distribution<uint8_t> dis(0, 255);
+  brillo::Blob old_data(32 * kBlockSize);
+  for (auto& byte : old_data) {
+    byte = dis(gen);
+  }
+  // Insert some data near the beginning of the new file, shifting everything
+  // after it by less than a block.
+  brillo::Blob new_data = old_data;
+  new_data.insert(new_data.begin() + 10, 1000, 'x');
+  new_data.resize(old_data.size());
+
+  vector<Extent> old_extents = {ExtentForRange(0, 32)};
+  vector<Extent> new_extents = {ExtentForRange(64, 32)};
+  ASSERT_TRUE(WriteExtents(old_part_.path, old_extents, kBlockSize, old_data));
+  ASSERT_TRUE(WriteExtents(new_part_.path, new_extents, kBlockSize, new_data));
+
+  vector<uint64_t> old_chunk_offsets;
+  ASSERT_TRUE(diff_utils::AlignOldChunks(old_part_.path,
+                                         new_part_.path,
+                                         old_extents,
+                                         new_extents,
+                                         8,
+                                         &old_chunk_offsets));
+  // Each new chunk starts 1000 bytes before the old chunk with the same index.
+  EXPECT_EQ((vector<uint64_t>{0, 7, 15, 23}), old_chunk_offsets);
+}
+
+// Large chunks are only sampled to find where they moved from.
+TEST_F(DeltaDiffUtilsTest, AlignOldChunksSampledTest) {
+  std::mt19937 gen(1234);
+  std::uniform_int_distribution<uint8_t> dis(0, 255);
+  brillo::Blob old_data(1024 * kBlockSize);
+  for (auto& byte : old_data) {
+    byte = dis(gen);
+  }
+  brillo::Blob new_data = old_data;
+  new_data.insert(new_data.begin() + 10, 1000, 'x');
+  new_data.resize(old_data.size());
+
+  vector<Extent> old_extents = {ExtentForRange(0, 1024)};
+  vector<Extent> new_extents = {ExtentForRange(2048, 1024)};
+  ASSERT_TRUE(WriteExtents(old_part_.path, old_extents, kBlockSize, old_data));
+  ASSERT_TRUE(WriteExtents(new_part_.path, new_extents, kBlockSize, new_data));
+
+  vector<uint64_t> old_chunk_offsets;
+  ASSERT_TRUE(diff_utils::AlignOldChunks(old_part_.path,
+                                         new_part_.path,
+                                         old_extents,
+                                         new_extents,
+                                         512,
+                                         &old_chunk_offsets));
+  EXPECT_EQ((vector<uint64_t>{0, 511}), old_chunk_offsets);
+}
+
 TEST_F(DeltaDiffUtilsTest, GetOldFileEmptyTest) {
   ASSERT_TRUE(diff_utils::GetOldFile({}, "filename").name.empty());
 }
@@ -15,6 +15,7 @@
 //
 
 #include <map>
+#include <memory>
 #include <string>
 #include <vector>
 
@@ -39,10 +40,14 @@
 #include "update_engine/common/utils.h"
 #include "update_engine/payload_consumer/filesystem_verifier_action.h"
 #include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_consumer/payload_metadata.h"
 #include "update_engine/payload_generator/delta_diff_generator.h"
+#include "update_engine/payload_generator/install_time_estimator.h"
+#include "update_engine/payload_generator/partition_result_cache.h"
 #include "update_engine/payload_generator/payload_generation_config.h"
 #include "update_engine/payload_generator/payload_properties.h"
 #include "update_engine/payload_generator/payload_signer.h"
+#include "update_engine/payload_generator/puffdiff_cache.h"
 #include "update_engine/payload_generator/xz.h"
 #include "update_engine/update_metadata.pb.h"
 
@@ -270,6 +275,34 @@ bool ExtractProperties(const string& payload_path,
   return true;
 }
 
+bool EstimateInstallTime(const string& payload_path,
+                         const string& device_profile_path,
+                         const string& install_time_file) {
+  DeviceProfile profile;
+  if (!device_profile_path.empty()) {
+    brillo::KeyValueStore store;
+    TEST_AND_RETURN_FALSE(store.Load(base::FilePath(device_profile_path)));
+    TEST_AND_RETURN_FALSE(profile.Load(store));
+  }
+  PayloadMetadata payload_metadata;
+  DeltaArchiveManifest manifest;
+  Signatures metadata_signatures;
+  TEST_AND_RETURN_FALSE(payload_metadata.ParsePayloadFile(
+      payload_path, &manifest, &metadata_signatures));
+
+  string estimates =
+      InstallTimeToKeyValue(EstimateInstallTime(manifest, profile))
+          .SaveToString();
+  if (install_time_file == "-") {
+    printf("%s", estimates.c_str());
+  } else {
+    TEST_AND_RETURN_FALSE(utils::WriteFile(
+        install_time_file.c_str(), estimates.c_str(), estimates.length()));
+    LOG(INFO) << "Generated install time estimates at " << install_time_file;
+  }
+  return true;
+}
+
 template <typename Key, typename Val>
 string ToString(const map<Key, Val>& map) {
   vector<string> result;
@@ -385,6 +418,18 @@ int Main(int argc, char** argv) {
                 "",
                 "If passed, dumps the payload properties of the payload passed "
                 "in --in_file and exits. Look at --properties_format.");
+  DEFINE_string(install_time_file,
+                "",
+                "If passed, estimates how long installing the payload passed "
+                "in --in_file takes on the device described by "
+                "--device_profile, writes the estimates there as key-value "
+                "pairs (or to stdout for \"-\") and exits.");
+  DEFINE_string(device_profile,
+                "",
+                "Key-value file with the MB/s of a device class for each kind "
+                "of work done by an install, e.g. read_mbps=400 or "
+                "bspatch_mbps=40, used by --install_time_file. Rates not "
+                "listed use defaults for a mid-range device.");
   DEFINE_string(properties_format,
                 kPayloadPropertiesFormatKeyValue,
                 "Defines the format of the --properties_file. The acceptable "
@@ -413,6 +458,10 @@ int Main(int argc, char** argv) {
   DEFINE_bool(disable_verity_computation,
               false,
               "Disables the verity data computation on device.");
+  DEFINE_bool(disable_verity_self_check,
+              false,
+              "Skips checking the verity hash tree and FEC stored in the "
+              "target images. Only use with images from a trusted pipeline.");
   DEFINE_string(
       out_maximum_signature_size_file,
       "",
@@ -444,6 +493,43 @@ int Main(int argc, char** argv) {
       true,
       "Whether to enable zucchini feature when processing executable files.");
 
+  DEFINE_bool(full_payload_xz_arm64_filter,
+              false,
+              "Whether to compress AArch64 executables of a full payload with "
+              "the ARM64 BCJ filter of xz. Delta payloads use it from minor "
+              "version 10 on. Only set it if every device applying the full "
+              "payload supports minor version 10, older ones fail to apply "
+              "it.");
+
+  DEFINE_string(diff_size_limits,
+                "",
+                "Comma separated list of per file size limits for the diff "
+                "algorithms, as <algorithm>:<max memory MiB>:<max input MiB>, "
+                "where <algorithm> is bsdiff, puffdiff or zucchini and 0 "
+                "means no limit. The memory is estimated from the size of the "
+                "old and new files, the input is their total size. Files over "
+                "a limit fall back to the other algorithms. Example: "
+                "zucchini:4096:256");
+
+  DEFINE_string(puffdiff_cache_dir,
+                "",
+                "Directory where PUFFDIFF patches are cached across runs, "
+                "keyed by the contents they were generated from and the "
+                "build of the generator.");
+
+  DEFINE_uint64(puffdiff_cache_memory_mib,
+                0,
+                "Maximum size in MiB of the PUFFDIFF patches kept in memory "
+                "during the run, for files duplicated across partitions. 0 "
+                "disables the in memory cache.");
+
+  DEFINE_string(partition_cache_dir,
+                "",
+                "Directory where the generated operations of each partition "
+                "are cached across runs, keyed by the old and new images and "
+                "the payload options. Partitions found there are not diffed "
+                "again.");
+
   DEFINE_string(erofs_compression_param,
                 "",
                 "Compression parameter passed to mkfs.erofs's -z option. "
@@ -530,6 +616,12 @@ int Main(int argc, char** argv) {
                ? 0
                : 1;
   }
+  if (!FLAGS_install_time_file.empty()) {
+    return EstimateInstallTime(
+               FLAGS_in_file, FLAGS_device_profile, FLAGS_install_time_file)
+               ? 0
+               : 1;
+  }
 
   // A payload generation was requested. Convert the flags to a
   // PayloadGenerationConfig.
@@ -567,8 +659,30 @@ int Main(int argc, char** argv) {
   payload_config.enable_vabc_xor = FLAGS_enable_vabc_xor;
   payload_config.enable_lz4diff = FLAGS_enable_lz4diff;
   payload_config.enable_zucchini = FLAGS_enable_zucchini;
+  payload_config.version.full_payload_xz_arm64_filter =
+      FLAGS_full_payload_xz_arm64_filter;
 
   payload_config.ParseCompressorTypes(FLAGS_compressor_types);
+  LOG_IF(FATAL, !payload_config.ParseDiffSizeLimits(FLAGS_diff_size_limits))
+      << "Invalid --diff_size_limits: " << FLAGS_diff_size_limits;
+
+  if (!FLAGS_puffdiff_cache_dir.empty()) {
+    CHECK(base::CreateDirectory(base::FilePath(FLAGS_puffdiff_cache_dir)))
+        << "Failed to create " << FLAGS_puffdiff_cache_dir;
+  }
+  if (!FLAGS_puffdiff_cache_dir.empty() ||
+      FLAGS_puffdiff_cache_memory_mib != 0) {
+    payload_config.puffdiff_cache = std::make_shared<PuffdiffCache>(
+        FLAGS_puffdiff_cache_memory_mib * 1024 * 1024,
+        FLAGS_puffdiff_cache_dir);
+  }
+
+  if (!FLAGS_partition_cache_dir.empty()) {
+    CHECK(base::CreateDirectory(base::FilePath(FLAGS_partition_cache_dir)))
+        << "Failed to create " << FLAGS_partition_cache_dir;
+    payload_config.partition_result_cache =
+        std::make_shared<PartitionResultCache>(FLAGS_partition_cache_dir);
+  }
 
   if (!FLAGS_new_partitions.empty()) {
     LOG_IF(FATAL, !FLAGS_new_image.empty() || !FLAGS_new_kernel.empty())
@@ -599,6 +713,8 @@ int Main(int argc, char** argv) {
     payload_config.target.partitions.back().path = new_partitions[i];
     payload_config.target.partitions.back().disable_fec_computation =
         FLAGS_disable_fec_computation;
+    payload_config.target.partitions.back().disable_verity_self_check =
+        FLAGS_disable_verity_self_check;
     if (!FLAGS_erofs_compression_param.empty()) {
       payload_config.target.partitions.back().erofs_compression_param =
           PartitionConfig::ParseCompressionParam(FLAGS_erofs_compression_param);
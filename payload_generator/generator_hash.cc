@@ -0,0 +1,109 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_generator/generator_hash.h"
+
+#include <set>
+
+#include <base/files/file_path.h>
+#include <base/files/file_util.h>
+#include <base/logging.h>
+#include <base/strings/string_split.h>
+#include <base/strings/string_util.h>
+
+#include "update_engine/common/hash_calculator.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// The file name prefixes of the shared libraries whose code decides the
+// generated operations: the diff algorithms and the compressors of the
+// patches and of the REPLACE operations. "libz" also matches libzucchini.
+const char* const kDiffLibraryPrefixes[] = {
+    "libbrotli",
+    "libbsdiff",
+    "libbz",
+    "liblz4",
+    "liblzma",
+    "libpuffin",
+    "libz",
+};
+
+// Adds the SHA-256 of the file at |path| to |hasher|.
+bool HashFile(const std::string& path, HashCalculator* hasher) {
+  brillo::Blob hash;
+  if (!HashCalculator::RawHashOfFile(path, &hash)) {
+    LOG(WARNING) << "Failed to hash " << path;
+    return false;
+  }
+  const uint64_t size = path.size();
+  return hasher->Update(&size, sizeof(size)) &&
+         hasher->Update(path.data(), path.size()) &&
+         hasher->Update(hash.data(), hash.size());
+}
+
+}  // namespace
+
+std::vector<std::string> GetDiffLibraryPaths(const std::string& maps) {
+  std::set<std::string> paths;
+  for (const auto& line : base::SplitString(
+           maps, "\n", base::TRIM_WHITESPACE, base::SPLIT_WANT_NONEMPTY)) {
+    // The mapped file is the sixth field, missing for anonymous mappings.
+    auto fields = base::SplitString(
+        line, " ", base::TRIM_WHITESPACE, base::SPLIT_WANT_NONEMPTY);
+    if (fields.size() < 6 || fields[5][0] != '/') {
+      continue;
+    }
+    const std::string name = base::FilePath(fields[5]).BaseName().value();
+    for (const char* prefix : kDiffLibraryPrefixes) {
+      if (base::StartsWith(name, prefix, base::CompareCase::SENSITIVE)) {
+        paths.insert(fields[5]);
+        break;
+      }
+    }
+  }
+  return std::vector<std::string>(paths.begin(), paths.end());
+}
+
+const brillo::Blob& GetGeneratorHash() {
+  static const brillo::Blob hash = [] {
+    HashCalculator hasher;
+    if (!HashFile("/proc/self/exe", &hasher)) {
+      return brillo::Blob();
+    }
+    // Host builds load the diff libraries as shared libraries, which are
+    // rebuilt without the binary changing.
+    std::string maps;
+    if (!base::ReadFileToString(base::FilePath("/proc/self/maps"), &maps)) {
+      LOG(WARNING) << "Failed to read the libraries loaded by the generator.";
+      return brillo::Blob();
+    }
+    for (const auto& path : GetDiffLibraryPaths(maps)) {
+      if (!HashFile(path, &hasher)) {
+        return brillo::Blob();
+      }
+    }
+    if (!hasher.Finalize()) {
+      return brillo::Blob();
+    }
+    return hasher.raw_hash();
+  }();
+  return hash;
+}
+
+}  // namespace chromeos_update_engine
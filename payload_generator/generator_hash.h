@@ -0,0 +1,40 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_GENERATOR_HASH_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_GENERATOR_HASH_H_
+
+#include <string>
+#include <vector>
+
+#include <brillo/secure_blob.h>
+
+namespace chromeos_update_engine {
+
+// Returns the SHA-256 of the generator binary and of the diff and compression
+// libraries it loaded, or an empty blob if they can't be read. The generated
+// operations depend on these as much as on their inputs, so the caches of
+// generated data key on it to never reuse the results of another build.
+const brillo::Blob& GetGeneratorHash();
+
+// Returns the sorted paths of the diff and compression libraries mapped in
+// |maps|, the contents of a /proc/<pid>/maps file.
+std::vector<std::string> GetDiffLibraryPaths(const std::string& maps);
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_GENERATOR_HASH_H_
@@ -0,0 +1,51 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+
+#include "update_engine/payload_generator/generator_hash.h"
+
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace chromeos_update_engine {
+
+TEST(GeneratorHashTest, GetDiffLibraryPathsTest) {
+  const std::string maps =
+      "55d0c000-55d0d000 r--p 00000000 fd:01 1 /out/host/bin/delta_generator\n"
+      "7f00a000-7f00b000 r-xp 00001000 fd:01 2 /out/host/lib64/libpuffin.so\n"
+      "7f00b000-7f00c000 r--p 00002000 fd:01 2 /out/host/lib64/libpuffin.so\n"
+      "7f00c000-7f00d000 r-xp 00000000 fd:01 3 /out/host/lib64/libz.so\n"
+      "7f00d000-7f00e000 r-xp 00000000 fd:01 4 "
+      "/out/host/lib64/libzucchini.so\n"
+      "7f00e000-7f00f000 r-xp 00000000 fd:01 5 /out/host/lib64/libbase.so\n"
+      "7f00f000-7f010000 rw-p 00000000 00:00 0 \n"
+      "7ffd0000-7ffd1000 rw-p 00000000 00:00 0 [stack]\n";
+  EXPECT_EQ(std::vector<std::string>({"/out/host/lib64/libpuffin.so",
+                                      "/out/host/lib64/libz.so",
+                                      "/out/host/lib64/libzucchini.so"}),
+            GetDiffLibraryPaths(maps));
+  EXPECT_TRUE(GetDiffLibraryPaths("").empty());
+}
+
+TEST(GeneratorHashTest, GetGeneratorHashTest) {
+  const brillo::Blob& hash = GetGeneratorHash();
+  EXPECT_EQ(32u, hash.size());
+  EXPECT_EQ(hash, GetGeneratorHash());
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,224 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/install_time_estimator.h"
+
+#include <algorithm>
+#include <utility>
+
+#include <base/logging.h>
+#include <base/strings/string_number_conversions.h>
+#include <base/strings/stringprintf.h>
+
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/payload_constants.h"
+
+using std::string;
+using std::vector;
+
+namespace chromeos_update_engine {
+
+namespace {
+
+constexpr double kBytesPerMB = 1e6;
+
+double Seconds(uint64_t bytes, double mbps) {
+  return bytes / (mbps * kBytesPerMB);
+}
+
+uint64_t ExtentBytes(const Extent& extent, uint64_t block_size) {
+  return extent.num_blocks() * block_size;
+}
+
+// Returns the time taken by the install operation |op| alone.
+double OperationSeconds(const InstallOperation& op,
+                        uint64_t block_size,
+                        bool vabc,
+                        const DeviceProfile& profile) {
+  const uint64_t src_bytes =
+      utils::BlocksInExtents(op.src_extents()) * block_size;
+  const uint64_t dst_bytes =
+      utils::BlocksInExtents(op.dst_extents()) * block_size;
+  // The data of the operation is read from the payload.
+  double seconds = Seconds(op.data_length(), profile.read_mbps);
+  // The rate of the whole operation, for the ones decoding or patching data.
+  // It already covers reading the source and writing the target.
+  double op_mbps = 0;
+  bool writes_dst = true;
+  switch (op.type()) {
+    case InstallOperation::REPLACE:
+      break;
+    case InstallOperation::REPLACE_BZ:
+      op_mbps = profile.bz2_decode_mbps;
+      break;
+    case InstallOperation::REPLACE_XZ:
+      op_mbps = profile.xz_decode_mbps;
+      break;
+    case InstallOperation::ZERO:
+    case InstallOperation::DISCARD:
+      // Virtual A/B compression only records the blocks in the COW.
+      writes_dst = !vabc;
+      break;
+    case InstallOperation::SOURCE_COPY:
+      // With Virtual A/B compression the copy is recorded in the COW and done
+      // by the merge.
+      writes_dst = !vabc;
+      if (writes_dst) {
+        seconds += Seconds(src_bytes, profile.read_mbps);
+      }
+      break;
+    case InstallOperation::SOURCE_BSDIFF:
+    case InstallOperation::BROTLI_BSDIFF:
+      op_mbps = profile.bspatch_mbps;
+      break;
+    case InstallOperation::PUFFDIFF:
+      op_mbps = profile.puffpatch_mbps;
+      break;
+    case InstallOperation::ZUCCHINI:
+      op_mbps = profile.zucchini_mbps;
+      break;
+    case InstallOperation::LZ4DIFF_BSDIFF:
+    case InstallOperation::LZ4DIFF_PUFFDIFF:
+      op_mbps = profile.lz4diff_mbps;
+      break;
+    default:
+      LOG(WARNING) << "No install time estimate for operation "
+                   << InstallOperationTypeName(op.type());
+      break;
+  }
+  if (op_mbps > 0) {
+    return seconds + Seconds(dst_bytes, op_mbps);
+  }
+  if (writes_dst) {
+    seconds += Seconds(dst_bytes, profile.write_mbps);
+    if (vabc) {
+      seconds += Seconds(dst_bytes, profile.cow_compress_mbps);
+    }
+  }
+  return seconds;
+}
+
+}  // namespace
+
+bool DeviceProfile::Load(const brillo::KeyValueStore& store) {
+  const std::pair<const char*, double*> rates[] = {
+      {"read_mbps", &read_mbps},
+      {"write_mbps", &write_mbps},
+      {"bz2_decode_mbps", &bz2_decode_mbps},
+      {"xz_decode_mbps", &xz_decode_mbps},
+      {"bspatch_mbps", &bspatch_mbps},
+      {"puffpatch_mbps", &puffpatch_mbps},
+      {"zucchini_mbps", &zucchini_mbps},
+      {"lz4diff_mbps", &lz4diff_mbps},
+      {"cow_compress_mbps", &cow_compress_mbps},
+      {"xor_mbps", &xor_mbps},
+      {"hash_mbps", &hash_mbps},
+      {"fec_mbps", &fec_mbps},
+  };
+  for (const auto& [key, rate] : rates) {
+    string value;
+    if (!store.GetString(key, &value)) {
+      continue;
+    }
+    double parsed = 0;
+    if (!base::StringToDouble(value, &parsed) || !(parsed > 0)) {
+      LOG(ERROR) << "Invalid device profile rate " << key << "=" << value;
+      return false;
+    }
+    *rate = parsed;
+  }
+  return true;
+}
+
+vector<PartitionInstallTime> EstimateInstallTime(
+    const DeltaArchiveManifest& manifest, const DeviceProfile& profile) {
+  const uint64_t block_size = manifest.block_size();
+  const auto& metadata = manifest.dynamic_partition_metadata();
+  const bool snapshot = metadata.snapshot_enabled();
+  const bool vabc = snapshot && metadata.vabc_enabled();
+
+  vector<PartitionInstallTime> estimates;
+  for (const PartitionUpdate& partition : manifest.partitions()) {
+    PartitionInstallTime estimate;
+    estimate.name = partition.partition_name();
+
+    uint64_t written_bytes = 0;
+    for (const InstallOperation& op : partition.operations()) {
+      estimate.install_seconds +=
+          OperationSeconds(op, block_size, vabc, profile);
+      written_bytes += utils::BlocksInExtents(op.dst_extents()) * block_size;
+    }
+
+    // The target partition is read once, to hash it and to compute the verity
+    // data, which is then written.
+    const uint64_t new_size = partition.new_partition_info().size();
+    estimate.verify_seconds =
+        Seconds(new_size, std::min(profile.read_mbps, profile.hash_mbps));
+    if (partition.has_fec_extent()) {
+      estimate.verify_seconds +=
+          Seconds(ExtentBytes(partition.fec_data_extent(), block_size),
+                  profile.fec_mbps) +
+          Seconds(ExtentBytes(partition.fec_extent(), block_size),
+                  profile.write_mbps);
+    }
+    if (partition.has_hash_tree_extent()) {
+      estimate.verify_seconds += Seconds(
+          ExtentBytes(partition.hash_tree_extent(), block_size),
+          profile.write_mbps);
+    }
+
+    // The merge reads every block written through the snapshot, from the COW
+    // or the source, and writes it to the base device.
+    if (snapshot) {
+      estimate.merge_seconds = Seconds(written_bytes, profile.read_mbps) +
+                               Seconds(written_bytes, profile.write_mbps);
+      for (const CowMergeOperation& merge_op : partition.merge_operations()) {
+        if (merge_op.type() == CowMergeOperation::COW_XOR) {
+          estimate.merge_seconds += Seconds(
+              ExtentBytes(merge_op.dst_extent(), block_size), profile.xor_mbps);
+        }
+      }
+    }
+    estimates.push_back(std::move(estimate));
+  }
+  return estimates;
+}
+
+brillo::KeyValueStore InstallTimeToKeyValue(
+    const vector<PartitionInstallTime>& estimates) {
+  brillo::KeyValueStore store;
+  PartitionInstallTime total;
+  for (const PartitionInstallTime& estimate : estimates) {
+    store.SetString(estimate.name + ".install_seconds",
+                    base::StringPrintf("%.1f", estimate.install_seconds));
+    store.SetString(estimate.name + ".verify_seconds",
+                    base::StringPrintf("%.1f", estimate.verify_seconds));
+    store.SetString(estimate.name + ".merge_seconds",
+                    base::StringPrintf("%.1f", estimate.merge_seconds));
+    total.install_seconds += estimate.install_seconds;
+    total.verify_seconds += estimate.verify_seconds;
+    total.merge_seconds += estimate.merge_seconds;
+  }
+  store.SetString("total.install_seconds",
+                  base::StringPrintf("%.1f", total.install_seconds));
+  store.SetString("total.verify_seconds",
+                  base::StringPrintf("%.1f", total.verify_seconds));
+  store.SetString("total.merge_seconds",
+                  base::StringPrintf("%.1f", total.merge_seconds));
+  return store;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,94 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_INSTALL_TIME_ESTIMATOR_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_INSTALL_TIME_ESTIMATOR_H_
+
+#include <string>
+#include <vector>
+
+#include <brillo/key_value_store.h>
+
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// The speed of a class of devices at each kind of work done to apply a
+// payload, in MB/s (10^6 bytes per second). The rates of the decoding and
+// patching operations are the throughput of the whole operation, reading the
+// source and writing the target included, in bytes written to the target
+// partition. They are logged by DeltaPerformer as "Install operation
+// throughput" at the end of an update, and should be measured on a device of
+// the same kind, with or without Virtual A/B compression. The defaults are
+// rough values for a mid-range device.
+struct DeviceProfile {
+  // Loads the rates found in |store|, keyed by the name of the members, e.g.
+  // "read_mbps=450". Other rates keep their current value. Returns false if a
+  // rate isn't a positive number.
+  bool Load(const brillo::KeyValueStore& store);
+
+  // Storage.
+  double read_mbps = 400;
+  double write_mbps = 200;
+
+  // Applying REPLACE_BZ and REPLACE_XZ operations.
+  double bz2_decode_mbps = 25;
+  double xz_decode_mbps = 45;
+
+  // Applying SOURCE_BSDIFF and BROTLI_BSDIFF, PUFFDIFF, ZUCCHINI and the
+  // LZ4DIFF operations.
+  double bspatch_mbps = 30;
+  double puffpatch_mbps = 15;
+  double zucchini_mbps = 20;
+  double lz4diff_mbps = 25;
+
+  // Compressing the blocks written to the COW of Virtual A/B compression, and
+  // XOR-ing the COW_XOR blocks.
+  double cow_compress_mbps = 150;
+  double xor_mbps = 1000;
+
+  // Hashing the target partition and computing its verity hash tree and FEC.
+  double hash_mbps = 500;
+  double fec_mbps = 100;
+};
+
+// The estimated time to apply one partition of a payload.
+struct PartitionInstallTime {
+  std::string name;
+
+  // Applying the install operations.
+  double install_seconds = 0;
+
+  // Computing verity data and verifying the target partition.
+  double verify_seconds = 0;
+
+  // Merging the snapshot after reboot, 0 without Virtual A/B.
+  double merge_seconds = 0;
+};
+
+// Estimates how long applying each partition of |manifest| takes on a device
+// with |profile|. The install time includes reading the payload data.
+std::vector<PartitionInstallTime> EstimateInstallTime(
+    const DeltaArchiveManifest& manifest, const DeviceProfile& profile);
+
+// Returns the |estimates| as a key/value store with the seconds of each step
+// of each partition, and of the whole payload, e.g. "system.install_seconds".
+brillo::KeyValueStore InstallTimeToKeyValue(
+    const std::vector<PartitionInstallTime>& estimates);
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_INSTALL_TIME_ESTIMATOR_H_
@@ -0,0 +1,133 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/install_time_estimator.h"
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+#include "update_engine/payload_generator/extent_ranges.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+// One MB per block makes the expected seconds easy to compute.
+constexpr uint64_t kBlockSize = 1000 * 1000;
+}  // namespace
+
+class InstallTimeEstimatorTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    manifest_.set_block_size(kBlockSize);
+    partition_ = manifest_.add_partitions();
+    partition_->set_partition_name("system");
+    partition_->mutable_new_partition_info()->set_size(100 * kBlockSize);
+
+    profile_.read_mbps = 100;
+    profile_.write_mbps = 50;
+    profile_.bspatch_mbps = 10;
+    profile_.cow_compress_mbps = 20;
+    profile_.hash_mbps = 200;
+    profile_.xor_mbps = 25;
+  }
+
+  void AddOperation(InstallOperation::Type type,
+                    uint64_t num_blocks,
+                    uint64_t data_length) {
+    InstallOperation* op = partition_->add_operations();
+    op->set_type(type);
+    if (type == InstallOperation::SOURCE_COPY ||
+        type == InstallOperation::SOURCE_BSDIFF) {
+      *op->add_src_extents() = ExtentForRange(0, num_blocks);
+    }
+    *op->add_dst_extents() = ExtentForRange(0, num_blocks);
+    if (data_length > 0) {
+      op->set_data_length(data_length);
+    }
+  }
+
+  DeltaArchiveManifest manifest_;
+  PartitionUpdate* partition_;
+  DeviceProfile profile_;
+};
+
+TEST_F(InstallTimeEstimatorTest, SumsOperationsTest) {
+  // Reads 10 MB of data and writes 10 MB: 0.1 + 0.2 s.
+  AddOperation(InstallOperation::REPLACE, 10, 10 * kBlockSize);
+  // Reads 1 MB of patch, then patches 10 MB at the rate of the whole
+  // operation: 0.01 + 1 s.
+  AddOperation(InstallOperation::SOURCE_BSDIFF, 10, kBlockSize);
+  // Reads and writes 5 MB: 0.05 + 0.1 s.
+  AddOperation(InstallOperation::SOURCE_COPY, 5, 0);
+
+  auto estimates = EstimateInstallTime(manifest_, profile_);
+  ASSERT_EQ(1u, estimates.size());
+  EXPECT_EQ("system", estimates[0].name);
+  EXPECT_NEAR(1.46, estimates[0].install_seconds, 1e-9);
+  // 100 MB read at 100 MB/s, slower than hashing.
+  EXPECT_NEAR(1.0, estimates[0].verify_seconds, 1e-9);
+  EXPECT_EQ(0, estimates[0].merge_seconds);
+}
+
+TEST_F(InstallTimeEstimatorTest, VirtualABCompressionTest) {
+  auto* metadata = manifest_.mutable_dynamic_partition_metadata();
+  metadata->set_snapshot_enabled(true);
+  metadata->set_vabc_enabled(true);
+  // Reads 10 MB of data, writes and compresses 10 MB: 0.1 + 0.2 + 0.5 s.
+  AddOperation(InstallOperation::REPLACE, 10, 10 * kBlockSize);
+  // Copies are done by the merge.
+  AddOperation(InstallOperation::SOURCE_COPY, 5, 0);
+  CowMergeOperation* merge_op = partition_->add_merge_operations();
+  merge_op->set_type(CowMergeOperation::COW_XOR);
+  *merge_op->mutable_dst_extent() = ExtentForRange(0, 5);
+
+  auto estimates = EstimateInstallTime(manifest_, profile_);
+  ASSERT_EQ(1u, estimates.size());
+  EXPECT_NEAR(0.8, estimates[0].install_seconds, 1e-9);
+  // 15 MB read and written, 5 MB XOR-ed: 0.15 + 0.3 + 0.2 s.
+  EXPECT_NEAR(0.65, estimates[0].merge_seconds, 1e-9);
+}
+
+TEST_F(InstallTimeEstimatorTest, LoadProfileTest) {
+  brillo::KeyValueStore store;
+  store.SetString("read_mbps", "123.5");
+  DeviceProfile profile;
+  const double default_write_mbps = profile.write_mbps;
+  EXPECT_TRUE(profile.Load(store));
+  EXPECT_EQ(123.5, profile.read_mbps);
+  EXPECT_EQ(default_write_mbps, profile.write_mbps);
+
+  store.SetString("write_mbps", "0");
+  EXPECT_FALSE(profile.Load(store));
+  store.SetString("write_mbps", "fast");
+  EXPECT_FALSE(profile.Load(store));
+}
+
+TEST_F(InstallTimeEstimatorTest, KeyValueOutputTest) {
+  PartitionInstallTime system{"system", 1.24, 2, 3};
+  PartitionInstallTime vendor{"vendor", 1, 0, 0};
+  auto store = InstallTimeToKeyValue({system, vendor});
+  std::string value;
+  EXPECT_TRUE(store.GetString("system.install_seconds", &value));
+  EXPECT_EQ("1.2", value);
+  EXPECT_TRUE(store.GetString("total.install_seconds", &value));
+  EXPECT_EQ("2.2", value);
+  EXPECT_TRUE(store.GetString("total.merge_seconds", &value));
+  EXPECT_EQ("3.0", value);
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,235 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/memory_patch_writer.h"
+
+#include <bzlib.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+
+#include <base/logging.h>
+#include <base/strings/stringprintf.h>
+#include <brotli/encode.h>
+
+namespace chromeos_update_engine {
+
+namespace {
+
+constexpr char kLegacyMagicHeader[] = "BSDIFF40";
+constexpr char kBSDF2MagicHeader[] = "BSDF2";
+// Magic (8 bytes) followed by the control stream size, the diff stream size
+// and the new file size, 8 bytes each.
+constexpr size_t kHeaderSize = 32;
+
+// Append |value| to |out| using the bsdiff sign-magnitude little endian
+// encoding.
+void AppendInt64(int64_t value, brillo::Blob* out) {
+  uint64_t y = value < 0 ? (1ULL << 63ULL) - value : value;
+  for (int i = 0; i < 8; i++) {
+    out->push_back(y & 0xff);
+    y >>= 8;
+  }
+}
+
+void EncodeInt64(int64_t value, uint8_t* buf) {
+  brillo::Blob encoded;
+  AppendInt64(value, &encoded);
+  std::copy(encoded.begin(), encoded.end(), buf);
+}
+
+}  // namespace
+
+MemoryPatchWriter::MemoryPatchWriter(brillo::Blob* patch)
+    : patch_(patch),
+      bsdf2_(false),
+      types_({bsdiff::CompressorType::kBZ2}),
+      brotli_quality_(0) {}
+
+MemoryPatchWriter::MemoryPatchWriter(
+    brillo::Blob* patch,
+    const std::vector<bsdiff::CompressorType>& types,
+    int brotli_quality)
+    : patch_(patch),
+      bsdf2_(true),
+      types_(types),
+      brotli_quality_(brotli_quality) {}
+
+bool MemoryPatchWriter::Init(size_t new_size) {
+  TEST_AND_RETURN_FALSE(patch_ != nullptr);
+  TEST_AND_RETURN_FALSE(!types_.empty());
+  new_size_ = new_size;
+  written_output_ = 0;
+  ctrl_stream_.clear();
+  diff_stream_.clear();
+  extra_stream_.clear();
+  return true;
+}
+
+bool MemoryPatchWriter::WriteDiffStream(const uint8_t* data, size_t size) {
+  diff_stream_.insert(diff_stream_.end(), data, data + size);
+  return true;
+}
+
+bool MemoryPatchWriter::WriteExtraStream(const uint8_t* data, size_t size) {
+  extra_stream_.insert(extra_stream_.end(), data, data + size);
+  return true;
+}
+
+bool MemoryPatchWriter::AddControlEntry(const bsdiff::ControlEntry& entry) {
+  AppendInt64(entry.diff_size, &ctrl_stream_);
+  AppendInt64(entry.extra_size, &ctrl_stream_);
+  AppendInt64(entry.offset_increment, &ctrl_stream_);
+  written_output_ += entry.diff_size + entry.extra_size;
+  return true;
+}
+
+bool MemoryPatchWriter::CompressStream(bsdiff::CompressorType type,
+                                       const brillo::Blob& stream,
+                                       brillo::Blob* out) const {
+  switch (type) {
+    case bsdiff::CompressorType::kBZ2: {
+      // bzip2 guarantees the output fits in 1% more than the input plus 600
+      // bytes.
+      size_t out_size = stream.size() + stream.size() / 100 + 600;
+      TEST_AND_RETURN_FALSE(out_size <= std::numeric_limits<uint32_t>::max());
+      out->resize(out_size);
+      uint32_t data_size = out_size;
+      int rc = BZ2_bzBuffToBuffCompress(
+          reinterpret_cast<char*>(out->data()),
+          &data_size,
+          reinterpret_cast<char*>(const_cast<uint8_t*>(stream.data())),
+          stream.size(),
+          9,   // Best compression, same as bsdiff's BZ2Compressor.
+          0,   // Silent verbosity
+          0);  // Default work factor
+      TEST_AND_RETURN_FALSE(rc == BZ_OK);
+      out->resize(data_size);
+      return true;
+    }
+    case bsdiff::CompressorType::kBrotli: {
+      size_t out_size = BrotliEncoderMaxCompressedSize(stream.size());
+      TEST_AND_RETURN_FALSE(out_size > 0);
+      out->resize(out_size);
+      TEST_AND_RETURN_FALSE(BrotliEncoderCompress(brotli_quality_,
+                                                  BROTLI_DEFAULT_WINDOW,
+                                                  BROTLI_MODE_GENERIC,
+                                                  stream.size(),
+                                                  stream.data(),
+                                                  &out_size,
+                                                  out->data()));
+      out->resize(out_size);
+      return true;
+    }
+    case bsdiff::CompressorType::kNoCompression:
+      // Only the BSDF2 format can carry uncompressed streams.
+      TEST_AND_RETURN_FALSE(bsdf2_);
+      *out = stream;
+      return true;
+  }
+  LOG(ERROR) << "Unsupported compressor type " << static_cast<int>(type);
+  return false;
+}
+
+bool MemoryPatchWriter::CompressStreamSmallest(
+    const brillo::Blob& stream,
+    brillo::Blob* out,
+    bsdiff::CompressorType* type) const {
+  out->clear();
+  bool found = false;
+  brillo::Blob compressed;
+  for (auto candidate : types_) {
+    TEST_AND_RETURN_FALSE(CompressStream(candidate, stream, &compressed));
+    if (!found || compressed.size() < out->size()) {
+      *out = std::move(compressed);
+      *type = candidate;
+      found = true;
+    }
+    compressed.clear();
+  }
+  return found;
+}
+
+bool MemoryPatchWriter::Close() {
+  if (written_output_ != new_size_) {
+    LOG(ERROR) << "Close() called but not all the output was written, "
+               << written_output_ << " of " << new_size_ << " bytes.";
+    return false;
+  }
+
+  brillo::Blob ctrl_data, diff_data, extra_data;
+  bsdiff::CompressorType ctrl_type, diff_type, extra_type;
+  TEST_AND_RETURN_FALSE(
+      CompressStreamSmallest(ctrl_stream_, &ctrl_data, &ctrl_type));
+  TEST_AND_RETURN_FALSE(
+      CompressStreamSmallest(diff_stream_, &diff_data, &diff_type));
+  TEST_AND_RETURN_FALSE(
+      CompressStreamSmallest(extra_stream_, &extra_data, &extra_type));
+
+  brillo::Blob& patch = *patch_;
+  patch.clear();
+  patch.reserve(kHeaderSize + ctrl_data.size() + diff_data.size() +
+                extra_data.size());
+  patch.resize(kHeaderSize);
+  if (bsdf2_) {
+    memcpy(patch.data(), kBSDF2MagicHeader, strlen(kBSDF2MagicHeader));
+    patch[5] = static_cast<uint8_t>(ctrl_type);
+    patch[6] = static_cast<uint8_t>(diff_type);
+    patch[7] = static_cast<uint8_t>(extra_type);
+  } else {
+    memcpy(patch.data(), kLegacyMagicHeader, strlen(kLegacyMagicHeader));
+  }
+  EncodeInt64(ctrl_data.size(), patch.data() + 8);
+  EncodeInt64(diff_data.size(), patch.data() + 16);
+  EncodeInt64(new_size_, patch.data() + 24);
+  patch.insert(patch.end(), ctrl_data.begin(), ctrl_data.end());
+  patch.insert(patch.end(), diff_data.begin(), diff_data.end());
+  patch.insert(patch.end(), extra_data.begin(), extra_data.end());
+
+  // Release the uncompressed streams right away, bsdiff keeps the writer
+  // alive until the caller destroys it.
+  brillo::Blob().swap(ctrl_stream_);
+  brillo::Blob().swap(diff_stream_);
+  brillo::Blob().swap(extra_stream_);
+  return true;
+}
+
+ScopedMemoryTempFile::ScopedMemoryTempFile(const std::string& pattern) {
+#if defined(__linux__) && defined(SYS_memfd_create)
+  memfd_ = syscall(SYS_memfd_create, pattern.c_str(), 0);
+  if (memfd_ >= 0) {
+    path_ = base::StringPrintf("/proc/self/fd/%d", memfd_);
+    if (access(path_.c_str(), R_OK | W_OK) == 0) {
+      return;
+    }
+    IGNORE_EINTR(close(memfd_));
+    memfd_ = -1;
+  }
+#endif
+  temp_file_ = std::make_unique<ScopedTempFile>(pattern);
+  path_ = temp_file_->path();
+}
+
+ScopedMemoryTempFile::~ScopedMemoryTempFile() {
+  if (memfd_ >= 0) {
+    IGNORE_EINTR(close(memfd_));
+  }
+}
+
+}  // namespace chromeos_update_engine
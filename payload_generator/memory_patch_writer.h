@@ -0,0 +1,109 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_MEMORY_PATCH_WRITER_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_MEMORY_PATCH_WRITER_H_
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <base/macros.h>
+#include <brillo/secure_blob.h>
+#include <bsdiff/constants.h>
+#include <bsdiff/control_entry.h>
+#include <bsdiff/patch_writer_interface.h>
+
+#include "update_engine/common/utils.h"
+
+namespace chromeos_update_engine {
+
+// A bsdiff patch writer that keeps the control, diff and extra streams in
+// growable in-memory buffers and serializes the final patch into a caller
+// provided blob on Close(), instead of going through a file on disk like the
+// writers from bsdiff/patch_writer_factory.h do. The produced patches are
+// readable by bsdiff::BsdiffPatchReader and bspatch.
+class MemoryPatchWriter : public bsdiff::PatchWriterInterface {
+ public:
+  // Create a writer producing a legacy "BSDIFF40" patch compressed with bzip2
+  // into |patch|. |patch| must outlive this object.
+  explicit MemoryPatchWriter(brillo::Blob* patch);
+
+  // Create a writer producing a "BSDF2" patch into |patch|. Each stream is
+  // compressed with every compressor in |types| and the smallest result is
+  // kept. |brotli_quality| is used for the brotli compressor.
+  MemoryPatchWriter(brillo::Blob* patch,
+                    const std::vector<bsdiff::CompressorType>& types,
+                    int brotli_quality);
+
+  ~MemoryPatchWriter() override = default;
+
+  // PatchWriterInterface overrides.
+  bool Init(size_t new_size) override;
+  bool WriteDiffStream(const uint8_t* data, size_t size) override;
+  bool WriteExtraStream(const uint8_t* data, size_t size) override;
+  bool AddControlEntry(const bsdiff::ControlEntry& entry) override;
+  bool Close() override;
+
+ private:
+  // Compress |stream| with |type| into |out|.
+  bool CompressStream(bsdiff::CompressorType type,
+                      const brillo::Blob& stream,
+                      brillo::Blob* out) const;
+
+  // Compress |stream| with every allowed compressor and store the smallest
+  // result in |out| and the compressor used in |type|.
+  bool CompressStreamSmallest(const brillo::Blob& stream,
+                              brillo::Blob* out,
+                              bsdiff::CompressorType* type) const;
+
+  brillo::Blob* patch_;
+  const bool bsdf2_;
+  const std::vector<bsdiff::CompressorType> types_;
+  const int brotli_quality_;
+
+  size_t new_size_{0};
+  uint64_t written_output_{0};
+
+  brillo::Blob ctrl_stream_;
+  brillo::Blob diff_stream_;
+  brillo::Blob extra_stream_;
+
+  DISALLOW_COPY_AND_ASSIGN(MemoryPatchWriter);
+};
+
+// A scratch file for libraries that insist on a path to write intermediate
+// output to, such as puffin::PuffDiff(). When possible the file is an
+// anonymous memfd reachable through /proc/self/fd, so nothing touches the
+// build host's disk; otherwise it falls back to a regular temporary file.
+class ScopedMemoryTempFile {
+ public:
+  explicit ScopedMemoryTempFile(const std::string& pattern);
+  ~ScopedMemoryTempFile();
+
+  const std::string& path() const { return path_; }
+
+ private:
+  int memfd_{-1};
+  std::string path_;
+  std::unique_ptr<ScopedTempFile> temp_file_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScopedMemoryTempFile);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_MEMORY_PATCH_WRITER_H_
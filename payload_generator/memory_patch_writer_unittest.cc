@@ -0,0 +1,116 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/memory_patch_writer.h"
+
+#include <string>
+#include <vector>
+
+#include <bsdiff/bsdiff.h>
+#include <bsdiff/bspatch.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+
+namespace chromeos_update_engine {
+
+class MemoryPatchWriterTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    old_data_.resize(64 * 1024);
+    test_utils::FillWithData(&old_data_);
+    new_data_ = old_data_;
+    // Modify a few bytes and append some extra data so the patch has both
+    // diff and extra streams.
+    for (size_t i = 100; i < new_data_.size(); i += 4096) {
+      new_data_[i] ^= 0x5a;
+    }
+    new_data_.insert(new_data_.end(), 1000, 'x');
+  }
+
+  void ExpectPatchApplies(const brillo::Blob& patch) {
+    brillo::Blob output;
+    ASSERT_EQ(0,
+              bsdiff::bspatch(old_data_.data(),
+                              old_data_.size(),
+                              patch.data(),
+                              patch.size(),
+                              [&output](const uint8_t* data, size_t size) {
+                                output.insert(output.end(), data, data + size);
+                                return size;
+                              }));
+    EXPECT_EQ(new_data_, output);
+  }
+
+  brillo::Blob old_data_;
+  brillo::Blob new_data_;
+};
+
+TEST_F(MemoryPatchWriterTest, LegacyBsdiffPatchTest) {
+  brillo::Blob patch;
+  MemoryPatchWriter writer(&patch);
+  ASSERT_EQ(0,
+            bsdiff::bsdiff(old_data_.data(),
+                           old_data_.size(),
+                           new_data_.data(),
+                           new_data_.size(),
+                           &writer,
+                           nullptr));
+  ASSERT_GT(patch.size(), 8u);
+  EXPECT_EQ("BSDIFF40", std::string(patch.begin(), patch.begin() + 8));
+  ExpectPatchApplies(patch);
+}
+
+TEST_F(MemoryPatchWriterTest, BSDF2PatchTest) {
+  for (const auto& types : std::vector<std::vector<bsdiff::CompressorType>>{
+           {bsdiff::CompressorType::kBZ2},
+           {bsdiff::CompressorType::kBrotli},
+           {bsdiff::CompressorType::kBZ2, bsdiff::CompressorType::kBrotli}}) {
+    brillo::Blob patch;
+    MemoryPatchWriter writer(&patch, types, 9);
+    ASSERT_EQ(0,
+              bsdiff::bsdiff(old_data_.data(),
+                             old_data_.size(),
+                             new_data_.data(),
+                             new_data_.size(),
+                             &writer,
+                             nullptr));
+    ASSERT_GT(patch.size(), 5u);
+    EXPECT_EQ("BSDF2", std::string(patch.begin(), patch.begin() + 5));
+    ExpectPatchApplies(patch);
+  }
+}
+
+TEST_F(MemoryPatchWriterTest, IncompleteOutputFailsTest) {
+  brillo::Blob patch;
+  MemoryPatchWriter writer(&patch);
+  ASSERT_TRUE(writer.Init(10));
+  ASSERT_TRUE(writer.AddControlEntry({5, 0, 0}));
+  EXPECT_FALSE(writer.Close());
+}
+
+TEST(ScopedMemoryTempFileTest, WriteAndReadBackTest) {
+  ScopedMemoryTempFile temp_file("ScopedMemoryTempFileTest.XXXXXX");
+  const std::string data = "some patch data";
+  ASSERT_TRUE(
+      utils::WriteFile(temp_file.path().c_str(), data.data(), data.size()));
+  std::string read_data;
+  ASSERT_TRUE(utils::ReadFile(temp_file.path(), &read_data));
+  EXPECT_EQ(data, read_data);
+}
+
+}  // namespace chromeos_update_engine
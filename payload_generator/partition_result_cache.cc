@@ -0,0 +1,398 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/partition_result_cache.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <utility>
+
+#include <base/logging.h>
+#include <base/strings/string_number_conversions.h>
+
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/generator_hash.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// Bumped whenever the key or the on disk format changes, so stale cache
+// directories are simply missed.
+constexpr char kCacheFormat[] = "partition-result-cache-v1";
+
+// A cache file is the SHA-256 of the rest of the file followed by the
+// serialized PartitionResult.
+constexpr size_t kHashSize = 32;
+
+// The size of the reads done to verify a cache file.
+constexpr size_t kVerifyBufferSize = 1024 * 1024;
+
+void HashUint64(uint64_t value, HashCalculator* hasher) {
+  hasher->Update(&value, sizeof(value));
+}
+
+void HashString(const std::string& str, HashCalculator* hasher) {
+  HashUint64(str.size(), hasher);
+  hasher->Update(str.data(), str.size());
+}
+
+void HashBlob(const brillo::Blob& blob, HashCalculator* hasher) {
+  HashUint64(blob.size(), hasher);
+  hasher->Update(blob.data(), blob.size());
+}
+
+void HashMessage(const google::protobuf::MessageLite& message,
+                 HashCalculator* hasher) {
+  HashString(message.SerializeAsString(), hasher);
+}
+
+// Hashes the contents of |part| that the operations are generated from.
+bool HashPartition(const PartitionConfig& part, HashCalculator* hasher) {
+  HashString(part.name, hasher);
+  HashUint64(part.size, hasher);
+  brillo::Blob image_hash;
+  if (!part.path.empty()) {
+    TEST_AND_RETURN_FALSE(
+        HashCalculator::RawHashOfFile(part.path, part.size, &image_hash) ==
+        static_cast<off_t>(part.size));
+  }
+  HashBlob(image_hash, hasher);
+  brillo::Blob mapfile_hash;
+  if (!part.mapfile_path.empty()) {
+    TEST_AND_RETURN_FALSE(
+        HashCalculator::RawHashOfFile(part.mapfile_path, &mapfile_hash));
+  }
+  HashBlob(mapfile_hash, hasher);
+  HashMessage(part.verity.hash_tree_extent, hasher);
+  HashMessage(part.verity.fec_extent, hasher);
+  HashMessage(part.erofs_compression_param, hasher);
+  return true;
+}
+
+// Writes a cache file while hashing everything written after the hash.
+class CacheFileWriter {
+ public:
+  explicit CacheFileWriter(int fd) : fd_(fd) {}
+
+  // Reserves the space of the hash, written by Finalize().
+  bool Init() {
+    const brillo::Blob placeholder(kHashSize);
+    return utils::WriteAll(fd_, placeholder.data(), placeholder.size());
+  }
+
+  bool Write(const void* data, size_t size) {
+    TEST_AND_RETURN_FALSE(hasher_.Update(data, size));
+    return utils::WriteAll(fd_, data, size);
+  }
+
+  bool WriteUint64(uint64_t value) { return Write(&value, sizeof(value)); }
+
+  bool WriteString(const std::string& str) {
+    return WriteUint64(str.size()) && Write(str.data(), str.size());
+  }
+
+  bool WriteMessage(const google::protobuf::MessageLite& message) {
+    std::string serialized;
+    TEST_AND_RETURN_FALSE(message.SerializeToString(&serialized));
+    return WriteString(serialized);
+  }
+
+  bool Finalize() {
+    TEST_AND_RETURN_FALSE(hasher_.Finalize());
+    const brillo::Blob& hash = hasher_.raw_hash();
+    TEST_AND_RETURN_FALSE(hash.size() == kHashSize);
+    return utils::PWriteAll(fd_, hash.data(), hash.size(), 0);
+  }
+
+ private:
+  int fd_;
+  HashCalculator hasher_;
+
+  DISALLOW_COPY_AND_ASSIGN(CacheFileWriter);
+};
+
+// Reads the serialized PartitionResult of a verified cache file.
+class CacheFileReader {
+ public:
+  CacheFileReader(int fd, off_t file_size)
+      : fd_(fd), offset_(kHashSize), file_size_(file_size) {}
+
+  bool Read(void* data, size_t size) {
+    TEST_AND_RETURN_FALSE(size <= remaining());
+    ssize_t bytes_read = 0;
+    TEST_AND_RETURN_FALSE(
+        utils::PReadAll(fd_, data, size, offset_, &bytes_read));
+    TEST_AND_RETURN_FALSE(static_cast<size_t>(bytes_read) == size);
+    offset_ += size;
+    return true;
+  }
+
+  bool ReadUint64(uint64_t* value) { return Read(value, sizeof(*value)); }
+
+  bool ReadBlob(brillo::Blob* blob) {
+    uint64_t size = 0;
+    TEST_AND_RETURN_FALSE(ReadUint64(&size));
+    // Checked before allocating, the size could be anything.
+    TEST_AND_RETURN_FALSE(size <= remaining());
+    blob->resize(size);
+    return Read(blob->data(), size);
+  }
+
+  bool ReadString(std::string* str) {
+    brillo::Blob blob;
+    TEST_AND_RETURN_FALSE(ReadBlob(&blob));
+    str->assign(blob.begin(), blob.end());
+    return true;
+  }
+
+  bool ReadMessage(google::protobuf::MessageLite* message) {
+    std::string serialized;
+    TEST_AND_RETURN_FALSE(ReadString(&serialized));
+    return message->ParseFromString(serialized);
+  }
+
+  uint64_t remaining() const { return file_size_ - offset_; }
+
+ private:
+  int fd_;
+  off_t offset_;
+  off_t file_size_;
+
+  DISALLOW_COPY_AND_ASSIGN(CacheFileReader);
+};
+
+// Returns whether the hash at the start of the file at |fd| matches the rest
+// of the file.
+bool VerifyCacheFile(int fd, off_t file_size) {
+  TEST_AND_RETURN_FALSE(file_size >= static_cast<off_t>(kHashSize));
+  brillo::Blob expected_hash(kHashSize);
+  ssize_t bytes_read = 0;
+  TEST_AND_RETURN_FALSE(
+      utils::PReadAll(fd, expected_hash.data(), kHashSize, 0, &bytes_read));
+  TEST_AND_RETURN_FALSE(bytes_read == static_cast<ssize_t>(kHashSize));
+
+  HashCalculator hasher;
+  brillo::Blob buffer(kVerifyBufferSize);
+  for (off_t offset = kHashSize; offset < file_size; offset += bytes_read) {
+    const size_t size = std::min<off_t>(buffer.size(), file_size - offset);
+    TEST_AND_RETURN_FALSE(
+        utils::PReadAll(fd, buffer.data(), size, offset, &bytes_read));
+    TEST_AND_RETURN_FALSE(bytes_read == static_cast<ssize_t>(size));
+    TEST_AND_RETURN_FALSE(hasher.Update(buffer.data(), size));
+  }
+  TEST_AND_RETURN_FALSE(hasher.Finalize());
+  return hasher.raw_hash() == expected_hash;
+}
+
+// Returns whether all the destination extents of |op| are within the
+// |num_blocks| blocks of the partition.
+bool DstExtentsInPartition(const InstallOperation& op, uint64_t num_blocks) {
+  for (const Extent& extent : op.dst_extents()) {
+    if (extent.start_block() > num_blocks ||
+        extent.num_blocks() > num_blocks - extent.start_block()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+PartitionResultCache::PartitionResultCache(const std::string& cache_dir)
+    : cache_dir_(cache_dir) {}
+
+std::string PartitionResultCache::GetKey(const PayloadGenerationConfig& config,
+                                         const PartitionConfig& old_part,
+                                         const PartitionConfig& new_part) {
+  const brillo::Blob& generator_hash = GetGeneratorHash();
+  if (generator_hash.empty()) {
+    return "";
+  }
+  HashCalculator hasher;
+  hasher.Update(kCacheFormat, sizeof(kCacheFormat));
+  HashBlob(generator_hash, &hasher);
+  if (!HashPartition(old_part, &hasher) || !HashPartition(new_part, &hasher)) {
+    LOG(WARNING) << "Failed to hash the images of partition " << new_part.name;
+    return "";
+  }
+
+  HashUint64(config.version.major, &hasher);
+  HashUint64(config.version.minor, &hasher);
+  // Full payloads choose it independently of their minor version.
+  HashUint64(config.version.XzArm64FilterAllowed(), &hasher);
+  HashUint64(config.block_size, &hasher);
+  HashUint64(config.hard_chunk_size, &hasher);
+  HashUint64(config.soft_chunk_size, &hasher);
+  HashUint64(config.enable_vabc_xor, &hasher);
+  HashUint64(config.enable_lz4diff, &hasher);
+  HashUint64(config.enable_zucchini, &hasher);
+  HashUint64(config.compressors.size(), &hasher);
+  for (auto type : config.compressors) {
+    HashUint64(static_cast<uint64_t>(type), &hasher);
+  }
+  HashUint64(config.diff_size_limits.size(), &hasher);
+  for (const auto& [op, limits] : config.diff_size_limits) {
+    HashUint64(op, &hasher);
+    HashUint64(limits.max_memory_bytes, &hasher);
+    HashUint64(limits.max_input_bytes, &hasher);
+  }
+  // The dynamic partition metadata decides whether a merge sequence and a COW
+  // size are generated, and how the COW is compressed.
+  if (config.target.dynamic_partition_metadata) {
+    HashMessage(*config.target.dynamic_partition_metadata, &hasher);
+  } else {
+    HashString("", &hasher);
+  }
+  hasher.Finalize();
+  return base::HexEncode(hasher.raw_hash().data(), hasher.raw_hash().size());
+}
+
+bool PartitionResultCache::Lookup(const std::string& key,
+                                  uint64_t partition_size,
+                                  uint64_t block_size,
+                                  BlobFileWriter* blob_file,
+                                  PartitionResult* result) const {
+  const std::string path = GetCachePath(key);
+  if (key.empty() || !utils::FileExists(path.c_str())) {
+    return false;
+  }
+  int fd = HANDLE_EINTR(open(path.c_str(), O_RDONLY));
+  TEST_AND_RETURN_FALSE_ERRNO(fd >= 0);
+  ScopedFdCloser fd_closer(&fd);
+  PartitionResult cached;
+  if (!ReadFromFile(fd, partition_size, block_size, blob_file, &cached)) {
+    LOG(WARNING) << "Ignoring corrupted partition cache file " << path;
+    return false;
+  }
+  // Only counted once the whole entry is read, since the partition is
+  // generated again, and its blobs counted then, if it is corrupted.
+  blob_file->IncTotalBlobs(cached.aops.size());
+  *result = std::move(cached);
+  return true;
+}
+
+void PartitionResultCache::Store(const std::string& key,
+                                 const PartitionResult& result,
+                                 const BlobFileWriter& blob_file) const {
+  if (key.empty()) {
+    return;
+  }
+  // Write to a temporary file and rename it, so concurrent generator runs
+  // sharing the directory never see a partially written result.
+  const std::string path = GetCachePath(key);
+  std::string temp_path = path + ".XXXXXX";
+  int fd = mkstemp(temp_path.data());
+  if (fd < 0) {
+    PLOG(WARNING) << "Failed to create " << temp_path;
+    return;
+  }
+  bool success = WriteToFile(fd, result, blob_file);
+  success = IGNORE_EINTR(close(fd)) == 0 && success;
+  if (success && rename(temp_path.c_str(), path.c_str()) == 0) {
+    return;
+  }
+  PLOG(WARNING) << "Failed to store the partition result in " << path;
+  unlink(temp_path.c_str());
+}
+
+std::string PartitionResultCache::GetCachePath(const std::string& key) const {
+  return cache_dir_ + "/" + key + ".partition";
+}
+
+bool PartitionResultCache::ReadFromFile(int fd,
+                                        uint64_t partition_size,
+                                        uint64_t block_size,
+                                        BlobFileWriter* blob_file,
+                                        PartitionResult* result) const {
+  const off_t file_size = utils::FileSize(fd);
+  // The whole file is verified before anything in it is trusted.
+  TEST_AND_RETURN_FALSE(VerifyCacheFile(fd, file_size));
+  CacheFileReader reader(fd, file_size);
+  const uint64_t num_blocks = (partition_size + block_size - 1) / block_size;
+
+  uint64_t num_aops = 0;
+  TEST_AND_RETURN_FALSE(reader.ReadUint64(&num_aops));
+  TEST_AND_RETURN_FALSE(num_aops <= reader.remaining());
+  result->aops.resize(num_aops);
+  for (AnnotatedOperation& aop : result->aops) {
+    TEST_AND_RETURN_FALSE(reader.ReadString(&aop.name));
+    TEST_AND_RETURN_FALSE(reader.ReadMessage(&aop.op));
+    TEST_AND_RETURN_FALSE(DstExtentsInPartition(aop.op, num_blocks));
+    uint64_t num_xor_ops = 0;
+    TEST_AND_RETURN_FALSE(reader.ReadUint64(&num_xor_ops));
+    TEST_AND_RETURN_FALSE(num_xor_ops <= reader.remaining());
+    aop.xor_ops.resize(num_xor_ops);
+    for (CowMergeOperation& xor_op : aop.xor_ops) {
+      TEST_AND_RETURN_FALSE(reader.ReadMessage(&xor_op));
+    }
+    brillo::Blob blob;
+    TEST_AND_RETURN_FALSE(reader.ReadBlob(&blob));
+    TEST_AND_RETURN_FALSE(aop.op.data_length() == blob.size());
+    // Moves the blob to this run's blob file and points the operation to it.
+    TEST_AND_RETURN_FALSE(aop.SetOperationBlob(blob, blob_file));
+  }
+
+  uint64_t num_merge_ops = 0;
+  TEST_AND_RETURN_FALSE(reader.ReadUint64(&num_merge_ops));
+  TEST_AND_RETURN_FALSE(num_merge_ops <= reader.remaining());
+  result->merge_sequence.resize(num_merge_ops);
+  for (CowMergeOperation& merge_op : result->merge_sequence) {
+    TEST_AND_RETURN_FALSE(reader.ReadMessage(&merge_op));
+  }
+
+  uint64_t cow_size = 0;
+  TEST_AND_RETURN_FALSE(reader.ReadUint64(&cow_size));
+  result->cow_size = cow_size;
+  TEST_AND_RETURN_FALSE(reader.remaining() == 0);
+  return true;
+}
+
+bool PartitionResultCache::WriteToFile(int fd,
+                                       const PartitionResult& result,
+                                       const BlobFileWriter& blob_file) const {
+  CacheFileWriter writer(fd);
+  TEST_AND_RETURN_FALSE(writer.Init());
+  TEST_AND_RETURN_FALSE(writer.WriteUint64(result.aops.size()));
+  for (const AnnotatedOperation& aop : result.aops) {
+    TEST_AND_RETURN_FALSE(writer.WriteString(aop.name));
+    TEST_AND_RETURN_FALSE(writer.WriteMessage(aop.op));
+    TEST_AND_RETURN_FALSE(writer.WriteUint64(aop.xor_ops.size()));
+    for (const CowMergeOperation& xor_op : aop.xor_ops) {
+      TEST_AND_RETURN_FALSE(writer.WriteMessage(xor_op));
+    }
+    brillo::Blob blob;
+    if (aop.op.data_length() > 0) {
+      TEST_AND_RETURN_FALSE(blob_file.LoadBlob(
+          aop.op.data_offset(), aop.op.data_length(), &blob));
+    }
+    TEST_AND_RETURN_FALSE(writer.WriteUint64(blob.size()));
+    TEST_AND_RETURN_FALSE(writer.Write(blob.data(), blob.size()));
+  }
+  TEST_AND_RETURN_FALSE(writer.WriteUint64(result.merge_sequence.size()));
+  for (const CowMergeOperation& merge_op : result.merge_sequence) {
+    TEST_AND_RETURN_FALSE(writer.WriteMessage(merge_op));
+  }
+  TEST_AND_RETURN_FALSE(writer.WriteUint64(result.cow_size));
+  return writer.Finalize();
+}
+
+}  // namespace chromeos_update_engine
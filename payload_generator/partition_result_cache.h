@@ -0,0 +1,93 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_PARTITION_RESULT_CACHE_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_PARTITION_RESULT_CACHE_H_
+
+#include <string>
+#include <vector>
+
+#include <base/macros.h>
+
+#include "update_engine/payload_generator/annotated_operation.h"
+#include "update_engine/payload_generator/blob_file_writer.h"
+#include "update_engine/payload_generator/payload_generation_config.h"
+#include "update_engine/update_metadata.pb.h"
+
+namespace chromeos_update_engine {
+
+// Everything generated for one partition of the payload.
+struct PartitionResult {
+  std::vector<AnnotatedOperation> aops;
+  std::vector<CowMergeOperation> merge_sequence;
+  size_t cow_size = 0;
+};
+
+// An on disk cache of the PartitionResult of each partition, so regenerating
+// a payload after a change to a few partitions only diffs those. Results are
+// keyed by the contents of the old and new images, the parts of the config
+// that affect the operations and the generator binary itself. Each cache file
+// starts with the SHA-256 of the rest of the file, so truncated or corrupted
+// entries are missed instead of producing a broken payload.
+class PartitionResultCache {
+ public:
+  explicit PartitionResultCache(const std::string& cache_dir);
+  ~PartitionResultCache() = default;
+
+  // Returns the key of the result of generating |new_part| from |old_part|
+  // with |config|, or an empty string if the images can't be read. This reads
+  // both images in full.
+  static std::string GetKey(const PayloadGenerationConfig& config,
+                            const PartitionConfig& old_part,
+                            const PartitionConfig& new_part);
+
+  // Looks up the result for |key|. On success the blobs of the operations are
+  // stored in |blob_file| and the operations in |result| point to them. The
+  // blobs of an entry found to be corrupted halfway are left unreferenced in
+  // |blob_file|, so they don't make it to the payload.
+  bool Lookup(const std::string& key,
+              uint64_t partition_size,
+              uint64_t block_size,
+              BlobFileWriter* blob_file,
+              PartitionResult* result) const;
+
+  // Stores |result| for |key|, reading the blobs of its operations from
+  // |blob_file|. Failing to store it is not an error.
+  void Store(const std::string& key,
+             const PartitionResult& result,
+             const BlobFileWriter& blob_file) const;
+
+ private:
+  // Returns the path of the cache file for |key|.
+  std::string GetCachePath(const std::string& key) const;
+
+  bool ReadFromFile(int fd,
+                    uint64_t partition_size,
+                    uint64_t block_size,
+                    BlobFileWriter* blob_file,
+                    PartitionResult* result) const;
+  bool WriteToFile(int fd,
+                   const PartitionResult& result,
+                   const BlobFileWriter& blob_file) const;
+
+  const std::string cache_dir_;
+
+  DISALLOW_COPY_AND_ASSIGN(PartitionResultCache);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_PARTITION_RESULT_CACHE_H_
@@ -0,0 +1,221 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/partition_result_cache.h"
+
+#include <unistd.h>
+
+#include <string>
+
+#include <base/files/scoped_temp_dir.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/payload_constants.h"
+#include "update_engine/payload_generator/extent_ranges.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+constexpr uint64_t kBlockSize = 4096;
+constexpr uint64_t kPartitionSize = 4 * kBlockSize;
+constexpr char kKey[] = "key";
+}  // namespace
+
+class PartitionResultCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    ASSERT_TRUE(temp_dir_.CreateUniqueTempDir());
+    cache_path_ = temp_dir_.GetPath().value() + "/" + kKey + ".partition";
+
+    AnnotatedOperation replace;
+    replace.name = "replace";
+    replace.op.set_type(InstallOperation::REPLACE);
+    *replace.op.add_dst_extents() = ExtentForRange(0, 1);
+    ASSERT_TRUE(replace.SetOperationBlob(blob_, &blob_file_));
+    result_.aops.push_back(replace);
+
+    AnnotatedOperation copy;
+    copy.name = "copy";
+    copy.op.set_type(InstallOperation::SOURCE_COPY);
+    *copy.op.add_src_extents() = ExtentForRange(1, 3);
+    *copy.op.add_dst_extents() = ExtentForRange(1, 3);
+    result_.aops.push_back(copy);
+
+    CowMergeOperation merge_op;
+    merge_op.set_type(CowMergeOperation::COW_COPY);
+    *merge_op.mutable_src_extent() = ExtentForRange(1, 3);
+    *merge_op.mutable_dst_extent() = ExtentForRange(1, 3);
+    result_.merge_sequence.push_back(merge_op);
+    result_.cow_size = 12345;
+  }
+
+  base::ScopedTempDir temp_dir_;
+  std::string cache_path_;
+  const brillo::Blob blob_{'d', 'a', 't', 'a'};
+  ScopedTempFile blob_file_path_{"BlobFile-XXXXXX", true};
+  off_t blob_file_size_{0};
+  BlobFileWriter blob_file_{blob_file_path_.fd(), &blob_file_size_};
+  PartitionResult result_;
+};
+
+TEST_F(PartitionResultCacheTest, StoreAndLookupTest) {
+  PartitionResultCache cache(temp_dir_.GetPath().value());
+  cache.Store(kKey, result_, blob_file_);
+
+  ScopedTempFile new_blob_file_path("BlobFile-XXXXXX", true);
+  // Something is already in the new blob file, so the blob moves.
+  off_t new_blob_file_size = 10;
+  BlobFileWriter new_blob_file(new_blob_file_path.fd(), &new_blob_file_size);
+  PartitionResult result;
+  ASSERT_TRUE(
+      cache.Lookup(kKey, kPartitionSize, kBlockSize, &new_blob_file, &result));
+
+  ASSERT_EQ(2u, result.aops.size());
+  EXPECT_EQ("replace", result.aops[0].name);
+  EXPECT_EQ(10u, result.aops[0].op.data_offset());
+  brillo::Blob blob;
+  EXPECT_TRUE(new_blob_file.LoadBlob(result.aops[0].op.data_offset(),
+                                     result.aops[0].op.data_length(),
+                                     &blob));
+  EXPECT_EQ(blob_, blob);
+  EXPECT_EQ("copy", result.aops[1].name);
+  EXPECT_FALSE(result.aops[1].op.has_data_length());
+  EXPECT_EQ(result_.aops[1].op.SerializeAsString(),
+            result.aops[1].op.SerializeAsString());
+  ASSERT_EQ(1u, result.merge_sequence.size());
+  EXPECT_EQ(result_.merge_sequence[0].SerializeAsString(),
+            result.merge_sequence[0].SerializeAsString());
+  EXPECT_EQ(12345u, result.cow_size);
+}
+
+TEST_F(PartitionResultCacheTest, MissingEntryTest) {
+  PartitionResultCache cache(temp_dir_.GetPath().value());
+  PartitionResult result;
+  EXPECT_FALSE(
+      cache.Lookup(kKey, kPartitionSize, kBlockSize, &blob_file_, &result));
+  EXPECT_FALSE(
+      cache.Lookup("", kPartitionSize, kBlockSize, &blob_file_, &result));
+}
+
+TEST_F(PartitionResultCacheTest, CorruptedEntryIgnoredTest) {
+  PartitionResultCache cache(temp_dir_.GetPath().value());
+  cache.Store(kKey, result_, blob_file_);
+  brillo::Blob contents;
+  ASSERT_TRUE(utils::ReadFile(cache_path_, &contents));
+  contents.back() ^= 1;
+  ASSERT_TRUE(
+      utils::WriteFile(cache_path_.c_str(), contents.data(), contents.size()));
+
+  PartitionResult result;
+  EXPECT_FALSE(
+      cache.Lookup(kKey, kPartitionSize, kBlockSize, &blob_file_, &result));
+}
+
+TEST_F(PartitionResultCacheTest, TruncatedEntryIgnoredTest) {
+  PartitionResultCache cache(temp_dir_.GetPath().value());
+  cache.Store(kKey, result_, blob_file_);
+  ASSERT_EQ(0, truncate(cache_path_.c_str(), utils::FileSize(cache_path_) - 1));
+
+  PartitionResult result;
+  EXPECT_FALSE(
+      cache.Lookup(kKey, kPartitionSize, kBlockSize, &blob_file_, &result));
+}
+
+TEST_F(PartitionResultCacheTest, ExtentsOutsidePartitionRejectedTest) {
+  PartitionResultCache cache(temp_dir_.GetPath().value());
+  cache.Store(kKey, result_, blob_file_);
+
+  PartitionResult result;
+  EXPECT_FALSE(
+      cache.Lookup(kKey, 2 * kBlockSize, kBlockSize, &blob_file_, &result));
+}
+
+TEST_F(PartitionResultCacheTest, KeyDependsOnImagesAndConfigTest) {
+  ScopedTempFile old_image("Old-XXXXXX");
+  ScopedTempFile new_image("New-XXXXXX");
+  brillo::Blob data(kPartitionSize, 'a');
+  ASSERT_TRUE(test_utils::WriteFileVector(old_image.path(), data));
+  data[0] = 'b';
+  ASSERT_TRUE(test_utils::WriteFileVector(new_image.path(), data));
+
+  PayloadGenerationConfig config;
+  PartitionConfig old_part("system");
+  old_part.path = old_image.path();
+  old_part.size = kPartitionSize;
+  PartitionConfig new_part("system");
+  new_part.path = new_image.path();
+  new_part.size = kPartitionSize;
+
+  const std::string key =
+      PartitionResultCache::GetKey(config, old_part, new_part);
+  EXPECT_FALSE(key.empty());
+  EXPECT_EQ(key, PartitionResultCache::GetKey(config, old_part, new_part));
+  // A full payload of the same partition.
+  const PartitionConfig empty_part("");
+  EXPECT_NE(key, PartitionResultCache::GetKey(config, empty_part, new_part));
+
+  data[1] = 'b';
+  ASSERT_TRUE(test_utils::WriteFileVector(new_image.path(), data));
+  EXPECT_NE(key, PartitionResultCache::GetKey(config, old_part, new_part));
+  data[1] = 'a';
+  ASSERT_TRUE(test_utils::WriteFileVector(new_image.path(), data));
+  EXPECT_EQ(key, PartitionResultCache::GetKey(config, old_part, new_part));
+
+  config.enable_zucchini = !config.enable_zucchini;
+  EXPECT_NE(key, PartitionResultCache::GetKey(config, old_part, new_part));
+  config.enable_zucchini = !config.enable_zucchini;
+
+  // Images that can't be read disable the cache for the partition.
+  new_part.size = 2 * kPartitionSize;
+  EXPECT_TRUE(PartitionResultCache::GetKey(config, old_part, new_part).empty());
+}
+
+// The REPLACE_XZ blobs of full payloads made with the ARM64 filter can't be
+// reused for payloads made without it.
+TEST_F(PartitionResultCacheTest, KeyDependsOnXzArm64FilterTest) {
+  ScopedTempFile new_image("New-XXXXXX");
+  ASSERT_TRUE(test_utils::WriteFileVector(new_image.path(),
+                                          brillo::Blob(kPartitionSize, 'a')));
+  PayloadGenerationConfig config;
+  config.version.major = kBrilloMajorPayloadVersion;
+  config.version.minor = kFullPayloadMinorVersion;
+  config.version.full_payload_xz_arm64_filter = true;
+  const PartitionConfig old_part("");
+  PartitionConfig new_part("system");
+  new_part.path = new_image.path();
+  new_part.size = kPartitionSize;
+
+  const std::string filter_key =
+      PartitionResultCache::GetKey(config, old_part, new_part);
+  ASSERT_FALSE(filter_key.empty());
+  PartitionResultCache cache(temp_dir_.GetPath().value());
+  cache.Store(filter_key, result_, blob_file_);
+
+  config.version.full_payload_xz_arm64_filter = false;
+  const std::string key =
+      PartitionResultCache::GetKey(config, old_part, new_part);
+  ASSERT_FALSE(key.empty());
+  EXPECT_NE(filter_key, key);
+  PartitionResult result;
+  EXPECT_FALSE(
+      cache.Lookup(key, kPartitionSize, kBlockSize, &blob_file_, &result));
+  EXPECT_TRUE(cache.Lookup(
+      filter_key, kPartitionSize, kBlockSize, &blob_file_, &result));
+}
+
+}  // namespace chromeos_update_engine
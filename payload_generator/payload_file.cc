@@ -51,6 +51,9 @@ struct DeltaObject {
   off_t size;
 };
 
+// The size of the reads done to copy the data blobs to the payload.
+constexpr size_t kBlobsCopyBufferSize = 1024 * 1024;
+
 // Writes the uint64_t passed in in host-endian to the file as big-endian.
 // Returns true on success.
 bool WriteUint64AsBigEndian(FileWriter* writer, const uint64_t value) {
@@ -119,10 +122,15 @@ bool PayloadFile::WritePayload(const string& payload_file,
                                const string& data_blobs_path,
                                const string& private_key_path,
                                uint64_t* metadata_size_out) {
-  // Reorder the data blobs with the manifest_.
-  ScopedTempFile ordered_blobs_file("CrAU_temp_data.ordered.XXXXXX");
-  TEST_AND_RETURN_FALSE(
-      ReorderDataBlobs(data_blobs_path, ordered_blobs_file.path()));
+  int blobs_fd = open(data_blobs_path.c_str(), O_RDONLY, 0);
+  TEST_AND_RETURN_FALSE_ERRNO(blobs_fd >= 0);
+  ScopedFdCloser blobs_fd_closer(&blobs_fd);
+
+  // Lay out the data blobs in the order of the operations. They are copied
+  // straight from |data_blobs_path| to the payload, without an intermediate
+  // ordered copy.
+  vector<BlobRange> blob_ranges;
+  TEST_AND_RETURN_FALSE(LayoutDataBlobs(blobs_fd, &blob_ranges));
 
   // Check that install op blobs are in order.
   uint64_t next_blob_offset = 0;
@@ -195,12 +203,15 @@ bool PayloadFile::WritePayload(const string& payload_file,
     PayloadSigner::AddSignatureToManifest(
         next_blob_offset, signature_blob_length, &manifest_);
   }
-  WritePayload(payload_file,
-               ordered_blobs_file.path(),
-               private_key_path,
-               major_version_,
-               manifest_,
-               metadata_size_out);
+  TEST_AND_RETURN_FALSE(WritePayloadWithBlobs(
+      payload_file,
+      [blobs_fd, &blob_ranges](FileWriter* writer) {
+        return CopyDataBlobs(blobs_fd, blob_ranges, writer);
+      },
+      private_key_path,
+      major_version_,
+      manifest_,
+      metadata_size_out));
 
   ReportPayloadUsage(*metadata_size_out);
   return true;
@@ -212,6 +223,36 @@ bool PayloadFile::WritePayload(const std::string& payload_file,
                                uint64_t major_version_,
                                const DeltaArchiveManifest& manifest,
                                uint64_t* metadata_size_out) {
+  int blobs_fd = open(ordered_blobs_file.c_str(), O_RDONLY, 0);
+  ScopedFdCloser blobs_fd_closer(&blobs_fd);
+  TEST_AND_RETURN_FALSE(blobs_fd >= 0);
+  return WritePayloadWithBlobs(
+      payload_file,
+      [blobs_fd](FileWriter* writer) {
+        for (;;) {
+          vector<char> buf(1024 * 1024);
+          ssize_t rc = read(blobs_fd, buf.data(), buf.size());
+          if (0 == rc) {
+            // EOF
+            break;
+          }
+          TEST_AND_RETURN_FALSE_ERRNO(rc > 0);
+          TEST_AND_RETURN_FALSE_ERRNO(writer->Write(buf.data(), rc));
+        }
+        return true;
+      },
+      private_key_path,
+      major_version_,
+      manifest,
+      metadata_size_out);
+}
+
+bool PayloadFile::WritePayloadWithBlobs(const std::string& payload_file,
+                                        const BlobsWriter& write_blobs,
+                                        const std::string& private_key_path,
+                                        uint64_t major_version_,
+                                        const DeltaArchiveManifest& manifest,
+                                        uint64_t* metadata_size_out) {
   std::string serialized_manifest;
 
   TEST_AND_RETURN_FALSE(manifest.SerializeToString(&serialized_manifest));
@@ -267,19 +308,7 @@ bool PayloadFile::WritePayload(const std::string& payload_file,
 
   // Append the data blobs.
   LOG(INFO) << "Writing final delta file data blobs...";
-  int blobs_fd = open(ordered_blobs_file.c_str(), O_RDONLY, 0);
-  ScopedFdCloser blobs_fd_closer(&blobs_fd);
-  TEST_AND_RETURN_FALSE(blobs_fd >= 0);
-  for (;;) {
-    vector<char> buf(1024 * 1024);
-    ssize_t rc = read(blobs_fd, buf.data(), buf.size());
-    if (0 == rc) {
-      // EOF
-      break;
-    }
-    TEST_AND_RETURN_FALSE_ERRNO(rc > 0);
-    TEST_AND_RETURN_FALSE_ERRNO(writer.Write(buf.data(), rc));
-  }
+  TEST_AND_RETURN_FALSE(write_blobs(&writer));
   // Write payload signature blob.
   if (!private_key_path.empty()) {
     LOG(INFO) << "Signing the update...";
@@ -300,20 +329,9 @@ bool PayloadFile::WritePayload(const std::string& payload_file,
   return true;
 }
 
-bool PayloadFile::ReorderDataBlobs(const string& data_blobs_path,
-                                   const string& new_data_blobs_path) {
-  int in_fd = open(data_blobs_path.c_str(), O_RDONLY, 0);
-  TEST_AND_RETURN_FALSE_ERRNO(in_fd >= 0);
-  ScopedFdCloser in_fd_closer(&in_fd);
-
-  DirectFileWriter writer;
-  int rc = writer.Open(
-      new_data_blobs_path.c_str(), O_WRONLY | O_TRUNC | O_CREAT, 0644);
-  if (rc != 0) {
-    PLOG(ERROR) << "Error creating " << new_data_blobs_path;
-    return false;
-  }
-  ScopedFileWriterCloser writer_closer(&writer);
+bool PayloadFile::LayoutDataBlobs(int data_blobs_fd,
+                                  vector<BlobRange>* blob_ranges) {
+  blob_ranges->clear();
   uint64_t out_file_size = 0;
 
   for (auto& part : part_vec_) {
@@ -321,16 +339,43 @@ bool PayloadFile::ReorderDataBlobs(const string& data_blobs_path,
       if (!aop.op.has_data_offset())
         continue;
       CHECK(aop.op.has_data_length());
-      brillo::Blob buf(aop.op.data_length());
-      ssize_t rc = pread(in_fd, buf.data(), buf.size(), aop.op.data_offset());
-      TEST_AND_RETURN_FALSE(rc == static_cast<ssize_t>(buf.size()));
-
-      // Add the hash of the data blobs for this operation
-      TEST_AND_RETURN_FALSE(AddOperationHash(&aop.op, buf));
+      const uint64_t offset = aop.op.data_offset();
+      const uint64_t length = aop.op.data_length();
+      // Blobs are normally hashed when stored, only blobs shared with another
+      // operation after splitting it need to be read back.
+      if (!aop.op.has_data_sha256_hash()) {
+        brillo::Blob buf(length);
+        ssize_t rc = pread(data_blobs_fd, buf.data(), buf.size(), offset);
+        TEST_AND_RETURN_FALSE(rc == static_cast<ssize_t>(buf.size()));
+        TEST_AND_RETURN_FALSE(AddOperationHash(&aop.op, buf));
+      }
 
+      if (!blob_ranges->empty() &&
+          blob_ranges->back().offset + blob_ranges->back().length == offset) {
+        blob_ranges->back().length += length;
+      } else {
+        blob_ranges->push_back({offset, length});
+      }
       aop.op.set_data_offset(out_file_size);
-      TEST_AND_RETURN_FALSE_ERRNO(writer.Write(buf.data(), buf.size()));
-      out_file_size += buf.size();
+      out_file_size += length;
+    }
+  }
+  return true;
+}
+
+bool PayloadFile::CopyDataBlobs(int data_blobs_fd,
+                                const vector<BlobRange>& blob_ranges,
+                                FileWriter* writer) {
+  brillo::Blob buf(kBlobsCopyBufferSize);
+  for (const BlobRange& range : blob_ranges) {
+    for (uint64_t copied = 0; copied < range.length;) {
+      const size_t size = std::min<uint64_t>(buf.size(), range.length - copied);
+      ssize_t bytes_read = 0;
+      TEST_AND_RETURN_FALSE(utils::PReadAll(
+          data_blobs_fd, buf.data(), size, range.offset + copied, &bytes_read));
+      TEST_AND_RETURN_FALSE(bytes_read == static_cast<ssize_t>(size));
+      TEST_AND_RETURN_FALSE_ERRNO(writer->Write(buf.data(), size));
+      copied += size;
     }
   }
   return true;
@@ -17,6 +17,7 @@
 #ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_PAYLOAD_FILE_H_
 #define UPDATE_ENGINE_PAYLOAD_GENERATOR_PAYLOAD_FILE_H_
 
+#include <functional>
 #include <string>
 #include <vector>
 
@@ -29,6 +30,8 @@
 
 namespace chromeos_update_engine {
 
+class FileWriter;
+
 // Class to handle the creation of a payload file. This class is the only one
 // dealing with writing the payload and its format, but has no logic about what
 // should be on it.
@@ -48,9 +51,9 @@ class PayloadFile {
                     size_t cow_size);
 
   // Write the payload to the |payload_file| file. The operations reference
-  // blobs in the |data_blobs_path| file and the blobs will be reordered in the
-  // payload file to match the order of the operations. The size of the metadata
-  // section of the payload is stored in |metadata_size_out|.
+  // blobs in the |data_blobs_path| file, in any order, and the blobs are
+  // copied to the payload file in the order of the operations. The size of
+  // the metadata section of the payload is stored in |metadata_size_out|.
   bool WritePayload(const std::string& payload_file,
                     const std::string& data_blobs_path,
                     const std::string& private_key_path,
@@ -64,7 +67,26 @@ class PayloadFile {
                            uint64_t* out_metadata_size);
 
  private:
-  FRIEND_TEST(PayloadFileTest, ReorderBlobsTest);
+  FRIEND_TEST(PayloadFileTest, LayoutBlobsTest);
+  FRIEND_TEST(PayloadFileTest, LayoutBlobsMergesAdjacentRangesTest);
+
+  // A range of bytes of the data blobs file.
+  struct BlobRange {
+    uint64_t offset;
+    uint64_t length;
+  };
+
+  // Writes the blobs section of the payload to the writer passed.
+  using BlobsWriter = std::function<bool(FileWriter* writer)>;
+
+  // Writes the payload with |manifest| to |payload_file|, calling
+  // |write_blobs| to write the data blobs after the metadata.
+  static bool WritePayloadWithBlobs(const std::string& payload_file,
+                                    const BlobsWriter& write_blobs,
+                                    const std::string& private_key_path,
+                                    uint64_t major_version,
+                                    const DeltaArchiveManifest& manifest,
+                                    uint64_t* out_metadata_size);
 
   // Computes a SHA256 hash of the given buf and sets the hash value in the
   // operation so that update_engine could verify. This hash should be set
@@ -74,15 +96,21 @@ class PayloadFile {
   // gracefully ignore the fake signature operation.
   static bool AddOperationHash(InstallOperation* op, const brillo::Blob& buf);
 
-  // Install operations in the manifest may reference data blobs, which
-  // are in data_blobs_path. This function creates a new data blobs file
-  // with the data blobs in the same order as the referencing install
-  // operations in the manifest. E.g. if manifest[0] has a data blob
-  // "X" at offset 1, manifest[1] has a data blob "Y" at offset 0,
-  // and data_blobs_path's file contains "YX", new_data_blobs_path
-  // will set to be a file that contains "XY".
-  bool ReorderDataBlobs(const std::string& data_blobs_path,
-                        const std::string& new_data_blobs_path);
+  // Install operations in the manifest may reference data blobs, which are
+  // in the |data_blobs_fd| file in the order they were generated. This
+  // function lays them out in the payload in the same order as the
+  // referencing install operations, so the payload doesn't depend on the
+  // order they were generated in. E.g. if manifest[0] has a data blob "X" at
+  // offset 1, manifest[1] has a data blob "Y" at offset 0, and the file
+  // contains "YX", the operations are pointed to offsets 0 and 1 of the
+  // payload blobs and |blob_ranges| is set to copy "X" then "Y". Adjacent
+  // ranges are merged. Operations missing the hash of their blob get it.
+  bool LayoutDataBlobs(int data_blobs_fd, std::vector<BlobRange>* blob_ranges);
+
+  // Copies the |blob_ranges| of |data_blobs_fd| to |writer|, in order.
+  static bool CopyDataBlobs(int data_blobs_fd,
+                            const std::vector<BlobRange>& blob_ranges,
+                            FileWriter* writer);
 
   // Print in stderr the Payload usage report.
   void ReportPayloadUsage(uint64_t metadata_size) const;
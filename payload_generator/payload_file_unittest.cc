@@ -16,13 +16,17 @@
 
 #include "update_engine/payload_generator/payload_file.h"
 
+#include <fcntl.h>
+
 #include <string>
 #include <utility>
 #include <vector>
 
 #include <gtest/gtest.h>
 
+#include "update_engine/common/hash_calculator.h"
 #include "update_engine/common/test_utils.h"
+#include "update_engine/payload_consumer/file_writer.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 
 using std::string;
@@ -35,8 +39,8 @@ class PayloadFileTest : public ::testing::Test {
   PayloadFile payload_;
 };
 
-TEST_F(PayloadFileTest, ReorderBlobsTest) {
-  ScopedTempFile orig_blobs("ReorderBlobsTest.orig.XXXXXX");
+TEST_F(PayloadFileTest, LayoutBlobsTest) {
+  ScopedTempFile orig_blobs("LayoutBlobsTest.orig.XXXXXX", true);
 
   // The operations have three blob and one gap (the whitespace):
   // Rootfs operation 1: [8, 3] bcd
@@ -45,7 +49,7 @@ TEST_F(PayloadFileTest, ReorderBlobsTest) {
   string orig_data = "kernel abcd";
   EXPECT_TRUE(test_utils::WriteFileString(orig_blobs.path(), orig_data));
 
-  ScopedTempFile new_blobs("ReorderBlobsTest.new.XXXXXX");
+  ScopedTempFile new_blobs("LayoutBlobsTest.new.XXXXXX");
 
   payload_.part_vec_.resize(2);
 
@@ -64,7 +68,16 @@ TEST_F(PayloadFileTest, ReorderBlobsTest) {
   aop.op.set_data_length(6);
   payload_.part_vec_[1].aops = {aop};
 
-  EXPECT_TRUE(payload_.ReorderDataBlobs(orig_blobs.path(), new_blobs.path()));
+  vector<PayloadFile::BlobRange> blob_ranges;
+  EXPECT_TRUE(payload_.LayoutDataBlobs(orig_blobs.fd(), &blob_ranges));
+  {
+    DirectFileWriter writer;
+    ASSERT_EQ(0,
+              writer.Open(new_blobs.path().c_str(), O_WRONLY | O_TRUNC, 0644));
+    ScopedFileWriterCloser writer_closer(&writer);
+    EXPECT_TRUE(
+        PayloadFile::CopyDataBlobs(orig_blobs.fd(), blob_ranges, &writer));
+  }
 
   const vector<AnnotatedOperation>& part0_aops = payload_.part_vec_[0].aops;
   const vector<AnnotatedOperation>& part1_aops = payload_.part_vec_[1].aops;
@@ -72,6 +85,7 @@ TEST_F(PayloadFileTest, ReorderBlobsTest) {
   EXPECT_TRUE(utils::ReadFile(new_blobs.path(), &new_data));
   // Kernel blobs should appear at the end.
   EXPECT_EQ("bcdakernel", new_data);
+  EXPECT_EQ(3U, blob_ranges.size());
 
   EXPECT_EQ(2U, part0_aops.size());
   EXPECT_EQ(0U, part0_aops[0].op.data_offset());
@@ -82,6 +96,35 @@ TEST_F(PayloadFileTest, ReorderBlobsTest) {
   EXPECT_EQ(1U, part1_aops.size());
   EXPECT_EQ(4U, part1_aops[0].op.data_offset());
   EXPECT_EQ(6U, part1_aops[0].op.data_length());
+
+  // The operations got the hash of their blob.
+  brillo::Blob hash;
+  EXPECT_TRUE(HashCalculator::RawHashOfBytes("bcd", 3, &hash));
+  EXPECT_EQ(string(hash.begin(), hash.end()),
+            part0_aops[0].op.data_sha256_hash());
+}
+
+TEST_F(PayloadFileTest, LayoutBlobsMergesAdjacentRangesTest) {
+  ScopedTempFile orig_blobs("LayoutBlobsTest.orig.XXXXXX", true);
+  EXPECT_TRUE(test_utils::WriteFileString(orig_blobs.path(), "abcdef"));
+
+  payload_.part_vec_.resize(1);
+  AnnotatedOperation aop;
+  aop.op.set_data_offset(0);
+  aop.op.set_data_length(2);
+  payload_.part_vec_[0].aops.push_back(aop);
+  // Operations without a blob don't split the range.
+  payload_.part_vec_[0].aops.emplace_back();
+  aop.op.set_data_offset(2);
+  aop.op.set_data_length(4);
+  payload_.part_vec_[0].aops.push_back(aop);
+
+  vector<PayloadFile::BlobRange> blob_ranges;
+  EXPECT_TRUE(payload_.LayoutDataBlobs(orig_blobs.fd(), &blob_ranges));
+  ASSERT_EQ(1U, blob_ranges.size());
+  EXPECT_EQ(0U, blob_ranges[0].offset);
+  EXPECT_EQ(6U, blob_ranges[0].length);
+  EXPECT_EQ(2U, payload_.part_vec_[0].aops[2].op.data_offset());
 }
 
 }  // namespace chromeos_update_engine
@@ -257,7 +257,8 @@ bool PayloadVersion::Validate() const {
                         minor == kVerityMinorPayloadVersion ||
                         minor == kPartialUpdateMinorPayloadVersion ||
                         minor == kZucchiniMinorPayloadVersion ||
-                        minor == kLZ4DIFFMinorPayloadVersion);
+                        minor == kLZ4DIFFMinorPayloadVersion ||
+                        minor == kXzArm64MinorPayloadVersion);
   return true;
 }
 
@@ -306,6 +307,13 @@ bool PayloadVersion::IsDeltaOrPartial() const {
   return minor != kFullPayloadMinorVersion;
 }
 
+bool PayloadVersion::XzArm64FilterAllowed() const {
+  if (!IsDeltaOrPartial()) {
+    return full_payload_xz_arm64_filter;
+  }
+  return minor >= kXzArm64MinorPayloadVersion;
+}
+
 bool PayloadGenerationConfig::Validate() const {
   TEST_AND_RETURN_FALSE(version.Validate());
   TEST_AND_RETURN_FALSE(version.IsDeltaOrPartial() ==
@@ -366,6 +374,48 @@ void PayloadGenerationConfig::ParseCompressorTypes(
   }
 }
 
+bool PayloadGenerationConfig::ParseDiffSizeLimits(const std::string& limits) {
+  static const std::map<std::string, InstallOperation::Type> kAlgorithms = {
+      {"bsdiff", InstallOperation::SOURCE_BSDIFF},
+      {"puffdiff", InstallOperation::PUFFDIFF},
+      {"zucchini", InstallOperation::ZUCCHINI},
+  };
+  diff_size_limits.clear();
+  for (const auto& entry : brillo::string_utils::Split(limits, ",")) {
+    auto fields = brillo::string_utils::Split(entry, ":");
+    if (fields.size() != 3) {
+      LOG(ERROR) << "Invalid diff size limits \"" << entry
+                 << "\", expected <algorithm>:<max memory MiB>:<max input MiB>";
+      return false;
+    }
+    auto it = kAlgorithms.find(fields[0]);
+    if (it == kAlgorithms.end()) {
+      LOG(ERROR) << "Unknown diff algorithm in size limits: " << fields[0];
+      return false;
+    }
+    uint64_t max_memory_mib = 0;
+    uint64_t max_input_mib = 0;
+    if (!base::StringToUint64(fields[1], &max_memory_mib) ||
+        !base::StringToUint64(fields[2], &max_input_mib)) {
+      LOG(ERROR) << "Invalid diff size limits \"" << entry << "\"";
+      return false;
+    }
+    DiffSizeLimits& op_limits = diff_size_limits[it->second];
+    op_limits.max_memory_bytes = max_memory_mib * 1024 * 1024;
+    op_limits.max_input_bytes = max_input_mib * 1024 * 1024;
+  }
+  return true;
+}
+
+DiffSizeLimits PayloadGenerationConfig::GetDiffSizeLimits(
+    InstallOperation::Type op) const {
+  if (op == InstallOperation::BROTLI_BSDIFF) {
+    op = InstallOperation::SOURCE_BSDIFF;
+  }
+  auto it = diff_size_limits.find(op);
+  return it == diff_size_limits.end() ? DiffSizeLimits() : it->second;
+}
+
 bool PayloadGenerationConfig::OperationEnabled(
     InstallOperation::Type op) const noexcept {
   if (!version.OperationAllowed(op)) {
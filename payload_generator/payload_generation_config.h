@@ -19,6 +19,7 @@
 
 #include <cstddef>
 
+#include <map>
 #include <memory>
 #include <string>
 #include <vector>
@@ -33,6 +34,9 @@
 
 namespace chromeos_update_engine {
 
+class PartitionResultCache;
+class PuffdiffCache;
+
 struct PostInstallConfig {
   // Whether the postinstall config is empty.
   bool IsEmpty() const;
@@ -128,6 +132,11 @@ struct PartitionConfig {
   // Enables the on device fec data computation by default.
   bool disable_fec_computation = false;
 
+  // Skips regenerating the verity hash tree and FEC on the host to check them
+  // against the ones stored in the image. Only meant for trusted pipelines
+  // that already validated the images.
+  bool disable_verity_self_check = false;
+
   // Per-partition version, usually a number representing timestamp.
   std::string version;
 
@@ -183,11 +192,29 @@ struct PayloadVersion {
   // Whether this payload version is a delta or partial payload.
   bool IsDeltaOrPartial() const;
 
+  // Whether REPLACE_XZ operations may use the ARM64 BCJ filter.
+  bool XzArm64FilterAllowed() const;
+
   // The major version of the payload.
   uint64_t major;
 
   // The minor version of the payload.
   uint32_t minor;
+
+  // Whether the clients of a full payload, which doesn't state the minor
+  // version they support, all decode the ARM64 BCJ filter.
+  bool full_payload_xz_arm64_filter = false;
+};
+
+// The largest file a diff algorithm is run on. Both limits only depend on the
+// size of the old and new data, so the payload doesn't depend on the machine
+// generating it. A value of 0 means no limit.
+struct DiffSizeLimits {
+  // Maximum peak memory of one run estimated from the input size, in bytes.
+  uint64_t max_memory_bytes = 0;
+
+  // Maximum size of the old and new data of one run, in bytes.
+  uint64_t max_input_bytes = 0;
 };
 
 // The PayloadGenerationConfig struct encapsulates all the configuration to
@@ -262,6 +289,30 @@ struct PayloadGenerationConfig {
   std::vector<bsdiff::CompressorType> compressors{
       bsdiff::CompressorType::kBZ2, bsdiff::CompressorType::kBrotli};
 
+  // The size limits of the diff algorithms, keyed by SOURCE_BSDIFF, PUFFDIFF
+  // and ZUCCHINI. Files over the limits of an algorithm skip it, so the best of
+  // the remaining candidates is used instead.
+  std::map<InstallOperation::Type, DiffSizeLimits> diff_size_limits;
+
+  // The cache of PUFFDIFF patches shared by all the partitions, or null to
+  // always run puffdiff.
+  std::shared_ptr<PuffdiffCache> puffdiff_cache;
+
+  // The cache of the operations, merge sequence and COW size of each
+  // partition from previous runs, or null to always generate them.
+  std::shared_ptr<PartitionResultCache> partition_result_cache;
+
+  // Parses |diff_size_limits| from a comma separated list of
+  // <algorithm>:<max memory MiB>:<max input MiB> entries, where <algorithm> is
+  // one of bsdiff, puffdiff or zucchini, e.g. "zucchini:4096:256". Returns
+  // false on malformed input.
+  bool ParseDiffSizeLimits(const std::string& limits);
+
+  // Returns the size limits of |op|, BROTLI_BSDIFF sharing the ones of
+  // SOURCE_BSDIFF.
+  [[nodiscard]] DiffSizeLimits GetDiffSizeLimits(
+      InstallOperation::Type op) const;
+
   [[nodiscard]] bool OperationEnabled(InstallOperation::Type op) const noexcept;
 };
 
@@ -16,16 +16,27 @@
 
 #include "update_engine/payload_generator/payload_generation_config.h"
 
+#include <fcntl.h>
+
+#include <algorithm>
+#include <functional>
+#include <list>
+#include <utility>
+#include <vector>
+
 #include <base/logging.h>
 #include <base/strings/string_number_conversions.h>
 #include <base/strings/string_split.h>
+#include <base/threading/simple_thread.h>
 #include <brillo/secure_blob.h>
 #include <fec/io.h>
 #include <libavb/libavb.h>
 #include <verity/hash_tree_builder.h>
 
 #include "update_engine/common/utils.h"
+#include "update_engine/payload_consumer/file_descriptor.h"
 #include "update_engine/payload_consumer/verity_writer_android.h"
+#include "update_engine/payload_generator/delta_diff_utils.h"
 #include "update_engine/payload_generator/extent_ranges.h"
 
 namespace chromeos_update_engine {
@@ -73,58 +84,143 @@ bool AvbDescriptorCallback(const AvbDescriptor* descriptor, void* user_data) {
   return true;
 }
 
-// Generate hash tree and FEC based on the verity config and verify that it
-// matches the hash tree and FEC stored in the image.
-bool VerifyVerityConfig(const PartitionConfig& part) {
+// Generate hash tree based on the verity config and verify that it matches the
+// hash tree stored in the image.
+bool VerifyHashTree(const PartitionConfig& part) {
   const size_t block_size = part.fs_interface->GetBlockSize();
-  if (part.verity.hash_tree_extent.num_blocks() != 0) {
-    auto hash_function =
-        HashTreeBuilder::HashFunction(part.verity.hash_tree_algorithm);
-    TEST_AND_RETURN_FALSE(hash_function != nullptr);
-    HashTreeBuilder hash_tree_builder(block_size, hash_function);
-    uint64_t data_size =
-        part.verity.hash_tree_data_extent.num_blocks() * block_size;
-    uint64_t tree_size = hash_tree_builder.CalculateSize(data_size);
+  auto hash_function =
+      HashTreeBuilder::HashFunction(part.verity.hash_tree_algorithm);
+  TEST_AND_RETURN_FALSE(hash_function != nullptr);
+  HashTreeBuilder hash_tree_builder(block_size, hash_function);
+  uint64_t data_size =
+      part.verity.hash_tree_data_extent.num_blocks() * block_size;
+  // The size of the tree only depends on |data_size|, so checking it doesn't
+  // read the data. The data is read once, to build the tree verified below.
+  uint64_t tree_size = hash_tree_builder.CalculateSize(data_size);
+  TEST_AND_RETURN_FALSE(
+      tree_size == part.verity.hash_tree_extent.num_blocks() * block_size);
+  TEST_AND_RETURN_FALSE(
+      hash_tree_builder.Initialize(data_size, part.verity.hash_tree_salt));
+
+  brillo::Blob buffer;
+  for (uint64_t offset = part.verity.hash_tree_data_extent.start_block() *
+                         block_size,
+                data_end = offset + data_size;
+       offset < data_end;) {
+    constexpr uint64_t kBufferSize = 1024 * 1024;
+    size_t bytes_to_read = std::min(kBufferSize, data_end - offset);
     TEST_AND_RETURN_FALSE(
-        tree_size == part.verity.hash_tree_extent.num_blocks() * block_size);
+        utils::ReadFileChunk(part.path, offset, bytes_to_read, &buffer));
     TEST_AND_RETURN_FALSE(
-        hash_tree_builder.Initialize(data_size, part.verity.hash_tree_salt));
-
-    brillo::Blob buffer;
-    for (uint64_t offset = part.verity.hash_tree_data_extent.start_block() *
-                           block_size,
-                  data_end = offset + data_size;
-         offset < data_end;) {
-      constexpr uint64_t kBufferSize = 1024 * 1024;
-      size_t bytes_to_read = std::min(kBufferSize, data_end - offset);
-      TEST_AND_RETURN_FALSE(
-          utils::ReadFileChunk(part.path, offset, bytes_to_read, &buffer));
-      TEST_AND_RETURN_FALSE(
-          hash_tree_builder.Update(buffer.data(), buffer.size()));
-      offset += buffer.size();
-      buffer.clear();
+        hash_tree_builder.Update(buffer.data(), buffer.size()));
+    offset += buffer.size();
+    buffer.clear();
+  }
+  TEST_AND_RETURN_FALSE(hash_tree_builder.BuildHashTree());
+  TEST_AND_RETURN_FALSE(utils::ReadFileChunk(
+      part.path,
+      part.verity.hash_tree_extent.start_block() * block_size,
+      tree_size,
+      &buffer));
+  TEST_AND_RETURN_FALSE(hash_tree_builder.CheckHashTree(buffer));
+  LOG(INFO) << "Verified verity hash tree of " << part.name;
+  return true;
+}
+
+// Generate FEC for the RS rounds in [first_round, first_round + num_rounds)
+// based on the verity config and verify that it matches the FEC stored in the
+// image.
+bool VerifyFECRounds(const PartitionConfig& part,
+                     uint64_t first_round,
+                     uint64_t num_rounds) {
+  const size_t block_size = part.fs_interface->GetBlockSize();
+  EintrSafeFileDescriptor fd;
+  TEST_AND_RETURN_FALSE(fd.Open(part.path.c_str(), O_RDONLY));
+  return VerityWriterAndroid::VerifyFECRounds(
+      &fd,
+      part.verity.fec_data_extent.start_block() * block_size,
+      part.verity.fec_data_extent.num_blocks() * block_size,
+      part.verity.fec_extent.start_block() * block_size,
+      part.verity.fec_extent.num_blocks() * block_size,
+      part.verity.fec_roots,
+      block_size,
+      first_round,
+      num_rounds);
+}
+
+// A single piece of the verity self check, run on a thread pool.
+class VerityCheckTask : public base::DelegateSimpleThread::Delegate {
+ public:
+  explicit VerityCheckTask(std::function<bool()> check)
+      : check_(std::move(check)) {}
+  ~VerityCheckTask() override = default;
+
+  // Overrides DelegateSimpleThread::Delegate.
+  void Run() override { success_ = check_(); }
+
+  bool success() const { return success_; }
+
+ private:
+  std::function<bool()> check_;
+  bool success_ = false;
+
+  DISALLOW_COPY_AND_ASSIGN(VerityCheckTask);
+};
+
+// Generate hash tree and FEC based on the verity config of every partition in
+// |partitions| and verify that they match the hash tree and FEC stored in the
+// images. The hash trees of all partitions and the FEC, split in ranges of RS
+// rounds, are verified concurrently.
+bool VerifyVerityConfigs(const std::vector<PartitionConfig>& partitions) {
+  const size_t max_threads = diff_utils::GetMaxThreads();
+  std::list<VerityCheckTask> tasks;
+  for (const PartitionConfig& part : partitions) {
+    if (part.verity.IsEmpty())
+      continue;
+    if (part.disable_verity_self_check) {
+      LOG(INFO) << "Skipping verity self check for " << part.name;
+      continue;
+    }
+    if (part.verity.hash_tree_extent.num_blocks() != 0) {
+      tasks.emplace_back([&part]() { return VerifyHashTree(part); });
+    }
+    if (part.verity.fec_extent.num_blocks() != 0) {
+      const size_t block_size = part.fs_interface->GetBlockSize();
+      const uint64_t rounds = VerityWriterAndroid::GetFECRounds(
+          part.verity.fec_data_extent.num_blocks() * block_size,
+          part.verity.fec_roots,
+          block_size);
+      TEST_AND_RETURN_FALSE(rounds * part.verity.fec_roots ==
+                            part.verity.fec_extent.num_blocks());
+      // Each round reads about 1 MiB of data with 4K blocks, don't bother
+      // splitting below a few rounds per task.
+      constexpr uint64_t kMinFECRoundsPerTask = 16;
+      const uint64_t rounds_per_task = std::max(
+          kMinFECRoundsPerTask, utils::DivRoundUp(rounds, max_threads));
+      for (uint64_t first_round = 0; first_round < rounds;
+           first_round += rounds_per_task) {
+        const uint64_t num_rounds =
+            std::min(rounds_per_task, rounds - first_round);
+        tasks.emplace_back([&part, first_round, num_rounds]() {
+          return VerifyFECRounds(part, first_round, num_rounds);
+        });
+      }
     }
-    TEST_AND_RETURN_FALSE(hash_tree_builder.BuildHashTree());
-    TEST_AND_RETURN_FALSE(utils::ReadFileChunk(
-        part.path,
-        part.verity.hash_tree_extent.start_block() * block_size,
-        tree_size,
-        &buffer));
-    TEST_AND_RETURN_FALSE(hash_tree_builder.CheckHashTree(buffer));
   }
+  if (tasks.empty())
+    return true;
 
-  if (part.verity.fec_extent.num_blocks() != 0) {
-    TEST_AND_RETURN_FALSE(VerityWriterAndroid::EncodeFEC(
-        part.path,
-        part.verity.fec_data_extent.start_block() * block_size,
-        part.verity.fec_data_extent.num_blocks() * block_size,
-        part.verity.fec_extent.start_block() * block_size,
-        part.verity.fec_extent.num_blocks() * block_size,
-        part.verity.fec_roots,
-        block_size,
-        true /* verify_mode */));
+  base::DelegateSimpleThreadPool thread_pool(
+      "verity-self-check", std::min(max_threads, tasks.size()));
+  thread_pool.Start();
+  for (auto& task : tasks) {
+    thread_pool.AddWork(&task);
   }
-  return true;
+  thread_pool.JoinAll();
+
+  return std::all_of(tasks.begin(), tasks.end(), [](const auto& task) {
+    return task.success();
+  });
 }
 }  // namespace
 
@@ -218,11 +314,8 @@ bool ImageConfig::LoadVerityConfig() {
       }
     }
 
-    if (!part.verity.IsEmpty()) {
-      TEST_AND_RETURN_FALSE(VerifyVerityConfig(part));
-    }
   }
-  return true;
+  return VerifyVerityConfigs(partitions);
 }
 
 }  // namespace chromeos_update_engine
@@ -196,6 +196,21 @@ TEST_F(PayloadGenerationConfigAndroidTest, LoadVerityConfigInvalidFECTest) {
   EXPECT_FALSE(image_config_.LoadVerityConfig());
 }
 
+TEST_F(PayloadGenerationConfigAndroidTest,
+       LoadVerityConfigDisableSelfCheckTest) {
+  brillo::Blob part = GetAVBPartition();
+  part[kHashTreeOffset] ^= 1;  // flip one bit
+  part[kFECOffset] ^= 1;       // flip one bit
+  test_utils::WriteFileVector(temp_file_.path(), part);
+  image_config_.partitions[0].disable_verity_self_check = true;
+  EXPECT_TRUE(image_config_.LoadImageSize());
+  EXPECT_TRUE(image_config_.partitions[0].OpenFilesystem());
+  EXPECT_TRUE(image_config_.LoadVerityConfig());
+  const VerityConfig& verity = image_config_.partitions[0].verity;
+  EXPECT_EQ(ExtentForRange(2, 1), verity.hash_tree_extent);
+  EXPECT_EQ(ExtentForRange(3, 2), verity.fec_extent);
+}
+
 TEST_F(PayloadGenerationConfigAndroidTest, LoadVerityConfigEmptyImageTest) {
   brillo::Blob part(kImageSize);
   test_utils::WriteFileVector(temp_file_.path(), part);
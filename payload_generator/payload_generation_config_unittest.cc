@@ -142,4 +142,29 @@ TEST_F(PayloadGenerationConfigTest, ValidateDynamicPartitionMetadataTooBig) {
 
   EXPECT_FALSE(image_config.ValidateDynamicPartitionMetadata());
 }
+
+TEST_F(PayloadGenerationConfigTest, ParseDiffSizeLimitsTest) {
+  PayloadGenerationConfig config;
+  EXPECT_TRUE(config.ParseDiffSizeLimits(""));
+  EXPECT_TRUE(config.diff_size_limits.empty());
+
+  EXPECT_TRUE(config.ParseDiffSizeLimits("zucchini:4096:256,bsdiff:0:64"));
+  EXPECT_EQ(2u, config.diff_size_limits.size());
+  DiffSizeLimits zucchini =
+      config.GetDiffSizeLimits(InstallOperation::ZUCCHINI);
+  EXPECT_EQ(4096ULL * 1024 * 1024, zucchini.max_memory_bytes);
+  EXPECT_EQ(256ULL * 1024 * 1024, zucchini.max_input_bytes);
+  DiffSizeLimits bsdiff =
+      config.GetDiffSizeLimits(InstallOperation::BROTLI_BSDIFF);
+  EXPECT_EQ(0u, bsdiff.max_memory_bytes);
+  EXPECT_EQ(64ULL * 1024 * 1024, bsdiff.max_input_bytes);
+  DiffSizeLimits puffdiff =
+      config.GetDiffSizeLimits(InstallOperation::PUFFDIFF);
+  EXPECT_EQ(0u, puffdiff.max_memory_bytes);
+  EXPECT_EQ(0u, puffdiff.max_input_bytes);
+
+  EXPECT_FALSE(config.ParseDiffSizeLimits("zucchini:4096"));
+  EXPECT_FALSE(config.ParseDiffSizeLimits("xdelta:1:1"));
+  EXPECT_FALSE(config.ParseDiffSizeLimits("zucchini:lots:1"));
+}
 }  // namespace chromeos_update_engine
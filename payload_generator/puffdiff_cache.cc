@@ -0,0 +1,192 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/puffdiff_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <base/logging.h>
+#include <base/strings/string_number_conversions.h>
+
+#include "update_engine/common/hash_calculator.h"
+#include "update_engine/common/utils.h"
+#include "update_engine/payload_generator/generator_hash.h"
+
+namespace chromeos_update_engine {
+
+namespace {
+
+// Bumped whenever the key or the on disk format changes, so stale cache
+// directories are simply missed.
+constexpr char kCacheFormat[] = "puffdiff-cache-v2";
+
+// A cache file is the SHA-256 of the patch followed by the patch itself.
+constexpr size_t kHashSize = 32;
+
+void HashUint64(uint64_t value, HashCalculator* hasher) {
+  hasher->Update(&value, sizeof(value));
+}
+
+void HashBlob(const brillo::Blob& blob, HashCalculator* hasher) {
+  HashUint64(blob.size(), hasher);
+  hasher->Update(blob.data(), blob.size());
+}
+
+void HashExtents(const std::vector<puffin::BitExtent>& extents,
+                 HashCalculator* hasher) {
+  HashUint64(extents.size(), hasher);
+  for (const auto& extent : extents) {
+    HashUint64(extent.offset, hasher);
+    HashUint64(extent.length, hasher);
+  }
+}
+
+}  // namespace
+
+PuffdiffCache::PuffdiffCache(uint64_t max_memory_bytes,
+                             const std::string& cache_dir)
+    : max_memory_bytes_(max_memory_bytes), cache_dir_(cache_dir) {}
+
+std::string PuffdiffCache::GetKey(
+    const brillo::Blob& old_data,
+    const brillo::Blob& new_data,
+    const std::vector<puffin::BitExtent>& old_deflates,
+    const std::vector<puffin::BitExtent>& new_deflates,
+    const std::vector<bsdiff::CompressorType>& types) {
+  HashCalculator hasher;
+  hasher.Update(kCacheFormat, sizeof(kCacheFormat));
+  // The patch depends on the puffin, bsdiff and brotli code that made it.
+  HashBlob(GetGeneratorHash(), &hasher);
+  HashBlob(old_data, &hasher);
+  HashBlob(new_data, &hasher);
+  HashExtents(old_deflates, &hasher);
+  HashExtents(new_deflates, &hasher);
+  HashUint64(types.size(), &hasher);
+  for (auto type : types) {
+    HashUint64(static_cast<uint64_t>(type), &hasher);
+  }
+  hasher.Finalize();
+  return base::HexEncode(hasher.raw_hash().data(), hasher.raw_hash().size());
+}
+
+bool PuffdiffCache::Lookup(const std::string& key, brillo::Blob* patch) {
+  {
+    base::AutoLock auto_lock(lock_);
+    auto it = patches_.find(key);
+    if (it != patches_.end()) {
+      *patch = it->second;
+      hit_count_++;
+      return true;
+    }
+  }
+  if (!UseDisk() || !ReadFromDisk(key, patch)) {
+    return false;
+  }
+  base::AutoLock auto_lock(lock_);
+  StoreInMemoryLocked(key, *patch);
+  hit_count_++;
+  return true;
+}
+
+void PuffdiffCache::Store(const std::string& key, const brillo::Blob& patch) {
+  {
+    base::AutoLock auto_lock(lock_);
+    StoreInMemoryLocked(key, patch);
+  }
+  if (UseDisk() && !WriteToDisk(key, patch)) {
+    LOG(WARNING) << "Failed to store puffdiff patch " << key << " in "
+                 << cache_dir_;
+  }
+}
+
+size_t PuffdiffCache::hit_count() const {
+  base::AutoLock auto_lock(lock_);
+  return hit_count_;
+}
+
+void PuffdiffCache::StoreInMemoryLocked(const std::string& key,
+                                        const brillo::Blob& patch) {
+  if (patch.size() > max_memory_bytes_ || patches_.count(key)) {
+    return;
+  }
+  while (used_bytes_ + patch.size() > max_memory_bytes_) {
+    auto it = patches_.find(insertion_order_.front());
+    used_bytes_ -= it->second.size();
+    patches_.erase(it);
+    insertion_order_.pop_front();
+  }
+  patches_[key] = patch;
+  insertion_order_.push_back(key);
+  used_bytes_ += patch.size();
+}
+
+bool PuffdiffCache::UseDisk() const {
+  // Without the generator hash the patches of another build could be reused.
+  return !cache_dir_.empty() && !GetGeneratorHash().empty();
+}
+
+std::string PuffdiffCache::GetCachePath(const std::string& key) const {
+  return cache_dir_ + "/" + key + ".puffdiff";
+}
+
+bool PuffdiffCache::ReadFromDisk(const std::string& key,
+                                 brillo::Blob* patch) const {
+  const std::string path = GetCachePath(key);
+  if (!utils::FileExists(path.c_str())) {
+    return false;
+  }
+  brillo::Blob contents;
+  TEST_AND_RETURN_FALSE(utils::ReadFile(path, &contents));
+  TEST_AND_RETURN_FALSE(contents.size() > kHashSize);
+  brillo::Blob hash;
+  TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfBytes(
+      contents.data() + kHashSize, contents.size() - kHashSize, &hash));
+  if (!std::equal(hash.begin(), hash.end(), contents.begin())) {
+    LOG(WARNING) << "Ignoring corrupted puffdiff cache file " << path;
+    return false;
+  }
+  patch->assign(contents.begin() + kHashSize, contents.end());
+  return true;
+}
+
+bool PuffdiffCache::WriteToDisk(const std::string& key,
+                                const brillo::Blob& patch) const {
+  brillo::Blob contents;
+  TEST_AND_RETURN_FALSE(HashCalculator::RawHashOfData(patch, &contents));
+  TEST_AND_RETURN_FALSE(contents.size() == kHashSize);
+  contents.insert(contents.end(), patch.begin(), patch.end());
+
+  // Write to a temporary file and rename it, so concurrent generator runs
+  // sharing the directory never see a partially written patch.
+  const std::string path = GetCachePath(key);
+  std::string temp_path = path + ".XXXXXX";
+  int fd = mkstemp(temp_path.data());
+  TEST_AND_RETURN_FALSE_ERRNO(fd >= 0);
+  bool success = utils::WriteAll(fd, contents.data(), contents.size());
+  success = IGNORE_EINTR(close(fd)) == 0 && success;
+  if (success && rename(temp_path.c_str(), path.c_str()) == 0) {
+    return true;
+  }
+  PLOG(ERROR) << "Failed to write " << path;
+  unlink(temp_path.c_str());
+  return false;
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,95 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_PUFFDIFF_CACHE_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_PUFFDIFF_CACHE_H_
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <base/macros.h>
+#include <base/synchronization/lock.h>
+#include <brillo/secure_blob.h>
+#include <bsdiff/constants.h>
+#include <puffin/common.h>
+
+namespace chromeos_update_engine {
+
+// A content addressed cache of PUFFDIFF patches. Puffing and huffing the
+// deflate streams of big APKs is most of the cost of puffdiff, and the same
+// inputs show up again when files are duplicated across partitions or when
+// the same builds are diffed again. Patches are kept in memory for the
+// current run and, when a directory is given, on disk across runs. All
+// methods are thread safe.
+class PuffdiffCache {
+ public:
+  // |max_memory_bytes| caps the size of the patches kept in memory, the
+  // oldest ones are evicted first. If |cache_dir| is not empty, patches are
+  // also stored in and looked up from that directory.
+  PuffdiffCache(uint64_t max_memory_bytes, const std::string& cache_dir);
+  ~PuffdiffCache() = default;
+
+  // Returns the key identifying a puffdiff from |old_data| to |new_data| with
+  // the given deflate locations and patch compressors, by this build of the
+  // generator.
+  static std::string GetKey(const brillo::Blob& old_data,
+                            const brillo::Blob& new_data,
+                            const std::vector<puffin::BitExtent>& old_deflates,
+                            const std::vector<puffin::BitExtent>& new_deflates,
+                            const std::vector<bsdiff::CompressorType>& types);
+
+  // Looks up the patch for |key| in memory, then on disk. Returns whether it
+  // was found, in which case it is stored in |patch|.
+  bool Lookup(const std::string& key, brillo::Blob* patch);
+
+  // Stores |patch| for |key|. Failing to write it to disk is not an error.
+  void Store(const std::string& key, const brillo::Blob& patch);
+
+  // Returns the number of successful lookups, for testing and logging.
+  size_t hit_count() const;
+
+ private:
+  // Adds |patch| to the in memory cache. |lock_| must be held.
+  void StoreInMemoryLocked(const std::string& key, const brillo::Blob& patch);
+
+  // Returns whether patches are stored in and looked up from |cache_dir_|.
+  bool UseDisk() const;
+
+  // Returns the path of the cache file for |key|.
+  std::string GetCachePath(const std::string& key) const;
+
+  bool ReadFromDisk(const std::string& key, brillo::Blob* patch) const;
+  bool WriteToDisk(const std::string& key, const brillo::Blob& patch) const;
+
+  const uint64_t max_memory_bytes_;
+  const std::string cache_dir_;
+
+  // Protects all the members below.
+  mutable base::Lock lock_;
+  std::map<std::string, brillo::Blob> patches_;
+  // Keys of |patches_| in insertion order, for eviction.
+  std::list<std::string> insertion_order_;
+  uint64_t used_bytes_{0};
+  size_t hit_count_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(PuffdiffCache);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_PUFFDIFF_CACHE_H_
@@ -0,0 +1,132 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/puffdiff_cache.h"
+
+#include <string>
+#include <vector>
+
+#include <base/files/file_enumerator.h>
+#include <base/files/file_path.h>
+#include <base/files/scoped_temp_dir.h>
+#include <gtest/gtest.h>
+
+#include "update_engine/common/utils.h"
+
+namespace chromeos_update_engine {
+
+class PuffdiffCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override { ASSERT_TRUE(temp_dir_.CreateUniqueTempDir()); }
+
+  std::string GetKey(const brillo::Blob& old_data) {
+    return PuffdiffCache::GetKey(old_data,
+                                 new_data_,
+                                 {{8, 16}},
+                                 {{8, 24}},
+                                 {bsdiff::CompressorType::kBrotli});
+  }
+
+  // Returns the paths of the files in the cache directory.
+  std::vector<std::string> GetCacheFiles() {
+    std::vector<std::string> files;
+    base::FileEnumerator enumerator(
+        temp_dir_.GetPath(), false, base::FileEnumerator::FILES);
+    for (auto path = enumerator.Next(); !path.empty();
+         path = enumerator.Next()) {
+      files.push_back(path.value());
+    }
+    return files;
+  }
+
+  base::ScopedTempDir temp_dir_;
+  const brillo::Blob old_data_{1, 2, 3, 4};
+  const brillo::Blob new_data_{1, 2, 3, 5};
+  const brillo::Blob patch_{'p', 'a', 't', 'c', 'h'};
+};
+
+TEST_F(PuffdiffCacheTest, KeyDependsOnAllInputsTest) {
+  const std::string key = GetKey(old_data_);
+  EXPECT_EQ(key, GetKey(old_data_));
+  EXPECT_NE(key, GetKey(new_data_));
+  EXPECT_NE(key,
+            PuffdiffCache::GetKey(old_data_,
+                                  new_data_,
+                                  {{8, 16}},
+                                  {{8, 24}},
+                                  {bsdiff::CompressorType::kBZ2}));
+  EXPECT_NE(key,
+            PuffdiffCache::GetKey(old_data_,
+                                  new_data_,
+                                  {{8, 16}},
+                                  {},
+                                  {bsdiff::CompressorType::kBrotli}));
+}
+
+TEST_F(PuffdiffCacheTest, InMemoryTest) {
+  PuffdiffCache cache(1024, "");
+  brillo::Blob patch;
+  EXPECT_FALSE(cache.Lookup(GetKey(old_data_), &patch));
+  cache.Store(GetKey(old_data_), patch_);
+  EXPECT_TRUE(cache.Lookup(GetKey(old_data_), &patch));
+  EXPECT_EQ(patch_, patch);
+  EXPECT_FALSE(cache.Lookup(GetKey(new_data_), &patch));
+  EXPECT_EQ(1u, cache.hit_count());
+}
+
+TEST_F(PuffdiffCacheTest, EvictsOldestTest) {
+  PuffdiffCache cache(2 * patch_.size(), "");
+  cache.Store("a", patch_);
+  cache.Store("b", patch_);
+  cache.Store("c", patch_);
+  brillo::Blob patch;
+  EXPECT_FALSE(cache.Lookup("a", &patch));
+  EXPECT_TRUE(cache.Lookup("b", &patch));
+  EXPECT_TRUE(cache.Lookup("c", &patch));
+}
+
+TEST_F(PuffdiffCacheTest, OnDiskAcrossInstancesTest) {
+  const std::string key = GetKey(old_data_);
+  {
+    PuffdiffCache cache(1024, temp_dir_.GetPath().value());
+    cache.Store(key, patch_);
+  }
+  PuffdiffCache cache(1024, temp_dir_.GetPath().value());
+  brillo::Blob patch;
+  EXPECT_TRUE(cache.Lookup(key, &patch));
+  EXPECT_EQ(patch_, patch);
+}
+
+TEST_F(PuffdiffCacheTest, CorruptedOnDiskEntryIgnoredTest) {
+  const std::string key = GetKey(old_data_);
+  {
+    PuffdiffCache cache(1024, temp_dir_.GetPath().value());
+    cache.Store(key, patch_);
+  }
+  auto files = GetCacheFiles();
+  ASSERT_EQ(1u, files.size());
+  brillo::Blob contents;
+  ASSERT_TRUE(utils::ReadFile(files[0], &contents));
+  contents.back() ^= 1;
+  ASSERT_TRUE(
+      utils::WriteFile(files[0].c_str(), contents.data(), contents.size()));
+
+  PuffdiffCache cache(1024, temp_dir_.GetPath().value());
+  brillo::Blob patch;
+  EXPECT_FALSE(cache.Lookup(key, &patch));
+}
+
+}  // namespace chromeos_update_engine
@@ -0,0 +1,164 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/suffix_array_cache.h"
+
+#include <limits>
+
+#include <base/logging.h>
+#include <bsdiff/control_entry.h>
+
+namespace chromeos_update_engine {
+
+namespace {
+
+bool RunBsdiff(const brillo::Blob& old_data,
+               const brillo::Blob& new_data,
+               bsdiff::PatchWriterInterface* patch_writer,
+               bsdiff::SuffixArrayIndexInterface** sarray) {
+  return 0 == bsdiff::bsdiff(old_data.data(),
+                             old_data.size(),
+                             new_data.data(),
+                             new_data.size(),
+                             patch_writer,
+                             sarray);
+}
+
+// A patch writer that drops the patch, used to have bsdiff only build the
+// suffix array of the old data.
+class NullPatchWriter : public bsdiff::PatchWriterInterface {
+ public:
+  NullPatchWriter() = default;
+  ~NullPatchWriter() override = default;
+
+  bool Init(size_t new_size) override { return true; }
+  bool WriteDiffStream(const uint8_t* data, size_t size) override {
+    return true;
+  }
+  bool WriteExtraStream(const uint8_t* data, size_t size) override {
+    return true;
+  }
+  bool AddControlEntry(const bsdiff::ControlEntry& entry) override {
+    return true;
+  }
+  bool Close() override { return true; }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(NullPatchWriter);
+};
+
+// Returns the suffix array of |old_data|, or nullptr on failure. Diffing
+// against an empty buffer builds the array without generating any patch.
+bsdiff::SuffixArrayIndexInterface* BuildSuffixArray(
+    const brillo::Blob& old_data) {
+  NullPatchWriter patch_writer;
+  bsdiff::SuffixArrayIndexInterface* sarray = nullptr;
+  if (!RunBsdiff(old_data, brillo::Blob(), &patch_writer, &sarray)) {
+    delete sarray;
+    return nullptr;
+  }
+  return sarray;
+}
+
+}  // namespace
+
+uint64_t SuffixArrayCache::EstimatedSuffixArraySize(uint64_t size) {
+  // bsdiff uses 32-bit indexes when the whole buffer is addressable with
+  // them, and 64-bit ones otherwise.
+  const uint64_t index_size =
+      size < std::numeric_limits<int32_t>::max() ? sizeof(int32_t)
+                                                 : sizeof(int64_t);
+  return (size + 1) * index_size;
+}
+
+void SuffixArrayCache::AddReference(const std::string& key) {
+  base::AutoLock auto_lock(lock_);
+  auto& entry = entries_[key];
+  if (!entry) {
+    entry = std::make_shared<Entry>();
+  }
+  entry->users++;
+}
+
+void SuffixArrayCache::Release(const std::string& key) {
+  base::AutoLock auto_lock(lock_);
+  auto it = entries_.find(key);
+  if (it == entries_.end()) {
+    return;
+  }
+  if (--it->second->users == 0) {
+    // Users still running bsdiff hold their own reference to the entry, so
+    // the suffix array is freed once they finish.
+    used_bytes_ -= it->second->reserved_bytes;
+    entries_.erase(it);
+  }
+}
+
+bool SuffixArrayCache::Bsdiff(const std::string& key,
+                              const brillo::Blob& old_data,
+                              const brillo::Blob& new_data,
+                              bsdiff::PatchWriterInterface* patch_writer) {
+  std::shared_ptr<Entry> entry;
+  {
+    base::AutoLock auto_lock(lock_);
+    auto it = entries_.find(key);
+    if (it != entries_.end()) {
+      entry = it->second;
+      // Reserve room for the suffix array only if somebody else is going to
+      // reuse it.
+      if (entry->reserved_bytes == 0) {
+        const uint64_t size = EstimatedSuffixArraySize(old_data.size());
+        if (entry->users > 1 && used_bytes_ + size <= max_bytes_) {
+          entry->reserved_bytes = size;
+          used_bytes_ += size;
+        } else {
+          entry.reset();
+        }
+      }
+    }
+  }
+
+  if (!entry) {
+    return RunBsdiff(old_data, new_data, patch_writer, nullptr);
+  }
+
+  bsdiff::SuffixArrayIndexInterface* sarray = nullptr;
+  {
+    // Other users of the same key wait here while the first one builds the
+    // suffix array, instead of building their own copy. The lock is only
+    // held while building it, all the users diff concurrently.
+    base::AutoLock entry_lock(entry->lock);
+    if (!entry->sarray) {
+      entry->sarray.reset(BuildSuffixArray(old_data));
+      if (entry->sarray) {
+        base::AutoLock auto_lock(lock_);
+        built_count_++;
+      }
+    }
+    sarray = entry->sarray.get();
+  }
+  if (!sarray) {
+    return RunBsdiff(old_data, new_data, patch_writer, nullptr);
+  }
+  return RunBsdiff(old_data, new_data, patch_writer, &sarray);
+}
+
+size_t SuffixArrayCache::built_count() const {
+  base::AutoLock auto_lock(lock_);
+  return built_count_;
+}
+
+}  // namespace chromeos_update_engine
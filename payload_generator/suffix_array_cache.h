@@ -0,0 +1,90 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#ifndef UPDATE_ENGINE_PAYLOAD_GENERATOR_SUFFIX_ARRAY_CACHE_H_
+#define UPDATE_ENGINE_PAYLOAD_GENERATOR_SUFFIX_ARRAY_CACHE_H_
+
+#include <map>
+#include <memory>
+#include <string>
+
+#include <base/macros.h>
+#include <base/synchronization/lock.h>
+#include <brillo/secure_blob.h>
+#include <bsdiff/bsdiff.h>
+#include <bsdiff/patch_writer_interface.h>
+
+namespace chromeos_update_engine {
+
+// Building the suffix array of the old data is the dominant cost of bsdiff.
+// This class keeps the suffix arrays of source buffers that are known to be
+// diffed more than once, for example when several new files are matched
+// against the same old file, so the array is only built by the first bsdiff
+// run and reused by the following ones. All methods are thread safe.
+class SuffixArrayCache {
+ public:
+  // |max_bytes| is an upper bound on the estimated memory held by the cached
+  // suffix arrays. Buffers that don't fit are diffed without caching.
+  explicit SuffixArrayCache(uint64_t max_bytes) : max_bytes_(max_bytes) {}
+  ~SuffixArrayCache() = default;
+
+  // Records that the old data identified by |key| is going to be used as the
+  // bsdiff source once more. Only keys with at least two users are cached.
+  void AddReference(const std::string& key);
+
+  // Drops one user of |key|, freeing the cached suffix array once the last
+  // user is gone. Must be called once per AddReference(), whether or not
+  // Bsdiff() was called for that user.
+  void Release(const std::string& key);
+
+  // Generates a bsdiff patch from |old_data| to |new_data| into
+  // |patch_writer|. |key| identifies the contents of |old_data|; the suffix
+  // array of |old_data| is taken from the cache when present, and stored for
+  // the other users otherwise. Returns whether bsdiff succeeded.
+  bool Bsdiff(const std::string& key,
+              const brillo::Blob& old_data,
+              const brillo::Blob& new_data,
+              bsdiff::PatchWriterInterface* patch_writer);
+
+  // Returns the estimated memory used by the suffix array of |size| bytes.
+  static uint64_t EstimatedSuffixArraySize(uint64_t size);
+
+  // Returns the number of suffix arrays built through this cache, for
+  // testing.
+  size_t built_count() const;
+
+ private:
+  struct Entry {
+    // Protects |sarray|, held while the first user builds it.
+    base::Lock lock;
+    std::unique_ptr<bsdiff::SuffixArrayIndexInterface> sarray;
+    size_t users{0};
+    uint64_t reserved_bytes{0};
+  };
+
+  // Protects all the members below.
+  mutable base::Lock lock_;
+  std::map<std::string, std::shared_ptr<Entry>> entries_;
+  const uint64_t max_bytes_;
+  uint64_t used_bytes_{0};
+  size_t built_count_{0};
+
+  DISALLOW_COPY_AND_ASSIGN(SuffixArrayCache);
+};
+
+}  // namespace chromeos_update_engine
+
+#endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_SUFFIX_ARRAY_CACHE_H_
@@ -0,0 +1,82 @@
+//
+// Copyright (C) 2024 The Android Open Source Project
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//      http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+
+#include "update_engine/payload_generator/suffix_array_cache.h"
+
+#include <gtest/gtest.h>
+
+#include "update_engine/common/test_utils.h"
+#include "update_engine/payload_generator/memory_patch_writer.h"
+
+namespace chromeos_update_engine {
+
+class SuffixArrayCacheTest : public ::testing::Test {
+ protected:
+  void SetUp() override {
+    old_data_.resize(16 * 1024);
+    test_utils::FillWithData(&old_data_);
+    new_data_ = old_data_;
+    new_data_[10] ^= 0xff;
+    new_data_.insert(new_data_.end(), 100, 'a');
+  }
+
+  brillo::Blob Diff(SuffixArrayCache* cache, const std::string& key) {
+    brillo::Blob patch;
+    MemoryPatchWriter writer(&patch);
+    EXPECT_TRUE(cache->Bsdiff(key, old_data_, new_data_, &writer));
+    return patch;
+  }
+
+  brillo::Blob old_data_;
+  brillo::Blob new_data_;
+};
+
+TEST_F(SuffixArrayCacheTest, SharedSourceBuiltOnceTest) {
+  SuffixArrayCache cache(1024 * 1024);
+  cache.AddReference("src");
+  cache.AddReference("src");
+
+  brillo::Blob first = Diff(&cache, "src");
+  cache.Release("src");
+  brillo::Blob second = Diff(&cache, "src");
+  cache.Release("src");
+
+  EXPECT_FALSE(first.empty());
+  EXPECT_EQ(first, second);
+  EXPECT_EQ(1u, cache.built_count());
+}
+
+TEST_F(SuffixArrayCacheTest, SingleUserNotCachedTest) {
+  SuffixArrayCache cache(1024 * 1024);
+  cache.AddReference("src");
+  EXPECT_FALSE(Diff(&cache, "src").empty());
+  cache.Release("src");
+  // Unknown keys are diffed without caching too.
+  EXPECT_FALSE(Diff(&cache, "other").empty());
+  EXPECT_EQ(0u, cache.built_count());
+}
+
+TEST_F(SuffixArrayCacheTest, OverBudgetNotCachedTest) {
+  SuffixArrayCache cache(
+      SuffixArrayCache::EstimatedSuffixArraySize(old_data_.size()) - 1);
+  cache.AddReference("src");
+  cache.AddReference("src");
+  EXPECT_FALSE(Diff(&cache, "src").empty());
+  EXPECT_FALSE(Diff(&cache, "src").empty());
+  EXPECT_EQ(0u, cache.built_count());
+}
+
+}  // namespace chromeos_update_engine
@@ -29,6 +29,10 @@ void XzCompressInit();
 // will be the equivalent of running xz -9 --check=none
 bool XzCompress(const brillo::Blob& in, brillo::Blob* out);
 
+// Same as XzCompress(), but AArch64 ELF files are also run through the ARM64
+// BCJ filter if |arm64_filter| is set and the xz encoder supports it.
+bool XzCompress(const brillo::Blob& in, bool arm64_filter, brillo::Blob* out);
+
 }  // namespace chromeos_update_engine
 
 #endif  // UPDATE_ENGINE_PAYLOAD_GENERATOR_XZ_H_
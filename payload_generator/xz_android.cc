@@ -69,8 +69,9 @@ struct BlobWriterStream : public ISeqOutStream {
 };
 
 // Returns the filter id to be used to compress |data|.
-// Only BCJ filter for x86 and ARM ELF file are supported, returns 0 otherwise.
-int GetFilterID(const brillo::Blob& data) {
+// Only BCJ filter for x86 and ARM ELF file are supported, and for AArch64 ELF
+// files if |arm64_filter| is set, returns 0 otherwise.
+int GetFilterID(const brillo::Blob& data, bool arm64_filter) {
   if (data.size() < sizeof(Elf32_Ehdr) ||
       memcmp(data.data(), ELFMAG, SELFMAG) != 0)
     return 0;
@@ -92,7 +93,13 @@ int GetFilterID(const brillo::Blob& data) {
       return XZ_ID_ARMT;
 #ifdef EM_AARCH64
     case EM_AARCH64:
-      // Neither the ARM nor the ARM Thumb filter works well with AArch64.
+      // Neither the ARM nor the ARM Thumb filter works well with AArch64, only
+      // the dedicated ARM64 filter does. Older xz-embedded decoders don't
+      // support it.
+#ifdef XZ_ID_ARM64
+      if (arm64_filter)
+        return XZ_ID_ARM64;
+#endif
       return 0;
 #endif
   }
@@ -114,6 +121,10 @@ void XzCompressInit() {
 }
 
 bool XzCompress(const brillo::Blob& in, brillo::Blob* out) {
+  return XzCompress(in, false, out);
+}
+
+bool XzCompress(const brillo::Blob& in, bool arm64_filter, brillo::Blob* out) {
   CHECK(xz_initialized) << "Initialize XzCompress first";
   out->clear();
   if (in.empty())
@@ -139,7 +150,7 @@ bool XzCompress(const brillo::Blob& in, brillo::Blob* out) {
   Lzma2EncProps_Normalize(&lzma2Props);
   props.lzma2Props = lzma2Props;
 
-  props.filterProps.id = GetFilterID(in);
+  props.filterProps.id = GetFilterID(in, arm64_filter);
 
   BlobWriterStream out_writer(out);
   BlobReaderStream in_reader(in);
@@ -24,6 +24,11 @@ namespace chromeos_update_engine {
 void XzCompressInit() {}
 
 bool XzCompress(const brillo::Blob& in, brillo::Blob* out) {
+  return XzCompress(in, false, out);
+}
+
+// No filter is used, so |arm64_filter| has no effect.
+bool XzCompress(const brillo::Blob& in, bool arm64_filter, brillo::Blob* out) {
   out->clear();
   if (in.empty())
     return true;
@@ -14,6 +14,7 @@
 // limitations under the License.
 //
 
+#include <elf.h>
 #include <string.h>
 #include <unistd.h>
 
@@ -175,4 +176,36 @@ TYPED_TEST(ZipTest, CompressELFTest) {
   EXPECT_EQ(0, memcmp(in.data(), decompressed.data(), in.size()));
 }
 
+TEST(XzArm64FilterTest, AArch64ELFTest) {
+  // An AArch64 ELF file whose code calls the same function over and over,
+  // each BL encoding a different relative offset.
+  brillo::Blob in(64 * 1024);
+  Elf64_Ehdr header{};
+  memcpy(header.e_ident, ELFMAG, SELFMAG);
+  header.e_ident[EI_CLASS] = ELFCLASS64;
+  header.e_ident[EI_DATA] = ELFDATA2LSB;
+  header.e_machine = EM_AARCH64;
+  memcpy(in.data(), &header, sizeof(header));
+  constexpr uint32_t kFunction = 0x100000;
+  for (uint32_t pc = 4096; pc < in.size(); pc += 4) {
+    const uint32_t bl = 0x94000000 | (((kFunction - pc) >> 2) & 0x03FFFFFF);
+    memcpy(in.data() + pc, &bl, sizeof(bl));
+  }
+
+  brillo::Blob plain, filtered;
+  ASSERT_TRUE(XzCompress(in, &plain));
+  ASSERT_TRUE(XzCompress(in, true, &filtered));
+  // The filter turns the calls into the same absolute address, if the
+  // encoder supports it.
+  EXPECT_LE(filtered.size(), plain.size());
+
+  brillo::Blob decompressed;
+  EXPECT_TRUE(DecompressWithWriter<XzExtentWriter>(plain, &decompressed));
+  EXPECT_EQ(in, decompressed);
+  if (filtered != plain && XzExtentWriter::Arm64FilterSupported()) {
+    EXPECT_TRUE(DecompressWithWriter<XzExtentWriter>(filtered, &decompressed));
+    EXPECT_EQ(in, decompressed);
+  }
+}
+
 }  // namespace chromeos_update_engine